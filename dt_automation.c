@@ -7,15 +7,102 @@ PURPOSE:
     continuous analog input operations for upto 4 channels using
     windows messaging in a console environment.
 
+    All board access goes through a DaqBackend: the Open Layers driver on
+    Windows, or a deterministic simulator that also builds on Linux:
+        gcc -O2 -shared -fPIC -o dt_lib.so dt_automation.c -lm -lpthread
+
 ****************************************************************************/
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // clock_gettime, usleep, posix_memalign, mmap/madvise flags under -std=c11
+#endif
+
+#if defined(_WIN32)
 #include <windows.h>
+#include <conio.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#endif
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
-#include <conio.h>
 #include <math.h>
 #include <time.h>
+#include <stdatomic.h>
+
+#if defined(_WIN32) && !defined(DT_NO_OPENLAYERS)
+#define DT_OPENLAYERS 1
 #include "oldaapi.h" // requires Open Layers Data Aquisition (olDa) packaged lib files.
+#else
+#define DT_OPENLAYERS 0
+#endif
+
+#if !defined(_WIN32)
+/* Windows types used by this file, same widths as the LP64 equivalents ctypes expects */
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef unsigned long ULNG;
+typedef long LONG;
+typedef int64_t LONGLONG;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef WORD *PWORD;
+typedef DWORD *PDWORD;
+typedef void *LPVOID;
+typedef char *LPSTR;
+typedef intptr_t LPARAM;
+typedef uintptr_t WPARAM;
+typedef intptr_t LRESULT;
+typedef void *HWND;
+#define TRUE 1
+#define FALSE 0
+#define CALLBACK
+#define GHND 0
+#define GMEM_FIXED 0
+#endif
+
+#if !DT_OPENLAYERS
+/* Subset of the Open Layers types and constants used by this file (simulator-only build) */
+typedef double DBL;
+typedef UINT ECODE;
+typedef void *HDEV;
+typedef void *HDASS;
+typedef void *HBUF;
+typedef HDEV *LPHDEV;
+typedef BOOL (CALLBACK *DABRDPROC)(LPSTR lpszBrdName, LPSTR lpszDriverName, LPARAM lParam);
+
+#define OLNOERROR 0
+#define OLSUCCESS 0
+#define OLSS_AD 0
+#define OLSS_DA 1
+#define OL_DF_CONTINUOUS 1
+#define OL_TRG_SOFT 0
+#define OL_CLK_INTERNAL 0
+#define OL_WRP_NONE 0
+#define OL_WRP_MULTIPLE 1
+#define OL_WRP_SINGLE 2
+#define OL_ENC_BINARY 0
+#define OL_ENC_2SCOMP 1
+#define AC 1
+#define INTERNAL 1
+#define OLDC_ADELEMENTS 1
+#define OLDC_DAELEMENTS 2
+#define OLSSCE_MAXTHROUGHPUT 1
+#define OLSSC_NUMDMACHANS 1
+#define OLDA_WM_BUFFER_DONE 0x0401
+#define OLDA_WM_QUEUE_DONE 0x0402
+#define OLDA_WM_TRIGGER_ERROR 0x0403
+#define OLDA_WM_OVERRUN_ERROR 0x0404
+#define OLDA_WM_UNDERRUN_ERROR 0x0405
+#endif
 
 /* Config Params*/
 #define NUM_CHANNELS 4             // Max 4 for DT9837
@@ -26,6 +113,7 @@ PURPOSE:
 #define DEFAULT_WAV_FREQUENCY 1000 // for output
 
 #define EN_MULTIPLE_CH_GAIN 1 //(1-ON,0-OFF)
+#define EN_CONVERSION_WORKER 1 //(1-convert on a worker thread, 0-convert inside the message handler)
 
 #if EN_MULTIPLE_CH_GAIN
 #define CHANNEL_GAIN_0 1 // Z
@@ -49,6 +137,7 @@ PURPOSE:
 #define ERR_MEASUREMENT 5
 #define ERR_OUTPUT 6
 #define ERR_DEINIT_CONFIG 7
+#define ERR_PENDING 8 // measure_async() still running
 
 #define LOGGING_EN 0
 #if LOGGING_EN
@@ -58,7 +147,12 @@ PURPOSE:
       printf(format, ##__VA_ARGS__);  \
 }  while (0)
 #else
-#define LOG_PRINT(format, ...) ((void)0)
+/* never prints, but the compiler still checks the format and sees the arguments used */
+#define LOG_PRINT(format, ...)           \
+   do {                                  \
+      if (0)                             \
+         printf(format, ##__VA_ARGS__);  \
+   } while (0)
 #endif
 
 #define CHECKERROR(ecode)                           \
@@ -75,357 +169,5602 @@ PURPOSE:
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-#define NUM_OL_BUFFERS 4
-#define MAX_BUFFER_SIZE 8000  // 8192 rounded to 8k for even output repeatability
-#define AVERAGING_CONSTANT 10 // observed from buffer to output conversion
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
-int counter = 0;
-BOOL tfileopen = 0;
-DBL textfile_time = 0;
-ULNG glist_resume = 0;
+#define MAX_BUFFER_SIZE 8000  // D/A buffers are filled with whole periods up to this size
 
+/* Platform layer: threads, events, timing, console input and aligned memory */
+#if defined(_WIN32)
+typedef HANDLE Thread;
+typedef HANDLE Event; // auto-reset
+typedef DWORD ThreadResult;
+#define THREAD_CALL WINAPI
+#else
+typedef pthread_t Thread;
 typedef struct {
-   DBL *channel[NUM_CHANNELS];
-   DBL *time_ms;
-   UINT num_readings;
-   UINT max_readings;
-} ChannelData;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   BOOL signalled;
+} EventObject;
+typedef EventObject *Event; // auto-reset
+typedef void *ThreadResult;
+#define THREAD_CALL
+#endif
+typedef ThreadResult (THREAD_CALL *ThreadProc)(LPVOID lpParam);
+#if defined(_WIN32)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
 
-static volatile ChannelData measure_channels = {0};
+static BOOL thread_create(Thread *thread, ThreadProc proc, LPVOID arg)
+{
+#if defined(_WIN32)
+   *thread = CreateThread(NULL, 0, proc, arg, 0, NULL);
+   return *thread != NULL;
+#else
+   return pthread_create(thread, NULL, proc, arg) == 0;
+#endif
+}
 
-int allocate_data_memory(ChannelData *channels, int duration) 
+static void thread_join(Thread thread)
 {
-   if(duration <= 0)
-   {
-      duration = 1;
-   }
-   else if (duration > 900)
+#if defined(_WIN32)
+   WaitForSingleObject(thread, INFINITE);
+   CloseHandle(thread);
+#else
+   pthread_join(thread, NULL);
+#endif
+}
+
+static Event event_create(void)
+{
+#if defined(_WIN32)
+   return CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+   pthread_condattr_t attr;
+   Event ev = calloc(1, sizeof(EventObject));
+   if (ev == NULL)
+      return NULL;
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+   pthread_mutex_init(&ev->lock, NULL);
+   pthread_cond_init(&ev->cond, &attr);
+   pthread_condattr_destroy(&attr);
+   return ev;
+#endif
+}
+
+static void event_set(Event ev)
+{
+#if defined(_WIN32)
+   SetEvent(ev);
+#else
+   pthread_mutex_lock(&ev->lock);
+   ev->signalled = TRUE;
+   pthread_cond_signal(&ev->cond);
+   pthread_mutex_unlock(&ev->lock);
+#endif
+}
+
+/* Waits up to timeout_ms (0xFFFFFFFF waits forever); TRUE if the event was signalled */
+static BOOL event_wait(Event ev, UINT timeout_ms)
+{
+#if defined(_WIN32)
+   return WaitForSingleObject(ev, timeout_ms) == WAIT_OBJECT_0;
+#else
+   struct timespec deadline;
+   BOOL signalled;
+
+   clock_gettime(CLOCK_MONOTONIC, &deadline);
+   deadline.tv_sec += timeout_ms / 1000;
+   deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+   if (deadline.tv_nsec >= 1000000000L)
    {
-      duration = 900;
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
    }
-   UINT max_readings = (duration * 1000) * 2;
-   channels->max_readings = max_readings; // Allocate double the required data size
-   channels->num_readings = 0;
-   channels->time_ms = malloc(max_readings * sizeof(DBL));
-   for (int i = 0; i < NUM_CHANNELS; i++) 
+   pthread_mutex_lock(&ev->lock);
+   while (!ev->signalled)
    {
-      channels->channel[i] = malloc(max_readings * sizeof(DBL));
+      if (timeout_ms == 0xFFFFFFFF)
+         pthread_cond_wait(&ev->cond, &ev->lock);
+      else if (pthread_cond_timedwait(&ev->cond, &ev->lock, &deadline) != 0)
+         break;
    }
-   return CFG_SUCCESS;
+   signalled = ev->signalled;
+   ev->signalled = FALSE;
+   pthread_mutex_unlock(&ev->lock);
+   return signalled;
+#endif
 }
 
-void cleanup_data() 
+static void event_destroy(Event ev)
 {
-   LOG_PRINT("Freeing allocated memory: %x\n",measure_channels.time_ms);
-   free(measure_channels.time_ms);
-   for (int i = 0; i < NUM_CHANNELS; i++) {
-      free(measure_channels.channel[i]);
-   }
+#if defined(_WIN32)
+   CloseHandle(ev);
+#else
+   pthread_cond_destroy(&ev->cond);
+   pthread_mutex_destroy(&ev->lock);
+   free(ev);
+#endif
 }
 
-void add_reading(ChannelData *channels, DBL time_ms, DBL ch0, DBL ch1, DBL ch2, DBL ch3) {
-   if (channels->num_readings < channels->max_readings) {
-      channels->time_ms[channels->num_readings] = time_ms;
-      channels->channel[0][channels->num_readings] = ch0;
-      channels->channel[1][channels->num_readings] = ch1;
-      channels->channel[2][channels->num_readings] = ch2;
-      channels->channel[3][channels->num_readings] = ch3;
-      channels->num_readings++;
-   } else {
-      LOG_PRINT("Error: Maximum number of readings exceeded.\n");
-   }
+static void sleep_ms(UINT ms)
+{
+#if defined(_WIN32)
+   Sleep(ms);
+#else
+   usleep((useconds_t)ms * 1000);
+#endif
 }
 
-BOOL save_data(HDASS hAD_v, HBUF hBuf_v)
+/* Seconds on a monotonic high resolution clock */
+static DBL monotonic_seconds(void)
 {
-   /*
-      This function writes the specified buffer to the volts output file:
-      volts.csv  The function returns TRUE if successful.  Otherwise,
-      it returns FALSE and writes an error message to the specified
-      string ( strlen is the max length of the input string )
-   */
-   UINT strlen = 80;
-   char lpstr[80];
-   UINT size = 0L;
-   ECODE status = OLNOERROR;
-   FILE *stream;
-   BOOL rval = FALSE;
-   DBL max = 0, min = 0;
-   UINT resolution, listsize;
-   UINT encoding;
-   ULNG samples;
-   ULNG value;
-   PWORD pBuffer = NULL;
-   PDWORD pBuffer32 = NULL;
-   DBL voltage, freq;
-   DBL volt_x, volt_y, volt_z;
-   DBL accel_x, accel_y, accel_z;
-   ULNG i = 0, j = 0;
-   DBL gainlist[1024];
-   DBL currentglistentry;
+#if defined(_WIN32)
+   LARGE_INTEGER count, freq;
+   QueryPerformanceCounter(&count);
+   QueryPerformanceFrequency(&freq);
+   return (DBL)count.QuadPart / (DBL)freq.QuadPart;
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
 
-   /* get sub system information for code/volts conversion */
+/* A mutex that needs no run-time initialization (statically LOCK_INIT) */
+#if defined(_WIN32)
+typedef SRWLOCK Lock;
+#define LOCK_INIT SRWLOCK_INIT
+#else
+typedef pthread_mutex_t Lock;
+#define LOCK_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
 
-   status = olDaGetRange(hAD_v, &max, &min);
-   if (status == OLNOERROR)
-      status = olDaGetEncoding(hAD_v, &encoding);
-   if (status == OLNOERROR)
-      status = olDaGetResolution(hAD_v, &resolution);
-   if (status == OLNOERROR)
-      status = olDmGetValidSamples(hBuf_v, &samples);
-   if (status == OLNOERROR)
-      status = olDmGetDataWidth(hBuf_v, &size);
-   if (status == OLNOERROR)
-      status = olDaGetClockFrequency(hAD_v, &freq);
-   if (status == OLNOERROR)
-      status = olDaGetChannelListSize(hAD_v, &listsize);
-   if (status != OLNOERROR)
+static void lock_take(Lock *lock)
+{
+#if defined(_WIN32)
+   AcquireSRWLockExclusive(lock);
+#else
+   pthread_mutex_lock(lock);
+#endif
+}
+
+static void lock_give(Lock *lock)
+{
+#if defined(_WIN32)
+   ReleaseSRWLockExclusive(lock);
+#else
+   pthread_mutex_unlock(lock);
+#endif
+}
+
+/* TRUE (and the key consumed) if a key was hit on the console */
+static BOOL key_pressed(void)
+{
+#if defined(_WIN32)
+   if (_kbhit())
    {
-      olDaGetErrorString(status, lpstr, strlen);
-      return FALSE;
+      _getch();
+      return TRUE;
    }
+   return FALSE;
+#else
+   struct timeval tv = {0, 0};
+   fd_set fds;
+   char discard[64];
+
+   if (!isatty(STDIN_FILENO))
+      return FALSE;
+   FD_ZERO(&fds);
+   FD_SET(STDIN_FILENO, &fds);
+   if (select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) <= 0)
+      return FALSE;
+   if (read(STDIN_FILENO, discard, sizeof(discard)) < 0)
+      return FALSE;
+   return TRUE;
+#endif
+}
+
+static void *aligned_malloc(size_t bytes, size_t alignment)
+{
+#if defined(_WIN32)
+   return _aligned_malloc(bytes, alignment);
+#else
+   void *p = NULL;
+   return (posix_memalign(&p, alignment, bytes) == 0) ? p : NULL;
+#endif
+}
+
+static void aligned_free(void *p)
+{
+#if defined(_WIN32)
+   _aligned_free(p);
+#else
+   free(p);
+#endif
+}
+
+/* Hardware abstraction
+   Every olDa/olDm call and the buffer notification loop go through a DaqBackend.
+   ol_backend forwards to the Open Layers driver; sim_backend is a deterministic
+   DT9837 stand-in that fills buffers at the configured clock rate with per-channel
+   sine signals and noise, and can inject overrun/queue-done events, so measure()
+   and generate() run end-to-end without a board.
+*/
+#define DAQ_BACKEND_OPENLAYERS 0
+#define DAQ_BACKEND_SIMULATOR 1
+
+typedef struct {
+   const char *name;
+   int (*InitNotify)(HWND *hWnd_p); // create the target that receives buffer notifications
+   BOOL (*Pump)(HWND hWnd_v, UINT timeout_ms); // wait up to timeout_ms and dispatch pending notifications,
+                                               // FALSE once quit was posted
+   void (*PostQuit)(void);
+   ECODE (*EnumBoards)(DABRDPROC proc, LPARAM lParam);
+   ECODE (*Initialize)(LPSTR name, LPHDEV hDev_p);
+   ECODE (*Terminate)(HDEV hDev_v);
+   ECODE (*GetDevCaps)(HDEV hDev_v, UINT cap, UINT *value);
+   ECODE (*GetDASS)(HDEV hDev_v, UINT type, UINT element, HDASS *hDass_p);
+   ECODE (*ReleaseDASS)(HDASS hDass_v);
+   ECODE (*SetWndHandle)(HDASS hDass_v, HWND hWnd_v, UINT lParam);
+   ECODE (*SetDataFlow)(HDASS hDass_v, UINT flow);
+   ECODE (*GetSSCapsEx)(HDASS hDass_v, UINT cap, DBL *value);
+   ECODE (*GetSSCaps)(HDASS hDass_v, UINT cap, UINT *value);
+   ECODE (*SetChannelListSize)(HDASS hDass_v, UINT size);
+   ECODE (*GetChannelListSize)(HDASS hDass_v, UINT *size);
+   ECODE (*SetChannelListEntry)(HDASS hDass_v, UINT entry, UINT channel);
+   ECODE (*SetGainListEntry)(HDASS hDass_v, UINT entry, DBL gain);
+   ECODE (*GetGainListEntry)(HDASS hDass_v, UINT entry, DBL *gain);
+   ECODE (*SetCouplingType)(HDASS hDass_v, UINT channel, UINT coupling);
+   ECODE (*SetExcitationCurrentSource)(HDASS hDass_v, UINT channel, UINT source);
+   ECODE (*SetClockFrequency)(HDASS hDass_v, DBL freq);
+   ECODE (*GetClockFrequency)(HDASS hDass_v, DBL *freq);
+   ECODE (*SetClockSource)(HDASS hDass_v, UINT source);
+   ECODE (*SetTrigger)(HDASS hDass_v, UINT trigger);
+   ECODE (*SetDmaUsage)(HDASS hDass_v, UINT dma);
+   ECODE (*SetWrapMode)(HDASS hDass_v, UINT mode);
+   ECODE (*GetRange)(HDASS hDass_v, DBL *max, DBL *min);
+   ECODE (*GetEncoding)(HDASS hDass_v, UINT *encoding);
+   ECODE (*GetResolution)(HDASS hDass_v, UINT *resolution);
+   ECODE (*VoltsToCode)(DBL min, DBL max, DBL gain, UINT resolution, UINT encoding, DBL volts, ULNG *code);
+   ECODE (*Config)(HDASS hDass_v);
+   ECODE (*Start)(HDASS hDass_v);
+   ECODE (*Abort)(HDASS hDass_v);
+   ECODE (*GetBuffer)(HDASS hDass_v, HBUF *hBuf_p);
+   ECODE (*PutBuffer)(HDASS hDass_v, HBUF hBuf_v);
+   ECODE (*GetErrorString)(ECODE status, char *str, UINT len);
+   ECODE (*DmCallocBuffer)(UINT flags, UINT ex_flags, ULNG samples, UINT sample_size, HBUF *hBuf_p);
+   ECODE (*DmFreeBuffer)(HBUF hBuf_v);
+   ECODE (*DmGetBufferPtr)(HBUF hBuf_v, LPVOID *ptr);
+   ECODE (*DmGetValidSamples)(HBUF hBuf_v, ULNG *samples);
+   ECODE (*DmSetValidSamples)(HBUF hBuf_v, ULNG samples);
+   ECODE (*DmGetDataWidth)(HBUF hBuf_v, UINT *width);
+   ECODE (*StartTogether)(HDASS *hDass_list, UINT count); // simultaneous start of configured subsystems
+} DaqBackend;
+
+void daq_event(HDASS hAD_v, UINT msg);
+BOOL output_event(HDASS hDass_v, UINT msg);
+BOOL conv_backlogged(void);
+struct ConvTable;
+void sub_append(DBL *const src[NUM_CHANNELS], ULNG pos, ULNG frames);
+void sub_convert(const struct ConvTable *ct, const void *raw, UINT width, ULNG frames, UINT stride);
+void sub_flush(void);
+DBL code_to_volts_ref(DBL min, DBL max, DBL gain, UINT resolution, UINT encoding, ULNG value);
+
+#if DT_OPENLAYERS
+LRESULT WINAPI WndProc(HWND hWnd_v, UINT msg, WPARAM hAD_v, LPARAM lParam);
+
+static int ol_init_notify(HWND *hWnd_p)
+{
+   // create a window for messages
+   WNDCLASS wc;
+   memset(&wc, 0, sizeof(wc));
+   wc.lpfnWndProc = WndProc;
+   wc.lpszClassName = "DtConsoleClass";
+   RegisterClass(&wc);
+
+   *hWnd_p = CreateWindow(wc.lpszClassName,
+                          NULL,
+                          NULL,
+                          0, 0, 0, 0,
+                          NULL,
+                          NULL,
+                          NULL,
+                          NULL);
+
+   if (!*hWnd_p)
+      return CFG_FAILURE;
+
+   SetMessageQueue(50); // Increase the our message queue size so
+                        // we don't lose any data acq messages
+   return CFG_SUCCESS;
+}
+
+static BOOL ol_pump(HWND hWnd_v, UINT timeout_ms)
+{
+   MSG msg;
 
-   for (j = 0; j < listsize; j++)
+   // wake on the next message or the caller's deadline, whichever comes first
+   MsgWaitForMultipleObjects(0, NULL, FALSE, timeout_ms, QS_ALLINPUT);
+   while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
    {
-      olDaGetGainListEntry(hAD_v, j, &currentglistentry);
-      gainlist[j] = currentglistentry;
+      if (msg.message == WM_QUIT)
+         return FALSE;
+      TranslateMessage(&msg); // Translates virtual key codes
+      DispatchMessage(&msg);  // Dispatches message to window
    }
+   return TRUE;
+}
 
-   j = glist_resume; // set current channel list element to either 0 or the next one in the list
-                     // this is encase the buffersize is not divisible by the channel list size
+static void ol_post_quit(void) { PostQuitMessage(0); }
+static ECODE ol_enum_boards(DABRDPROC proc, LPARAM lParam) { return olDaEnumBoards(proc, lParam); }
+static ECODE ol_initialize(LPSTR name, LPHDEV hDev_p) { return olDaInitialize(name, hDev_p); }
+static ECODE ol_terminate(HDEV hDev_v) { return olDaTerminate(hDev_v); }
+static ECODE ol_get_dev_caps(HDEV hDev_v, UINT cap, UINT *value) { return olDaGetDevCaps(hDev_v, cap, value); }
+static ECODE ol_get_dass(HDEV hDev_v, UINT type, UINT element, HDASS *hDass_p) { return olDaGetDASS(hDev_v, type, element, hDass_p); }
+static ECODE ol_release_dass(HDASS hDass_v) { return olDaReleaseDASS(hDass_v); }
+static ECODE ol_set_wnd_handle(HDASS hDass_v, HWND hWnd_v, UINT lParam) { return olDaSetWndHandle(hDass_v, hWnd_v, lParam); }
+static ECODE ol_set_data_flow(HDASS hDass_v, UINT flow) { return olDaSetDataFlow(hDass_v, flow); }
+static ECODE ol_get_ss_caps_ex(HDASS hDass_v, UINT cap, DBL *value) { return olDaGetSSCapsEx(hDass_v, cap, value); }
+static ECODE ol_get_ss_caps(HDASS hDass_v, UINT cap, UINT *value) { return olDaGetSSCaps(hDass_v, cap, value); }
+static ECODE ol_set_channel_list_size(HDASS hDass_v, UINT size) { return olDaSetChannelListSize(hDass_v, size); }
+static ECODE ol_get_channel_list_size(HDASS hDass_v, UINT *size) { return olDaGetChannelListSize(hDass_v, size); }
+static ECODE ol_set_channel_list_entry(HDASS hDass_v, UINT entry, UINT channel) { return olDaSetChannelListEntry(hDass_v, entry, channel); }
+static ECODE ol_set_gain_list_entry(HDASS hDass_v, UINT entry, DBL gain) { return olDaSetGainListEntry(hDass_v, entry, gain); }
+static ECODE ol_get_gain_list_entry(HDASS hDass_v, UINT entry, DBL *gain) { return olDaGetGainListEntry(hDass_v, entry, gain); }
+static ECODE ol_set_coupling_type(HDASS hDass_v, UINT channel, UINT coupling) { return olDaSetCouplingType(hDass_v, channel, coupling); }
+static ECODE ol_set_excitation(HDASS hDass_v, UINT channel, UINT source) { return olDaSetExcitationCurrentSource(hDass_v, channel, source); }
+static ECODE ol_set_clock_frequency(HDASS hDass_v, DBL freq) { return olDaSetClockFrequency(hDass_v, freq); }
+static ECODE ol_get_clock_frequency(HDASS hDass_v, DBL *freq) { return olDaGetClockFrequency(hDass_v, freq); }
+static ECODE ol_set_clock_source(HDASS hDass_v, UINT source) { return olDaSetClockSource(hDass_v, source); }
+static ECODE ol_set_trigger(HDASS hDass_v, UINT trigger) { return olDaSetTrigger(hDass_v, trigger); }
+static ECODE ol_set_dma_usage(HDASS hDass_v, UINT dma) { return olDaSetDmaUsage(hDass_v, dma); }
+static ECODE ol_set_wrap_mode(HDASS hDass_v, UINT mode) { return olDaSetWrapMode(hDass_v, mode); }
+static ECODE ol_get_range(HDASS hDass_v, DBL *max, DBL *min) { return olDaGetRange(hDass_v, max, min); }
+static ECODE ol_get_encoding(HDASS hDass_v, UINT *encoding) { return olDaGetEncoding(hDass_v, encoding); }
+static ECODE ol_get_resolution(HDASS hDass_v, UINT *resolution) { return olDaGetResolution(hDass_v, resolution); }
+static ECODE ol_volts_to_code(DBL min, DBL max, DBL gain, UINT resolution, UINT encoding, DBL volts, ULNG *code) { return olDaVoltsToCode(min, max, gain, resolution, encoding, volts, (LPVOID)code); }
+static ECODE ol_config(HDASS hDass_v) { return olDaConfig(hDass_v); }
+static ECODE ol_start(HDASS hDass_v) { return olDaStart(hDass_v); }
+static ECODE ol_abort(HDASS hDass_v) { return olDaAbort(hDass_v); }
+static ECODE ol_get_buffer(HDASS hDass_v, HBUF *hBuf_p) { return olDaGetBuffer(hDass_v, hBuf_p); }
+static ECODE ol_put_buffer(HDASS hDass_v, HBUF hBuf_v) { return olDaPutBuffer(hDass_v, hBuf_v); }
+static ECODE ol_get_error_string(ECODE status, char *str, UINT len) { return olDaGetErrorString(status, str, len); }
+static ECODE ol_calloc_buffer(UINT flags, UINT ex_flags, ULNG samples, UINT sample_size, HBUF *hBuf_p) { return olDmCallocBuffer(flags, ex_flags, samples, sample_size, hBuf_p); }
+static ECODE ol_free_buffer(HBUF hBuf_v) { return olDmFreeBuffer(hBuf_v); }
+static ECODE ol_get_buffer_ptr(HBUF hBuf_v, LPVOID *ptr) { return olDmGetBufferPtr(hBuf_v, ptr); }
+static ECODE ol_get_valid_samples(HBUF hBuf_v, ULNG *samples) { return olDmGetValidSamples(hBuf_v, samples); }
+static ECODE ol_set_valid_samples(HBUF hBuf_v, ULNG samples) { return olDmSetValidSamples(hBuf_v, samples); }
+static ECODE ol_get_data_width(HBUF hBuf_v, UINT *width) { return olDmGetDataWidth(hBuf_v, width); }
 
-   // write the data
-   rval = TRUE;
-   // if (tfileopen)
-   //    stream = fopen("accel.csv", "a+"); // append to existing file
-   // else
-   // {
-   //    stream = fopen("accel.csv", "w"); // open new file
-   //    tfileopen = 1;
-   //    textfile_time = 0;
-   //    fprintf(stream, "Time,accel(x),accel(y),accel(z),dac\n");
-   // }
-   /* get pointer to the buffer */
-   CHECKERROR(olDmGetBufferPtr(hBuf_v, (LPVOID *)&pBuffer32));
+/* Starts the subsystems off one shared trigger through a simultaneous start list */
+static ECODE ol_start_together(HDASS *hDass_list, UINT count)
+{
+   HSSLIST hList = NULL;
+   ECODE status = olDaGetSSList(&hList);
+   for (UINT i = 0; i < count && status == OLNOERROR; i++)
+      status = olDaPutDassToSSList(hList, hDass_list[i]);
+   if (status == OLNOERROR)
+      status = olDaSimultaneousPrestart(hList);
+   if (status == OLNOERROR)
+      status = olDaSimultaneousStart(hList);
+   if (hList != NULL)
+      olDaReleaseSSList(hList);
+   return status;
+}
 
-   while (i < samples)
-   {
-      if (resolution > 16)
-      {
-         // Value reserved for channel 4
-         value = pBuffer32[i + 3];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &voltage);
+static const DaqBackend ol_backend = {
+   "openlayers", ol_init_notify, ol_pump, ol_post_quit,
+   ol_enum_boards, ol_initialize, ol_terminate, ol_get_dev_caps, ol_get_dass, ol_release_dass,
+   ol_set_wnd_handle, ol_set_data_flow, ol_get_ss_caps_ex, ol_get_ss_caps,
+   ol_set_channel_list_size, ol_get_channel_list_size, ol_set_channel_list_entry,
+   ol_set_gain_list_entry, ol_get_gain_list_entry, ol_set_coupling_type, ol_set_excitation,
+   ol_set_clock_frequency, ol_get_clock_frequency, ol_set_clock_source, ol_set_trigger,
+   ol_set_dma_usage, ol_set_wrap_mode, ol_get_range, ol_get_encoding, ol_get_resolution,
+   ol_volts_to_code, ol_config, ol_start, ol_abort, ol_get_buffer, ol_put_buffer, ol_get_error_string,
+   ol_calloc_buffer, ol_free_buffer, ol_get_buffer_ptr, ol_get_valid_samples, ol_set_valid_samples,
+   ol_get_data_width, ol_start_together,
+};
+#endif
 
-         // Convert and store values
-         value = pBuffer32[i + 2];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &volt_x);
-         value = pBuffer32[i + 1];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &volt_y);
-         value = pBuffer32[i];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &volt_z);
-      }
-      else
-      {
-         // Value reserved for channel 4
-         value = pBuffer[i + 3];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &voltage);
+/* Devices
+   All per-board state (handles, buffers, configuration, capture storage and the
+   simulated board) lives in a DeviceContext, allocated with its defaults the
+   first time the device is selected. ctx is the context the calling thread
+   works on: select_device() sets it, and the conversion and acquisition threads
+   a device starts are handed theirs, so several boards can acquire at once from
+   one process. A thread that has not selected a device works on device 0, as
+   callers of the single-board API always did (run.py selects ahead of every
+   call). Devices are allocated under device_lock, so threads may select the
+   same new device at once. Each module keeps its state type next to its code and
+   the context points at one of each; device_open() at the end of the file
+   allocates them together in one block.
+*/
+#define MAX_DEVICES 8
+#define BOARD_NAME_LEN 64
 
-         // Convert and store values
-         value = pBuffer[i + 2];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &volt_x);
-         value = pBuffer[i + 1];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &volt_y);
-         value = pBuffer[i];
-         olDaCodeToVolts(min, max, gainlist[j] /*gain*/, resolution, encoding, value, &volt_z);
-      }
+typedef struct {
+   char name[MAX_DEVICES][BOARD_NAME_LEN]; // device i opens board i
+   UINT count;
+} BoardList;
+
+typedef struct {
+   UINT index; // board index the device opens
 
-      // printf("ValueX: %d\n",volt_x);
+   /* simulated board */
+   struct SimConfig *sim_config;
+   struct SimSinkStats *sim_sink;
+   DBL *sim_sink_history; // SIM_SINK_HISTORY samples, allocated when the D/A is first used
+   DBL sim_sink_step;     // step between the last two samples played
+   struct SimSubsystem *sim_ad;
+   struct SimSubsystem *sim_da;
+   int sim_device;
+   BOOL sim_quit;
+   uint64_t sim_rng;
 
-      accel_x = volt_x / (SENSITIVITY_VAL_X / 1000);
-      accel_y = volt_y / (SENSITIVITY_VAL_Y / 1000);
-      accel_z = volt_z / (SENSITIVITY_VAL_Z / 1000);
+   /* capture configuration and storage */
+   int counter;
+   BOOL tfileopen;
+   volatile struct ChannelData *measure_channels;
+   struct ChannelMap *channel_map;
+   struct ChannelMap *active_map; // what config_channels_input() last wrote to the A/D
+   struct Decimator *decim;
+   struct Trigger *trig;
+   struct TimeBase *time_base;
+   struct TimeAnchor *time_anchor; // TIME_ANCHOR_SLOTS, allocated by the first run
+   struct AcqSchedule *schedule;
+   struct CaptureStream *capture;
+   struct CaptureArena *arena;
+   struct ChannelStatsState *stats;
+   struct SyncStart *sync_start;
+   struct PsdState *psd;
+   struct ConvTable *conv_table;
+   struct RecordFile *record;
+   struct Subscription *sub;
 
-      // Print voltage values to file
-      // fprintf(stream, "%.3f,%f,%f,%f,%f\n", textfile_time, accel_x, accel_y, accel_z, voltage);
-      add_reading(&measure_channels, textfile_time, accel_x, accel_y, accel_z, voltage);
+   /* acquisition pipeline */
+   struct PoolLimits *pool_limits;
+   struct BufferPool *pool;
+   DBL pool_min_lag;
+   DBL pool_process_at;    // buffer_seconds process_mean was measured at
+   DBL pool_process_stall; // worst processing time of the previous run
+   struct Instrumentation *instr;
+   struct RawRing *raw_ring;
+   struct WaveSpec *wave;
+   struct WaveInfo *wave_info;
+   struct OutputStream *output;
 
-      textfile_time += (1 / freq);
-      // i++;
-      i += size;
-      if (j == listsize - 1)
-         j = 0;
-      else
-         j++;
-   }
-   glist_resume = j; // hold current list element position and gain for next buffer
+   /* board handles */
+   HWND hWnd;
+   HDEV hDev;
+   HDASS hAD;
+   HDASS hDA;
+   HBUF *hBufs; // POOL_MAX_BUFFERS
+   HBUF hBuf;
+   LPVOID lpbuf;
+   struct Session *session;
+
+   /* asynchronous measurement */
+   struct MeasureArgs *acq_args;
+   Thread acq_thread;
+   Event acq_done;
+   BOOL acq_started;
+   _Atomic BOOL acq_finished;
+   int acq_result;
+} DeviceContext;
 
-   // fclose(stream);
-   // system( "type volts.txt" );
+static THREAD_LOCAL DeviceContext *ctx_selected = NULL;
+static DeviceContext *devices[MAX_DEVICES];
+static Lock device_lock = LOCK_INIT;
+static BoardList boards = {0}; // boards with an A/D, filled by the first enumeration
 
-   return rval;
+static DeviceContext *device_open(UINT index);
+
+/* Makes the calling thread work on device index until it selects another one */
+int select_device(UINT index)
+{
+   DeviceContext *device;
+
+   if (index >= MAX_DEVICES)
+      return CFG_FAILURE;
+   lock_take(&device_lock);
+   if (devices[index] == NULL)
+      devices[index] = device_open(index);
+   device = devices[index];
+   lock_give(&device_lock);
+   if (device == NULL)
+      return CFG_FAILURE;
+   ctx_selected = device;
+   return CFG_SUCCESS;
 }
 
-/* UNUSED: can be used to get a single value from 1 channel*/
-void process_data(HDASS hAD_v, HBUF hBuffer)
+/* Device 0 for a thread that has not selected one */
+static DeviceContext *device_default(void)
 {
-   /*
-     This function writes the specified buffer record a single voltage
-     value from a single channel. It prints the value to the console
-  */
-   DBL min = 0, max = 0;
-   DBL volts;
-   ULNG value;
-   ULNG samples;
-   UINT encoding = 0, resolution = 0;
-   PDWORD pBuffer32 = NULL;
-   PWORD pBuffer = NULL;
+   select_device(0);
+   return ctx_selected;
+}
 
-   if (hBuffer)
+#define ctx (ctx_selected != NULL ? ctx_selected : device_default())
+
+UINT get_device()
+{
+   return (ctx_selected != NULL) ? ctx_selected->index : 0;
+}
+
+/* Simulated DT9837: 4 channel 24-bit A/D and 1 channel 16-bit D/A, +/-10 V, 2's complement */
+#define SIM_ERROR 1
+#define SIM_QUEUE_SIZE 64
+#define SIM_MAX_LIST 4
+#define SIM_AD_MAX_FREQ 52734.0
+#define SIM_DA_MAX_FREQ 46875.0
+
+typedef struct {
+   LPVOID data;
+   ULNG max_samples;
+   ULNG valid_samples;
+   UINT width;
+   DBL queued_at; // monotonic_seconds() of the last PutBuffer
+} SimBuffer;
+
+typedef struct {
+   HBUF items[SIM_QUEUE_SIZE];
+   UINT head;
+   UINT count;
+} SimQueue;
+
+typedef struct SimSubsystem {
+   UINT type; // OLSS_AD or OLSS_DA
+   BOOL running;
+   UINT listsize;
+   UINT chanlist[SIM_MAX_LIST];
+   DBL gainlist[SIM_MAX_LIST];
+   DBL freq;
+   UINT wrap_mode;
+   UINT resolution;
+   UINT encoding;
+   DBL min, max;
+   SimQueue ready; // buffers handed to the "driver"
+   SimQueue done;  // filled buffers waiting for GetBuffer
+   ULNG frames;    // frames delivered since Start
+   ULNG buffers;   // buffers completed since Start
+   DBL start_time;
+   DBL lead;       // D/A: seconds its output runs ahead of the A/D clock
+} SimSubsystem;
+
+typedef struct SimConfig {
+   DBL speed;                     // 1 = real time, 0 = as fast as buffers are returned
+   DBL amplitude[NUM_CHANNELS];   // volts, per physical channel
+   DBL frequency[NUM_CHANNELS];   // Hz, per physical channel
+   DBL noise;                     // volts rms added to every sample
+   ULNG seed;
+   ULNG overrun_after;            // post OLDA_WM_OVERRUN_ERROR after this many buffers (0-never)
+   ULNG queue_done_after;         // post OLDA_WM_QUEUE_DONE after this many buffers (0-never)
+   BOOL dac_loopback;             // physical channel 3 reads the running D/A output
+   DBL da_lead;                   // seconds a separately started D/A runs ahead of the A/D
+   DBL loopback_delay;            // seconds from the D/A output to the loopback input
+   BOOL wait_for_worker;          // tests only: at speed 0 the A/D waits for the conversion worker
+} SimConfig;
+
+/* The simulated D/A output in OL_WRP_NONE mode. Played samples are kept for the
+   loopback channel and every buffer boundary is checked for continuity: a step
+   between buffers more than twice the steps either side of it (plus 1 LSB) is
+   counted, which catches gaps, repeats and reordering of smooth signals. */
+#define SIM_SINK_HISTORY 65536
+
+typedef struct SimSinkStats {
+   ULNG samples;          // samples played
+   ULNG buffers;          // buffers played
+   ULNG underruns;        // D/A queue ran dry while running
+   ULNG discontinuities;  // buffer boundaries failing the continuity check
+   DBL max_step;          // largest step inside a buffer, volts
+   DBL max_boundary_step; // largest step across a buffer boundary, volts
+} SimSinkStats;
+
+static const SimConfig sim_config_default = {
+   .speed = 1.0,
+   .amplitude = {0.2, 0.2, 0.2, 0.0},
+   .frequency = {160.0, 120.0, 80.0, 0.0},
+   .noise = 0.001,
+   .seed = 1,
+   .dac_loopback = TRUE,
+};
+static UINT sim_boards = 1; // boards the simulator enumerates
+
+static BOOL sim_queue_push(SimQueue *q, HBUF hBuf_v)
+{
+   if (q->count == SIM_QUEUE_SIZE)
+      return FALSE;
+   q->items[(q->head + q->count++) % SIM_QUEUE_SIZE] = hBuf_v;
+   return TRUE;
+}
+
+static HBUF sim_queue_pop(SimQueue *q)
+{
+   HBUF hBuf_v;
+   if (q->count == 0)
+      return NULL;
+   hBuf_v = q->items[q->head];
+   q->head = (q->head + 1) % SIM_QUEUE_SIZE;
+   q->count--;
+   return hBuf_v;
+}
+
+/* approximately normal, unit variance (sum of four uniforms) */
+static DBL sim_noise(void)
+{
+   DBL sum = 0;
+   for (int i = 0; i < 4; i++)
    {
+      ctx->sim_rng ^= ctx->sim_rng << 13;
+      ctx->sim_rng ^= ctx->sim_rng >> 7;
+      ctx->sim_rng ^= ctx->sim_rng << 17;
+      sum += (DBL)(ctx->sim_rng >> 11) * (1.0 / 9007199254740992.0);
+   }
+   return (sum - 2.0) * 1.7320508075688772;
+}
 
-      /* get sub system information for code/volts conversion */
-      olDaGetRange(hAD_v, &max, &min);
-      olDaGetEncoding(hAD_v, &encoding);
-      olDaGetResolution(hAD_v, &resolution);
+static ECODE sim_volts_to_code(DBL min, DBL max, DBL gain, UINT resolution, UINT encoding, DBL volts, ULNG *code)
+{
+   DBL full = ldexp(1.0, resolution);
+   DBL c = floor((volts * gain - min) / (max - min) * full + 0.5);
 
-      /* get max samples in input buffer */
-      olDmGetValidSamples(hBuffer, &samples);
+   c = MAX(0.0, MIN(c, full - 1));
+   *code = (ULNG)c;
+   if (encoding != OL_ENC_BINARY)
+      *code ^= 1UL << (resolution - 1);
+   return OLNOERROR;
+}
 
-      /* get pointer to the buffer */
-      if (resolution > 16)
-      {
-         olDmGetBufferPtr(hBuffer, (LPVOID *)&pBuffer32);
-         /* get last sample in buffer */
-         value = pBuffer32[samples - 1];
-      }
-      else
+static DBL sim_buffer_volts(SimSubsystem *ss, SimBuffer *buf, ULNG n)
+{
+   ULNG code = (buf->width > 2) ? ((DWORD *)buf->data)[n] : ((WORD *)buf->data)[n];
+   return code_to_volts_ref(ss->min, ss->max, 1, ss->resolution, ss->encoding, code);
+}
+
+/* Plays a D/A buffer into the sink */
+static void sim_sink_play(SimSubsystem *ss, SimBuffer *buf)
+{
+   DBL step_in = 0;
+
+   for (ULNG n = 0; n < buf->valid_samples; n++)
+   {
+      DBL v = sim_buffer_volts(ss, buf, n);
+      ULNG k = ctx->sim_sink->samples + n;
+
+      if (k > 0)
       {
-         olDmGetBufferPtr(hBuffer, (LPVOID *)&pBuffer);
-         /* get last sample in buffer */
-         value = pBuffer[samples - 1];
+         DBL step = fabs(v - ctx->sim_sink_history[(k - 1) % SIM_SINK_HISTORY]);
+         if (n == 0)
+         {
+            DBL next = (buf->valid_samples > 1) ? fabs(sim_buffer_volts(ss, buf, 1) - v) : step;
+            DBL lsb = (ss->max - ss->min) / ldexp(1.0, ss->resolution);
+            if (step > 2 * MAX(ctx->sim_sink_step, next) + lsb)
+               ctx->sim_sink->discontinuities++;
+            ctx->sim_sink->max_boundary_step = MAX(ctx->sim_sink->max_boundary_step, step);
+         }
+         else
+         {
+            ctx->sim_sink->max_step = MAX(ctx->sim_sink->max_step, step);
+         }
+         step_in = step;
       }
-      /*  convert value to volts */
+      ctx->sim_sink_history[k % SIM_SINK_HISTORY] = v;
+   }
+   ctx->sim_sink_step = step_in;
+   ctx->sim_sink->samples += buf->valid_samples;
+   ctx->sim_sink->buffers++;
+}
 
-      if (encoding != OL_ENC_BINARY)
-      {
-         /* convert to offset binary by inverting the sign bit */
+static DBL sim_dac_volts(DBL t)
+{
+   SimBuffer *buf = (SimBuffer *)ctx->sim_da->ready.items[ctx->sim_da->ready.head];
+   ULNG code;
 
-         value ^= 1L << (resolution - 1);
-         value &= (1L << resolution) - 1; /* zero upper bits */
-      }
+   if (ctx->sim_da->running && ctx->sim_da->wrap_mode == OL_WRP_NONE)
+   {
+      /* streamed output: played samples come from the sink, the rest from the head buffer */
+      ULNG k = (ULNG)(t * ctx->sim_da->freq + 1e-6);
+      if (k < ctx->sim_sink->samples)
+         return (ctx->sim_sink->samples - k <= SIM_SINK_HISTORY) ? ctx->sim_sink_history[k % SIM_SINK_HISTORY] : 0.0;
+      if (ctx->sim_da->ready.count > 0 && k - ctx->sim_sink->samples < buf->valid_samples)
+         return sim_buffer_volts(ctx->sim_da, buf, k - ctx->sim_sink->samples);
+      return 0.0;
+   }
+   if (!ctx->sim_da->running || ctx->sim_da->ready.count == 0 || buf->valid_samples == 0)
+      return 0.0;
+   ULNG n = (ULNG)(t * ctx->sim_da->freq + 1e-6) % buf->valid_samples;
+   code = (buf->width > 2) ? ((DWORD *)buf->data)[n] : ((WORD *)buf->data)[n];
+   return code_to_volts_ref(ctx->sim_da->min, ctx->sim_da->max, 1, ctx->sim_da->resolution, ctx->sim_da->encoding, code);
+}
 
-      volts = ((float)max - (float)min) / (1L << resolution) * value + (float)min;
-      fflush(stdout);
-      LOG_PRINT("%lf\r", volts * 1000);
+static void sim_fill(SimSubsystem *ss, SimBuffer *buf, ULNG frames)
+{
+   ULNG sign = 1UL << (ss->resolution - 1);
+   ULNG mask = (1UL << ss->resolution) - 1;
+
+   for (ULNG f = 0; f < frames; f++)
+   {
+      DBL t = (ss->frames + f) / ss->freq;
+      for (UINT k = 0; k < ss->listsize; k++)
+      {
+         UINT ch = ss->chanlist[k];
+         ULNG code;
+         DBL volts = ctx->sim_config->amplitude[ch] * sin(2 * M_PI * ctx->sim_config->frequency[ch] * t) +
+                     ctx->sim_config->noise * sim_noise();
+         if (ch == 3 && ctx->sim_config->dac_loopback && t + ctx->sim_da->lead >= ctx->sim_config->loopback_delay)
+            volts += sim_dac_volts(t + ctx->sim_da->lead - ctx->sim_config->loopback_delay);
+         sim_volts_to_code(ss->min, ss->max, ss->gainlist[k], ss->resolution, ss->encoding, volts, &code);
+         if (ss->encoding != OL_ENC_BINARY && (code & sign))
+            code |= ~mask; // the board delivers sign extended samples
+         if (buf->width > 2)
+            ((DWORD *)buf->data)[f * ss->listsize + k] = (DWORD)code;
+         else
+            ((WORD *)buf->data)[f * ss->listsize + k] = (WORD)code;
+      }
    }
+   buf->valid_samples = frames * ss->listsize;
+}
+
+static int sim_init_notify(HWND *hWnd_p)
+{
+   *hWnd_p = (HWND)ctx->sim_ad; // any non-NULL handle, notifications are dispatched directly
+   return CFG_SUCCESS;
+}
+
+/* Buffers of a running subsystem that complete over time: every A/D buffer and
+   D/A buffers in OL_WRP_NONE mode (a wrap single D/A just replays its buffer) */
+static BOOL sim_streaming(SimSubsystem *ss)
+{
+   return ss->running && (ss->type == OLSS_AD || ss->wrap_mode == OL_WRP_NONE);
+}
+
+/* Simulated time at which the head buffer of ss completes */
+static DBL sim_due(SimSubsystem *ss)
+{
+   SimBuffer *buf = (SimBuffer *)ss->ready.items[ss->ready.head];
+   ULNG frames = (ss->type == OLSS_AD) ? buf->max_samples / ss->listsize : buf->valid_samples;
+   return (ss->frames + frames) / ss->freq;
+}
+
+/* Completes the next buffer (A/D or streamed D/A, whichever is first in simulated
+   time) once it is due, sleeping at most timeout_ms */
+static BOOL sim_pump(HWND hWnd_v, UINT timeout_ms)
+{
+   SimSubsystem *ss = NULL;
+   SimSubsystem *all[2] = {ctx->sim_da, ctx->sim_ad};
+
+   if (ctx->sim_quit)
+   {
+      ctx->sim_quit = FALSE;
+      return FALSE;
+   }
+   for (int i = 0; i < 2; i++)
+   {
+      if (!sim_streaming(all[i]))
+         continue;
+      if (all[i]->ready.count == 0)
+      {
+         all[i]->running = FALSE;
+         if (all[i]->type == OLSS_DA)
+         {
+            ctx->sim_sink->underruns++;
+            daq_event((HDASS)all[i], OLDA_WM_UNDERRUN_ERROR);
+         }
+         else
+         {
+            daq_event((HDASS)all[i], OLDA_WM_QUEUE_DONE);
+         }
+         return TRUE;
+      }
+      if (ss == NULL || sim_due(all[i]) < sim_due(ss))
+         ss = all[i];
+   }
+   if (ss == NULL)
+   {
+      sleep_ms(MIN(timeout_ms, 1));
+      return TRUE;
+   }
+
+   SimBuffer *buf = (SimBuffer *)ss->ready.items[ss->ready.head];
+   if (ctx->sim_config->wait_for_worker && ctx->sim_config->speed <= 0 && ss->type == OLSS_AD && conv_backlogged())
+   {
+      /* flat out, wait for the conversion worker rather than overrun its ring (a
+         board never waits, so runs that check for drops must not use this) */
+      sleep_ms(0);
+      return TRUE;
+   }
+   if (ctx->sim_config->speed > 0)
+   {
+      DBL due = ss->start_time + sim_due(ss) / ctx->sim_config->speed;
+      DBL now = monotonic_seconds();
+      if (now < due)
+      {
+         sleep_ms((UINT)MIN((DBL)timeout_ms, ceil((due - now) * 1000)));
+         return TRUE;
+      }
+   }
+
+   sim_queue_pop(&ss->ready);
+   if (ss->type == OLSS_DA)
+   {
+      /* in real time a buffer queued after it should have started playing means the D/A ran dry */
+      if (ctx->sim_config->speed > 0 && buf->queued_at > ss->start_time + ss->frames / ss->freq / ctx->sim_config->speed)
+      {
+         ss->running = FALSE;
+         sim_queue_push(&ss->done, buf);
+         ctx->sim_sink->underruns++;
+         daq_event((HDASS)ss, OLDA_WM_UNDERRUN_ERROR);
+         return TRUE;
+      }
+      sim_sink_play(ss, buf);
+      sim_queue_push(&ss->done, buf);
+      ss->frames += buf->valid_samples;
+      ss->buffers++;
+      daq_event((HDASS)ss, OLDA_WM_BUFFER_DONE);
+      return TRUE;
+   }
+
+   ULNG frames = buf->max_samples / ss->listsize;
+   sim_fill(ss, buf, frames);
+   sim_queue_push(&ss->done, buf);
+   ss->frames += frames;
+   ss->buffers++;
+
+   if (ctx->sim_config->overrun_after && ss->buffers == ctx->sim_config->overrun_after)
+   {
+      ss->running = FALSE;
+      daq_event((HDASS)ss, OLDA_WM_OVERRUN_ERROR);
+   }
+   else if (ctx->sim_config->queue_done_after && ss->buffers == ctx->sim_config->queue_done_after)
+   {
+      ss->running = FALSE;
+      daq_event((HDASS)ss, OLDA_WM_QUEUE_DONE);
+   }
+   else
+   {
+      daq_event((HDASS)ss, OLDA_WM_BUFFER_DONE);
+   }
+   return TRUE;
+}
+
+static void sim_post_quit(void)
+{
+   ctx->sim_quit = TRUE;
+}
+
+static ECODE sim_enum_boards(DABRDPROC proc, LPARAM lParam)
+{
+   char name[BOARD_NAME_LEN];
+
+   for (UINT i = 0; i < sim_boards; i++)
+   {
+      snprintf(name, sizeof(name), "DT9837(SIM%u)", i);
+      if (!proc(name, "simulator", lParam))
+         break;
+   }
+   return OLNOERROR;
+}
+
+static ECODE sim_initialize(LPSTR name, LPHDEV hDev_p)
+{
+   *hDev_p = (HDEV)&ctx->sim_device;
+   return OLNOERROR;
+}
+
+static ECODE sim_terminate(HDEV hDev_v)
+{
+   return (hDev_v == (HDEV)&ctx->sim_device) ? OLNOERROR : SIM_ERROR;
+}
+
+static ECODE sim_get_dev_caps(HDEV hDev_v, UINT cap, UINT *value)
+{
+   *value = 1;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_dass(HDEV hDev_v, UINT type, UINT element, HDASS *hDass_p)
+{
+   SimSubsystem *ss = (type == OLSS_AD) ? ctx->sim_ad : (type == OLSS_DA) ? ctx->sim_da : NULL;
+
+   if (ss == NULL || element != 0)
+      return SIM_ERROR;
+   if (type == OLSS_DA && ctx->sim_sink_history == NULL &&
+       (ctx->sim_sink_history = calloc(SIM_SINK_HISTORY, sizeof(DBL))) == NULL)
+      return SIM_ERROR;
+   memset(ss, 0, sizeof(SimSubsystem));
+   ss->type = type;
+   ss->listsize = 1;
+   ss->gainlist[0] = 1;
+   ss->freq = 1000.0;
+   ss->resolution = (type == OLSS_AD) ? 24 : 16;
+   ss->encoding = OL_ENC_2SCOMP;
+   ss->min = -10.0;
+   ss->max = 10.0;
+   *hDass_p = (HDASS)ss;
+   return OLNOERROR;
+}
+
+static ECODE sim_release_dass(HDASS hDass_v)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   ss->running = FALSE;
+   memset(&ss->ready, 0, sizeof(SimQueue));
+   memset(&ss->done, 0, sizeof(SimQueue));
+   return OLNOERROR;
+}
+
+static ECODE sim_set_wnd_handle(HDASS hDass_v, HWND hWnd_v, UINT lParam) { return OLNOERROR; }
+static ECODE sim_set_data_flow(HDASS hDass_v, UINT flow) { return OLNOERROR; }
+static ECODE sim_set_coupling_type(HDASS hDass_v, UINT channel, UINT coupling) { return OLNOERROR; }
+static ECODE sim_set_excitation(HDASS hDass_v, UINT channel, UINT source) { return OLNOERROR; }
+static ECODE sim_set_clock_source(HDASS hDass_v, UINT source) { return OLNOERROR; }
+static ECODE sim_set_trigger(HDASS hDass_v, UINT trigger) { return OLNOERROR; }
+static ECODE sim_set_dma_usage(HDASS hDass_v, UINT dma) { return OLNOERROR; }
+
+static ECODE sim_get_ss_caps_ex(HDASS hDass_v, UINT cap, DBL *value)
+{
+   *value = (((SimSubsystem *)hDass_v)->type == OLSS_AD) ? SIM_AD_MAX_FREQ : SIM_DA_MAX_FREQ;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_ss_caps(HDASS hDass_v, UINT cap, UINT *value)
+{
+   *value = 1;
+   return OLNOERROR;
+}
+
+static ECODE sim_set_channel_list_size(HDASS hDass_v, UINT size)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   if (size == 0 || size > ((ss->type == OLSS_AD) ? SIM_MAX_LIST : 1))
+      return SIM_ERROR;
+   for (UINT i = ss->listsize; i < size; i++)
+   {
+      ss->chanlist[i] = i;
+      ss->gainlist[i] = 1;
+   }
+   ss->listsize = size;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_channel_list_size(HDASS hDass_v, UINT *size)
+{
+   *size = ((SimSubsystem *)hDass_v)->listsize;
+   return OLNOERROR;
+}
+
+static ECODE sim_set_channel_list_entry(HDASS hDass_v, UINT entry, UINT channel)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   if (entry >= ss->listsize || channel >= NUM_CHANNELS)
+      return SIM_ERROR;
+   ss->chanlist[entry] = channel;
+   return OLNOERROR;
+}
+
+static ECODE sim_set_gain_list_entry(HDASS hDass_v, UINT entry, DBL gain)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   if (entry >= ss->listsize || (gain != 1 && gain != 10))
+      return SIM_ERROR;
+   ss->gainlist[entry] = gain;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_gain_list_entry(HDASS hDass_v, UINT entry, DBL *gain)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   if (entry >= ss->listsize)
+      return SIM_ERROR;
+   *gain = ss->gainlist[entry];
+   return OLNOERROR;
+}
+
+static ECODE sim_set_clock_frequency(HDASS hDass_v, DBL freq)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   DBL max_freq = (ss->type == OLSS_AD) ? SIM_AD_MAX_FREQ : SIM_DA_MAX_FREQ;
+   if (freq <= 0)
+      return SIM_ERROR;
+   ss->freq = MIN(freq, max_freq);
+   return OLNOERROR;
+}
+
+static ECODE sim_get_clock_frequency(HDASS hDass_v, DBL *freq)
+{
+   *freq = ((SimSubsystem *)hDass_v)->freq;
+   return OLNOERROR;
+}
+
+static ECODE sim_set_wrap_mode(HDASS hDass_v, UINT mode)
+{
+   ((SimSubsystem *)hDass_v)->wrap_mode = mode;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_range(HDASS hDass_v, DBL *max, DBL *min)
+{
+   *max = ((SimSubsystem *)hDass_v)->max;
+   *min = ((SimSubsystem *)hDass_v)->min;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_encoding(HDASS hDass_v, UINT *encoding)
+{
+   *encoding = ((SimSubsystem *)hDass_v)->encoding;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_resolution(HDASS hDass_v, UINT *resolution)
+{
+   *resolution = ((SimSubsystem *)hDass_v)->resolution;
+   return OLNOERROR;
+}
+
+static ECODE sim_config_dass(HDASS hDass_v)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   return (ss->listsize > 0 && ss->freq > 0) ? OLNOERROR : SIM_ERROR;
+}
+
+static ECODE sim_start(HDASS hDass_v)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   ctx->sim_rng = ctx->sim_config->seed ? ctx->sim_config->seed : 1;
+   ctx->sim_quit = FALSE;
+   ss->frames = 0;
+   ss->buffers = 0;
+   ss->start_time = monotonic_seconds();
+   ss->lead = (ss->type == OLSS_DA) ? ctx->sim_config->da_lead : 0;
+   ss->running = TRUE;
+   if (ss->type == OLSS_DA)
+   {
+      memset(ctx->sim_sink, 0, sizeof(*ctx->sim_sink));
+      ctx->sim_sink_step = 0;
+   }
+   return OLNOERROR;
+}
+
+/* A shared start: every subsystem runs off the same instant, no D/A lead */
+static ECODE sim_start_together(HDASS *hDass_list, UINT count)
+{
+   DBL now = monotonic_seconds();
+   for (UINT i = 0; i < count; i++)
+   {
+      SimSubsystem *ss = (SimSubsystem *)hDass_list[i];
+      sim_start(ss);
+      ss->start_time = now;
+      ss->lead = 0;
+   }
+   return OLNOERROR;
+}
+
+static ECODE sim_abort(HDASS hDass_v)
+{
+   SimSubsystem *ss = (SimSubsystem *)hDass_v;
+   HBUF hBuf_v;
+   ss->running = FALSE;
+   while ((hBuf_v = sim_queue_pop(&ss->ready)) != NULL)
+      sim_queue_push(&ss->done, hBuf_v);
+   return OLNOERROR;
+}
+
+static ECODE sim_get_buffer(HDASS hDass_v, HBUF *hBuf_p)
+{
+   *hBuf_p = sim_queue_pop(&((SimSubsystem *)hDass_v)->done);
+   return OLNOERROR;
+}
+
+static ECODE sim_put_buffer(HDASS hDass_v, HBUF hBuf_v)
+{
+   ((SimBuffer *)hBuf_v)->queued_at = monotonic_seconds();
+   return sim_queue_push(&((SimSubsystem *)hDass_v)->ready, hBuf_v) ? OLNOERROR : SIM_ERROR;
+}
+
+static ECODE sim_get_error_string(ECODE status, char *str, UINT len)
+{
+   snprintf(str, len, "Simulator error %u", status);
+   return OLNOERROR;
+}
+
+static ECODE sim_calloc_buffer(UINT flags, UINT ex_flags, ULNG samples, UINT sample_size, HBUF *hBuf_p)
+{
+   SimBuffer *buf = calloc(1, sizeof(SimBuffer));
+   if (buf == NULL)
+      return SIM_ERROR;
+   buf->data = calloc(samples, sample_size);
+   if (buf->data == NULL)
+   {
+      free(buf);
+      return SIM_ERROR;
+   }
+   buf->max_samples = samples;
+   buf->width = sample_size;
+   *hBuf_p = (HBUF)buf;
+   return OLNOERROR;
+}
+
+static ECODE sim_free_buffer(HBUF hBuf_v)
+{
+   if (hBuf_v)
+   {
+      free(((SimBuffer *)hBuf_v)->data);
+      free(hBuf_v);
+   }
+   return OLNOERROR;
+}
+
+static ECODE sim_get_buffer_ptr(HBUF hBuf_v, LPVOID *ptr)
+{
+   *ptr = ((SimBuffer *)hBuf_v)->data;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_valid_samples(HBUF hBuf_v, ULNG *samples)
+{
+   *samples = ((SimBuffer *)hBuf_v)->valid_samples;
+   return OLNOERROR;
+}
+
+static ECODE sim_set_valid_samples(HBUF hBuf_v, ULNG samples)
+{
+   SimBuffer *buf = (SimBuffer *)hBuf_v;
+   if (samples > buf->max_samples)
+      return SIM_ERROR;
+   buf->valid_samples = samples;
+   return OLNOERROR;
+}
+
+static ECODE sim_get_data_width(HBUF hBuf_v, UINT *width)
+{
+   *width = ((SimBuffer *)hBuf_v)->width;
+   return OLNOERROR;
+}
+
+static const DaqBackend sim_backend = {
+   "simulator", sim_init_notify, sim_pump, sim_post_quit,
+   sim_enum_boards, sim_initialize, sim_terminate, sim_get_dev_caps, sim_get_dass, sim_release_dass,
+   sim_set_wnd_handle, sim_set_data_flow, sim_get_ss_caps_ex, sim_get_ss_caps,
+   sim_set_channel_list_size, sim_get_channel_list_size, sim_set_channel_list_entry,
+   sim_set_gain_list_entry, sim_get_gain_list_entry, sim_set_coupling_type, sim_set_excitation,
+   sim_set_clock_frequency, sim_get_clock_frequency, sim_set_clock_source, sim_set_trigger,
+   sim_set_dma_usage, sim_set_wrap_mode, sim_get_range, sim_get_encoding, sim_get_resolution,
+   sim_volts_to_code, sim_config_dass, sim_start, sim_abort, sim_get_buffer, sim_put_buffer, sim_get_error_string,
+   sim_calloc_buffer, sim_free_buffer, sim_get_buffer_ptr, sim_get_valid_samples, sim_set_valid_samples,
+   sim_get_data_width, sim_start_together,
+};
+
+#if DT_OPENLAYERS
+static const DaqBackend *daq = &ol_backend;
+#else
+static const DaqBackend *daq = &sim_backend;
+#endif
+
+/* Continuity statistics of the simulated D/A output since it was last started */
+SimSinkStats get_sim_sink_stats()
+{
+   return *ctx->sim_sink;
+}
+
+/* Selects the backend used by initialize_board() and everything after it */
+int select_backend(int backend)
+{
+   const DaqBackend *selected = NULL;
+
+   if (backend == DAQ_BACKEND_SIMULATOR)
+      selected = &sim_backend;
+#if DT_OPENLAYERS
+   if (backend == DAQ_BACKEND_OPENLAYERS)
+      selected = &ol_backend;
+#endif
+   if (selected == NULL)
+      return CFG_FAILURE;
+   if (selected != daq)
+      boards.count = 0; // enumerate the new backend's boards
+   daq = selected;
+   return CFG_SUCCESS;
+}
+
+/* speed: 1 real time, 0 as fast as possible; overrun/queue-done after N buffers (0-never) */
+int configure_simulator(DBL speed, DBL noise, ULNG seed, ULNG overrun_after, ULNG queue_done_after, bool dac_loopback)
+{
+   if (speed < 0 || noise < 0)
+      return CFG_FAILURE;
+   ctx->sim_config->speed = speed;
+   ctx->sim_config->noise = noise;
+   ctx->sim_config->seed = seed;
+   ctx->sim_config->overrun_after = overrun_after;
+   ctx->sim_config->queue_done_after = queue_done_after;
+   ctx->sim_config->dac_loopback = dac_loopback;
+   return CFG_SUCCESS;
+}
+
+/* For tests that run the simulator flat out: the A/D holds back its next buffer while
+   the conversion worker is more than half a ring behind, so no buffer is dropped */
+int set_sim_flow_control(bool wait_for_worker)
+{
+   ctx->sim_config->wait_for_worker = wait_for_worker;
+   return CFG_SUCCESS;
+}
+
+/* The simulator settings, so a caller can put back what it changed */
+SimConfig get_simulator_config()
+{
+   return *ctx->sim_config;
+}
+
+/* Timing of the simulated loopback: how far a separately started D/A runs ahead of
+   the A/D and the delay from the D/A output to the loopback input, both in seconds */
+int set_sim_timing(DBL da_lead, DBL loopback_delay)
+{
+   if (da_lead < 0 || loopback_delay < 0)
+      return CFG_FAILURE;
+   ctx->sim_config->da_lead = da_lead;
+   ctx->sim_config->loopback_delay = loopback_delay;
+   return CFG_SUCCESS;
+}
+
+/* Number of simulated boards (1..MAX_DEVICES), each with its own signals and settings */
+int set_sim_boards(UINT count)
+{
+   if (count == 0 || count > MAX_DEVICES)
+      return CFG_FAILURE;
+   sim_boards = count;
+   boards.count = 0;
+   return CFG_SUCCESS;
+}
+
+/* Sine signal on a physical input channel (0-Z, 1-Y, 2-X, 3-DAC loop) */
+int set_sim_signal(int channel, DBL amplitude, DBL frequency)
+{
+   if (channel < 0 || channel >= NUM_CHANNELS)
+      return CFG_FAILURE;
+   ctx->sim_config->amplitude[channel] = amplitude;
+   ctx->sim_config->frequency[channel] = frequency;
+   return CFG_SUCCESS;
+}
+
+typedef struct ChannelData {
+   DBL *channel[NUM_CHANNELS];
+   UINT num_readings;
+   UINT max_readings;
+   UINT num_channels; // channels in use, the rest are NULL
+} ChannelData;
+
+/* Channel map
+   Output channel k of a capture is the physical input physical[k], scaled with
+   sensitivity[k]. The A/D channel list holds the mapped inputs in ascending
+   order, as the board scans them, so a frame holds exactly count codes; the
+   conversion writes code c to output channel order[c] (see ConvTable), and the
+   storage, analysis and files only carry the mapped channels in output order.
+   measure() uses the first num_channels entries of the map. The default is the
+   DT9837 wiring: X, Y and Z on inputs 2, 1 and 0 and the DAC loop on input 3.
+*/
+#define DAC_LOOP_INPUT 3 // physical input wired to the D/A output
+
+typedef struct ChannelMap {
+   UINT count;
+   UINT physical[NUM_CHANNELS];
+   DBL sensitivity[NUM_CHANNELS]; // mV per g, 1000 keeps a channel in volts
+} ChannelMap;
+
+/* calibrated sensitivity and CSV column of each physical input (0-Z, 1-Y, 2-X, 3-DAC loop) */
+static const DBL input_sensitivity[NUM_CHANNELS] = {SENSITIVITY_VAL_Z, SENSITIVITY_VAL_Y, SENSITIVITY_VAL_X, 1000.0};
+static const char *const input_name[NUM_CHANNELS] = {"accel(z)", "accel(y)", "accel(x)", "dac"};
+
+static const ChannelMap channel_map_default = {
+   .count = NUM_CHANNELS,
+   .physical = {2, 1, 0, 3},
+   .sensitivity = {SENSITIVITY_VAL_X, SENSITIVITY_VAL_Y, SENSITIVITY_VAL_Z, 1000.0},
+};
+
+/* Maps output channel k to physical[k] for the next configurations. A NULL
+   sensitivity (or an entry of 0) takes the calibrated value of the input. */
+int set_channel_map(UINT count, const UINT *physical, const DBL *sensitivity)
+{
+   ChannelMap map = {0};
+   UINT used = 0;
+
+   if (count == 0 || count > NUM_CHANNELS || physical == NULL)
+      return CFG_FAILURE;
+   map.count = count;
+   for (UINT k = 0; k < count; k++)
+   {
+      if (physical[k] >= NUM_CHANNELS || (used & (1u << physical[k])) || (sensitivity != NULL && sensitivity[k] < 0))
+         return CFG_FAILURE;
+      used |= 1u << physical[k];
+      map.physical[k] = physical[k];
+      map.sensitivity[k] = (sensitivity != NULL && sensitivity[k] > 0) ? sensitivity[k] : input_sensitivity[physical[k]];
+   }
+   *ctx->channel_map = map;
+   return CFG_SUCCESS;
+}
+
+ChannelMap get_channel_map()
+{
+   return *ctx->channel_map;
+}
+
+/* Output channels of the configured capture */
+static UINT capture_channels()
+{
+   return ctx->active_map->count;
+}
+
+/* Output channel of each A/D channel list entry: the list holds the mapped
+   inputs in ascending order, so entry c is the c-th smallest physical input */
+static void channel_map_order(const ChannelMap *map, UINT order[NUM_CHANNELS])
+{
+   UINT c = 0;
+   for (UINT physical = 0; physical < NUM_CHANNELS; physical++)
+   {
+      for (UINT k = 0; k < map->count; k++)
+      {
+         if (map->physical[k] == physical)
+            order[c++] = k;
+      }
+   }
+}
+
+/* Output channel reading physical input, -1 when it is not in the capture */
+static int capture_position(UINT physical)
+{
+   for (UINT k = 0; k < ctx->active_map->count; k++)
+   {
+      if (ctx->active_map->physical[k] == physical)
+         return (int)k;
+   }
+   return -1;
+}
+
+/* Decimation
+   With a factor above 1 the converted frames pass through a linear phase FIR
+   low-pass and only every factor-th output is computed and stored, so storage,
+   streamed chunks and everything handed to Python shrink by the factor. The
+   filter keeps its last taps - 1 input frames between buffers, and stored frame
+   k is centred on input frame k * factor (the group delay is compensated by
+   running taps/2 frames behind). The first and last frames are repeated to fill
+   the window at the edges of a run. Frames are kept interleaved so each tap is
+   one 4-wide multiply-add across the channels. Live subscription blocks stay at the full rate.
+*/
+#define DECIM_MAX_FACTOR 64
+#define DECIM_DEFAULT_TAPS 16     // taps per output phase, taps = factor * this + 1
+#define DECIM_MAX_TAPS_PER_PHASE 32
+#define DECIM_MAX_TAPS (DECIM_MAX_FACTOR * DECIM_MAX_TAPS_PER_PHASE + 1)
+#define DECIM_PASSBAND 0.8        // cutoff as a fraction of the output Nyquist frequency
+#define DECIM_BLOCK_FRAMES 4096   // input frames filtered per pass
+
+typedef struct {
+   UINT factor;  // input frames per stored frame, 1-off
+   UINT taps;
+   DBL cutoff;   // -6 dB point as a fraction of the input rate
+} DecimationInfo;
+
+typedef struct Decimator {
+   DecimationInfo info;
+   DBL coeff[DECIM_MAX_TAPS];
+   DBL (*line)[NUM_CHANNELS]; // history followed by the block being filtered
+   DBL *block[NUM_CHANNELS];  // planar conversion scratch
+   DBL *out[NUM_CHANNELS];    // filtered frames of one pass
+   ULNG next_start;           // line index of the next output's first tap
+   BOOL primed;               // history holds real frames
+} Decimator;
+
+static const Decimator decim_default = {.info = {.factor = 1, .taps = 1, .cutoff = 0.5}, .coeff = {1.0}};
+
+/* Windowed-sinc (Blackman) low-pass for decimation by factor */
+static void decim_design(Decimator *d, UINT factor, UINT taps_per_phase)
+{
+   UINT taps = factor * taps_per_phase + 1;
+   DBL fc = DECIM_PASSBAND * 0.5 / factor, sum = 0;
+
+   for (UINT t = 0; t < taps; t++)
+   {
+      DBL x = (DBL)t - (taps - 1) / 2.0;
+      DBL sinc = (x == 0) ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+      DBL w = 0.42 - 0.5 * cos(2 * M_PI * t / (taps - 1)) + 0.08 * cos(4 * M_PI * t / (taps - 1));
+      d->coeff[t] = sinc * w;
+      sum += d->coeff[t];
+   }
+   for (UINT t = 0; t < taps; t++)
+      d->coeff[t] /= sum; // unity gain at DC
+   d->info.factor = factor;
+   d->info.taps = taps;
+   d->info.cutoff = fc;
+}
+
+/* Stores every factor-th frame of the next runs, low-pass filtered first; factor 1
+   stores every frame. taps_per_phase 0 selects DECIM_DEFAULT_TAPS, otherwise even. */
+int set_decimation(UINT factor, UINT taps_per_phase)
+{
+   if (taps_per_phase == 0)
+      taps_per_phase = DECIM_DEFAULT_TAPS;
+   if (factor == 0 || factor > DECIM_MAX_FACTOR || taps_per_phase % 2 != 0 ||
+       taps_per_phase > DECIM_MAX_TAPS_PER_PHASE)
+      return CFG_FAILURE;
+   if (factor == 1)
+   {
+      ctx->decim->info.factor = 1;
+      ctx->decim->info.taps = 1;
+      ctx->decim->info.cutoff = 0.5;
+      ctx->decim->coeff[0] = 1.0;
+      return CFG_SUCCESS;
+   }
+   decim_design(ctx->decim, factor, taps_per_phase);
+   return CFG_SUCCESS;
+}
+
+DecimationInfo get_decimation()
+{
+   return ctx->decim->info;
+}
+
+/* Copies up to max coefficients into out and returns the filter length */
+UINT get_decimation_taps(DBL *out, UINT max)
+{
+   if (out != NULL)
+      memcpy(out, ctx->decim->coeff, MIN(max, ctx->decim->info.taps) * sizeof(DBL));
+   return ctx->decim->info.taps;
+}
+
+/* Filters the frames at line[history, history + frames) into out[][0..) and returns
+   the number of outputs; the last history frames are moved to the front afterwards */
+static ULNG decim_filter(Decimator *d, ULNG frames)
+{
+   const ULNG history = d->info.taps - 1;
+   const UINT taps = d->info.taps, channels = capture_channels();
+   const DBL *restrict h = d->coeff;
+   ULNG n = 0;
+
+   for (; d->next_start + taps <= history + frames; d->next_start += d->info.factor, n++)
+   {
+      const DBL (*restrict w)[NUM_CHANNELS] = (const DBL (*)[NUM_CHANNELS])d->line + d->next_start;
+      DBL acc[NUM_CHANNELS] = {0};
+      for (UINT t = 0; t < taps; t++)
+      {
+         for (int c = 0; c < NUM_CHANNELS; c++)
+            acc[c] += h[t] * w[t][c];
+      }
+      for (UINT c = 0; c < channels; c++)
+         d->out[c][n] = acc[c];
+   }
+   memmove(d->line, d->line + frames, history * sizeof(*d->line));
+   d->next_start -= frames;
+   return n;
+}
+
+/* Reference path: direct convolution of one channel with the same taps, edges and
+   phase as the streaming filter, kept to validate it. Returns the outputs written. */
+ULNG decimate_ref(const DBL *in, ULNG frames, DBL *out)
+{
+   const long half = (long)(ctx->decim->info.taps - 1) / 2;
+   ULNG n = 0;
+
+   for (ULNG k = 0; k < frames; k += ctx->decim->info.factor, n++)
+   {
+      DBL acc = 0;
+      for (long t = 0; t < (long)ctx->decim->info.taps; t++)
+      {
+         long i = (long)k - half + t;
+         acc += ctx->decim->coeff[t] * in[(i < 0) ? 0 : ((ULNG)i >= frames) ? frames - 1 : (ULNG)i];
+      }
+      out[n] = acc;
+   }
+   return n;
+}
+
+/* Event capture
+   With a trigger set, converted frames are not stored as they arrive. The last
+   pre_frames frames are kept in a fixed ring instead, and when the trigger
+   channel fires the ring plus the next post_frames frames (starting with the
+   one that fired) are committed to storage as one window. Storage therefore
+   holds max_events windows back to back and TriggerEvent records where each
+   one starts, in the storage and in the stream of converted frames (the frame
+   index frame_time() takes). Triggers are evaluated on the frames that would
+   otherwise be stored, after decimation; statistics and the PSD still see every
+   frame. A crossing is only accepted once the channel has gone back past the
+   level by the hysteresis; crossings during a window or after max_events are
+   counted as missed.
+*/
+#define TRIG_OFF 0
+#define TRIG_RISING 1  // channel rises through level
+#define TRIG_FALLING 2 // channel falls through level
+#define TRIG_ABOVE 3   // |channel| reaches level (shock threshold)
+
+#define TRIG_MAX_EVENTS 65536
+#define TRIG_MAX_STORED_FRAMES (1UL << 26) // max_events * (pre_frames + post_frames)
+
+typedef struct {
+   ULNG trigger_frame; // stream frame that fired
+   ULNG first_frame;   // stream frame of the first stored frame
+   ULNG offset;        // storage index of the first stored frame
+   UINT frames;
+} TriggerEvent;
+
+typedef struct {
+   ULNG events;
+   ULNG missed;
+} TriggerCounters;
+
+typedef struct Trigger {
+   int mode;
+   UINT channel; // output order X, Y, Z, DAC
+   DBL level;
+   DBL hysteresis;
+   UINT pre_frames;
+   UINT post_frames;
+   UINT max_events;
+   BOOL armed;
+   UINT post_left;     // frames still to store for the current window
+   ULNG stream_frames; // converted frames seen this run
+   DBL *ring[NUM_CHANNELS];
+   DBL *block[NUM_CHANNELS]; // planar conversion scratch
+   TriggerEvent *event;
+   TriggerCounters counters;
+} Trigger;
+
+/* Windows of pre_frames + post_frames frames around trigger crossings of channel
+   for the next runs; mode TRIG_OFF stores every frame again */
+int set_trigger(int mode, UINT channel, DBL level, DBL hysteresis, UINT pre_frames, UINT post_frames,
+                UINT max_events)
+{
+   if (mode == TRIG_OFF)
+   {
+      ctx->trig->mode = TRIG_OFF;
+      return CFG_SUCCESS;
+   }
+   if (mode < TRIG_RISING || mode > TRIG_ABOVE || channel >= NUM_CHANNELS || hysteresis < 0 ||
+       post_frames == 0 || max_events == 0 || max_events > TRIG_MAX_EVENTS ||
+       (ULNG)max_events * ((ULNG)pre_frames + post_frames) > TRIG_MAX_STORED_FRAMES)
+      return CFG_FAILURE;
+   ctx->trig->mode = mode;
+   ctx->trig->channel = channel;
+   ctx->trig->level = level;
+   ctx->trig->hysteresis = hysteresis;
+   ctx->trig->pre_frames = pre_frames;
+   ctx->trig->post_frames = post_frames;
+   ctx->trig->max_events = max_events;
+   return CFG_SUCCESS;
+}
+
+/* Advances the trigger by one frame; TRUE if it fired and a window may start */
+static BOOL trig_step(DBL v, BOOL can_fire)
+{
+   BOOL fire, rearm;
+
+   switch (ctx->trig->mode)
+   {
+   case TRIG_RISING:
+      fire = v >= ctx->trig->level;
+      rearm = v < ctx->trig->level - ctx->trig->hysteresis;
+      break;
+   case TRIG_FALLING:
+      fire = v <= ctx->trig->level;
+      rearm = v > ctx->trig->level + ctx->trig->hysteresis;
+      break;
+   default:
+      fire = fabs(v) >= ctx->trig->level;
+      rearm = fabs(v) < ctx->trig->level - ctx->trig->hysteresis;
+      break;
+   }
+   if (!ctx->trig->armed)
+   {
+      ctx->trig->armed = rearm;
+      return FALSE;
+   }
+   if (!fire)
+      return FALSE;
+   ctx->trig->armed = FALSE;
+   if (!can_fire)
+      ctx->trig->counters.missed++;
+   return can_fire;
+}
+
+/* Copies up to max events of the current or last run into out and returns the count */
+UINT get_trigger_events(TriggerEvent *out, UINT max)
+{
+   UINT n = (UINT)MIN(ctx->trig->counters.events, (ULNG)max);
+
+   if (out == NULL || ctx->trig->event == NULL)
+      return 0;
+   memcpy(out, ctx->trig->event, n * sizeof(TriggerEvent));
+   return n;
+}
+
+TriggerCounters get_trigger_counters()
+{
+   return ctx->trig->counters;
+}
+
+/* Time base
+   Timestamps are not stored per frame. Stored frame n of a run was sampled
+   n / rate seconds after the first one (rate is the stored rate, the clock
+   divided by the decimation factor), computed on demand from the integer index so
+   it does not drift however long the run is. Every completed buffer also
+   records the host monotonic time it arrived at together with the index just
+   past its last frame, which frame_host_time() uses to place frames on the
+   host clock. Anchors are written by the notification loop; query host times
+   once the run has ended. A run that loses a buffer keeps only the frames before
+   it (see the raw ring), so stored frame n is always the nth frame the board
+   delivered (times the decimation factor).
+*/
+#define TIME_ANCHOR_SLOTS 32768 // newest anchors kept, 900 s at 36 buffers per second
+
+typedef struct TimeAnchor {
+   ULNG end_frame;   // frames delivered up to and including this buffer
+   DBL host_seconds; // monotonic_seconds() at OLDA_WM_BUFFER_DONE
+} TimeAnchor;
+
+typedef struct TimeBase {
+   DBL rate;          // stored frames per second
+   DBL start_seconds; // monotonic_seconds() just before the subsystem started
+   ULNG anchors;      // anchors recorded this run
+   UINT decimation;   // board frames per stored frame
+} TimeBase;
+
+void time_base_begin(DBL rate)
+{
+   ctx->time_base->decimation = ctx->decim->info.factor;
+   ctx->time_base->rate = rate / ctx->decim->info.factor;
+   ctx->time_base->start_seconds = 0;
+   ctx->time_base->anchors = 0;
+   if (ctx->time_anchor == NULL)
+      ctx->time_anchor = malloc(TIME_ANCHOR_SLOTS * sizeof(TimeAnchor)); // without it frames get nominal times
+}
+
+void time_base_mark(ULNG end_frame)
+{
+   if (ctx->time_anchor == NULL)
+      return;
+   TimeAnchor *a = &ctx->time_anchor[ctx->time_base->anchors % TIME_ANCHOR_SLOTS];
+
+   a->end_frame = end_frame;
+   a->host_seconds = monotonic_seconds();
+   ctx->time_base->anchors++;
+}
+
+TimeBase get_time_base()
+{
+   return *ctx->time_base;
+}
+
+/* Seconds between the first frame of the run and frame */
+DBL frame_time(ULNG frame)
+{
+   return (ctx->time_base->rate > 0) ? (DBL)frame / ctx->time_base->rate : 0.0;
+}
+
+int get_frame_times(ULNG first_frame, UINT count, DBL *out)
+{
+   if (out == NULL || ctx->time_base->rate <= 0)
+      return CFG_FAILURE;
+   for (UINT i = 0; i < count; i++)
+      out[i] = (DBL)(first_frame + i) / ctx->time_base->rate;
+   return CFG_SUCCESS;
+}
+
+/* Host monotonic time of frame, taken from the buffer that delivered it. Frames
+   whose anchor was overwritten are placed relative to the oldest one kept. */
+DBL frame_host_time(ULNG frame)
+{
+   ULNG n = ctx->time_base->anchors;
+   ULNG lo = (n > TIME_ANCHOR_SLOTS) ? n - TIME_ANCHOR_SLOTS : 0, hi = n;
+   DBL board_rate = ctx->time_base->rate * ctx->time_base->decimation;
+
+   if (n == 0)
+      return ctx->time_base->start_seconds + frame_time(frame);
+
+   /* anchors count board frames */
+   frame *= ctx->time_base->decimation;
+   /* first anchor whose buffer ends past frame */
+   while (lo < hi)
+   {
+      ULNG mid = lo + (hi - lo) / 2;
+      if (ctx->time_anchor[mid % TIME_ANCHOR_SLOTS].end_frame > frame)
+         hi = mid;
+      else
+         lo = mid + 1;
+   }
+   const TimeAnchor *a = &ctx->time_anchor[MIN(lo, n - 1) % TIME_ANCHOR_SLOTS];
+   return a->host_seconds - ((DBL)a->end_frame - 1 - (DBL)frame) / board_rate;
+}
+
+/* Acquisition schedule
+   A run stops after an exact number of frames: duration * clock for timed runs,
+   the set_capture_frames() count, or the retained storage capacity for untimed
+   runs. The buffer holding the last frame is trimmed before it is stored. The
+   monotonic deadline only catches a board that stops delivering buffers.
+*/
+#define STOP_REASON_NONE 0
+#define STOP_REASON_TIMER 1
+#define STOP_REASON_KEY 2
+#define STOP_REASON_SAMPLE_COUNT 3
+#define STOP_REASON_QUEUE_DONE 4
+#define STOP_REASON_OVERRUN 5
+#define STOP_REASON_TRIGGER_ERROR 6
+#define STOP_REASON_ERROR 7
+#define STOP_REASON_UNDERRUN 8    // streamed D/A output ran dry
+#define STOP_REASON_OUTPUT_DONE 9 // streamed D/A output played its last sample
+#define STOP_REASON_USER 10       // measure_stop() from another thread
+
+#define STOP_GRACE_SECONDS 2.0 // deadline slack past the requested duration
+#define KEY_POLL_MS 50
+#define MAX_RETAINED_DURATION 900 // seconds, retained (non-streaming) captures only
+
+typedef struct AcqSchedule {
+   ULNG requested_frames; // set_capture_frames(), 0-use the timer
+   ULNG frame_limit;      // frames to keep this run, 0-no limit
+   int limit_reason;      // stop reason reported when frame_limit is reached
+   ULNG frames_seen;      // frames accepted from the driver
+   ULNG frames_delivered; // frames the driver delivered, including trimmed ones
+   BOOL limit_reached;
+   int stop_reason;
+   DBL run_seconds;       // expected length of the run, 0-until key or storage full
+   _Atomic BOOL stop_requested; // set by measure_stop(), acted on by the notification loop
+   BOOL background;       // run started by measure_async(), untimed runs ignore the keyboard
+   DBL start_time;
+   DBL stop_time;
+} AcqSchedule;
+
+/* Stops the next run after exactly frames frames (0 restores timer/key behaviour) */
+int set_capture_frames(ULNG frames)
+{
+   ctx->schedule->requested_frames = frames;
+   return CFG_SUCCESS;
+}
+
+/* Works out the frame limit of the next run */
+void schedule_plan(bool timer_en, int timer_duration, DBL clk_freq, BOOL streaming)
+{
+   DBL retained_max = MAX_RETAINED_DURATION * clk_freq;
+
+   time_base_begin(clk_freq);
+   ctx->schedule->run_seconds = 0;
+   if (ctx->schedule->requested_frames > 0)
+   {
+      ctx->schedule->frame_limit = ctx->schedule->requested_frames;
+      ctx->schedule->limit_reason = STOP_REASON_SAMPLE_COUNT;
+      ctx->schedule->run_seconds = ctx->schedule->requested_frames / clk_freq;
+   }
+   else if (timer_en)
+   {
+      ctx->schedule->frame_limit = (ULNG)floor(MAX(timer_duration, 1) * clk_freq + 0.5);
+      ctx->schedule->limit_reason = STOP_REASON_TIMER;
+      ctx->schedule->run_seconds = MAX(timer_duration, 1);
+   }
+   else
+   {
+      ctx->schedule->frame_limit = 0;
+      ctx->schedule->limit_reason = STOP_REASON_SAMPLE_COUNT;
+   }
+
+   /* retained captures stop when storage is full instead of dropping frames */
+   if (!streaming && (ctx->schedule->frame_limit == 0 || ctx->schedule->frame_limit > retained_max))
+      ctx->schedule->frame_limit = (ULNG)retained_max;
+}
+
+void schedule_begin()
+{
+   atomic_store(&ctx->schedule->stop_requested, FALSE);
+   ctx->schedule->frames_seen = 0;
+   ctx->schedule->frames_delivered = 0;
+   ctx->schedule->limit_reached = FALSE;
+   ctx->schedule->stop_reason = STOP_REASON_NONE;
+   ctx->schedule->start_time = monotonic_seconds();
+   ctx->schedule->stop_time = ctx->schedule->start_time;
+   ctx->time_base->start_seconds = ctx->schedule->start_time;
+}
+
+/* Records the first stop reason of the run and ends the notification loop */
+void schedule_stop(int reason)
+{
+   if (ctx->schedule->stop_reason == STOP_REASON_NONE)
+      ctx->schedule->stop_reason = reason;
+   daq->PostQuit();
+}
+
+int get_stop_reason()
+{
+   return ctx->schedule->stop_reason;
+}
+
+/* Seconds between the start of the A/D and the end of the notification loop */
+DBL get_run_seconds()
+{
+   return ctx->schedule->stop_time - ctx->schedule->start_time;
+}
+
+/* Streaming capture
+   In streaming mode measure_channels holds a single chunk of STREAM_CHUNK_FRAMES
+   frames. Every time it fills it is handed to the registered callback and/or
+   appended to a csv file and then reused, so memory stays bounded however long
+   the run is. Frames that do not fit are counted instead of silently dropped.
+*/
+#define STREAM_CHUNK_FRAMES 16384
+
+/* Called on the conversion thread with the chunk that just filled */
+typedef void (*ChunkCallback)(DBL *const channel[NUM_CHANNELS], UINT frames, ULNG first_frame,
+                              void *user);
+
+typedef struct {
+   ULNG frames_stored;  // frames converted into storage (including flushed chunks)
+   ULNG frames_dropped; // frames lost because retained storage was full
+   ULNG chunks_flushed;
+   ULNG capacity;       // frames the storage holds at once
+} CaptureCounters;
+
+typedef struct CaptureStream {
+   BOOL streaming;
+   ChunkCallback callback;
+   void *user;
+   char path[260];
+   FILE *stream;
+   ULNG chunk_first_frame;
+   CaptureCounters counters;
+} CaptureStream;
+
+/* Capture arena
+   The capture storage of a device is one reservation of address space carved
+   into one region per channel, each ARENA_CHUNK_BYTES aligned (so DATA_ALIGNMENT
+   aligned for the kernels) and sized for the largest run so far. Memory is only
+   committed as frames are stored, ARENA_CHUNK_BYTES of every region at a time,
+   so an untimed run stopped early touches what it used rather than 15 minutes
+   of storage. A new run or cleanup_data() resets the arena: committed memory is
+   kept and reused, and only release_capture_arena() returns it to the system.
+   With set_capture_arena() the regions are backed by transparent huge pages on
+   Linux.
+   Every run and every release starts a new generation of the stored data. A
+   caller that keeps views of a capture pins the arena with pin_capture_arena()
+   until it drops them: while pinned the arena is never unmapped, so a release
+   and a run that would need a larger reservation fail instead, and a run that
+   reuses the arena shows up as a new generation.
+*/
+#define DATA_ALIGNMENT 64
+#define ARENA_CHUNK_BYTES (2 * 1024 * 1024) // commit step per region, one huge page
+
+typedef struct {
+   size_t reserved_bytes;  // address space over all regions
+   size_t committed_bytes; // memory committed over all regions
+   size_t region_bytes;    // address space per channel
+   ULNG resets;            // runs that reused the arena
+   ULNG reservations;      // times the address space was (re)reserved
+   ULNG commits;           // chunks committed
+   BOOL huge_pages;
+   ULNG generation;        // bumped by every run and release of the stored data
+   UINT pins;              // pin_capture_arena() holders
+} ArenaInfo;
+
+typedef struct CaptureArena {
+   char *base;      // ARENA_CHUNK_BYTES aligned start of region 0
+   void *mapping;   // what was reserved, for the release
+   size_t mapping_bytes;
+   size_t region;   // bytes per region
+   UINT channels;   // regions, one per output channel
+   size_t committed; // bytes committed at the start of every region
+   BOOL attached;   // measure_channels points into the arena
+   BOOL huge_pages; // set_capture_arena()
+   ArenaInfo info;
+} CaptureArena;
+
+/* Backs the regions of the next reservations with transparent huge pages (Linux) */
+int set_capture_arena(bool huge_pages)
+{
+   ctx->arena->huge_pages = huge_pages;
+   return CFG_SUCCESS;
+}
+
+ArenaInfo get_capture_arena()
+{
+   ctx->arena->info.committed_bytes = ctx->arena->committed * ctx->arena->channels;
+   return ctx->arena->info;
+}
+
+/* Keeps (pin TRUE) or lets go of (FALSE) the arena under views a caller holds */
+int pin_capture_arena(bool pin)
+{
+   if (pin)
+      ctx->arena->info.pins++;
+   else if (ctx->arena->info.pins > 0)
+      ctx->arena->info.pins--;
+   else
+      return CFG_FAILURE;
+   return CFG_SUCCESS;
+}
+
+/* Returns the reservation and all committed memory to the system, unless pinned */
+int release_capture_arena()
+{
+   if (ctx->arena->info.pins > 0)
+      return CFG_FAILURE;
+   if (ctx->arena->mapping != NULL)
+   {
+#if defined(_WIN32)
+      VirtualFree(ctx->arena->mapping, 0, MEM_RELEASE);
+#else
+      munmap(ctx->arena->mapping, ctx->arena->mapping_bytes);
+#endif
+   }
+   ctx->arena->base = NULL;
+   ctx->arena->mapping = NULL;
+   ctx->arena->mapping_bytes = ctx->arena->region = ctx->arena->committed = 0;
+   ctx->arena->channels = 0;
+   ctx->arena->attached = FALSE;
+   ctx->arena->info.reserved_bytes = ctx->arena->info.region_bytes = 0;
+   ctx->arena->info.generation++;
+   memset((ChannelData *)ctx->measure_channels, 0, sizeof(ChannelData));
+   return CFG_SUCCESS;
+}
+
+/* Reserves address space for channels regions of region bytes each */
+static int arena_reserve(size_t region, UINT channels)
+{
+   size_t bytes = region * channels + ARENA_CHUNK_BYTES; // slack to align the base
+
+   if (release_capture_arena() == CFG_FAILURE)
+      return CFG_FAILURE;
+#if defined(_WIN32)
+   ctx->arena->mapping = VirtualAlloc(NULL, bytes, MEM_RESERVE, PAGE_READWRITE);
+#else
+   ctx->arena->mapping = mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (ctx->arena->mapping == MAP_FAILED)
+      ctx->arena->mapping = NULL;
+#endif
+   if (ctx->arena->mapping == NULL)
+      return CFG_FAILURE;
+   ctx->arena->mapping_bytes = bytes;
+   ctx->arena->base = (char *)(((uintptr_t)ctx->arena->mapping + ARENA_CHUNK_BYTES - 1) & ~(uintptr_t)(ARENA_CHUNK_BYTES - 1));
+   ctx->arena->region = region;
+   ctx->arena->channels = channels;
+   ctx->arena->info.reserved_bytes = region * channels;
+   ctx->arena->info.region_bytes = region;
+   ctx->arena->info.huge_pages = ctx->arena->huge_pages;
+   ctx->arena->info.reservations++;
+   return CFG_SUCCESS;
+}
+
+/* Commits every region up to bytes (a multiple of ARENA_CHUNK_BYTES) */
+static int arena_commit(size_t bytes)
+{
+   bytes = MIN(bytes, ctx->arena->region);
+   if (bytes <= ctx->arena->committed)
+      return CFG_SUCCESS;
+   for (UINT i = 0; i < ctx->arena->channels; i++)
+   {
+      char *from = ctx->arena->base + ctx->arena->region * i + ctx->arena->committed;
+      size_t n = bytes - ctx->arena->committed;
+#if defined(_WIN32)
+      if (VirtualAlloc(from, n, MEM_COMMIT, PAGE_READWRITE) == NULL)
+         return CFG_FAILURE;
+#else
+      if (mprotect(from, n, PROT_READ | PROT_WRITE) != 0)
+         return CFG_FAILURE;
+#if defined(MADV_HUGEPAGE)
+      if (ctx->arena->huge_pages)
+         madvise(from, n, MADV_HUGEPAGE);
+#endif
+#endif
+   }
+   ctx->arena->info.commits += (bytes - ctx->arena->committed) / ARENA_CHUNK_BYTES;
+   ctx->arena->committed = bytes;
+   return CFG_SUCCESS;
+}
+
+/* Makes frames [num_readings, num_readings + n) of the run storage writable. If
+   memory runs out the capacity shrinks to what is committed, so later frames are
+   counted as dropped instead. */
+static void storage_commit(ChannelData *channels, ULNG n)
+{
+   size_t bytes = (size_t)(channels->num_readings + n) * sizeof(DBL);
+
+   if (!ctx->arena->attached || channels != (ChannelData *)ctx->measure_channels || bytes <= ctx->arena->committed)
+      return;
+   bytes = (bytes + ARENA_CHUNK_BYTES - 1) & ~(size_t)(ARENA_CHUNK_BYTES - 1);
+   if (arena_commit(bytes) == CFG_FAILURE)
+      channels->max_readings = (UINT)MIN((size_t)channels->max_readings, ctx->arena->committed / sizeof(DBL));
+}
+
+/* Export of the capture storage
+   All channels live in the capture arena, one contiguous region each; time is
+   not stored (see the time base). get_channel_views() describes every region with a
+   pointer, byte stride, count and NumPy style typestr so callers can wrap them
+   without copying. The views stay valid until the next run reuses the arena or
+   release_capture_arena() releases it; pin the arena to hold them longer.
+*/
+#define NUM_VIEWS NUM_CHANNELS
+
+typedef struct {
+   DBL *data;
+   LONG stride;   // bytes between consecutive samples
+   UINT count;
+   char dtype[4]; // "<f8"
+} ChannelView;
+
+int allocate_data_memory(ChannelData *channels, int duration, DBL clk_freq) 
+{
+   UINT max_readings;
+   UINT channel_count = capture_channels();
+
+   if (channel_count == 0)
+      return CFG_FAILURE;
+
+   if (ctx->capture->streaming)
+   {
+      max_readings = STREAM_CHUNK_FRAMES;
+   }
+   else if (ctx->trig->mode != TRIG_OFF)
+   {
+      max_readings = ctx->trig->max_events * (ctx->trig->pre_frames + ctx->trig->post_frames);
+   }
+   else if (ctx->schedule->frame_limit > 0)
+   {
+      max_readings = (ctx->schedule->frame_limit + ctx->decim->info.factor - 1) / ctx->decim->info.factor;
+   }
+   else
+   {
+      if(duration <= 0)
+      {
+         duration = 1;
+      }
+      else if (duration > MAX_RETAINED_DURATION)
+      {
+         duration = MAX_RETAINED_DURATION;
+      }
+      max_readings = (UINT)ceil(duration * clk_freq / ctx->decim->info.factor);
+   }
+
+   size_t region = ((size_t)max_readings * sizeof(DBL) + ARENA_CHUNK_BYTES - 1) & ~(size_t)(ARENA_CHUNK_BYTES - 1);
+   // the arena is reset rather than freed, and only reserved again for a larger run or another channel count
+   if (ctx->arena->mapping != NULL && ctx->arena->region >= region && ctx->arena->channels == channel_count &&
+       ctx->arena->info.huge_pages == ctx->arena->huge_pages)
+   {
+      ctx->arena->info.resets++;
+   }
+   else if (arena_reserve(region, channel_count) == CFG_FAILURE)
+   {
+      memset(channels, 0, sizeof(ChannelData));
+      return CFG_FAILURE;
+   }
+
+   channels->max_readings = max_readings;
+   channels->num_readings = 0;
+   channels->num_channels = channel_count;
+   for (UINT i = 0; i < NUM_CHANNELS; i++) 
+   {
+      channels->channel[i] = (i < channel_count) ? (DBL *)(ctx->arena->base + ctx->arena->region * i) : NULL;
+   }
+   ctx->arena->attached = TRUE;
+   ctx->arena->info.generation++;
+   if (arena_commit(ARENA_CHUNK_BYTES) == CFG_FAILURE)
+   {
+      ctx->arena->attached = FALSE;
+      memset(channels, 0, sizeof(ChannelData));
+      release_capture_arena();
+      return CFG_FAILURE;
+   }
+   memset(&ctx->capture->counters, 0, sizeof(ctx->capture->counters));
+   ctx->capture->counters.capacity = max_readings;
+   return CFG_SUCCESS;
+}
+
+/* Detaches the capture storage; the arena keeps its memory for the next run */
+void cleanup_data() 
+{
+   LOG_PRINT("Resetting capture arena: %p\n", (void *)ctx->arena->base);
+   ctx->arena->attached = FALSE;
+   memset((ChannelData *)ctx->measure_channels, 0, sizeof(ChannelData));
+}
+
+/* Fills views[0..NUM_CHANNELS-1] with the channels, unused ones are empty */
+int get_channel_views(ChannelView views[NUM_VIEWS])
+{
+   for (int i = 0; i < NUM_VIEWS; i++)
+   {
+      views[i].data = ctx->measure_channels->channel[i];
+      views[i].stride = sizeof(DBL);
+      views[i].count = (views[i].data != NULL) ? ctx->measure_channels->num_readings : 0;
+      memcpy(views[i].dtype, "<f8", sizeof(views[i].dtype));
+   }
+   return ctx->arena->attached ? CFG_SUCCESS : CFG_FAILURE;
+}
+
+/* Enables streaming capture. Either sink may be left NULL; with both NULL the
+   chunks are discarded after conversion (useful with the counters alone). */
+int set_capture_stream(bool enable, ChunkCallback callback, void *user, const char *csv_path)
+{
+   ctx->capture->streaming = enable;
+   ctx->capture->callback = callback;
+   ctx->capture->user = user;
+   ctx->capture->path[0] = '\0';
+   if (csv_path != NULL)
+   {
+      strncpy(ctx->capture->path, csv_path, sizeof(ctx->capture->path) - 1);
+      ctx->capture->path[sizeof(ctx->capture->path) - 1] = '\0';
+   }
+   return CFG_SUCCESS;
+}
+
+int capture_begin()
+{
+   ctx->capture->chunk_first_frame = 0;
+   if (ctx->capture->streaming && ctx->capture->path[0] != '\0')
+   {
+      ctx->capture->stream = fopen(ctx->capture->path, "w");
+      if (ctx->capture->stream == NULL)
+         return CFG_FAILURE;
+      fprintf(ctx->capture->stream, "Time");
+      for (UINT c = 0; c < capture_channels(); c++)
+         fprintf(ctx->capture->stream, ",%s", input_name[ctx->active_map->physical[c]]);
+      fprintf(ctx->capture->stream, "\n");
+   }
+   return CFG_SUCCESS;
+}
+
+void capture_flush(ChannelData *channels)
+{
+   UINT frames = channels->num_readings;
+
+   if (frames == 0)
+      return;
+   if (ctx->capture->callback)
+      ctx->capture->callback(channels->channel, frames, ctx->capture->chunk_first_frame, ctx->capture->user);
+   if (ctx->capture->stream)
+   {
+      for (UINT i = 0; i < frames; i++)
+      {
+         fprintf(ctx->capture->stream, "%.6f", frame_time(ctx->capture->chunk_first_frame + i));
+         for (UINT c = 0; c < channels->num_channels; c++)
+            fprintf(ctx->capture->stream, ",%f", channels->channel[c][i]);
+         fprintf(ctx->capture->stream, "\n");
+      }
+   }
+   ctx->capture->chunk_first_frame += frames;
+   ctx->capture->counters.chunks_flushed++;
+   channels->num_readings = 0;
+}
+
+void capture_end(ChannelData *channels)
+{
+   if (ctx->capture->streaming)
+      capture_flush(channels);
+   if (ctx->capture->stream)
+   {
+      fclose(ctx->capture->stream);
+      ctx->capture->stream = NULL;
+   }
+}
+
+CaptureCounters get_capture_counters()
+{
+   return ctx->capture->counters;
+}
+
+void add_reading(ChannelData *channels, DBL ch0, DBL ch1, DBL ch2, DBL ch3) {
+   storage_commit(channels, 1);
+   if (channels->num_readings < channels->max_readings) {
+      const UINT n = channels->num_readings;
+      channels->channel[0][n] = ch0;
+      if (channels->num_channels > 1)
+         channels->channel[1][n] = ch1;
+      if (channels->num_channels > 2)
+         channels->channel[2][n] = ch2;
+      if (channels->num_channels > 3)
+         channels->channel[3][n] = ch3;
+      channels->num_readings++;
+      ctx->capture->counters.frames_stored++;
+      if (ctx->capture->streaming && channels->num_readings == channels->max_readings)
+         capture_flush(channels);
+   } else {
+      ctx->capture->counters.frames_dropped++;
+      LOG_PRINT("Error: Maximum number of readings exceeded.\n");
+   }
+}
+
+/* Channel statistics
+   Mean, RMS, standard deviation, min/max, peak and crest factor of every channel
+   are kept up to date as frames are stored, for the whole run and for a sliding
+   window. Each block is summarised on its own and merged with the pairwise
+   (Chan et al.) form of Welford's update, so the sums never grow large and the
+   variance stays accurate however long the run is. The window is built from
+   STATS_SEGMENTS segment summaries and advances one segment at a time. The
+   conversion thread publishes through a sequence counter, so the getters can be
+   called from any thread while a run is going. With retention off
+   (set_capture_stream() with no sinks) a run keeps only these summaries.
+*/
+#define STATS_SEGMENTS 16 // segments per sliding window
+
+typedef struct {
+   ULNG count;
+   DBL mean;
+   DBL m2;   // sum of squared deviations from mean
+   DBL min, max;
+} StatsAccum;
+
+typedef struct {
+   ULNG count;
+   DBL mean;
+   DBL rms;
+   DBL std;  // population standard deviation
+   DBL min, max;
+   DBL peak; // largest absolute value
+   DBL crest; // peak / rms
+} ChannelStats;
+
+typedef struct ChannelStatsState {
+   DBL window_seconds; // set_stats_window(), 0-off
+   ULNG segment_frames;
+   ULNG segments;      // completed segments this run
+   StatsAccum run[NUM_CHANNELS];
+   StatsAccum current[NUM_CHANNELS];
+   StatsAccum segment[STATS_SEGMENTS][NUM_CHANNELS];
+   _Atomic ULNG seq;   // odd while the conversion thread is updating
+} ChannelStatsState;
+
+static void stats_merge(StatsAccum *a, const StatsAccum *b)
+{
+   if (b->count == 0)
+      return;
+   if (a->count == 0)
+   {
+      *a = *b;
+      return;
+   }
+   DBL n = (DBL)a->count + b->count;
+   DBL delta = b->mean - a->mean;
+   a->mean += delta * b->count / n;
+   a->m2 += b->m2 + delta * delta * a->count * b->count / n;
+   a->min = MIN(a->min, b->min);
+   a->max = MAX(a->max, b->max);
+   a->count += b->count;
+}
+
+/* Two passes over one channel: sum/min/max, then squared deviations from the block mean */
+static void stats_block(const DBL *x, ULNG n, StatsAccum *out)
+{
+   DBL sum = 0, lo = x[0], hi = x[0], m2 = 0;
+
+   for (ULNG i = 0; i < n; i++)
+   {
+      sum += x[i];
+      lo = (x[i] < lo) ? x[i] : lo;
+      hi = (x[i] > hi) ? x[i] : hi;
+   }
+   DBL mean = sum / n;
+   for (ULNG i = 0; i < n; i++)
+      m2 += (x[i] - mean) * (x[i] - mean);
+
+   out->count = n;
+   out->mean = mean;
+   out->m2 = m2;
+   out->min = lo;
+   out->max = hi;
+}
+
+/* Sliding window of window_seconds (0 turns it off), applied from the next run */
+int set_stats_window(DBL window_seconds)
+{
+   if (window_seconds < 0)
+      return CFG_FAILURE;
+   ctx->stats->window_seconds = window_seconds;
+   return CFG_SUCCESS;
+}
+
+void stats_begin()
+{
+   atomic_fetch_add_explicit(&ctx->stats->seq, 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   memset(ctx->stats->run, 0, sizeof(ctx->stats->run));
+   memset(ctx->stats->current, 0, sizeof(ctx->stats->current));
+   ctx->stats->segments = 0;
+   ctx->stats->segment_frames = (ULNG)MAX(1.0, floor(ctx->stats->window_seconds * ctx->time_base->rate / STATS_SEGMENTS + 0.5));
+   atomic_fetch_add_explicit(&ctx->stats->seq, 1, memory_order_release);
+}
+
+/* Adds frames [pos, pos + n) of the stored channels */
+void stats_update(DBL *const channel[NUM_CHANNELS], ULNG pos, ULNG n)
+{
+   const UINT channels = capture_channels();
+
+   atomic_fetch_add_explicit(&ctx->stats->seq, 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   for (ULNG done = 0; done < n;)
+   {
+      ULNG k = n - done;
+      if (ctx->stats->window_seconds > 0)
+         k = MIN(k, ctx->stats->segment_frames - ctx->stats->current[0].count);
+
+      for (UINT c = 0; c < channels; c++)
+      {
+         StatsAccum block;
+         stats_block(channel[c] + pos + done, k, &block);
+         stats_merge(&ctx->stats->run[c], &block);
+         if (ctx->stats->window_seconds > 0)
+            stats_merge(&ctx->stats->current[c], &block);
+      }
+      done += k;
+
+      if (ctx->stats->window_seconds > 0 && ctx->stats->current[0].count == ctx->stats->segment_frames)
+      {
+         memcpy(ctx->stats->segment[ctx->stats->segments % STATS_SEGMENTS], ctx->stats->current, sizeof(ctx->stats->current));
+         memset(ctx->stats->current, 0, sizeof(ctx->stats->current));
+         ctx->stats->segments++;
+      }
+   }
+   atomic_fetch_add_explicit(&ctx->stats->seq, 1, memory_order_release);
+}
+
+static void stats_report(const StatsAccum *a, ChannelStats *out)
+{
+   DBL var = (a->count > 0) ? a->m2 / a->count : 0;
+
+   out->count = a->count;
+   out->mean = a->mean;
+   out->std = sqrt(var);
+   out->rms = sqrt(a->mean * a->mean + var);
+   out->min = a->min;
+   out->max = a->max;
+   out->peak = MAX(fabs(a->min), fabs(a->max));
+   out->crest = (out->rms > 0) ? out->peak / out->rms : 0;
+}
+
+/* Consistent copy of the state, retried while the conversion thread is writing */
+static void stats_snapshot(ChannelStatsState *snap)
+{
+   for (;;)
+   {
+      ULNG seq = atomic_load_explicit(&ctx->stats->seq, memory_order_acquire);
+      if (seq & 1)
+      {
+         sleep_ms(0);
+         continue;
+      }
+      memcpy(snap, ctx->stats, offsetof(ChannelStatsState, seq));
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&ctx->stats->seq, memory_order_relaxed) == seq)
+         return;
+   }
+}
+
+/* Statistics of every frame stored so far in the current or last run */
+int get_channel_stats(ChannelStats out[NUM_CHANNELS])
+{
+   ChannelStatsState snap;
+
+   stats_snapshot(&snap);
+   for (int c = 0; c < NUM_CHANNELS; c++)
+      stats_report(&snap.run[c], &out[c]);
+   return (snap.run[0].count > 0) ? CFG_SUCCESS : CFG_FAILURE;
+}
+
+/* Statistics of the newest window (fewer segments until the first window fills) */
+int get_window_stats(ChannelStats out[NUM_CHANNELS])
+{
+   ChannelStatsState snap;
+
+   stats_snapshot(&snap);
+   ULNG first = (snap.segments > STATS_SEGMENTS) ? snap.segments - STATS_SEGMENTS : 0;
+   for (int c = 0; c < NUM_CHANNELS; c++)
+   {
+      StatsAccum window = {0};
+      for (ULNG s = first; s < snap.segments; s++)
+         stats_merge(&window, &snap.segment[s % STATS_SEGMENTS][c]);
+      stats_report(&window, &out[c]);
+   }
+   return (snap.window_seconds > 0 && snap.segments > 0) ? CFG_SUCCESS : CFG_FAILURE;
+}
+
+/* Synchronized stimulus/response
+   With set_sync_start() a generate() that reads input does not start the D/A on
+   its own: measurement_start() starts the D/A and the A/D together through the
+   backend's simultaneous start, so input frame 0 and output sample 0 share one
+   start point. The table the D/A replays is kept for the run, which lets the
+   spectral analysis below correlate the DAC input channel against the stimulus
+   actually played and report the sample offset between them (get_sync_info()).
+*/
+typedef struct SyncStart {
+   BOOL enabled;      // set_sync_start()
+   BOOL synchronized; // the last run started both subsystems together
+   HDASS pending_da;  // configured D/A waiting for measurement_start()
+   DBL *volts;        // stimulus table of the current generate(), NULL when streaming
+   UINT samples;
+   DBL clk_freq;      // D/A clock the table is played at
+   DBL hz;            // fundamental of the table
+} SyncStart;
+
+/* Starts the D/A together with the A/D in the next generate() runs that read input */
+int set_sync_start(bool enable)
+{
+   ctx->sync_start->enabled = enable;
+   return CFG_SUCCESS;
+}
+
+/* Takes ownership of the volts table the D/A replays at clk_freq */
+static void sync_keep_stimulus(DBL *volts, UINT samples, DBL clk_freq, DBL hz)
+{
+   free(ctx->sync_start->volts);
+   ctx->sync_start->volts = volts;
+   ctx->sync_start->samples = samples;
+   ctx->sync_start->clk_freq = clk_freq;
+   ctx->sync_start->hz = hz;
+}
+
+static void sync_release_stimulus()
+{
+   free(ctx->sync_start->volts);
+   ctx->sync_start->volts = NULL;
+   ctx->sync_start->samples = 0;
+}
+
+/* Spectral analysis
+   A Welch power spectral density of every channel is averaged as frames are
+   stored: Hann windowed segments of segment_frames frames, a new one every
+   segment_frames * (1 - overlap) frames, each transformed with the real FFT
+   below and its one-sided periodogram added to a running sum. Only the sums are
+   kept, so the spectrum of a run of any length costs a few segments of memory.
+   get_psd() divides by the segment count on demand and may be called mid-run.
+   With set_frf() the same segments also sum the cross spectrum of every channel
+   against the DAC input channel, from which get_frf() gives the H1 frequency
+   response (g per volt) and the coherence. In a synchronized run the played
+   stimulus is windowed over the same frames and summed against the DAC channel
+   the same way, and the phase at the stimulus frequency gives the offset.
+*/
+#define PSD_MIN_FRAMES 64
+#define PSD_MAX_FRAMES 65536 // powers of two in between
+#define PSD_MAX_OVERLAP 0.9
+
+typedef struct {
+   UINT segment_frames; // 0-off
+   UINT bins;           // segment_frames / 2 + 1
+   ULNG segments;       // periodograms averaged so far
+   DBL bin_hz;
+   DBL overlap;
+} PsdInfo;
+
+/* Real FFT of n = 2m points as an m point complex radix-2 FFT plus a split step */
+typedef struct {
+   UINT n;
+   UINT *bitrev;       // m entries
+   DBL *tw_re, *tw_im; // e^(-2 pi i k / m), k < m / 2
+   DBL *sp_re, *sp_im; // e^(-2 pi i k / n), k < m
+   DBL *re, *im;       // m point work arrays
+} RealFft;
+
+typedef struct {
+   BOOL synchronized;   // the A/D and D/A were started together
+   DBL offset_seconds;  // response lag behind the played stimulus, within +-half a period
+   DBL offset_frames;   // the same in stored frames
+   DBL stimulus_hz;     // frequency the offset was measured at
+   DBL coherence;       // stimulus to DAC channel coherence at that frequency
+   ULNG segments;
+} SyncInfo;
+
+typedef struct PsdState {
+   PsdInfo info;
+   UINT hop;
+   ULNG until_next;        // frames to store before the next segment is due
+   ULNG head;              // frames written into ring[]
+   UINT channels;          // output channels of the run
+   int ref;                // output channel of the DAC loop input the responses are relative to, -1-none
+   DBL *ring[NUM_CHANNELS]; // last segment_frames frames per channel
+   DBL *window;
+   DBL *segment;
+   DBL *sum[NUM_CHANNELS]; // summed periodograms, g^2/Hz (V^2/Hz on the DAC channel)
+   DBL scale;              // one-sided density scale of |X|^2
+   BOOL frf;               // set_frf()
+   DBL stim_step;          // stimulus samples per stored frame, 0-no stimulus this run
+   DBL *spec_re[NUM_CHANNELS + 1], *spec_im[NUM_CHANNELS + 1]; // current segment, the stimulus last
+   DBL *cross_re[NUM_CHANNELS], *cross_im[NUM_CHANNELS];       // summed conj(X_reference) X_c
+   DBL *stim_re, *stim_im; // summed conj(S) X_reference against the stimulus S
+   DBL *stim_power;        // summed |S|^2
+   RealFft fft;
+   _Atomic ULNG seq;       // odd while a periodogram is being added
+} PsdState;
+
+static void fft_free(RealFft *f)
+{
+   aligned_free(f->bitrev);
+   aligned_free(f->tw_re);
+   aligned_free(f->tw_im);
+   aligned_free(f->sp_re);
+   aligned_free(f->sp_im);
+   aligned_free(f->re);
+   aligned_free(f->im);
+   memset(f, 0, sizeof(*f));
+}
+
+static int fft_plan(RealFft *f, UINT n)
+{
+   UINT m = n / 2, bits = 0;
+
+   while ((1U << bits) < m)
+      bits++;
+   f->n = n;
+   f->bitrev = aligned_malloc(m * sizeof(UINT), 64);
+   f->tw_re = aligned_malloc(MAX(m / 2, 1) * sizeof(DBL), 64);
+   f->tw_im = aligned_malloc(MAX(m / 2, 1) * sizeof(DBL), 64);
+   f->sp_re = aligned_malloc(m * sizeof(DBL), 64);
+   f->sp_im = aligned_malloc(m * sizeof(DBL), 64);
+   f->re = aligned_malloc(m * sizeof(DBL), 64);
+   f->im = aligned_malloc(m * sizeof(DBL), 64);
+   if (!f->bitrev || !f->tw_re || !f->tw_im || !f->sp_re || !f->sp_im || !f->re || !f->im)
+   {
+      fft_free(f);
+      return CFG_FAILURE;
+   }
+   for (UINT k = 0; k < m; k++)
+   {
+      UINT r = 0;
+      for (UINT b = 0; b < bits; b++)
+         r |= ((k >> b) & 1) << (bits - 1 - b);
+      f->bitrev[k] = r;
+      f->sp_re[k] = cos(2 * M_PI * k / n);
+      f->sp_im[k] = -sin(2 * M_PI * k / n);
+   }
+   for (UINT k = 0; k < m / 2; k++)
+   {
+      f->tw_re[k] = cos(2 * M_PI * k / m);
+      f->tw_im[k] = -sin(2 * M_PI * k / m);
+   }
+   return CFG_SUCCESS;
+}
+
+/* m point complex FFT of the even (real) and odd (imaginary) samples of x[0..n),
+   left in f->re and f->im */
+static void fft_packed(const RealFft *f, const DBL *x)
+{
+   const UINT m = f->n / 2;
+   DBL *re = f->re, *im = f->im;
+
+   /* pack even samples as real, odd as imaginary, in bit reversed order */
+   for (UINT k = 0; k < m; k++)
+   {
+      re[f->bitrev[k]] = x[2 * k];
+      im[f->bitrev[k]] = x[2 * k + 1];
+   }
+   for (UINT len = 2; len <= m; len <<= 1)
+   {
+      UINT half = len / 2, step = m / len;
+      for (UINT i = 0; i < m; i += len)
+      {
+         for (UINT k = 0; k < half; k++)
+         {
+            DBL wr = f->tw_re[k * step], wi = f->tw_im[k * step];
+            UINT a = i + k, b = a + half;
+            DBL tr = re[b] * wr - im[b] * wi;
+            DBL ti = re[b] * wi + im[b] * wr;
+            re[b] = re[a] - tr;
+            im[b] = im[a] - ti;
+            re[a] += tr;
+            im[a] += ti;
+         }
+      }
+   }
+}
+
+/* split: X[k] = E[k] + e^(-2 pi i k / n) O[k], 0 < k < n/2, after fft_packed() */
+static void fft_split(const RealFft *f, UINT k, DBL *xr, DBL *xi)
+{
+   const UINT m = f->n / 2;
+   const DBL *re = f->re, *im = f->im;
+   DBL er = 0.5 * (re[k] + re[m - k]), ei = 0.5 * (im[k] - im[m - k]);
+   DBL odr = 0.5 * (im[k] + im[m - k]), odi = -0.5 * (re[k] - re[m - k]);
+   *xr = er + f->sp_re[k] * odr - f->sp_im[k] * odi;
+   *xi = ei + f->sp_re[k] * odi + f->sp_im[k] * odr;
+}
+
+/* |X[k]|^2 for k = 0..n/2 of the real sequence x[0..n) */
+static void fft_power(const RealFft *f, const DBL *x, DBL *power)
+{
+   const UINT m = f->n / 2;
+
+   fft_packed(f, x);
+   power[0] = (f->re[0] + f->im[0]) * (f->re[0] + f->im[0]);
+   power[m] = (f->re[0] - f->im[0]) * (f->re[0] - f->im[0]);
+   for (UINT k = 1; k < m; k++)
+   {
+      DBL xr, xi;
+      fft_split(f, k, &xr, &xi);
+      power[k] = xr * xr + xi * xi;
+   }
+}
+
+/* X[k] for k = 0..n/2 of the real sequence x[0..n) */
+static void fft_spectrum(const RealFft *f, const DBL *x, DBL *xr, DBL *xi)
+{
+   const UINT m = f->n / 2;
+
+   fft_packed(f, x);
+   xr[0] = f->re[0] + f->im[0];
+   xr[m] = f->re[0] - f->im[0];
+   xi[0] = xi[m] = 0;
+   for (UINT k = 1; k < m; k++)
+      fft_split(f, k, &xr[k], &xi[k]);
+}
+
+static void psd_release()
+{
+   for (int c = 0; c < NUM_CHANNELS; c++)
+   {
+      aligned_free(ctx->psd->ring[c]);
+      aligned_free(ctx->psd->sum[c]);
+      aligned_free(ctx->psd->cross_re[c]);
+      aligned_free(ctx->psd->cross_im[c]);
+      ctx->psd->ring[c] = ctx->psd->sum[c] = ctx->psd->cross_re[c] = ctx->psd->cross_im[c] = NULL;
+   }
+   for (int c = 0; c <= NUM_CHANNELS; c++)
+   {
+      aligned_free(ctx->psd->spec_re[c]);
+      aligned_free(ctx->psd->spec_im[c]);
+      ctx->psd->spec_re[c] = ctx->psd->spec_im[c] = NULL;
+   }
+   aligned_free(ctx->psd->stim_re);
+   aligned_free(ctx->psd->stim_im);
+   aligned_free(ctx->psd->stim_power);
+   ctx->psd->stim_re = ctx->psd->stim_im = ctx->psd->stim_power = NULL;
+   aligned_free(ctx->psd->window);
+   aligned_free(ctx->psd->segment);
+   ctx->psd->window = ctx->psd->segment = NULL;
+   fft_free(&ctx->psd->fft);
+}
+
+/* Zeroed bins array for a cross spectrum sum, counting failures in ok */
+static DBL *psd_alloc_bins(UINT bins, BOOL *ok)
+{
+   DBL *p = aligned_malloc(bins * sizeof(DBL), 64);
+   if (p == NULL)
+      *ok = FALSE;
+   else
+      memset(p, 0, bins * sizeof(DBL));
+   return p;
+}
+
+/* Welch PSD of the next runs over segment_frames frame segments (a power of two,
+   0 turns it off) overlapping by the given fraction */
+int set_psd(UINT segment_frames, DBL overlap)
+{
+   if (segment_frames != 0 && (segment_frames < PSD_MIN_FRAMES || segment_frames > PSD_MAX_FRAMES ||
+                               (segment_frames & (segment_frames - 1)) != 0))
+      return CFG_FAILURE;
+   if (overlap < 0 || overlap > PSD_MAX_OVERLAP)
+      return CFG_FAILURE;
+   ctx->psd->info.segment_frames = segment_frames;
+   ctx->psd->info.overlap = overlap;
+   return CFG_SUCCESS;
+}
+
+/* Sums the cross spectra against the DAC channel in the next runs with a PSD */
+int set_frf(bool enable)
+{
+   ctx->psd->frf = enable;
+   return CFG_SUCCESS;
+}
+
+int psd_begin()
+{
+   const UINT n = ctx->psd->info.segment_frames;
+   BOOL ok = TRUE;
+   DBL wsum = 0;
+
+   psd_release();
+   ctx->psd->info.segments = 0;
+   ctx->psd->info.bins = 0;
+   ctx->psd->stim_step = 0;
+   ctx->psd->channels = capture_channels();
+   ctx->psd->ref = capture_position(DAC_LOOP_INPUT);
+   if (n == 0)
+      return CFG_SUCCESS;
+
+   if (fft_plan(&ctx->psd->fft, n) == CFG_FAILURE)
+      return CFG_FAILURE;
+   ctx->psd->window = aligned_malloc(n * sizeof(DBL), 64);
+   ctx->psd->segment = aligned_malloc(n * sizeof(DBL), 64);
+   for (UINT c = 0; c < ctx->psd->channels; c++)
+   {
+      ctx->psd->ring[c] = aligned_malloc(n * sizeof(DBL), 64);
+      ctx->psd->sum[c] = aligned_malloc((n / 2 + 1) * sizeof(DBL), 64);
+      if (ctx->psd->ring[c] == NULL || ctx->psd->sum[c] == NULL)
+         ok = FALSE;
+      else
+         memset(ctx->psd->sum[c], 0, (n / 2 + 1) * sizeof(DBL));
+   }
+   // the responses need the DAC loop input in the capture
+   BOOL frf = ctx->psd->frf && ctx->psd->ref >= 0;
+   if (ctx->sync_start->volts != NULL && ctx->psd->ref >= 0)
+      ctx->psd->stim_step = ctx->sync_start->clk_freq / ctx->time_base->rate;
+   if (frf || ctx->psd->stim_step > 0)
+   {
+      for (int c = 0; c <= NUM_CHANNELS; c++)
+      {
+         ctx->psd->spec_re[c] = psd_alloc_bins(n / 2 + 1, &ok);
+         ctx->psd->spec_im[c] = psd_alloc_bins(n / 2 + 1, &ok);
+      }
+   }
+   if (frf)
+   {
+      for (UINT c = 0; c < ctx->psd->channels; c++)
+      {
+         ctx->psd->cross_re[c] = psd_alloc_bins(n / 2 + 1, &ok);
+         ctx->psd->cross_im[c] = psd_alloc_bins(n / 2 + 1, &ok);
+      }
+   }
+   if (ctx->psd->stim_step > 0)
+   {
+      ctx->psd->stim_re = psd_alloc_bins(n / 2 + 1, &ok);
+      ctx->psd->stim_im = psd_alloc_bins(n / 2 + 1, &ok);
+      ctx->psd->stim_power = psd_alloc_bins(n / 2 + 1, &ok);
+   }
+   if (!ok || ctx->psd->window == NULL || ctx->psd->segment == NULL)
+   {
+      psd_release();
+      return CFG_FAILURE;
+   }
+
+   for (UINT i = 0; i < n; i++)
+   {
+      ctx->psd->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / n); // periodic Hann
+      wsum += ctx->psd->window[i] * ctx->psd->window[i];
+   }
+   ctx->psd->hop = MAX(1, (UINT)floor(n * (1 - ctx->psd->info.overlap) + 0.5));
+   ctx->psd->until_next = n;
+   ctx->psd->head = 0;
+   ctx->psd->scale = 1.0 / (ctx->time_base->rate * wsum);
+   ctx->psd->info.bins = n / 2 + 1;
+   ctx->psd->info.bin_hz = ctx->time_base->rate / n;
+   return CFG_SUCCESS;
+}
+
+/* Adds conj(A) B with the one-sided density scale of the periodograms */
+static void psd_cross(DBL *sum_re, DBL *sum_im, const DBL *a_re, const DBL *a_im, const DBL *b_re, const DBL *b_im)
+{
+   const UINT m = ctx->psd->info.segment_frames / 2;
+
+   for (UINT k = 0; k <= m; k++)
+   {
+      DBL w = (k == 0 || k == m) ? ctx->psd->scale : 2 * ctx->psd->scale;
+      sum_re[k] += (a_re[k] * b_re[k] + a_im[k] * b_im[k]) * w;
+      sum_im[k] += (a_re[k] * b_im[k] - a_im[k] * b_re[k]) * w;
+   }
+}
+
+/* Windows the stimulus the D/A played during the newest segment into segment[] */
+static void psd_stimulus_segment()
+{
+   const UINT n = ctx->psd->info.segment_frames;
+   const ULNG first = ctx->psd->head - n; // stored frame of segment[0]
+
+   for (UINT i = 0; i < n; i++)
+   {
+      ULNG k = (ULNG)((DBL)(first + i) * ctx->psd->stim_step + 1e-6) % ctx->sync_start->samples;
+      ctx->psd->segment[i] = ctx->sync_start->volts[k] * ctx->psd->window[i];
+   }
+}
+
+/* Adds the periodogram of the newest segment of every channel to the sums */
+static void psd_segment()
+{
+   const UINT n = ctx->psd->info.segment_frames, m = n / 2;
+   const ULNG start = ctx->psd->head % n;
+   const int ref = ctx->psd->ref;
+   DBL *power = ctx->psd->segment; // free again once fft_power() has packed it
+   BOOL spectra = ctx->psd->spec_re[0] != NULL;
+
+   atomic_fetch_add_explicit(&ctx->psd->seq, 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   for (UINT c = 0; c < ctx->psd->channels; c++)
+   {
+      for (UINT i = 0; i < n; i++)
+         ctx->psd->segment[i] = ctx->psd->ring[c][(start + i) % n] * ctx->psd->window[i];
+      if (spectra)
+      {
+         fft_spectrum(&ctx->psd->fft, ctx->psd->segment, ctx->psd->spec_re[c], ctx->psd->spec_im[c]);
+         for (UINT k = 0; k <= m; k++)
+            power[k] = ctx->psd->spec_re[c][k] * ctx->psd->spec_re[c][k] + ctx->psd->spec_im[c][k] * ctx->psd->spec_im[c][k];
+      }
+      else
+      {
+         fft_power(&ctx->psd->fft, ctx->psd->segment, power);
+      }
+      ctx->psd->sum[c][0] += power[0] * ctx->psd->scale;
+      ctx->psd->sum[c][m] += power[m] * ctx->psd->scale;
+      for (UINT k = 1; k < m; k++)
+         ctx->psd->sum[c][k] += 2 * power[k] * ctx->psd->scale;
+   }
+   if (ctx->psd->cross_re[0] != NULL)
+   {
+      for (UINT c = 0; c < ctx->psd->channels; c++)
+         psd_cross(ctx->psd->cross_re[c], ctx->psd->cross_im[c], ctx->psd->spec_re[ref], ctx->psd->spec_im[ref],
+                   ctx->psd->spec_re[c], ctx->psd->spec_im[c]);
+   }
+   if (ctx->psd->stim_step > 0)
+   {
+      DBL *s_re = ctx->psd->spec_re[NUM_CHANNELS], *s_im = ctx->psd->spec_im[NUM_CHANNELS];
+      psd_stimulus_segment();
+      fft_spectrum(&ctx->psd->fft, ctx->psd->segment, s_re, s_im);
+      psd_cross(ctx->psd->stim_re, ctx->psd->stim_im, s_re, s_im, ctx->psd->spec_re[ref], ctx->psd->spec_im[ref]);
+      for (UINT k = 0; k <= m; k++)
+         ctx->psd->stim_power[k] += (s_re[k] * s_re[k] + s_im[k] * s_im[k]) * ((k == 0 || k == m) ? 1 : 2) * ctx->psd->scale;
+   }
+   ctx->psd->info.segments++;
+   atomic_fetch_add_explicit(&ctx->psd->seq, 1, memory_order_release);
+}
+
+/* Feeds frames [pos, pos + n) of the stored channels */
+void psd_update(DBL *const channel[NUM_CHANNELS], ULNG pos, ULNG n)
+{
+   const UINT len = ctx->psd->info.segment_frames;
+
+   if (ctx->psd->info.bins == 0)
+      return;
+   for (ULNG done = 0; done < n;)
+   {
+      ULNG k = MIN(n - done, ctx->psd->until_next); // never more than one segment, so at most one wrap
+      ULNG at = ctx->psd->head % len, first = MIN(k, len - at);
+      for (UINT c = 0; c < ctx->psd->channels; c++)
+      {
+         memcpy(ctx->psd->ring[c] + at, channel[c] + pos + done, first * sizeof(DBL));
+         memcpy(ctx->psd->ring[c], channel[c] + pos + done + first, (k - first) * sizeof(DBL));
+      }
+      ctx->psd->head += k;
+      ctx->psd->until_next -= k;
+      done += k;
+      if (ctx->psd->until_next == 0)
+      {
+         psd_segment();
+         ctx->psd->until_next = ctx->psd->hop;
+      }
+   }
+}
+
+PsdInfo get_psd_info()
+{
+   return ctx->psd->info;
+}
+
+/* Copies the averaged PSD of channel (max_bins at most) into out and returns the
+   number of bins, 0 until the first segment is complete */
+UINT get_psd(UINT channel, DBL *out, UINT max_bins)
+{
+   UINT bins = MIN(max_bins, ctx->psd->info.bins);
+
+   if (channel >= NUM_CHANNELS || out == NULL || ctx->psd->sum[channel] == NULL)
+      return 0;
+   for (;;)
+   {
+      ULNG seq = atomic_load_explicit(&ctx->psd->seq, memory_order_acquire);
+      if (seq & 1)
+      {
+         sleep_ms(0);
+         continue;
+      }
+      ULNG segments = ctx->psd->info.segments;
+      for (UINT k = 0; k < bins; k++)
+         out[k] = (segments > 0) ? ctx->psd->sum[channel][k] / segments : 0;
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&ctx->psd->seq, memory_order_relaxed) == seq)
+         return (segments > 0) ? bins : 0;
+   }
+}
+
+/* Copies the averaged frequency response of channel relative to the DAC channel
+   (g per volt, phase in radians) and its coherence into the arrays that are not
+   NULL, max_bins at most. Returns the number of bins, 0 without set_frf() or
+   until the first segment is complete. */
+UINT get_frf(UINT channel, DBL *magnitude, DBL *phase, DBL *coherence, UINT max_bins)
+{
+   const int ref = ctx->psd->ref;
+   UINT bins = MIN(max_bins, ctx->psd->info.bins);
+
+   if (channel >= NUM_CHANNELS || ctx->psd->cross_re[channel] == NULL)
+      return 0;
+   for (;;)
+   {
+      ULNG seq = atomic_load_explicit(&ctx->psd->seq, memory_order_acquire);
+      if (seq & 1)
+      {
+         sleep_ms(0);
+         continue;
+      }
+      for (UINT k = 0; k < bins; k++)
+      {
+         DBL re = ctx->psd->cross_re[channel][k], im = ctx->psd->cross_im[channel][k];
+         DBL sxx = ctx->psd->sum[ref][k], syy = ctx->psd->sum[channel][k];
+         if (magnitude)
+            magnitude[k] = (sxx > 0) ? sqrt(re * re + im * im) / sxx : 0;
+         if (phase)
+            phase[k] = atan2(im, re);
+         if (coherence)
+            coherence[k] = (sxx > 0 && syy > 0) ? (re * re + im * im) / (sxx * syy) : 0;
+      }
+      ULNG segments = ctx->psd->info.segments;
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&ctx->psd->seq, memory_order_relaxed) == seq)
+         return (segments > 0) ? bins : 0;
+   }
+}
+
+/* Offset between the stimulus played and the DAC input channel in the current or
+   last synchronized run. For a response r(t) = s(t - d) the summed conj(S) R at the
+   stimulus frequency f has the phase -2 pi f d, so d is known within one period. */
+SyncInfo get_sync_info()
+{
+   SyncInfo info = {0};
+   const int ref = ctx->psd->ref;
+
+   info.synchronized = ctx->sync_start->synchronized;
+   if (ctx->psd->stim_re == NULL || ctx->sync_start->hz <= 0)
+      return info;
+   UINT k = (UINT)floor(ctx->sync_start->hz / ctx->psd->info.bin_hz + 0.5);
+   k = MAX(1, MIN(k, ctx->psd->info.bins - 2));
+   for (;;)
+   {
+      ULNG seq = atomic_load_explicit(&ctx->psd->seq, memory_order_acquire);
+      if (seq & 1)
+      {
+         sleep_ms(0);
+         continue;
+      }
+      DBL re = ctx->psd->stim_re[k], im = ctx->psd->stim_im[k];
+      DBL sss = ctx->psd->stim_power[k], syy = ctx->psd->sum[ref][k];
+      info.segments = ctx->psd->info.segments;
+      info.coherence = (sss > 0 && syy > 0) ? (re * re + im * im) / (sss * syy) : 0;
+      info.offset_seconds = (info.segments > 0) ? -atan2(im, re) / (2 * M_PI * ctx->sync_start->hz) : 0;
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&ctx->psd->seq, memory_order_relaxed) == seq)
+         break;
+   }
+   info.stimulus_hz = ctx->sync_start->hz;
+   info.offset_frames = info.offset_seconds * ctx->time_base->rate;
+   return info;
+}
+
+/* Code-to-g conversion engine
+   The range, encoding, resolution and gain list of the A/D subsystem are read
+   once per olDaConfig and folded together with the sensor sensitivity into one
+   scale/offset pair per channel list position, so a whole buffer converts in a
+   single multiply-add pass instead of one olDaCodeToVolts call per sample. Gain
+   list entry k belongs to channel list entry k, so code k of every frame is
+   converted at gain k and sensitivity k and written to output channel order[k]
+   (the channel list is ascending, the outputs follow the channel map). The
+   kernels are instantiated per channel count.
+   Folding changes the rounding order, so a folded value is not bit-identical
+   to the reference formula (code_to_volts_ref() divided by the sensitivity):
+   it is within CONV_TOLERANCE * DBL_EPSILON of the channel's full scale, under
+   2e-13 g at gain 1 and 100 mV/g against the 1.2e-5 g of one 24-bit code.
+   tests/test_conversion.c checks the bound over the whole code range.
+*/
+#define CONV_USE_REFERENCE 0  // (1-convert with the per-sample reference formula, 0-folded kernel)
+#define CONV_TOLERANCE 8.0    // folded vs reference, in DBL_EPSILON of the full scale
+
+typedef struct ConvTable {
+   DBL min, max;
+   DBL freq;
+   UINT resolution;
+   UINT encoding;
+   ULNG sign_flip;                                // XOR mask converting 2's complement to offset binary
+   ULNG code_mask;                                // zeroes bits above the resolution
+   UINT listsize;                                 // codes per frame, one per output channel
+   UINT order[NUM_CHANNELS];                      // output channel of each channel list entry
+   DBL sensitivity[NUM_CHANNELS];                 // mV per g, per channel list entry
+   DBL gainlist[NUM_CHANNELS];                    // gain of each channel list entry
+   DBL scale[NUM_CHANNELS];                       // g (or V) per code, per channel list entry
+   DBL offset[NUM_CHANNELS];
+} ConvTable;
+
+/* Portable equivalent of olDaCodeToVolts */
+DBL code_to_volts_ref(DBL min, DBL max, DBL gain, UINT resolution, UINT encoding, ULNG value)
+{
+   if (encoding != OL_ENC_BINARY)
+   {
+      /* convert to offset binary by inverting the sign bit */
+      value ^= 1UL << (resolution - 1);
+      if (resolution < 32)
+         value &= (1UL << resolution) - 1; /* zero upper bits */
+   }
+   return ((max - min) / ldexp(1.0, resolution) * value + min) / gain;
+}
+
+/* Derives the folded constants from the range, encoding, resolution, gain list and
+   sensitivities. The output order is reset to the channel list order; a caller with
+   a channel map sets order[] afterwards. */
+int conv_table_build(ConvTable *ct)
+{
+   if (ct->listsize == 0 || ct->listsize > NUM_CHANNELS || ct->resolution == 0 || ct->resolution > 32)
+      return CFG_FAILURE;
+
+   ct->code_mask = (ct->resolution < 32) ? ((1UL << ct->resolution) - 1) : 0xFFFFFFFFUL;
+   ct->sign_flip = (ct->encoding != OL_ENC_BINARY) ? (1UL << (ct->resolution - 1)) : 0;
+   if (ct->encoding == OL_ENC_BINARY)
+      ct->code_mask = 0xFFFFFFFFUL; // offset binary codes are used as delivered
+
+   DBL lsb = (ct->max - ct->min) / ldexp(1.0, ct->resolution);
+   for (UINT c = 0; c < ct->listsize; c++)
+   {
+      ct->order[c] = c;
+      if (ct->gainlist[c] <= 0 || ct->sensitivity[c] <= 0)
+         return CFG_FAILURE;
+
+      DBL g_per_volt = 1000.0 / ct->sensitivity[c];
+      ct->scale[c] = lsb / ct->gainlist[c] * g_per_volt;
+      ct->offset[c] = ct->min / ct->gainlist[c] * g_per_volt;
+   }
+   return CFG_SUCCESS;
+}
+
+int conv_table_init(ConvTable *ct, HDASS hAD_v)
+{
+   CHECKERROR(daq->GetRange(hAD_v, &ct->max, &ct->min));
+   CHECKERROR(daq->GetEncoding(hAD_v, &ct->encoding));
+   CHECKERROR(daq->GetResolution(hAD_v, &ct->resolution));
+   CHECKERROR(daq->GetChannelListSize(hAD_v, &ct->listsize));
+   CHECKERROR(daq->GetClockFrequency(hAD_v, &ct->freq));
+
+   if (ct->listsize == 0 || ct->listsize != ctx->active_map->count)
+      return CFG_FAILURE;
+   UINT order[NUM_CHANNELS];
+   channel_map_order(ctx->active_map, order);
+   for (UINT c = 0; c < ct->listsize; c++)
+   {
+      CHECKERROR(daq->GetGainListEntry(hAD_v, c, &ct->gainlist[c]));
+      ct->sensitivity[c] = ctx->active_map->sensitivity[order[c]];
+   }
+   if (conv_table_build(ct) == CFG_FAILURE)
+      return CFG_FAILURE;
+   memcpy(ct->order, order, sizeof(order));
+   return CFG_SUCCESS;
+}
+
+/* Reference path: the original per-sample formula, kept to validate the folded kernel */
+void conv_block_ref(const ConvTable *ct, const void *raw, UINT width, ULNG frames, UINT stride,
+                    DBL *out[NUM_CHANNELS], ULNG pos)
+{
+   for (ULNG f = 0; f < frames; f++)
+   {
+      for (UINT c = 0; c < ct->listsize; c++)
+      {
+         ULNG value = (width > 2) ? ((const DWORD *)raw)[f * stride + c] : ((const WORD *)raw)[f * stride + c];
+         DBL volts = code_to_volts_ref(ct->min, ct->max, ct->gainlist[c], ct->resolution, ct->encoding, value);
+         out[ct->order[c]][pos + f] = volts / (ct->sensitivity[c] / 1000);
+      }
+   }
+}
+
+/* Folded kernels for 16-bit (PWORD) and 32-bit (PDWORD) buffers of channels
+   codes per frame. The channel count is a constant in every instance, so the
+   statements of unused channels drop out; the constants are hoisted out of the
+   loop and each channel becomes an independent multiply-add stream the compiler
+   can vectorize. */
+#define CONV_CODE(c) (DBL)((fr[c] ^ flip) & mask)
+#define DEFINE_CONV_KERNEL(name, code_t, channels)                                          \
+   static void name(const ConvTable *ct, const code_t *raw, ULNG frames, UINT stride,       \
+                    DBL *out[NUM_CHANNELS], ULNG pos)                                       \
+   {                                                                                        \
+      const ULNG flip = ct->sign_flip, mask = ct->code_mask;                                \
+      const DBL *sc = ct->scale, *of = ct->offset;                                          \
+      const DBL s0 = sc[0], s1 = sc[1], s2 = sc[2], s3 = sc[3];                             \
+      const DBL b0 = of[0], b1 = of[1], b2 = of[2], b3 = of[3];                             \
+      DBL *restrict o0 = out[0] + pos;                                                      \
+      DBL *restrict o1 = (channels > 1) ? out[1] + pos : NULL;                              \
+      DBL *restrict o2 = (channels > 2) ? out[2] + pos : NULL;                              \
+      DBL *restrict o3 = (channels > 3) ? out[3] + pos : NULL;                              \
+      for (ULNG f = 0; f < frames; f++)                                                     \
+      {                                                                                     \
+         const code_t *fr = raw + f * stride;                                               \
+         o0[f] = CONV_CODE(0) * s0 + b0;                                                    \
+         if (channels > 1)                                                                  \
+            o1[f] = CONV_CODE(1) * s1 + b1;                                                 \
+         if (channels > 2)                                                                  \
+            o2[f] = CONV_CODE(2) * s2 + b2;                                                 \
+         if (channels > 3)                                                                  \
+            o3[f] = CONV_CODE(3) * s3 + b3;                                                 \
+      }                                                                                     \
+   }
+
+DEFINE_CONV_KERNEL(conv_block16_1, WORD, 1)
+DEFINE_CONV_KERNEL(conv_block16_2, WORD, 2)
+DEFINE_CONV_KERNEL(conv_block16_3, WORD, 3)
+DEFINE_CONV_KERNEL(conv_block16_4, WORD, 4)
+DEFINE_CONV_KERNEL(conv_block32_1, DWORD, 1)
+DEFINE_CONV_KERNEL(conv_block32_2, DWORD, 2)
+DEFINE_CONV_KERNEL(conv_block32_3, DWORD, 3)
+DEFINE_CONV_KERNEL(conv_block32_4, DWORD, 4)
+
+typedef void (*ConvKernel16)(const ConvTable *, const WORD *, ULNG, UINT, DBL *[NUM_CHANNELS], ULNG);
+typedef void (*ConvKernel32)(const ConvTable *, const DWORD *, ULNG, UINT, DBL *[NUM_CHANNELS], ULNG);
+
+/* indexed by the channel count */
+static const ConvKernel16 conv_block16[NUM_CHANNELS + 1] = {NULL, conv_block16_1, conv_block16_2, conv_block16_3, conv_block16_4};
+static const ConvKernel32 conv_block32[NUM_CHANNELS + 1] = {NULL, conv_block32_1, conv_block32_2, conv_block32_3, conv_block32_4};
+
+/* Whole frames in samples interleaved codes of stride codes per frame */
+static ULNG conv_frame_count(ULNG samples, UINT stride)
+{
+   return (stride > 0) ? samples / stride : 0;
+}
+
+/* Converts frames frames with the kernel for the sample width and channel count */
+static void conv_frames(const ConvTable *ct, const void *raw, UINT width, ULNG frames, UINT stride,
+                        DBL *out[NUM_CHANNELS], ULNG pos)
+{
+#if CONV_USE_REFERENCE
+   conv_block_ref(ct, raw, width, frames, stride, out, pos);
+#else
+   DBL *dst[NUM_CHANNELS];
+   for (UINT c = 0; c < ct->listsize; c++)
+      dst[c] = out[ct->order[c]];
+   if (width > 2)
+      conv_block32[ct->listsize](ct, (const DWORD *)raw, frames, stride, dst, pos);
+   else
+      conv_block16[ct->listsize](ct, (const WORD *)raw, frames, stride, dst, pos);
+#endif
+}
+
+/* Appends n frames of src to storage, flushing full chunks in streaming mode */
+static void store_copy(ChannelData *channels, DBL *const src[NUM_CHANNELS], ULNG n)
+{
+   ULNG done = 0;
+
+   storage_commit(channels, n);
+   while (done < n && channels->num_readings < channels->max_readings)
+   {
+      ULNG k = MIN(n - done, channels->max_readings - channels->num_readings);
+      for (UINT c = 0; c < channels->num_channels; c++)
+         memcpy(channels->channel[c] + channels->num_readings, src[c] + done, k * sizeof(DBL));
+      channels->num_readings += k;
+      done += k;
+
+      if (ctx->capture->streaming && channels->num_readings == channels->max_readings)
+         capture_flush(channels);
+   }
+
+   ctx->capture->counters.frames_stored += done;
+   if (done < n)
+   {
+      ctx->capture->counters.frames_dropped += n - done;
+      LOG_PRINT("Error: Maximum number of readings exceeded.\n");
+   }
+}
+
+void trig_end()
+{
+   if (ctx->trig->post_left > 0)
+      ctx->trig->event[ctx->trig->counters.events - 1].frames -= ctx->trig->post_left; // run ended inside the window
+   ctx->trig->post_left = 0;
+   for (int c = 0; c < NUM_CHANNELS; c++)
+   {
+      aligned_free(ctx->trig->ring[c]);
+      aligned_free(ctx->trig->block[c]);
+      ctx->trig->ring[c] = ctx->trig->block[c] = NULL;
+   }
+}
+
+int trig_begin()
+{
+   BOOL ok = TRUE;
+
+   trig_end();
+   free(ctx->trig->event);
+   ctx->trig->event = NULL;
+   memset(&ctx->trig->counters, 0, sizeof(ctx->trig->counters));
+   ctx->trig->armed = FALSE;
+   ctx->trig->post_left = 0;
+   ctx->trig->stream_frames = 0;
+   if (ctx->trig->mode == TRIG_OFF)
+      return CFG_SUCCESS;
+
+   if (ctx->trig->channel >= capture_channels())
+      return CFG_FAILURE;
+   ctx->trig->event = calloc(ctx->trig->max_events, sizeof(TriggerEvent));
+   for (UINT c = 0; c < capture_channels(); c++)
+   {
+      ctx->trig->ring[c] = aligned_malloc(MAX(ctx->trig->pre_frames, 1) * sizeof(DBL), DATA_ALIGNMENT);
+      ctx->trig->block[c] = aligned_malloc(DECIM_BLOCK_FRAMES * sizeof(DBL), DATA_ALIGNMENT);
+      if (ctx->trig->ring[c] == NULL || ctx->trig->block[c] == NULL)
+         ok = FALSE;
+   }
+   if (!ok || ctx->trig->event == NULL)
+   {
+      trig_end();
+      return CFG_FAILURE;
+   }
+   return CFG_SUCCESS;
+}
+
+/* Passes frames [first, first + n) of src; stream frame s is kept in ring[s % pre_frames] */
+static void trig_history(DBL *const src[NUM_CHANNELS], ULNG first, ULNG n)
+{
+   const UINT pre = ctx->trig->pre_frames;
+   ULNG stream = ctx->trig->stream_frames;
+
+   ctx->trig->stream_frames += n;
+   if (pre == 0)
+      return;
+   if (n > pre)
+   {
+      first += n - pre;
+      stream += n - pre;
+      n = pre;
+   }
+   ULNG at = stream % pre, part = MIN(n, pre - at);
+   for (UINT c = 0; c < capture_channels(); c++)
+   {
+      memcpy(ctx->trig->ring[c] + at, src[c] + first, part * sizeof(DBL));
+      memcpy(ctx->trig->ring[c], src[c] + first + part, (n - part) * sizeof(DBL));
+   }
+}
+
+/* Starts a window at stream frame trigger_frame, storing the history before it */
+static void trig_open(ChannelData *channels, ULNG trigger_frame)
+{
+   const UINT pre = ctx->trig->pre_frames;
+   ULNG kept = MIN((ULNG)pre, trigger_frame);
+   TriggerEvent *e = &ctx->trig->event[ctx->trig->counters.events++];
+
+   e->trigger_frame = trigger_frame;
+   e->first_frame = trigger_frame - kept;
+   e->offset = ctx->capture->chunk_first_frame + channels->num_readings;
+   e->frames = (UINT)kept + ctx->trig->post_frames;
+   if (kept > 0)
+   {
+      ULNG at = e->first_frame % pre, part = MIN(kept, pre - at);
+      DBL *older[NUM_CHANNELS], *newer[NUM_CHANNELS];
+      for (UINT c = 0; c < channels->num_channels; c++)
+      {
+         older[c] = ctx->trig->ring[c] + at;
+         newer[c] = ctx->trig->ring[c];
+      }
+      store_copy(channels, older, part);
+      store_copy(channels, newer, kept - part);
+   }
+   ctx->trig->post_left = ctx->trig->post_frames;
+}
+
+/* Runs n converted frames through the trigger, storing the windows */
+static void trig_feed(ChannelData *channels, DBL *const src[NUM_CHANNELS], ULNG n)
+{
+   const DBL *x = src[ctx->trig->channel];
+   ULNG done = 0;
+
+   while (done < n)
+   {
+      ULNG i = done;
+
+      if (ctx->trig->post_left > 0)
+      {
+         ULNG k = MIN(n - done, ctx->trig->post_left);
+         for (; i < done + k; i++)
+            trig_step(x[i], FALSE);
+         DBL *from[NUM_CHANNELS];
+         for (UINT c = 0; c < channels->num_channels; c++)
+            from[c] = src[c] + done;
+         store_copy(channels, from, k);
+         ctx->trig->post_left -= (UINT)k;
+      }
+      else
+      {
+         BOOL can_fire = ctx->trig->counters.events < ctx->trig->max_events;
+         while (i < n && !trig_step(x[i], can_fire))
+            i++;
+         if (i < n)
+         {
+            trig_history(src, done, i - done);
+            trig_open(channels, ctx->trig->stream_frames);
+            done = i;
+            continue;
+         }
+      }
+      trig_history(src, done, i - done);
+      done = i;
+   }
+}
+
+/* Frames that are not converted straight into storage: statistics and the PSD
+   see all of them, then the trigger decides what is stored */
+static void store_frames(ChannelData *channels, DBL *const src[NUM_CHANNELS], ULNG n)
+{
+   stats_update(src, 0, n);
+   psd_update(src, 0, n);
+   if (ctx->trig->ring[0] != NULL)
+      trig_feed(channels, src, n);
+   else
+      store_copy(channels, src, n);
+}
+
+/* Filters the frames converted into decim.block and stores the outputs */
+static void decim_push(ChannelData *channels, ULNG frames)
+{
+   const ULNG history = ctx->decim->info.taps - 1;
+   DBL (*in)[NUM_CHANNELS] = ctx->decim->line + history;
+
+   for (ULNG f = 0; f < frames; f++)
+   {
+      for (UINT c = 0; c < channels->num_channels; c++)
+         in[f][c] = ctx->decim->block[c][f];
+   }
+   if (!ctx->decim->primed)
+   {
+      for (ULNG f = 0; f < history; f++)
+         memcpy(ctx->decim->line[f], in[0], sizeof(*in));
+      ctx->decim->primed = TRUE;
+   }
+   store_frames(channels, ctx->decim->out, decim_filter(ctx->decim, frames));
+}
+
+/* conv_buffer() through a planar scratch block when decimation or a trigger
+   sits between conversion and storage */
+static void conv_staged(const ConvTable *ct, ChannelData *channels, const void *raw, UINT width,
+                        ULNG samples, UINT stride)
+{
+   ULNG frames = conv_frame_count(samples, stride);
+   DBL **block = (ctx->decim->line != NULL) ? ctx->decim->block : ctx->trig->block;
+
+   for (ULNG done = 0; done < frames;)
+   {
+      ULNG n = MIN(frames - done, DECIM_BLOCK_FRAMES);
+      conv_frames(ct, (const char *)raw + done * stride * width, width, n, stride, block, 0);
+      sub_append(block, 0, n);
+      if (ctx->decim->line != NULL)
+         decim_push(channels, n);
+      else
+         store_frames(channels, block, n);
+      done += n;
+   }
+}
+
+/* Repeats the last frame until every input frame has its output, then frees the filter */
+void decim_end(ChannelData *channels)
+{
+   const ULNG history = ctx->decim->info.taps - 1;
+
+   if (ctx->decim->line != NULL && ctx->decim->primed)
+   {
+      for (UINT c = 0; c < channels->num_channels; c++)
+      {
+         for (ULNG f = 0; f < history / 2; f++)
+            ctx->decim->block[c][f] = ctx->decim->line[history - 1][c];
+      }
+      decim_push(channels, history / 2);
+   }
+   aligned_free(ctx->decim->line);
+   ctx->decim->line = NULL;
+   for (int c = 0; c < NUM_CHANNELS; c++)
+   {
+      aligned_free(ctx->decim->block[c]);
+      aligned_free(ctx->decim->out[c]);
+      ctx->decim->block[c] = ctx->decim->out[c] = NULL;
+   }
+}
+
+int decim_begin()
+{
+   ULNG history = ctx->decim->info.taps - 1;
+
+   ctx->decim->primed = FALSE;
+   ctx->decim->next_start = history / 2;
+   if (ctx->decim->info.factor <= 1)
+      return CFG_SUCCESS;
+
+   ctx->decim->line = aligned_malloc((history + DECIM_BLOCK_FRAMES) * sizeof(*ctx->decim->line), DATA_ALIGNMENT);
+   if (ctx->decim->line != NULL)
+      memset(ctx->decim->line, 0, (history + DECIM_BLOCK_FRAMES) * sizeof(*ctx->decim->line)); // unmapped columns stay 0
+   for (UINT c = 0; c < capture_channels(); c++)
+   {
+      ctx->decim->block[c] = aligned_malloc(DECIM_BLOCK_FRAMES * sizeof(DBL), DATA_ALIGNMENT);
+      ctx->decim->out[c] = aligned_malloc((DECIM_BLOCK_FRAMES / 2 + 1) * sizeof(DBL), DATA_ALIGNMENT);
+      if (ctx->decim->line == NULL || ctx->decim->block[c] == NULL || ctx->decim->out[c] == NULL)
+      {
+         decim_end(NULL);
+         return CFG_FAILURE;
+      }
+   }
+   return CFG_SUCCESS;
+}
+
+/* Converts a raw A/D buffer straight into the channel arrays. In streaming mode
+   full chunks are flushed as they fill, otherwise frames beyond max_readings are
+   counted as dropped. */
+void conv_buffer(const ConvTable *ct, ChannelData *channels, const void *raw, UINT width,
+                 ULNG samples, UINT stride)
+{
+   ULNG frames = conv_frame_count(samples, stride);
+   ULNG done = 0;
+
+   if (ctx->decim->line != NULL || ctx->trig->ring[0] != NULL)
+   {
+      conv_staged(ct, channels, raw, width, samples, stride);
+      return;
+   }
+
+   storage_commit(channels, frames);
+   while (done < frames && channels->num_readings < channels->max_readings)
+   {
+      ULNG room = channels->max_readings - channels->num_readings;
+      ULNG n = MIN(frames - done, room);
+      ULNG pos = channels->num_readings;
+      const void *src = (const char *)raw + done * stride * width;
+
+      conv_frames(ct, src, width, n, stride, channels->channel, pos);
+      sub_append(channels->channel, pos, n);
+      stats_update(channels->channel, pos, n);
+      psd_update(channels->channel, pos, n);
+
+      channels->num_readings += n;
+      done += n;
+
+      if (ctx->capture->streaming && channels->num_readings == channels->max_readings)
+         capture_flush(channels);
+   }
+
+   ctx->capture->counters.frames_stored += done;
+   if (done < frames)
+   {
+      sub_convert(ct, (const char *)raw + done * stride * width, width, frames - done, stride);
+      ctx->capture->counters.frames_dropped += frames - done;
+      LOG_PRINT("Error: Maximum number of readings exceeded.\n");
+   }
+}
+
+/* Binary capture files
+   A recording is a CaptureFileHeader followed by the raw interleaved A/D codes
+   exactly as the driver delivered them, appended with large sequential writes.
+   Nothing is converted while recording; capture_file_read() maps the file and
+   converts any frame window on demand with the same kernels as the live path.
+   The codes of a frame are in ascending input order as the A/D scanned them,
+   with the gain of each; physical[] and sensitivity[] are per output channel,
+   and the reader derives the output channel of each code from physical[] the
+   way the live conversion does. Files of versions 1 and 2 hold the four inputs
+   (Z, Y, X, DAC) and are read back as X, Y, Z, DAC as before.
+
+   With set_record_compression() the codes are packed losslessly instead, on the
+   conversion thread as each driver buffer is recorded. Every PACK_BLOCK_FRAMES
+   frames form one block: per channel the first code, then the residuals of a
+   first or second order predictor (whichever is smaller for the block), zigzag
+   coded and bit-packed PACK_GROUP at a time with the bit width of the largest.
+   Blocks are independent, so any frame window is decoded from the blocks it
+   touches only.
+*/
+#define CAPTURE_FILE_MAGIC "DTCAPv1"
+#define CAPTURE_FILE_VERSION 3
+#define CAPTURE_FILE_VERSION_PACKED 4 // codes in delta + bit-packed blocks
+#define CAPTURE_FILE_VERSION_INPUT_ORDER 1        // before the channel map: inputs 0-3 in every frame
+#define CAPTURE_FILE_VERSION_INPUT_ORDER_PACKED 2
+#define CAPTURE_FILE_GAINS 64          // gain list entries in the header
+#define RECORD_WRITE_BUFFER (4 * 1024 * 1024)
+#define PACK_BLOCK_FRAMES 4096        // frames per packed block, the unit of random access
+#define PACK_GROUP 128                // residuals sharing one bit width
+#define PACK_BOUND(samples, frame_size, width) \
+   ((size_t)(samples) * (width) + 2 * ((samples) / PACK_GROUP) + (size_t)(frame_size) * ((width) + 3) + 16)
+
+typedef struct {
+   char magic[8];
+   UINT version;
+   UINT header_bytes;                // offset of the first code
+   UINT frame_size;                  // samples per frame in the code stream
+   UINT width;                       // bytes per code (2 or 4)
+   UINT resolution;
+   UINT encoding;
+   DBL min, max;
+   DBL freq;                         // A/D clock frequency (frames per second)
+   UINT listsize;
+   UINT block_frames;                // frames per packed block, 0-raw codes
+   DBL gainlist[CAPTURE_FILE_GAINS]; // gain of each code in a frame, the rest unused
+   DBL sensitivity[NUM_CHANNELS];    // mV per g, output channel order
+   UINT physical[NUM_CHANNELS];      // input of each output channel (version 3 on)
+} CaptureFileHeader;
+
+#define CAPTURE_FILE_MIN_HEADER offsetof(CaptureFileHeader, physical) // versions 1 and 2
+
+typedef struct {
+   UINT samples; // codes in the block, a whole PACK_BLOCK_FRAMES frames except in the last
+   UINT bytes;   // packed bytes that follow
+} PackedBlockHeader;
+
+typedef struct {
+   UINT block_frames; // 0-raw codes
+   ULNG blocks;
+   ULNG raw_bytes;    // codes recorded
+   ULNG file_bytes;   // bytes written after the header
+   DBL pack_seconds;  // time spent packing
+} RecordInfo;
+
+typedef struct {
+   CaptureFileHeader header;
+   ULNG frames;
+   const char *codes;
+   ULNG blocks;         // packed files: blocks and the offset of each from codes
+   size_t *block_offset;
+   ConvTable conv;
+   LPVOID view;
+   size_t view_bytes;
+#if defined(_WIN32)
+   HANDLE file;
+   HANDLE mapping;
+#endif
+} CaptureFile;
+
+typedef struct RecordFile {
+   char path[260];
+   FILE *stream;
+   char *wbuf;
+   UINT width;
+   UINT frame_size;       // codes per frame, one per output channel
+   BOOL packed;           // set_record_compression()
+   char *stage;           // codes of the block being filled
+   ULNG staged;           // samples in stage
+   unsigned char *out;    // PackedBlockHeader and the packed block
+   RecordInfo info;
+} RecordFile;
+
+/* Zigzag code of a residual taken modulo the code width */
+static inline uint32_t pack_zigzag(uint32_t r, UINT width)
+{
+   int32_t v = (width > 2) ? (int32_t)r : (int32_t)(int16_t)(uint16_t)r;
+   return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline uint32_t pack_unzigzag(uint32_t z)
+{
+   return (z >> 1) ^ (0U - (z & 1));
+}
+
+/* Appends count values of bits bits each (LSB first), returns the end of the output */
+static unsigned char *pack_bits(unsigned char *out, const uint32_t *v, UINT count, UINT bits)
+{
+   uint64_t acc = 0;
+   UINT fill = 0;
+
+   if (bits == 0)
+      return out;
+   for (UINT i = 0; i < count; i++)
+   {
+      acc |= (uint64_t)v[i] << fill;
+      fill += bits;
+      if (fill >= 32)
+      {
+         uint32_t word = (uint32_t)acc;
+         memcpy(out, &word, 4); // little-endian, like the codes
+         out += 4;
+         acc >>= 32;
+         fill -= 32;
+      }
+   }
+   for (; fill > 0; fill = (fill > 8) ? fill - 8 : 0)
+   {
+      *out++ = (unsigned char)acc;
+      acc >>= 8;
+   }
+   return out;
+}
+
+/* Reads back count values written by pack_bits() */
+static const unsigned char *unpack_bits(const unsigned char *in, uint32_t *v, UINT count, UINT bits)
+{
+   const uint32_t mask = (bits >= 32) ? 0xFFFFFFFFU : (1U << bits) - 1;
+   uint64_t acc = 0;
+   UINT fill = 0;
+
+   if (bits == 0)
+   {
+      memset(v, 0, count * sizeof(uint32_t));
+      return in;
+   }
+   for (UINT i = 0; i < count; i++)
+   {
+      while (fill < bits)
+      {
+         acc |= (uint64_t)*in++ << fill;
+         fill += 8;
+      }
+      v[i] = (uint32_t)acc & mask;
+      acc >>= bits;
+      fill -= bits;
+   }
+   return in;
+}
+
+static inline uint32_t pack_code(const void *codes, UINT width, ULNG i)
+{
+   return (width > 2) ? ((const DWORD *)codes)[i] : ((const WORD *)codes)[i];
+}
+
+/* Packs samples interleaved codes (frame_size per frame, at most PACK_BLOCK_FRAMES
+   frames) into out, which holds PACK_BOUND() bytes. Returns the bytes written. */
+size_t pack_block(const void *codes, UINT width, ULNG samples, UINT frame_size, unsigned char *out)
+{
+   const uint32_t mask = (width > 2) ? 0xFFFFFFFFU : 0xFFFFU;
+   uint32_t x[PACK_BLOCK_FRAMES], z[PACK_BLOCK_FRAMES];
+   unsigned char *p = out;
+
+   if (samples > (ULNG)PACK_BLOCK_FRAMES * frame_size)
+      return 0;
+   for (UINT c = 0; c < frame_size && c < samples; c++)
+   {
+      UINT n = (UINT)((samples - c + frame_size - 1) / frame_size);
+      uint64_t cost1 = 0, cost2 = 0;
+
+      for (UINT i = 0; i < n; i++)
+         x[i] = pack_code(codes, width, (ULNG)i * frame_size + c);
+      for (UINT i = 2; i < n; i++)
+      {
+         cost1 += pack_zigzag((x[i] - x[i - 1]) & mask, width);
+         cost2 += pack_zigzag((x[i] - 2 * x[i - 1] + x[i - 2]) & mask, width);
+      }
+      UINT order = (cost2 < cost1) ? 2 : 1;
+
+      memcpy(p, &x[0], width);
+      p += width;
+      *p++ = (unsigned char)order;
+      if (n > 1)
+         z[0] = pack_zigzag((x[1] - x[0]) & mask, width);
+      for (UINT i = 2; i < n; i++)
+      {
+         uint32_t pred = (order == 2) ? 2 * x[i - 1] - x[i - 2] : x[i - 1];
+         z[i - 1] = pack_zigzag((x[i] - pred) & mask, width);
+      }
+      for (UINT g = 0; g + 1 < n; g += PACK_GROUP)
+      {
+         UINT count = MIN(PACK_GROUP, n - 1 - g), bits = 0;
+         uint32_t any = 0;
+         for (UINT i = 0; i < count; i++)
+            any |= z[g + i];
+         while (bits < 32 && (any >> bits) != 0)
+            bits++;
+         *p++ = (unsigned char)bits;
+         p = pack_bits(p, z + g, count, bits);
+      }
+   }
+   return (size_t)(p - out);
+}
+
+/* Decodes a block written by pack_block() into codes; FALSE if bytes runs out */
+BOOL unpack_block(const unsigned char *in, size_t bytes, UINT width, ULNG samples, UINT frame_size, void *codes)
+{
+   const uint32_t mask = (width > 2) ? 0xFFFFFFFFU : 0xFFFFU;
+   const unsigned char *end = in + bytes;
+   uint32_t z[PACK_GROUP];
+
+   if (samples > (ULNG)PACK_BLOCK_FRAMES * frame_size)
+      return FALSE;
+   for (UINT c = 0; c < frame_size && c < samples; c++)
+   {
+      UINT n = (UINT)((samples - c + frame_size - 1) / frame_size);
+      uint32_t prev = 0, prev2 = 0;
+
+      if ((size_t)(end - in) < width + 1U)
+         return FALSE;
+      memcpy(&prev, in, width);
+      in += width;
+      UINT order = *in++;
+      if (width > 2)
+         ((DWORD *)codes)[c] = (DWORD)prev;
+      else
+         ((WORD *)codes)[c] = (WORD)prev;
+      prev2 = prev;
+
+      for (UINT g = 0; g + 1 < n; g += PACK_GROUP)
+      {
+         UINT count = MIN(PACK_GROUP, n - 1 - g);
+         if (in >= end)
+            return FALSE;
+         UINT bits = *in++;
+         if (bits > 32 || (size_t)(end - in) < ((size_t)count * bits + 7) / 8)
+            return FALSE;
+         in = unpack_bits(in, z, count, bits);
+         for (UINT i = 0; i < count; i++)
+         {
+            UINT k = g + 1 + i;
+            uint32_t pred = (order == 2 && k >= 2) ? 2 * prev - prev2 : prev;
+            uint32_t v = (pred + pack_unzigzag(z[i])) & mask;
+            if (width > 2)
+               ((DWORD *)codes)[(ULNG)k * frame_size + c] = (DWORD)v;
+            else
+               ((WORD *)codes)[(ULNG)k * frame_size + c] = (WORD)v;
+            prev2 = prev;
+            prev = v;
+         }
+      }
+   }
+   return TRUE;
+}
+
+/* Enables recording of the raw codes for the next measurement (NULL disables) */
+int set_record_file(const char *path)
+{
+   ctx->record->path[0] = '\0';
+   if (path != NULL)
+   {
+      strncpy(ctx->record->path, path, sizeof(ctx->record->path) - 1);
+      ctx->record->path[sizeof(ctx->record->path) - 1] = '\0';
+   }
+   return CFG_SUCCESS;
+}
+
+/* Packs the recorded codes of the next measurements (set_record_file()) */
+int set_record_compression(bool enable)
+{
+   ctx->record->packed = enable;
+   return CFG_SUCCESS;
+}
+
+RecordInfo get_record_info()
+{
+   return ctx->record->info;
+}
+
+/* Packs and writes the staged codes as one block */
+static void record_flush_block()
+{
+   PackedBlockHeader blk;
+   DBL t0 = monotonic_seconds();
+
+   if (ctx->record->staged == 0)
+      return;
+   blk.samples = (UINT)ctx->record->staged;
+   blk.bytes = (UINT)pack_block(ctx->record->stage, ctx->record->width, ctx->record->staged, ctx->record->frame_size,
+                                ctx->record->out + sizeof(blk));
+   memcpy(ctx->record->out, &blk, sizeof(blk));
+   ctx->record->info.pack_seconds += monotonic_seconds() - t0;
+   fwrite(ctx->record->out, 1, sizeof(blk) + blk.bytes, ctx->record->stream);
+   ctx->record->info.file_bytes += sizeof(blk) + blk.bytes;
+   ctx->record->info.blocks++;
+   ctx->record->staged = 0;
+}
+
+void record_end()
+{
+   if (ctx->record->stream)
+   {
+      if (ctx->record->stage)
+         record_flush_block();
+      fclose(ctx->record->stream);
+      ctx->record->stream = NULL;
+   }
+   free(ctx->record->wbuf);
+   free(ctx->record->stage);
+   free(ctx->record->out);
+   ctx->record->wbuf = ctx->record->stage = NULL;
+   ctx->record->out = NULL;
+}
+
+int record_begin(const ConvTable *ct)
+{
+   CaptureFileHeader hdr = {0};
+
+   if (ctx->record->path[0] == '\0')
+      return CFG_SUCCESS;
+
+   ctx->record->stream = fopen(ctx->record->path, "wb");
+   if (ctx->record->stream == NULL)
+      return CFG_FAILURE;
+   ctx->record->wbuf = malloc(RECORD_WRITE_BUFFER);
+   if (ctx->record->wbuf)
+      setvbuf(ctx->record->stream, ctx->record->wbuf, _IOFBF, RECORD_WRITE_BUFFER);
+
+   ctx->record->width = (ct->resolution > 16) ? 4 : 2;
+   ctx->record->frame_size = ct->listsize;
+   memset(&ctx->record->info, 0, sizeof(ctx->record->info));
+   ctx->record->staged = 0;
+   if (ctx->record->packed)
+   {
+      const UINT frame_size = ctx->record->frame_size;
+      ctx->record->stage = malloc((size_t)PACK_BLOCK_FRAMES * frame_size * ctx->record->width);
+      ctx->record->out = malloc(sizeof(PackedBlockHeader) + PACK_BOUND(PACK_BLOCK_FRAMES * frame_size, frame_size, ctx->record->width));
+      if (ctx->record->stage == NULL || ctx->record->out == NULL)
+      {
+         record_end();
+         return CFG_FAILURE;
+      }
+      ctx->record->info.block_frames = PACK_BLOCK_FRAMES;
+   }
+   memcpy(hdr.magic, CAPTURE_FILE_MAGIC, sizeof(CAPTURE_FILE_MAGIC));
+   hdr.version = ctx->record->packed ? CAPTURE_FILE_VERSION_PACKED : CAPTURE_FILE_VERSION;
+   hdr.block_frames = ctx->record->info.block_frames;
+   hdr.header_bytes = sizeof(CaptureFileHeader);
+   hdr.frame_size = ctx->record->frame_size;
+   hdr.width = ctx->record->width;
+   hdr.resolution = ct->resolution;
+   hdr.encoding = ct->encoding;
+   hdr.min = ct->min;
+   hdr.max = ct->max;
+   hdr.freq = ct->freq;
+   hdr.listsize = ct->listsize;
+   memcpy(hdr.gainlist, ct->gainlist, sizeof(ct->gainlist));
+   memcpy(hdr.sensitivity, ctx->active_map->sensitivity, sizeof(hdr.sensitivity));
+   memcpy(hdr.physical, ctx->active_map->physical, sizeof(hdr.physical));
+
+   if (fwrite(&hdr, sizeof(hdr), 1, ctx->record->stream) != 1)
+   {
+      record_end();
+      return CFG_FAILURE;
+   }
+   return CFG_SUCCESS;
+}
+
+void record_append(const void *raw, ULNG samples)
+{
+   const ULNG block_samples = (ULNG)PACK_BLOCK_FRAMES * ctx->record->frame_size;
+
+   if (ctx->record->stream == NULL)
+      return;
+   ctx->record->info.raw_bytes += samples * ctx->record->width;
+   if (ctx->record->stage == NULL)
+   {
+      fwrite(raw, ctx->record->width, samples, ctx->record->stream);
+      ctx->record->info.file_bytes += samples * ctx->record->width;
+      return;
+   }
+   while (samples > 0)
+   {
+      ULNG n = MIN(samples, block_samples - ctx->record->staged);
+      memcpy(ctx->record->stage + ctx->record->staged * ctx->record->width, raw, n * ctx->record->width);
+      ctx->record->staged += n;
+      raw = (const char *)raw + n * ctx->record->width;
+      samples -= n;
+      if (ctx->record->staged == block_samples)
+         record_flush_block();
+   }
+}
+
+void capture_file_close(CaptureFile *cf)
+{
+   if (cf == NULL)
+      return;
+#if defined(_WIN32)
+   if (cf->view)
+      UnmapViewOfFile(cf->view);
+   if (cf->mapping)
+      CloseHandle(cf->mapping);
+   if (cf->file && cf->file != INVALID_HANDLE_VALUE)
+      CloseHandle(cf->file);
+#else
+   if (cf->view)
+      munmap(cf->view, cf->view_bytes);
+#endif
+   free(cf->block_offset);
+   free(cf);
+}
+
+/* Indexes the blocks of a packed file; a torn last block is left out */
+static int capture_file_index(CaptureFile *cf)
+{
+   const size_t size = cf->view_bytes - cf->header.header_bytes;
+   const ULNG block_samples = (ULNG)cf->header.block_frames * cf->header.frame_size;
+   ULNG samples = 0, capacity = 0;
+   size_t at = 0;
+
+   while (at + sizeof(PackedBlockHeader) <= size)
+   {
+      PackedBlockHeader blk;
+      memcpy(&blk, cf->codes + at, sizeof(blk));
+      if (blk.samples == 0 || blk.samples > block_samples || at + sizeof(blk) + blk.bytes > size)
+         break;
+      if (cf->blocks == capacity)
+      {
+         capacity = MAX(64UL, capacity * 2);
+         size_t *grown = realloc(cf->block_offset, capacity * sizeof(size_t));
+         if (grown == NULL)
+            return CFG_FAILURE;
+         cf->block_offset = grown;
+      }
+      cf->block_offset[cf->blocks++] = at;
+      samples += blk.samples;
+      at += sizeof(blk) + blk.bytes;
+      if (blk.samples < block_samples)
+         break; // only the last block is short
+   }
+   cf->frames = samples / cf->header.frame_size;
+   return CFG_SUCCESS;
+}
+
+/* Decodes block b of a packed file into codes (block_frames frames) */
+static BOOL capture_file_unpack(const CaptureFile *cf, ULNG b, void *codes)
+{
+   PackedBlockHeader blk;
+
+   memcpy(&blk, cf->codes + cf->block_offset[b], sizeof(blk));
+   return unpack_block((const unsigned char *)cf->codes + cf->block_offset[b] + sizeof(blk), blk.bytes,
+                       cf->header.width, blk.samples, cf->header.frame_size, codes);
+}
+
+CaptureFile *capture_file_open(const char *path)
+{
+   CaptureFile *cf = calloc(1, sizeof(CaptureFile));
+
+   if (cf == NULL)
+      return NULL;
+
+#if defined(_WIN32)
+   LARGE_INTEGER file_size;
+   cf->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   if (cf->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(cf->file, &file_size) ||
+       file_size.QuadPart < (LONGLONG)CAPTURE_FILE_MIN_HEADER)
+   {
+      capture_file_close(cf);
+      return NULL;
+   }
+   cf->view_bytes = (size_t)file_size.QuadPart;
+   cf->mapping = CreateFileMapping(cf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+   cf->view = cf->mapping ? MapViewOfFile(cf->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)CAPTURE_FILE_MIN_HEADER)
+   {
+      if (fd >= 0)
+         close(fd);
+      capture_file_close(cf);
+      return NULL;
+   }
+   cf->view_bytes = (size_t)st.st_size;
+   cf->view = mmap(NULL, cf->view_bytes, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (cf->view == MAP_FAILED)
+      cf->view = NULL;
+   else
+      madvise(cf->view, cf->view_bytes, MADV_SEQUENTIAL);
+#endif
+   if (cf->view == NULL)
+   {
+      capture_file_close(cf);
+      return NULL;
+   }
+
+   memcpy(&cf->header, cf->view, MIN(cf->view_bytes, sizeof(CaptureFileHeader)));
+   const UINT version = cf->header.version;
+   const BOOL input_order = version == CAPTURE_FILE_VERSION_INPUT_ORDER || version == CAPTURE_FILE_VERSION_INPUT_ORDER_PACKED;
+   const BOOL packed = version == CAPTURE_FILE_VERSION_PACKED || version == CAPTURE_FILE_VERSION_INPUT_ORDER_PACKED;
+   if (memcmp(cf->header.magic, CAPTURE_FILE_MAGIC, sizeof(CAPTURE_FILE_MAGIC)) != 0 ||
+       (!packed && !input_order && version != CAPTURE_FILE_VERSION) ||
+       cf->header.header_bytes < (input_order ? CAPTURE_FILE_MIN_HEADER : sizeof(CaptureFileHeader)) ||
+       cf->header.header_bytes > cf->view_bytes ||
+       cf->header.frame_size != (input_order ? NUM_CHANNELS : cf->header.listsize) ||
+       cf->header.listsize == 0 || cf->header.listsize > NUM_CHANNELS ||
+       (cf->header.width != 2 && cf->header.width != 4) ||
+       (packed && (cf->header.block_frames == 0 || cf->header.block_frames > PACK_BLOCK_FRAMES)))
+   {
+      capture_file_close(cf);
+      return NULL;
+   }
+
+   ChannelMap map = {.count = cf->header.frame_size};
+   UINT order[NUM_CHANNELS], used = 0;
+   if (input_order)
+      memcpy(cf->header.physical, channel_map_default.physical, sizeof(cf->header.physical));
+   memcpy(map.physical, cf->header.physical, sizeof(map.physical));
+   for (UINT k = 0; k < map.count; k++)
+   {
+      if (map.physical[k] >= NUM_CHANNELS || (used & (1u << map.physical[k])))
+      {
+         capture_file_close(cf);
+         return NULL;
+      }
+      used |= 1u << map.physical[k];
+   }
+   channel_map_order(&map, order);
+
+   cf->codes = (const char *)cf->view + cf->header.header_bytes;
+   if (packed)
+   {
+      if (capture_file_index(cf) == CFG_FAILURE)
+      {
+         capture_file_close(cf);
+         return NULL;
+      }
+   }
+   else
+   {
+      cf->frames = (ULNG)((cf->view_bytes - cf->header.header_bytes) /
+                          ((size_t)cf->header.frame_size * cf->header.width));
+   }
+
+   cf->conv.min = cf->header.min;
+   cf->conv.max = cf->header.max;
+   cf->conv.freq = cf->header.freq;
+   cf->conv.resolution = cf->header.resolution;
+   cf->conv.encoding = cf->header.encoding;
+   cf->conv.listsize = cf->header.listsize;
+   for (UINT k = 0; k < cf->header.frame_size; k++)
+   {
+      cf->conv.gainlist[k] = cf->header.gainlist[k];
+      cf->conv.sensitivity[k] = cf->header.sensitivity[order[k]];
+   }
+   if (conv_table_build(&cf->conv) == CFG_FAILURE)
+   {
+      capture_file_close(cf);
+      return NULL;
+   }
+   memcpy(cf->conv.order, order, sizeof(order));
+   return cf;
+}
+
+ULNG capture_file_frames(const CaptureFile *cf)
+{
+   return cf->frames;
+}
+
+DBL capture_file_frequency(const CaptureFile *cf)
+{
+   return cf->header.freq;
+}
+
+/* Output channels of the recording; physical (if not NULL) receives the input of each */
+UINT capture_file_channels(const CaptureFile *cf, UINT physical[NUM_CHANNELS])
+{
+   if (physical != NULL)
+      memcpy(physical, cf->header.physical, cf->header.frame_size * sizeof(UINT));
+   return cf->header.frame_size;
+}
+
+/* Converts frames [first, first + count) into out[channel][0..count) for the
+   capture_file_channels() output channels; returns the number of frames
+   converted, clipped to the end of the recording. */
+ULNG capture_file_read(const CaptureFile *cf, ULNG first, ULNG count, DBL *out[NUM_CHANNELS])
+{
+   if (first >= cf->frames)
+      return 0;
+   count = MIN(count, cf->frames - first);
+
+   const size_t frame_bytes = (size_t)cf->header.frame_size * cf->header.width;
+
+   if (cf->blocks == 0)
+   {
+      conv_frames(&cf->conv, cf->codes + first * frame_bytes, cf->header.width, count, cf->header.frame_size, out, 0);
+      return count;
+   }
+
+   /* packed: decode each block the window touches and convert its part */
+   const ULNG bf = cf->header.block_frames;
+   char *codes = malloc(bf * frame_bytes);
+   ULNG done = 0;
+   while (codes != NULL && done < count)
+   {
+      ULNG frame = first + done, at = frame % bf;
+      ULNG n = MIN(count - done, bf - at);
+      if (!capture_file_unpack(cf, frame / bf, codes))
+         break;
+      conv_frames(&cf->conv, codes + at * frame_bytes, cf->header.width, n, cf->header.frame_size, out, done);
+      done += n;
+   }
+   free(codes);
+   return done;
+}
+
+/* Copies the codes of frames [first, first + count) into codes, decoding packed
+   blocks; returns the number of frames copied. The codes keep the file's frame
+   layout, ascending input order. */
+ULNG capture_file_read_codes(const CaptureFile *cf, ULNG first, ULNG count, void *codes)
+{
+   if (first >= cf->frames)
+      return 0;
+   count = MIN(count, cf->frames - first);
+
+   const size_t frame_bytes = (size_t)cf->header.frame_size * cf->header.width;
+   if (cf->blocks == 0)
+   {
+      memcpy(codes, cf->codes + first * frame_bytes, count * frame_bytes);
+      return count;
+   }
+
+   const ULNG bf = cf->header.block_frames;
+   char *block = malloc(bf * frame_bytes);
+   ULNG done = 0;
+   while (block != NULL && done < count)
+   {
+      ULNG frame = first + done, at = frame % bf;
+      ULNG n = MIN(count - done, bf - at);
+      if (!capture_file_unpack(cf, frame / bf, block))
+         break;
+      memcpy((char *)codes + done * frame_bytes, block + at * frame_bytes, n * frame_bytes);
+      done += n;
+   }
+   free(block);
+   return done;
+}
+
+/* Live block subscription
+   While a run is going, the frames of every A/D buffer are also handed to
+   subscribers as soon as they are converted, at the full rate and independent
+   of the retained or streaming storage (frames the storage has no room for are
+   converted for the subscribers alone). A buffer becomes one block, or several
+   of at most block_frames when it is longer. Blocks are passed to a registered
+   callback (on the conversion thread) and/or kept in a ring that a consumer
+   drains with read_block(). When the ring is full the oldest unread block is
+   dropped and counted to make room, so a slow reader always gets the newest
+   data and sees the gap in the sequence numbers. The conversion thread is the
+   only writer; a reader that loses the block it is copying to a drop moves on
+   to the next one.
+*/
+#define SUB_SLOTS 32 // must be a power of two
+#define SUB_MASK (SUB_SLOTS - 1)
+
+/* Called on the conversion thread; the arrays are only valid during the call */
+typedef void (*BlockCallback)(DBL *const channel[NUM_CHANNELS], UINT frames, ULNG first_frame,
+                              ULNG sequence, void *user);
+
+typedef struct {
+   ULNG sequence;
+   ULNG first_frame;
+   UINT frames;
+   UINT channels; // output channels in the block, the rest of out[] is untouched
+} BlockHeader;
+
+typedef struct {
+   ULNG published; // blocks produced this run
+   ULNG dropped;   // unread blocks replaced by newer ones because the ring was full
+   ULNG read;      // blocks taken with read_block()
+} SubscriptionCounters;
+
+typedef struct Subscription {
+   BlockCallback callback;
+   void *user;
+   BOOL poll;
+   BOOL active;
+   UINT block_frames; // capacity of one block
+   UINT channels;     // output channels per block
+   DBL *data;         // SUB_SLOTS blocks, then one scratch block for the callback
+   BlockHeader header[SUB_SLOTS];
+   _Atomic ULNG head;
+   _Atomic ULNG tail; // advanced by the reader, and by the writer to drop the oldest block
+   _Atomic ULNG dropped;
+   ULNG read;
+   UINT slot;         // block being filled
+   UINT filled;       // frames in it, 0 when none is open
+   ULNG sequence;
+   ULNG next_frame;
+   Event ready;
+} Subscription;
+
+/* Registers the consumers of the next runs; poll keeps blocks for read_block() */
+int set_subscription(BlockCallback callback, void *user, bool poll)
+{
+   ctx->sub->callback = callback;
+   ctx->sub->user = user;
+   ctx->sub->poll = poll;
+   return CFG_SUCCESS;
+}
+
+static DBL *sub_block(UINT slot, UINT channel)
+{
+   return ctx->sub->data + ((size_t)slot * ctx->sub->channels + channel) * ctx->sub->block_frames;
+}
+
+int sub_begin(UINT block_frames)
+{
+   ctx->sub->active = FALSE;
+   if (ctx->sub->callback == NULL && !ctx->sub->poll)
+      return CFG_SUCCESS;
+
+   if (block_frames != ctx->sub->block_frames || capture_channels() != ctx->sub->channels || ctx->sub->data == NULL)
+   {
+      aligned_free(ctx->sub->data);
+      ctx->sub->block_frames = block_frames;
+      ctx->sub->channels = capture_channels();
+      ctx->sub->data = aligned_malloc((size_t)(SUB_SLOTS + 1) * ctx->sub->channels * block_frames * sizeof(DBL), DATA_ALIGNMENT);
+      if (ctx->sub->data == NULL)
+      {
+         ctx->sub->block_frames = 0;
+         return CFG_FAILURE;
+      }
+   }
+   if (ctx->sub->ready == NULL && (ctx->sub->ready = event_create()) == NULL)
+      return CFG_FAILURE;
+   atomic_store(&ctx->sub->head, 0);
+   atomic_store(&ctx->sub->tail, 0);
+   atomic_store(&ctx->sub->dropped, 0);
+   ctx->sub->read = 0;
+   ctx->sub->filled = 0;
+   ctx->sub->sequence = 0;
+   ctx->sub->next_frame = 0;
+   ctx->sub->active = TRUE;
+   return CFG_SUCCESS;
+}
+
+void sub_end()
+{
+   sub_flush();
+   ctx->sub->active = FALSE;
+   if (ctx->sub->ready)
+      event_set(ctx->sub->ready); // wake a reader waiting for a block that will not come
+}
+
+/* Opens the next block, dropping the oldest unread one when the ring is full */
+static void sub_open()
+{
+   ULNG head = atomic_load_explicit(&ctx->sub->head, memory_order_relaxed);
+   ULNG tail = atomic_load_explicit(&ctx->sub->tail, memory_order_acquire);
+
+   ctx->sub->slot = SUB_SLOTS; // the scratch block, when only the callback wants it
+   if (!ctx->sub->poll)
+      return;
+   if (head - tail == SUB_SLOTS &&
+       atomic_compare_exchange_strong_explicit(&ctx->sub->tail, &tail, tail + 1, memory_order_acq_rel,
+                                               memory_order_acquire))
+      atomic_fetch_add(&ctx->sub->dropped, 1);
+   // either the drop or the reader freed the oldest slot
+   ctx->sub->slot = (UINT)(head & SUB_MASK);
+}
+
+/* Hands the open block to the callback and the ring */
+void sub_flush()
+{
+   const UINT slot = ctx->sub->slot;
+   DBL *out[NUM_CHANNELS] = {NULL};
+
+   if (!ctx->sub->active || ctx->sub->filled == 0)
+      return;
+   if (ctx->sub->callback)
+   {
+      for (UINT c = 0; c < ctx->sub->channels; c++)
+         out[c] = sub_block(slot, c);
+      ctx->sub->callback(out, ctx->sub->filled, ctx->sub->next_frame, ctx->sub->sequence, ctx->sub->user);
+   }
+   if (slot < SUB_SLOTS)
+   {
+      ctx->sub->header[slot].sequence = ctx->sub->sequence;
+      ctx->sub->header[slot].first_frame = ctx->sub->next_frame;
+      ctx->sub->header[slot].frames = ctx->sub->filled;
+      atomic_store_explicit(&ctx->sub->head, atomic_load_explicit(&ctx->sub->head, memory_order_relaxed) + 1,
+                            memory_order_release);
+      event_set(ctx->sub->ready);
+   }
+   ctx->sub->sequence++;
+   ctx->sub->next_frame += ctx->sub->filled;
+   ctx->sub->filled = 0;
+}
+
+/* Room left in the open block, opening one if needed */
+static UINT sub_room()
+{
+   if (ctx->sub->filled == ctx->sub->block_frames)
+      sub_flush();
+   if (ctx->sub->filled == 0)
+      sub_open();
+   return ctx->sub->block_frames - ctx->sub->filled;
+}
+
+/* Adds frames [pos, pos + frames) of the converted channels src to the subscriber blocks */
+void sub_append(DBL *const src[NUM_CHANNELS], ULNG pos, ULNG frames)
+{
+   if (!ctx->sub->active)
+      return;
+   while (frames > 0)
+   {
+      UINT n = (UINT)MIN(frames, (ULNG)sub_room());
+      for (UINT c = 0; c < ctx->sub->channels; c++)
+         memcpy(sub_block(ctx->sub->slot, c) + ctx->sub->filled, src[c] + pos, n * sizeof(DBL));
+      ctx->sub->filled += n;
+      pos += n;
+      frames -= n;
+   }
+}
+
+/* Converts frames raw frames straight into the subscriber blocks, for frames the
+   storage does not take */
+void sub_convert(const ConvTable *ct, const void *raw, UINT width, ULNG frames, UINT stride)
+{
+   DBL *out[NUM_CHANNELS] = {NULL};
+
+   if (!ctx->sub->active)
+      return;
+   while (frames > 0)
+   {
+      UINT n = (UINT)MIN(frames, (ULNG)sub_room());
+      for (UINT c = 0; c < ctx->sub->channels; c++)
+         out[c] = sub_block(ctx->sub->slot, c);
+      conv_frames(ct, raw, width, n, stride, out, ctx->sub->filled);
+      ctx->sub->filled += n;
+      raw = (const char *)raw + (size_t)n * stride * width;
+      frames -= n;
+   }
+}
+
+/* Copies the oldest block into out[] (max_frames per channel) and returns its frame
+   count, waiting up to timeout_ms for one. Returns 0 when no block arrived. */
+UINT read_block(BlockHeader *header, DBL *out[NUM_CHANNELS], UINT max_frames, UINT timeout_ms)
+{
+   ULNG tail = atomic_load_explicit(&ctx->sub->tail, memory_order_acquire);
+
+   if (ctx->sub->data == NULL)
+      return 0;
+   if (atomic_load_explicit(&ctx->sub->head, memory_order_acquire) == tail)
+   {
+      if (timeout_ms == 0 || ctx->sub->ready == NULL)
+         return 0;
+      event_wait(ctx->sub->ready, timeout_ms);
+      tail = atomic_load_explicit(&ctx->sub->tail, memory_order_acquire);
+      if (atomic_load_explicit(&ctx->sub->head, memory_order_acquire) == tail)
+         return 0;
+   }
+
+   /* the writer may drop the block while it is copied; the exchange fails then and
+      the next oldest is taken instead */
+   UINT frames;
+   do
+   {
+      UINT slot = (UINT)(tail & SUB_MASK);
+      frames = MIN(ctx->sub->header[slot].frames, max_frames);
+      *header = ctx->sub->header[slot];
+      header->frames = frames;
+      header->channels = ctx->sub->channels;
+      for (UINT c = 0; c < ctx->sub->channels; c++)
+      {
+         if (out[c] != NULL)
+            memcpy(out[c], sub_block(slot, c), frames * sizeof(DBL));
+      }
+   } while (!atomic_compare_exchange_strong_explicit(&ctx->sub->tail, &tail, tail + 1, memory_order_acq_rel,
+                                                     memory_order_acquire));
+   ctx->sub->read++;
+   return frames;
+}
+
+/* Frames in the largest block of the current run, for sizing read_block() arrays */
+UINT get_block_frames()
+{
+   return ctx->sub->block_frames;
+}
+
+SubscriptionCounters get_subscription_counters()
+{
+   SubscriptionCounters c;
+   c.published = ctx->sub->sequence;
+   c.dropped = atomic_load(&ctx->sub->dropped);
+   c.read = ctx->sub->read;
+   return c;
+}
+
+BOOL save_data(HDASS hAD_v, HBUF hBuf_v, ULNG max_samples)
+{
+   /*
+      This function converts the specified buffer to g (volts for the DAC
+      channel) and appends it to measure_channels using the conversion
+      table built when the subsystem was configured. The function returns
+      TRUE if successful.
+   */
+   UINT strlen = 80;
+   char lpstr[80];
+   UINT size = 0L;
+   ECODE status = OLNOERROR;
+   ULNG samples;
+   LPVOID pRaw = NULL;
+
+   status = daq->DmGetValidSamples(hBuf_v, &samples);
+   if (status == OLNOERROR)
+      status = daq->DmGetDataWidth(hBuf_v, &size);
+   if (status != OLNOERROR)
+   {
+      daq->GetErrorString(status, lpstr, strlen);
+      return FALSE;
+   }
+
+   /* get pointer to the buffer */
+   CHECKERROR(daq->DmGetBufferPtr(hBuf_v, &pRaw));
+   samples = MIN(samples, max_samples);
+   record_append(pRaw, samples);
+   conv_buffer(ctx->conv_table, (ChannelData *)ctx->measure_channels, pRaw,
+               (ctx->conv_table->resolution > 16) ? 4 : 2, samples, ctx->conv_table->listsize);
+   sub_flush();
+
+   return TRUE;
+}
+
+/* Input buffer pool
+   The A/D buffers are sized from the sample rate, the channel count and a target
+   latency (the data in one buffer) instead of one second of samples each. Enough
+   buffers are queued to hold queue_seconds of data. The time spent processing
+   each buffer is measured and carried into the next plan: a queue shorter than
+   POOL_SAFETY times the worst stall gets more buffers, and buffers whose
+   processing takes more than POOL_MAX_LOAD of their own duration are made longer
+   so the per-buffer overhead is amortised.
+*/
+#define POOL_MAX_BUFFERS 64
+#define POOL_MIN_FRAMES 16
+#define POOL_MAX_SAMPLES (1UL << 20)
+#define POOL_SAFETY 2.0
+#define POOL_MAX_LOAD 0.5
+
+typedef struct PoolLimits {
+   DBL target_latency; // seconds of data per buffer
+   DBL queue_seconds;  // seconds of data queued in the driver
+   UINT min_buffers;
+   UINT max_buffers;
+} PoolLimits;
+
+static const PoolLimits pool_limits_default = {.target_latency = 0.1, .queue_seconds = 1.0, .min_buffers = 4,
+                                               .max_buffers = POOL_MAX_BUFFERS};
+
+typedef struct BufferPool {
+   UINT buffers;
+   ULNG buffer_samples; // frames * channels
+   DBL buffer_seconds;  // latency before a buffer is delivered
+   DBL queue_seconds;   // data the driver holds before it overruns
+   DBL process_mean;    // seconds to process one buffer, running mean
+   DBL process_max;     // worst processing time this run
+   DBL max_lag;         // latest buffer notification, relative to the earliest
+   DBL min_headroom;    // least queued data seen when a buffer arrived, seconds
+} BufferPool;
+
+int set_buffer_pool(DBL target_latency, DBL queue_seconds, UINT min_buffers, UINT max_buffers)
+{
+   if (target_latency <= 0 || queue_seconds <= 0 || min_buffers < 2 || min_buffers > max_buffers ||
+       max_buffers > POOL_MAX_BUFFERS)
+      return CFG_FAILURE;
+   ctx->pool_limits->target_latency = target_latency;
+   ctx->pool_limits->queue_seconds = queue_seconds;
+   ctx->pool_limits->min_buffers = min_buffers;
+   ctx->pool_limits->max_buffers = max_buffers;
+   return CFG_SUCCESS;
+}
+
+BufferPool get_buffer_pool()
+{
+   return *ctx->pool;
+}
+
+/* Works out the buffer count and size for rate frames per second of channels samples */
+void pool_plan(DBL rate, UINT channels)
+{
+   DBL seconds = ctx->pool_limits->target_latency;
+   ULNG frames;
+   UINT buffers;
+
+   if (ctx->pool->process_mean > 0 && ctx->pool_process_at > 0)
+   {
+      DBL load = ctx->pool->process_mean / ctx->pool_process_at;
+      if (load > POOL_MAX_LOAD)
+         seconds = MAX(seconds, ctx->pool_process_at * load / POOL_MAX_LOAD);
+   }
+   frames = (ULNG)floor(seconds * rate + 0.5);
+   frames = MAX(frames, POOL_MIN_FRAMES);
+   frames = MIN(frames, POOL_MAX_SAMPLES / channels);
+   seconds = frames / rate;
+
+   buffers = (UINT)ceil(ctx->pool_limits->queue_seconds / seconds - 1e-6);
+   if (ctx->pool_process_stall > 0)
+      buffers = MAX(buffers, (UINT)ceil(POOL_SAFETY * ctx->pool_process_stall / seconds) + 1);
+   buffers = MAX(ctx->pool_limits->min_buffers, MIN(buffers, ctx->pool_limits->max_buffers));
+
+   ctx->pool->buffers = buffers;
+   ctx->pool->buffer_samples = frames * channels;
+   ctx->pool->buffer_seconds = seconds;
+   ctx->pool->queue_seconds = buffers * seconds;
+   ctx->pool->process_max = 0;
+   ctx->pool->max_lag = 0;
+   ctx->pool->min_headroom = ctx->pool->queue_seconds;
+   ctx->pool_min_lag = HUGE_VAL;
+}
+
+/* Called with the end frame of every delivered buffer */
+void pool_note_arrival(ULNG end_frame)
+{
+   if (ctx->time_base->rate <= 0)
+      return;
+   DBL lag = monotonic_seconds() - ctx->time_base->start_seconds - end_frame / (ctx->time_base->rate * ctx->time_base->decimation);
+   ctx->pool_min_lag = MIN(ctx->pool_min_lag, lag);
+   ctx->pool->max_lag = MAX(ctx->pool->max_lag, lag - ctx->pool_min_lag);
+   ctx->pool->min_headroom = MIN(ctx->pool->min_headroom, (ctx->pool->buffers - 1) * ctx->pool->buffer_seconds - (lag - ctx->pool_min_lag));
+}
+
+/* Called with the time taken to store and convert one buffer */
+void pool_note_processing(DBL seconds)
+{
+   if (ctx->pool_process_at != ctx->pool->buffer_seconds)
+   {
+      ctx->pool->process_mean = seconds;
+      ctx->pool_process_at = ctx->pool->buffer_seconds;
+   }
+   ctx->pool->process_mean += (seconds - ctx->pool->process_mean) / 16;
+   ctx->pool->process_max = MAX(ctx->pool->process_max, seconds);
+   ctx->pool_process_stall = ctx->pool->process_max;
+}
+
+/* Instrumentation
+   On by default: every A/D buffer adds the time from its OLDA_WM_BUFFER_DONE
+   notification until it is back with the driver (handler) and the time taken to
+   convert and store it (convert) to log-bucketed histograms, next to counters of
+   the buffers, frames, drops and conversion queue depth. set_instrumentation(FALSE)
+   keeps only the counters, so a run can be timed without the histograms and the
+   clock reads that only they need. Each figure has a single
+   writer thread, so updates are plain relaxed loads and stores; readers on other
+   threads may see a histogram one buffer apart from its count. An optional dump
+   writes one summary line every period while the A/D runs, and one at the end.
+*/
+#define HIST_BUCKETS 40 // bucket b counts [2^b, 2^(b+1)) ns, the last one is open ended
+#define HIST_HANDLER 0
+#define HIST_CONVERT 1
+#define INSTR_PATH_LEN 260
+
+/* increment for counters that only one thread writes */
+#define INSTR_ADD(a, n) atomic_store_explicit(&(a), atomic_load_explicit(&(a), memory_order_relaxed) + (n), memory_order_relaxed)
+
+typedef struct {
+   ULNG count;
+   DBL mean; // seconds
+   DBL max;
+   ULNG bucket[HIST_BUCKETS];
+} LatencyHistogram;
+
+typedef struct {
+   ULNG buffers;         // A/D buffers delivered by the driver
+   ULNG frames;          // frames in them
+   ULNG frames_dropped;  // frames that found the capture storage full
+   ULNG buffers_dropped; // buffers given back unconverted because the conversion ring was full
+   UINT queue_depth;     // buffers waiting for the conversion worker at the last arrival
+   UINT queue_depth_max;
+} PipelineCounters;
+
+typedef struct {
+   _Atomic ULNG count;
+   _Atomic uint64_t total_ns;
+   _Atomic uint64_t max_ns;
+   _Atomic ULNG bucket[HIST_BUCKETS];
+} Histogram;
+
+typedef struct Instrumentation {
+   Histogram hist[2]; // HIST_HANDLER, HIST_CONVERT
+   _Atomic ULNG buffers;
+   _Atomic ULNG frames;
+   _Atomic ULNG buffers_dropped;
+   _Atomic UINT queue_depth;
+   _Atomic UINT queue_depth_max;
+   BOOL active;
+   BOOL disabled;   // set_instrumentation(FALSE): counters only
+   DBL dump_period; // seconds between dump lines, 0-off
+   DBL dump_next;
+   char dump_path[INSTR_PATH_LEN]; // empty for stdout
+   FILE *dump;
+} Instrumentation;
+
+static UINT hist_bucket(uint64_t ns)
+{
+   UINT b = 0;
+
+   for (UINT shift = 32; shift > 0; shift >>= 1)
+   {
+      if (ns >> shift)
+      {
+         ns >>= shift;
+         b += shift;
+      }
+   }
+   return MIN(b, HIST_BUCKETS - 1);
+}
+
+static void hist_add(Histogram *h, DBL seconds)
+{
+   uint64_t ns = (seconds > 0) ? (uint64_t)(seconds * 1e9) : 0;
+
+   INSTR_ADD(h->bucket[hist_bucket(ns)], 1);
+   INSTR_ADD(h->total_ns, ns);
+   if (ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed))
+      atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+   INSTR_ADD(h->count, 1);
+}
+
+/* Called on the handler thread for every delivered A/D buffer, done_at being the
+   monotonic_seconds() of its notification */
+void instr_note_buffer(ULNG frames, DBL done_at)
+{
+   INSTR_ADD(ctx->instr->buffers, 1);
+   INSTR_ADD(ctx->instr->frames, frames);
+   if (!ctx->instr->disabled)
+      hist_add(&ctx->instr->hist[HIST_HANDLER], monotonic_seconds() - done_at);
+}
+
+/* Called with the conversion queue depth after a buffer was offered to it */
+void instr_note_queue(UINT depth, BOOL dropped)
+{
+   if (dropped)
+      INSTR_ADD(ctx->instr->buffers_dropped, 1);
+   atomic_store_explicit(&ctx->instr->queue_depth, depth, memory_order_relaxed);
+   if (depth > atomic_load_explicit(&ctx->instr->queue_depth_max, memory_order_relaxed))
+      atomic_store_explicit(&ctx->instr->queue_depth_max, depth, memory_order_relaxed);
+}
+
+void instr_note_convert(DBL seconds)
+{
+   if (!ctx->instr->disabled)
+      hist_add(&ctx->instr->hist[HIST_CONVERT], seconds);
+}
+
+int get_latency_histogram(int which, LatencyHistogram *out)
+{
+   if (which != HIST_HANDLER && which != HIST_CONVERT)
+      return CFG_FAILURE;
+
+   Histogram *h = &ctx->instr->hist[which];
+   out->count = atomic_load_explicit(&h->count, memory_order_relaxed);
+   out->mean = (out->count > 0) ? atomic_load_explicit(&h->total_ns, memory_order_relaxed) * 1e-9 / out->count : 0;
+   out->max = atomic_load_explicit(&h->max_ns, memory_order_relaxed) * 1e-9;
+   for (int b = 0; b < HIST_BUCKETS; b++)
+      out->bucket[b] = atomic_load_explicit(&h->bucket[b], memory_order_relaxed);
+   return CFG_SUCCESS;
+}
+
+/* Upper edge of the bucket holding fraction p of the samples, capped at the maximum */
+DBL latency_percentile(const LatencyHistogram *h, DBL p)
+{
+   ULNG seen = 0;
+   ULNG total = 0;
+
+   for (int b = 0; b < HIST_BUCKETS; b++)
+      total += h->bucket[b];
+   if (total == 0)
+      return 0;
+   for (int b = 0; b < HIST_BUCKETS; b++)
+   {
+      seen += h->bucket[b];
+      if (seen >= p * total)
+         return MIN(ldexp(1e-9, b + 1), h->max);
+   }
+   return h->max;
+}
+
+PipelineCounters get_pipeline_counters()
+{
+   PipelineCounters c;
+   c.buffers = atomic_load_explicit(&ctx->instr->buffers, memory_order_relaxed);
+   c.frames = atomic_load_explicit(&ctx->instr->frames, memory_order_relaxed);
+   c.frames_dropped = ctx->capture->counters.frames_dropped;
+   c.buffers_dropped = atomic_load_explicit(&ctx->instr->buffers_dropped, memory_order_relaxed);
+   c.queue_depth = atomic_load_explicit(&ctx->instr->queue_depth, memory_order_relaxed);
+   c.queue_depth_max = atomic_load_explicit(&ctx->instr->queue_depth_max, memory_order_relaxed);
+   return c;
+}
+
+/* Turns the latency histograms on or off (the counters always run) */
+int set_instrumentation(bool enabled)
+{
+   ctx->instr->disabled = !enabled;
+   return CFG_SUCCESS;
+}
+
+/* Dumps a summary line every period_seconds of the next runs (0 disables) to path, or stdout if NULL */
+int set_instrumentation_dump(DBL period_seconds, const char *path)
+{
+   if (period_seconds < 0 || (path != NULL && strlen(path) >= INSTR_PATH_LEN))
+      return CFG_FAILURE;
+   ctx->instr->dump_period = period_seconds;
+   strcpy(ctx->instr->dump_path, (path != NULL) ? path : "");
+   return CFG_SUCCESS;
+}
+
+void instr_dump(DBL now)
+{
+   LatencyHistogram h[2];
+   PipelineCounters c = get_pipeline_counters();
+
+   if (ctx->instr->dump == NULL)
+      return;
+   get_latency_histogram(HIST_HANDLER, &h[0]);
+   get_latency_histogram(HIST_CONVERT, &h[1]);
+   fprintf(ctx->instr->dump, "%.3f,%lu,%lu,%lu,%lu,%u,%u", now - ctx->schedule->start_time, c.buffers, c.frames,
+           c.frames_dropped, c.buffers_dropped, c.queue_depth, c.queue_depth_max);
+   for (int i = 0; i < 2; i++)
+      fprintf(ctx->instr->dump, ",%.1f,%.1f,%.1f", latency_percentile(&h[i], 0.5) * 1e6,
+              latency_percentile(&h[i], 0.99) * 1e6, h[i].max * 1e6);
+   fprintf(ctx->instr->dump, "\n");
+   fflush(ctx->instr->dump);
+}
+
+/* Called from the notification loop; writes a line when the period has elapsed */
+void instr_dump_tick()
+{
+   if (!ctx->instr->active || ctx->instr->dump == NULL)
+      return;
+   DBL now = monotonic_seconds();
+   if (now < ctx->instr->dump_next)
+      return;
+   instr_dump(now);
+   ctx->instr->dump_next = now + ctx->instr->dump_period;
+}
+
+/* Clears the figures for a new run; called before the A/D starts */
+void instr_begin()
+{
+   for (int i = 0; i < 2; i++)
+   {
+      Histogram *h = &ctx->instr->hist[i];
+      atomic_store(&h->count, 0);
+      atomic_store(&h->total_ns, 0);
+      atomic_store(&h->max_ns, 0);
+      for (int b = 0; b < HIST_BUCKETS; b++)
+         atomic_store(&h->bucket[b], 0);
+   }
+   atomic_store(&ctx->instr->buffers, 0);
+   atomic_store(&ctx->instr->frames, 0);
+   atomic_store(&ctx->instr->buffers_dropped, 0);
+   atomic_store(&ctx->instr->queue_depth, 0);
+   atomic_store(&ctx->instr->queue_depth_max, 0);
+
+   ctx->instr->dump = NULL;
+   if (ctx->instr->dump_period > 0)
+   {
+      if (ctx->instr->dump_path[0] == '\0')
+         ctx->instr->dump = stdout;
+      else if ((ctx->instr->dump = fopen(ctx->instr->dump_path, "a")) != NULL && ftell(ctx->instr->dump) == 0)
+         fprintf(ctx->instr->dump, "seconds,buffers,frames,frames_dropped,buffers_dropped,queue_depth,queue_depth_max,"
+                                  "handler_p50_us,handler_p99_us,handler_max_us,convert_p50_us,convert_p99_us,convert_max_us\n");
+   }
+   ctx->instr->dump_next = monotonic_seconds() + ctx->instr->dump_period;
+   ctx->instr->active = TRUE;
+}
+
+/* Writes the final line once the conversion worker has finished the run */
+void instr_end()
+{
+   if (!ctx->instr->active)
+      return;
+   ctx->instr->active = FALSE;
+   instr_dump(monotonic_seconds());
+   if (ctx->instr->dump != NULL && ctx->instr->dump != stdout)
+      fclose(ctx->instr->dump);
+   ctx->instr->dump = NULL;
+}
+
+/* Raw buffer hand-off between the OLDA_WM_BUFFER_DONE handler and the conversion worker
+   The handler copies the driver buffer into the next free slot of a single-producer/
+   single-consumer ring and returns it to the driver straight away; the worker drains
+   the ring and runs the conversion and storage. head is only written by the handler,
+   tail only by the worker, so no lock is needed. A buffer that finds the ring full
+   is counted in dropped_buffers and stops the run with STOP_REASON_OVERRUN, the
+   same as a driver overrun. Buffers still arriving before the stop takes effect
+   are dropped as well, so the run keeps exactly the frames ahead of the first
+   lost one and the time base, trigger, statistics and PSD never span a gap.
+   Each run sizes the ring to the driver queue (the pool's buffer count rounded up
+   to a power of two), so the worker may fall as far behind as the driver itself
+   tolerates before a buffer is lost.
+*/
+#define RING_MAX_SLOTS POOL_MAX_BUFFERS // must be a power of two
+
+typedef struct {
+   ULNG samples; // valid samples copied from the driver buffer
+   UINT width;   // bytes per sample
+   LPVOID data;
+} RawBlock;
+
+typedef struct RawRing {
+   RawBlock slot[RING_MAX_SLOTS];
+   UINT slots; // in use this run, a power of two
+   ULNG slot_bytes;
+   _Atomic ULNG head;
+   _Atomic ULNG tail;
+   _Atomic BOOL stop;
+   ULNG dropped_buffers; // buffers returned to the driver without being converted
+   BOOL overrun;         // a buffer was dropped, nothing more is taken this run
+   Event ready;          // auto-reset event signalled on every push
+   Thread worker;
+   BOOL active;
+} RawRing;
+
+BOOL ring_push(RawRing *ring, HBUF hBuf_v, ULNG max_samples)
+{
+   ULNG head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   ULNG tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+   ULNG samples = 0;
+   UINT width = 0;
+   LPVOID pRaw = NULL;
+
+   if (ring->overrun || head - tail == ring->slots)
+   {
+      /* the worker is a whole ring behind: the run ends with an overrun rather than
+         going on with a hole in the data */
+      ring->dropped_buffers++;
+      ring->overrun = TRUE;
+      instr_note_queue((UINT)(head - tail), TRUE);
+      schedule_stop(STOP_REASON_OVERRUN);
+      return FALSE;
+   }
+
+   width = (ctx->conv_table->resolution > 16) ? 4 : 2;
+   if (daq->DmGetValidSamples(hBuf_v, &samples) != OLNOERROR ||
+       daq->DmGetBufferPtr(hBuf_v, &pRaw) != OLNOERROR)
+      return FALSE;
+
+   RawBlock *blk = &ring->slot[head & (ring->slots - 1)];
+   blk->samples = MIN(MIN(samples, max_samples), ring->slot_bytes / width);
+   blk->width = width;
+   memcpy(blk->data, pRaw, blk->samples * width);
+
+   atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+   event_set(ring->ready);
+   instr_note_queue((UINT)(head + 1 - tail), FALSE);
+   return TRUE;
+}
+
+/* TRUE while the conversion worker is more than half a ring behind the handler */
+BOOL conv_backlogged(void)
+{
+   if (!ctx->raw_ring->active)
+      return FALSE;
+   return atomic_load_explicit(&ctx->raw_ring->head, memory_order_relaxed) -
+              atomic_load_explicit(&ctx->raw_ring->tail, memory_order_acquire) >= ctx->raw_ring->slots / 2;
+}
+
+static void ring_drain(RawRing *ring)
+{
+   ULNG tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   ULNG head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+   while (tail != head)
+   {
+      RawBlock *blk = &ring->slot[tail & (ring->slots - 1)];
+      DBL t0 = monotonic_seconds();
+      record_append(blk->data, blk->samples);
+      conv_buffer(ctx->conv_table, (ChannelData *)ctx->measure_channels, blk->data,
+                  blk->width, blk->samples, ctx->conv_table->listsize);
+      sub_flush();
+      DBL seconds = monotonic_seconds() - t0;
+      pool_note_processing(seconds);
+      instr_note_convert(seconds);
+      tail++;
+      atomic_store_explicit(&ring->tail, tail, memory_order_release);
+      if (tail == head)
+         head = atomic_load_explicit(&ring->head, memory_order_acquire);
+   }
+}
+
+ThreadResult THREAD_CALL conv_worker(LPVOID lpParam)
+{
+   RawRing *ring;
+
+   ctx_selected = (DeviceContext *)lpParam; // the device that started the worker
+   ring = ctx->raw_ring;
+   for (;;)
+   {
+      /* read stop before draining so every block pushed ahead of it is converted */
+      BOOL stopping = atomic_load_explicit(&ring->stop, memory_order_acquire);
+      ring_drain(ring);
+      if (stopping)
+         break;
+      event_wait(ring->ready, 0xFFFFFFFF);
+   }
+   return 0;
+}
+
+int conv_worker_start(RawRing *ring, UINT buffers, ULNG buffer_samples)
+{
+   ring->slots = 2;
+   while (ring->slots < buffers && ring->slots < RING_MAX_SLOTS)
+      ring->slots *= 2;
+   ring->slot_bytes = buffer_samples * sizeof(DWORD);
+   ring->dropped_buffers = 0;
+   ring->overrun = FALSE;
+   atomic_store(&ring->head, 0);
+   atomic_store(&ring->tail, 0);
+   atomic_store(&ring->stop, FALSE);
+
+   for (int i = 0; i < (int)ring->slots; i++)
+   {
+      ring->slot[i].data = malloc(ring->slot_bytes);
+      if (ring->slot[i].data == NULL)
+      {
+         for (i--; i >= 0; i--)
+            free(ring->slot[i].data);
+         return CFG_FAILURE;
+      }
+   }
+
+   ring->ready = event_create();
+   ring->active = ring->ready && thread_create(&ring->worker, conv_worker, ctx);
+   if (!ring->active)
+   {
+      if (ring->ready)
+         event_destroy(ring->ready);
+      for (int i = 0; i < (int)ring->slots; i++)
+         free(ring->slot[i].data);
+      return CFG_FAILURE;
+   }
+   return CFG_SUCCESS;
+}
+
+void conv_worker_stop(RawRing *ring)
+{
+   if (!ring->active)
+      return;
+
+   atomic_store_explicit(&ring->stop, TRUE, memory_order_release);
+   event_set(ring->ready);
+   thread_join(ring->worker);
+   event_destroy(ring->ready);
+   ring->active = FALSE;
+   ring->ready = NULL;
+
+   for (int i = 0; i < (int)ring->slots; i++)
+   {
+      free(ring->slot[i].data);
+      ring->slot[i].data = NULL;
+   }
+   LOG_PRINT("Conversion worker stopped, %lu buffers dropped\n", ring->dropped_buffers);
+}
+
+ULNG get_dropped_buffers()
+{
+   return ctx->raw_ring->dropped_buffers;
+}
+
+/* UNUSED: can be used to get a single value from 1 channel*/
+void process_data(HDASS hAD_v, HBUF hBuffer)
+{
+   /*
+     This function writes the specified buffer record a single voltage
+     value from a single channel. It prints the value to the console
+  */
+   DBL min = 0, max = 0;
+   DBL volts;
+   ULNG value;
+   ULNG samples;
+   UINT encoding = 0, resolution = 0;
+   PDWORD pBuffer32 = NULL;
+   PWORD pBuffer = NULL;
+
+   if (hBuffer)
+   {
+
+      /* get sub system information for code/volts conversion */
+      daq->GetRange(hAD_v, &max, &min);
+      daq->GetEncoding(hAD_v, &encoding);
+      daq->GetResolution(hAD_v, &resolution);
+
+      /* get max samples in input buffer */
+      daq->DmGetValidSamples(hBuffer, &samples);
+
+      /* get pointer to the buffer */
+      if (resolution > 16)
+      {
+         daq->DmGetBufferPtr(hBuffer, (LPVOID *)&pBuffer32);
+         /* get last sample in buffer */
+         value = pBuffer32[samples - 1];
+      }
+      else
+      {
+         daq->DmGetBufferPtr(hBuffer, (LPVOID *)&pBuffer);
+         /* get last sample in buffer */
+         value = pBuffer[samples - 1];
+      }
+      /*  convert value to volts */
+
+      if (encoding != OL_ENC_BINARY)
+      {
+         /* convert to offset binary by inverting the sign bit */
+
+         value ^= 1L << (resolution - 1);
+         value &= (1L << resolution) - 1; /* zero upper bits */
+      }
+
+      volts = ((float)max - (float)min) / (1L << resolution) * value + (float)min;
+      fflush(stdout);
+      LOG_PRINT("%lf\r", volts * 1000);
+   }
+}
+
+/* Number of samples of a completed buffer that fall inside the frame limit */
+ULNG schedule_take(HBUF hBuf_v)
+{
+   ULNG samples = 0;
+
+   if (daq->DmGetValidSamples(hBuf_v, &samples) != OLNOERROR)
+      return 0;
+   ULNG frames = samples / ctx->conv_table->listsize;
+   ctx->schedule->frames_delivered += frames;
+   if (ctx->schedule->limit_reached)
+      return 0;
+   if (ctx->schedule->frame_limit == 0)
+   {
+      ctx->schedule->frames_seen += frames;
+      return samples;
+   }
+
+   ULNG keep = MIN(frames, ctx->schedule->frame_limit - ctx->schedule->frames_seen);
+   ctx->schedule->frames_seen += keep;
+   if (ctx->schedule->frames_seen == ctx->schedule->frame_limit)
+      ctx->schedule->limit_reached = TRUE;
+   return (keep == frames) ? samples : keep * ctx->conv_table->listsize;
+}
+
+/* Handles the notifications the backend posts for the A/D subsystem */
+void daq_event(HDASS hAD_v, UINT msg)
+{
+   if (output_event(hAD_v, msg))
+      return;
+
+   switch (msg)
+   {
+   case OLDA_WM_BUFFER_DONE:
+   {
+      LOG_PRINT("Buffer Done Count: %d \r", ctx->counter);
+      DBL done_at = ctx->instr->disabled ? 0 : monotonic_seconds();
+      HBUF hBuf = NULL;
+      ctx->counter++;
+      daq->GetBuffer(hAD_v, &hBuf);
+      if (hBuf)
+      {
+         ULNG delivered = ctx->schedule->frames_delivered;
+         ULNG keep = schedule_take(hBuf);
+         time_base_mark(ctx->schedule->frames_delivered);
+         pool_note_arrival(ctx->schedule->frames_delivered);
+         //   process_data( hAD_v, hBuf );
+         if (keep > 0)
+         {
+#if EN_CONVERSION_WORKER
+            ring_push(ctx->raw_ring, hBuf, keep);
+#else
+            DBL t0 = monotonic_seconds();
+            save_data(hAD_v, hBuf, keep);
+            DBL seconds = monotonic_seconds() - t0;
+            pool_note_processing(seconds);
+            instr_note_convert(seconds);
+#endif
+         }
+         daq->PutBuffer(hAD_v, hBuf);
+         instr_note_buffer(ctx->schedule->frames_delivered - delivered, done_at);
+         if (ctx->schedule->limit_reached)
+            schedule_stop(ctx->schedule->limit_reason);
+      }
+   }
+   break;
+
+   case OLDA_WM_QUEUE_DONE:
+      LOG_PRINT("Error: Acquisition stopped, rate too fast for current options.\n");
+      schedule_stop(STOP_REASON_QUEUE_DONE);
+      break;
+
+   case OLDA_WM_TRIGGER_ERROR:
+      LOG_PRINT("Trigger error: acquisition stopped.\n");
+      schedule_stop(STOP_REASON_TRIGGER_ERROR);
+      break;
+
+   case OLDA_WM_OVERRUN_ERROR:
+      LOG_PRINT("Input overrun error: acquisition stopped.\n");
+      schedule_stop(STOP_REASON_OVERRUN);
+      break;
+   }
+}
+
+#if DT_OPENLAYERS
+/* This function is a windows api callback for processing the data buffers*/
+LRESULT WINAPI
+WndProc(HWND hWnd_v, UINT msg, WPARAM hAD_v, LPARAM lParam)
+{
+   switch (msg)
+   {
+   case OLDA_WM_BUFFER_DONE:
+   case OLDA_WM_QUEUE_DONE:
+   case OLDA_WM_TRIGGER_ERROR:
+   case OLDA_WM_OVERRUN_ERROR:
+   case OLDA_WM_UNDERRUN_ERROR:
+      daq_event((HDASS)hAD_v, msg);
+      break;
+
+   default:
+      return DefWindowProc(hWnd_v, msg, hAD_v, lParam);
+   }
+
+   return 0;
+}
+#endif
+
+/* Waveform synthesis
+   The D/A runs in single wrap mode, replaying one buffer forever, so the buffer
+   must hold a whole number of periods or the output jumps at every wrap. The
+   buffer length is chosen so that periods * clock / frequency is an integer
+   (within WAVE_FREQ_TOLERANCE), and the waveform is evaluated from the integer
+   phase index. Volts are converted to codes in one pass with the range folded
+   into a single scale and offset.
+*/
+#define WAVE_SQUARE 0
+#define WAVE_SINE 1
+#define WAVE_TRIANGLE 2
+#define WAVE_CHIRP 3     // linear sweep from the generate() frequency to chirp_end
+#define WAVE_ARBITRARY 4 // one period of user samples (volts) at the D/A clock
+
+#define WAVE_MAX_SAMPLES 262144   // longest buffer searched / synthesized
+#define WAVE_FREQ_TOLERANCE 1e-6  // relative frequency error accepted for a length
+
+typedef struct WaveSpec {
+   int shape;
+   DBL chirp_end;     // Hz
+   DBL chirp_seconds; // sweep length
+   DBL *samples;      // WAVE_ARBITRARY, owned copy
+   UINT num_samples;
+} WaveSpec;
+
+typedef struct WaveInfo {
+   UINT samples;  // buffer length
+   UINT periods;  // whole periods (sweeps for a chirp) in the buffer
+   DBL frequency; // frequency actually produced, Hz (mean frequency for a chirp)
+} WaveInfo;
+
+int set_waveform(int shape, DBL chirp_end, DBL chirp_seconds)
+{
+   if (shape < WAVE_SQUARE || shape > WAVE_ARBITRARY)
+      return CFG_FAILURE;
+   if (shape == WAVE_CHIRP && (chirp_end <= 0 || chirp_seconds <= 0))
+      return CFG_FAILURE;
+   ctx->wave->shape = shape;
+   ctx->wave->chirp_end = chirp_end;
+   ctx->wave->chirp_seconds = chirp_seconds;
+   return CFG_SUCCESS;
+}
+
+/* Copies one period of samples (volts) and selects WAVE_ARBITRARY */
+int set_arbitrary_waveform(const DBL *volts, UINT count)
+{
+   if (volts == NULL || count < 2 || count > WAVE_MAX_SAMPLES)
+      return CFG_FAILURE;
+   DBL *copy = malloc(count * sizeof(DBL));
+   if (copy == NULL)
+      return CFG_FAILURE;
+   memcpy(copy, volts, count * sizeof(DBL));
+   free(ctx->wave->samples);
+   ctx->wave->samples = copy;
+   ctx->wave->num_samples = count;
+   ctx->wave->shape = WAVE_ARBITRARY;
+   return CFG_SUCCESS;
+}
+
+WaveInfo get_waveform_info()
+{
+   return *ctx->wave_info;
+}
+
+/* Shortest length holding a whole number of periods of frequency at clk_freq,
+   or the most accurate one up to max_samples. Returns 0 if no period fits. */
+UINT wave_buffer_length(DBL clk_freq, DBL frequency, UINT max_samples, UINT *periods)
+{
+   DBL per_period = clk_freq / frequency;
+   DBL best_err = HUGE_VAL;
+   UINT best_n = 0;
+
+   *periods = 0;
+   for (UINT p = 1; p * per_period < max_samples + 0.5; p++)
+   {
+      UINT n = (UINT)floor(p * per_period + 0.5);
+      DBL err = fabs(n - p * per_period) / (p * per_period);
+
+      if (n < 2 || err >= best_err)
+         continue;
+      best_err = err;
+      best_n = n;
+      *periods = p;
+      if (err < WAVE_FREQ_TOLERANCE)
+         break;
+   }
+   return best_n;
+}
+
+/* Evaluates the selected waveform into a newly allocated buffer of volts.
+   The base pattern is repeated to fill up to MAX_BUFFER_SIZE samples. */
+DBL *wave_synthesize(const WaveSpec *w, DBL clk_freq, DBL amplitude, DBL frequency, WaveInfo *info)
+{
+   UINT n = 0, periods = 1;
+   DBL f0 = frequency, f1 = frequency;
+
+   switch (w->shape)
+   {
+   case WAVE_ARBITRARY:
+      n = w->num_samples;
+      break;
+   case WAVE_CHIRP:
+   {
+      /* whole cycles per sweep so the phase is continuous across the wrap */
+      DBL mean = (w->chirp_end + frequency) / 2;
+      DBL cycles = MAX(1.0, floor(mean * w->chirp_seconds + 0.5));
+      n = (UINT)floor(cycles / mean * clk_freq + 0.5);
+      f0 *= cycles * clk_freq / n / mean;
+      f1 = w->chirp_end * cycles * clk_freq / n / mean;
+      break;
+   }
+   default:
+      if (frequency > 0)
+         n = wave_buffer_length(clk_freq, frequency, WAVE_MAX_SAMPLES, &periods);
+      break;
+   }
+   if (n < 2 || n > WAVE_MAX_SAMPLES)
+      return NULL;
+
+   UINT repeat = (n < MAX_BUFFER_SIZE) ? MAX_BUFFER_SIZE / n : 1;
+   DBL *volts = malloc((size_t)n * repeat * sizeof(DBL));
+   if (volts == NULL)
+      return NULL;
+
+   for (UINT i = 0; i < n; i++)
+   {
+      DBL t = (DBL)(((uint64_t)i * periods) % n) / n; // phase in periods, exact
+      switch (w->shape)
+      {
+      case WAVE_SINE:
+         volts[i] = amplitude * sin(2 * M_PI * t);
+         break;
+      case WAVE_TRIANGLE:
+         volts[i] = amplitude * (1 - 4 * fabs(t - 0.5));
+         break;
+      case WAVE_CHIRP:
+      {
+         DBL s = i / clk_freq, sweep = n / clk_freq;
+         volts[i] = amplitude * sin(2 * M_PI * (f0 * s + (f1 - f0) * s * s / (2 * sweep)));
+         break;
+      }
+      case WAVE_ARBITRARY:
+         volts[i] = w->samples[i];
+         break;
+      default:
+         volts[i] = (2 * t < 1) ? -amplitude : amplitude;
+         break;
+      }
+   }
+   for (UINT r = 1; r < repeat; r++)
+      memcpy(volts + (size_t)r * n, volts, n * sizeof(DBL));
+
+   info->samples = n * repeat;
+   info->periods = periods * repeat;
+   info->frequency = (w->shape == WAVE_CHIRP) ? (f0 + f1) / 2 : periods * clk_freq / n;
+   return volts;
+}
+
+/* Batched volts to code conversion, same rounding and clamping as olDaVoltsToCode */
+void wave_to_codes(const DBL *volts, UINT count, DBL min, DBL max, UINT resolution, UINT encoding,
+                   void *codes, UINT width)
+{
+   DBL full = ldexp(1.0, resolution);
+   DBL scale = full / (max - min), offset = -min * scale + 0.5;
+   ULNG flip = (encoding != OL_ENC_BINARY) ? 1UL << (resolution - 1) : 0;
+
+   for (UINT i = 0; i < count; i++)
+   {
+      DBL c = floor(volts[i] * scale + offset);
+      ULNG code = (ULNG)MAX(0.0, MIN(c, full - 1)) ^ flip;
+      if (width > 2)
+         ((DWORD *)codes)[i] = (DWORD)code;
+      else
+         ((WORD *)codes)[i] = (WORD)code;
+   }
+}
+
+/* Continuous D/A streaming
+   Instead of replaying one table in OL_WRP_SINGLE mode, OUT_NUM_BUFFERS buffers
+   rotate through the D/A in OL_WRP_NONE mode. Every OLDA_WM_BUFFER_DONE from the
+   D/A hands the played buffer back, which is refilled from the producer and
+   queued again. The producer is a callback, a file of little-endian float64
+   volts, or the selected waveform evaluated at the running sample index (a
+   chirp then sweeps once instead of repeating). If the queue runs dry before
+   the producer has finished the board stops with an underrun.
+*/
+#define OUT_NUM_BUFFERS 4
+#define OUT_BUFFER_SECONDS 0.1 // length of each output buffer
+#define OUT_MIN_BUFFER 256
+
+/* Fills volts[0..count-1] from sample first_sample on and returns the samples
+   written; returning fewer than count ends the stream after them */
+typedef UINT (*OutputProducer)(DBL *volts, UINT count, ULNG first_sample, void *user);
+
+typedef struct {
+   ULNG buffers_played;
+   ULNG samples_played;
+   ULNG samples_queued;
+   ULNG underruns;
+   UINT min_queued; // fewest buffers left queued when one completed (headroom)
+} OutputCounters;
+
+typedef struct OutputStream {
+   BOOL streaming;
+   OutputProducer producer;
+   void *user;
+   char path[260];
+   FILE *file;
+   OutputProducer fill; // producer of the current run
+   void *fill_user;
+   BOOL active;   // buffers are rotating on hda
+   BOOL finished; // producer has delivered its last sample
+   DBL limit_seconds; // timed runs stop the output after this long, 0-no limit
+   ULNG sample_limit;
+   HDASS hda;
+   HBUF buf[OUT_NUM_BUFFERS];
+   DBL *volts;
+   UINT buffer_samples;
+   UINT queued;
+   ULNG next_sample;
+   DBL clk_freq, amplitude, frequency;
+   DBL min, max;
+   UINT resolution, encoding, width;
+   OutputCounters counters;
+} OutputStream;
+
+/* Enables streaming output for generate(). With no producer and no path the
+   waveform selected by set_waveform() is streamed. */
+int set_output_stream(bool enable, OutputProducer producer, void *user, const char *path)
+{
+   ctx->output->streaming = enable;
+   ctx->output->producer = producer;
+   ctx->output->user = user;
+   ctx->output->path[0] = '\0';
+   if (path != NULL)
+   {
+      strncpy(ctx->output->path, path, sizeof(ctx->output->path) - 1);
+      ctx->output->path[sizeof(ctx->output->path) - 1] = '\0';
+   }
+   return CFG_SUCCESS;
+}
+
+OutputCounters get_output_counters()
+{
+   return ctx->output->counters;
+}
+
+static UINT output_file_producer(DBL *volts, UINT count, ULNG first_sample, void *user)
+{
+   return (UINT)fread(volts, sizeof(DBL), count, (FILE *)user);
+}
+
+/* Continuous phase version of wave_synthesize() for streaming */
+static UINT output_wave_producer(DBL *volts, UINT count, ULNG first_sample, void *user)
+{
+   const WaveSpec *w = (const WaveSpec *)user;
+   DBL a = ctx->output->amplitude, f = ctx->output->frequency, clk = ctx->output->clk_freq;
+
+   if (w->shape == WAVE_CHIRP)
+   {
+      ULNG total = (ULNG)(w->chirp_seconds * clk);
+      count = (first_sample < total) ? (UINT)MIN((ULNG)count, total - first_sample) : 0;
+   }
+   for (UINT i = 0; i < count; i++)
+   {
+      ULNG k = first_sample + i;
+      DBL t = fmod((DBL)k * f / clk, 1.0);
+      switch (w->shape)
+      {
+      case WAVE_SINE:
+         volts[i] = a * sin(2 * M_PI * t);
+         break;
+      case WAVE_TRIANGLE:
+         volts[i] = a * (1 - 4 * fabs(t - 0.5));
+         break;
+      case WAVE_CHIRP:
+      {
+         DBL s = k / clk;
+         volts[i] = a * sin(2 * M_PI * fmod(f * s + (w->chirp_end - f) * s * s / (2 * w->chirp_seconds), 1.0));
+         break;
+      }
+      case WAVE_ARBITRARY:
+         volts[i] = w->samples[k % w->num_samples];
+         break;
+      default:
+         volts[i] = (2 * t < 1) ? -a : a;
+         break;
+      }
+   }
+   return count;
+}
+
+/* Refills hBuf_v from the producer; returns the samples it now holds */
+UINT output_fill(HBUF hBuf_v)
+{
+   LPVOID codes;
+   UINT n;
+
+   if (ctx->output->finished || daq->DmGetBufferPtr(hBuf_v, &codes) != OLNOERROR)
+      return 0;
+   n = ctx->output->buffer_samples;
+   if (ctx->output->sample_limit > 0)
+      n = (UINT)MIN((ULNG)n, ctx->output->sample_limit - ctx->output->next_sample);
+   if (n > 0)
+      n = ctx->output->fill(ctx->output->volts, n, ctx->output->next_sample, ctx->output->fill_user);
+   n = MIN(n, ctx->output->buffer_samples);
+   if (n < ctx->output->buffer_samples)
+      ctx->output->finished = TRUE;
+   if (n == 0 || daq->DmSetValidSamples(hBuf_v, n) != OLNOERROR)
+      return 0;
+   wave_to_codes(ctx->output->volts, n, ctx->output->min, ctx->output->max, ctx->output->resolution, ctx->output->encoding, codes, ctx->output->width);
+   ctx->output->next_sample += n;
+   ctx->output->counters.samples_queued += n;
+   return n;
+}
+
+void output_stream_release()
+{
+   HBUF hBuf_v;
+
+   if (ctx->output->hda)
+   {
+      while (daq->GetBuffer(ctx->output->hda, &hBuf_v) == OLNOERROR && hBuf_v != NULL)
+         ;
+   }
+   for (int i = 0; i < OUT_NUM_BUFFERS; i++)
+   {
+      if (ctx->output->buf[i])
+         daq->DmFreeBuffer(ctx->output->buf[i]);
+      ctx->output->buf[i] = NULL;
+   }
+   free(ctx->output->volts);
+   ctx->output->volts = NULL;
+   if (ctx->output->file)
+   {
+      fclose(ctx->output->file);
+      ctx->output->file = NULL;
+   }
+   ctx->output->active = FALSE;
+   ctx->output->hda = NULL;
+}
+
+/* Allocates the rotating buffers, primes them from the producer and queues them */
+int output_stream_begin(HDASS hDA_v, DBL clk_freq, DBL amplitude, DBL frequency, DBL min, DBL max,
+                        UINT resolution, UINT encoding)
+{
+   ctx->output->hda = hDA_v;
+   ctx->output->clk_freq = clk_freq;
+   ctx->output->amplitude = amplitude;
+   ctx->output->frequency = frequency;
+   ctx->output->min = min;
+   ctx->output->max = max;
+   ctx->output->resolution = resolution;
+   ctx->output->encoding = encoding;
+   ctx->output->width = (resolution > 16) ? 4 : 2;
+   ctx->output->next_sample = 0;
+   ctx->output->sample_limit = (ULNG)floor(ctx->output->limit_seconds * clk_freq + 0.5);
+   ctx->output->queued = 0;
+   ctx->output->finished = FALSE;
+   memset(&ctx->output->counters, 0, sizeof(ctx->output->counters));
+   ctx->output->counters.min_queued = OUT_NUM_BUFFERS;
+   ctx->output->buffer_samples = MAX(OUT_MIN_BUFFER, (UINT)(clk_freq * OUT_BUFFER_SECONDS));
+
+   ctx->output->fill = ctx->output->producer;
+   ctx->output->fill_user = ctx->output->user;
+   if (ctx->output->producer == NULL && ctx->output->path[0] != '\0')
+   {
+      ctx->output->file = fopen(ctx->output->path, "rb");
+      if (ctx->output->file == NULL)
+         return CFG_FAILURE;
+      ctx->output->fill = output_file_producer;
+      ctx->output->fill_user = ctx->output->file;
+   }
+   else if (ctx->output->producer == NULL)
+   {
+      ctx->output->fill = output_wave_producer;
+      ctx->output->fill_user = ctx->wave;
+   }
+   ctx->output->volts = malloc(ctx->output->buffer_samples * sizeof(DBL));
+   if (ctx->output->volts == NULL)
+   {
+      output_stream_release();
+      return CFG_FAILURE;
+   }
+   ctx->output->active = TRUE;
+
+   for (int i = 0; i < OUT_NUM_BUFFERS; i++)
+   {
+      if (OLSUCCESS != daq->DmCallocBuffer(GMEM_FIXED, 0, ctx->output->buffer_samples, ctx->output->width, &ctx->output->buf[i]))
+      {
+         output_stream_release();
+         return CFG_FAILURE;
+      }
+      if (output_fill(ctx->output->buf[i]) > 0)
+      {
+         if (OLSUCCESS != daq->PutBuffer(hDA_v, ctx->output->buf[i]))
+         {
+            output_stream_release();
+            return CFG_FAILURE;
+         }
+         ctx->output->queued++;
+      }
+   }
+   return (ctx->output->queued > 0) ? CFG_SUCCESS : CFG_FAILURE;
+}
+
+static int output_end_reason()
+{
+   return (ctx->output->sample_limit > 0 && ctx->output->next_sample == ctx->output->sample_limit) ? STOP_REASON_TIMER
+                                                                                  : STOP_REASON_OUTPUT_DONE;
 }
 
-/* This function is a windows api callback for processing the data buffers*/
-LRESULT WINAPI
-WndProc(HWND hWnd_v, UINT msg, WPARAM hAD_v, LPARAM lParam)
+/* Handles the D/A notifications of a streamed output; returns FALSE for anything else */
+BOOL output_event(HDASS hDass_v, UINT msg)
 {
+   HBUF hBuf_v = NULL;
+   ULNG samples = 0;
+
+   if (!ctx->output->active || hDass_v != ctx->output->hda)
+      return FALSE;
+
    switch (msg)
    {
    case OLDA_WM_BUFFER_DONE:
-   {
-      LOG_PRINT("Buffer Done Count: %ld \r", counter);
-      HBUF hBuf = NULL;
-      counter++;
-      olDaGetBuffer((HDASS)hAD_v, &hBuf);
-      if (hBuf)
-      {
-         //   process_data( (HDASS)hAD_v, hBuf );
-         save_data((HDASS)hAD_v, hBuf);
-         olDaPutBuffer((HDASS)hAD_v, hBuf);
-      }
-   }
-   break;
-
-   case OLDA_WM_QUEUE_DONE:
-      LOG_PRINT("Error: Acquisition stopped, rate too fast for current options.\n");
-      PostQuitMessage(0);
-      break;
-
-   case OLDA_WM_TRIGGER_ERROR:
-      LOG_PRINT("Trigger error: acquisition stopped.\n");
-      PostQuitMessage(0);
+      daq->GetBuffer(hDass_v, &hBuf_v);
+      if (hBuf_v == NULL)
+         break;
+      daq->DmGetValidSamples(hBuf_v, &samples);
+      ctx->output->counters.buffers_played++;
+      ctx->output->counters.samples_played += samples;
+      ctx->output->queued--;
+      ctx->output->counters.min_queued = MIN(ctx->output->counters.min_queued, ctx->output->queued);
+      if (output_fill(hBuf_v) > 0 && daq->PutBuffer(hDass_v, hBuf_v) == OLNOERROR)
+         ctx->output->queued++;
+      else if (ctx->output->queued == 0)
+         schedule_stop(output_end_reason());
       break;
 
-   case OLDA_WM_OVERRUN_ERROR:
-      LOG_PRINT("Input overrun error: acquisition stopped.\n");
-      PostQuitMessage(0);
+   case OLDA_WM_QUEUE_DONE:
+   case OLDA_WM_UNDERRUN_ERROR:
+      if (ctx->output->finished && ctx->output->queued <= 1)
+      {
+         schedule_stop(output_end_reason());
+      }
+      else
+      {
+         LOG_PRINT("Error: D/A underrun, output stopped.\n");
+         ctx->output->counters.underruns++;
+         schedule_stop(STOP_REASON_UNDERRUN);
+      }
       break;
-
-   default:
-      return DefWindowProc(hWnd_v, msg, hAD_v, lParam);
    }
-
-   return 0;
+   return TRUE;
 }
 
-/* Open Layers callback functionto initialize board*/
+/* Open Layers callback function to list the boards */
 BOOL CALLBACK
 EnumBrdProc(LPSTR lpszBrdName, LPSTR lpszDriverName, LPARAM lParam)
 {
+   BoardList *list = (BoardList *)lParam;
+   HDEV hDev_v = NULL;
+
    // Make sure we can Init Board
-   if (OLSUCCESS != (olDaInitialize(lpszBrdName, (LPHDEV)lParam)))
+   if (OLSUCCESS != (daq->Initialize(lpszBrdName, &hDev_v)))
    {
-      return TRUE; // try again
+      return TRUE; // try the next one
    }
 
    // Make sure Board has an A/D Subsystem
    UINT uiCap = 0;
-   olDaGetDevCaps(*((LPHDEV)lParam), OLDC_ADELEMENTS, &uiCap);
-   if (uiCap < 1)
+   daq->GetDevCaps(hDev_v, OLDC_ADELEMENTS, &uiCap);
+   daq->Terminate(hDev_v);
+   if (uiCap >= 1)
    {
-      return TRUE; // try again
+      LOG_PRINT("%s found.\n", lpszBrdName);
+      strncpy(list->name[list->count], lpszBrdName, BOARD_NAME_LEN - 1);
+      list->name[list->count][BOARD_NAME_LEN - 1] = '\0';
+      list->count++;
    }
+   return list->count < MAX_DEVICES; // stop once every device has a board
+}
 
-   LOG_PRINT("%s succesfully initialized.\n", lpszBrdName);
-   return FALSE; // all set , board handle in lParam
+/* Boards with an A/D subsystem; enumerated once per backend, before any is opened */
+int get_board_count()
+{
+   if (boards.count == 0 && daq->EnumBoards(EnumBrdProc, (LPARAM)&boards) != OLNOERROR)
+      return 0;
+   return (int)boards.count;
 }
 
-static HWND hWnd;
-static HDEV hDev = NULL;
-static HDASS hAD = NULL;
-static HDASS hDA = NULL;
-static HBUF hBufs[NUM_OL_BUFFERS];
-static HBUF hBuf = NULL;
-static PWORD lpbuf = NULL;
+int get_board_name(UINT index, char *name, UINT len)
+{
+   if (index >= (UINT)get_board_count() || name == NULL || len == 0)
+      return CFG_FAILURE;
+   strncpy(name, boards.name[index], len - 1);
+   name[len - 1] = '\0';
+   return CFG_SUCCESS;
+}
 
 int initialize_board()
 {
-   // create a window for messages
-   WNDCLASS wc;
-   memset(&wc, 0, sizeof(wc));
-   wc.lpfnWndProc = WndProc;
-   wc.lpszClassName = "DtConsoleClass";
-   RegisterClass(&wc);
-
-   hWnd = CreateWindow(wc.lpszClassName,
-                            NULL,
-                            NULL,
-                            0, 0, 0, 0,
-                            NULL,
-                            NULL,
-                            NULL,
-                            NULL);
-
-   if (!hWnd)
+   // the calling thread's device opens the board with the same index
+   if (ctx->index >= (UINT)get_board_count())
       return CFG_FAILURE;
 
-   CHECKERROR(olDaEnumBoards(EnumBrdProc, (LPARAM)&hDev));
+   CHECKERROR(daq->Initialize(boards.name[ctx->index], &ctx->hDev));
+   LOG_PRINT("%s succesfully initialized.\n", boards.name[ctx->index]);
    return CFG_SUCCESS;
 }
 
 int config_board_output(HWND *hWnd_p, HDEV *hDev_p, HDASS *hDA_p, UINT *dma, DBL *freq, DBL clk_freq)
 {  
-   CHECKERROR(olDaGetDASS(*hDev_p, OLSS_DA, 0, hDA_p));
-   CHECKERROR(olDaSetWndHandle(*hDA_p, *hWnd_p, (UINT)NULL));
-   CHECKERROR(olDaSetDataFlow(*hDA_p, OL_DF_CONTINUOUS));
+   CHECKERROR(daq->GetDASS(*hDev_p, OLSS_DA, 0, hDA_p));
+   CHECKERROR(daq->SetWndHandle(*hDA_p, *hWnd_p, 0));
+   CHECKERROR(daq->SetDataFlow(*hDA_p, OL_DF_CONTINUOUS));
 
-   CHECKERROR(olDaGetSSCapsEx(*hDA_p, OLSSCE_MAXTHROUGHPUT, freq));
-   CHECKERROR(olDaGetSSCaps(*hDA_p, OLSSC_NUMDMACHANS, dma));
+   CHECKERROR(daq->GetSSCapsEx(*hDA_p, OLSSCE_MAXTHROUGHPUT, freq));
+   CHECKERROR(daq->GetSSCaps(*hDA_p, OLSSC_NUMDMACHANS, dma));
 
    *dma = MIN(1, *dma); /* try for one dma channel   */
    *freq = MIN(*freq, clk_freq);
@@ -435,140 +5774,162 @@ int config_board_output(HWND *hWnd_p, HDEV *hDev_p, HDASS *hDA_p, UINT *dma, DBL
 
 int config_board_input(HWND *hWnd_p, HDEV *hDev_p, HDASS *hAD_p)
 {  
-   CHECKERROR(olDaGetDASS(*hDev_p, OLSS_AD, 0, hAD_p));
-   CHECKERROR(olDaSetWndHandle(*hAD_p, *hWnd_p, 0));
-   CHECKERROR(olDaSetDataFlow(*hAD_p, OL_DF_CONTINUOUS));
+   CHECKERROR(daq->GetDASS(*hDev_p, OLSS_AD, 0, hAD_p));
+   CHECKERROR(daq->SetWndHandle(*hAD_p, *hWnd_p, 0));
+   CHECKERROR(daq->SetDataFlow(*hAD_p, OL_DF_CONTINUOUS));
 
    return CFG_SUCCESS;
 }
 
 int config_channels_output(HDASS *hDA_p,int all_channel_gain)
 {
-   CHECKERROR(olDaSetChannelListSize(*hDA_p, 1));
-   CHECKERROR(olDaSetChannelListEntry(*hDA_p, 0, 0));
-   CHECKERROR(olDaSetGainListEntry(*hDA_p, 0, all_channel_gain));
+   CHECKERROR(daq->SetChannelListSize(*hDA_p, 1));
+   CHECKERROR(daq->SetChannelListEntry(*hDA_p, 0, 0));
+   CHECKERROR(daq->SetGainListEntry(*hDA_p, 0, all_channel_gain));
 
    return CFG_SUCCESS;
 }
 
 int config_channels_input(HDASS *hAD_p, int num_channels, int all_channel_gain, int channel_0_gain, int channel_1_gain, int channel_2_gain, int channel_3_gain)
 {
-   CHECKERROR(olDaSetChannelListSize(*hAD_p, num_channels));
-   for (int i = 0; i < num_channels; i++)
+#if EN_MULTIPLE_CH_GAIN == 1
+   /* individual gains are given per physical input */
+   int gain[NUM_CHANNELS] = {channel_0_gain, channel_1_gain, channel_2_gain, channel_3_gain};
+#endif
+   ChannelMap map = *ctx->channel_map;
+
+   if (num_channels < 1)
+      return CFG_FAILURE;
+   map.count = MIN((UINT)num_channels, map.count);
+   ctx->active_map->count = 0;
+
+   UINT order[NUM_CHANNELS];
+   channel_map_order(&map, order);
+
+   CHECKERROR(daq->SetChannelListSize(*hAD_p, map.count));
+   for (UINT i = 0; i < map.count; i++)
    {
-      /* Set Channel List and index */
-      CHECKERROR(olDaSetChannelListEntry(*hAD_p, i, i));
+      /* Set Channel List in ascending input order, the map is applied in the conversion */
+      UINT physical = map.physical[order[i]];
+      CHECKERROR(daq->SetChannelListEntry(*hAD_p, i, physical));
 
       /* Set Channel Gain Values */
-      CHECKERROR(olDaSetGainListEntry(*hAD_p, i, all_channel_gain));
+      CHECKERROR(daq->SetGainListEntry(*hAD_p, i, all_channel_gain));
+#if EN_MULTIPLE_CH_GAIN == 1
+      /* Set individual Channel Gain Values */
+      CHECKERROR(daq->SetGainListEntry(*hAD_p, i, gain[physical]));
+#endif
 
       /* Set channels coupling type to AC coupling */
-      CHECKERROR(olDaSetCouplingType(*hAD_p, i, AC));
+      CHECKERROR(daq->SetCouplingType(*hAD_p, physical, AC));
 
       /* Set channels current source to disabled */
-      CHECKERROR(olDaSetExcitationCurrentSource(*hAD_p, i, INTERNAL));
+      CHECKERROR(daq->SetExcitationCurrentSource(*hAD_p, physical, INTERNAL));
    }
-
-#if EN_MULTIPLE_CH_GAIN == 1
-   /* Set individual Channel Gain Values */
-   CHECKERROR(olDaSetGainListEntry(*hAD_p, 0, channel_0_gain));
-   CHECKERROR(olDaSetGainListEntry(*hAD_p, 1, channel_1_gain));
-   CHECKERROR(olDaSetGainListEntry(*hAD_p, 2, channel_2_gain));
-   CHECKERROR(olDaSetGainListEntry(*hAD_p, 3, channel_2_gain));
-#endif
+   *ctx->active_map = map;
 
    return CFG_SUCCESS;
 }
 
 int config_data_output(HDASS *hDA_p, int dma, int freq, int wave_freq, int amplitude)
 {
-   UINT encoding, resolution, wavefreq, size, peak, minvalue, maxvalue;
-   DBL min_v, max_v;
-   float volts;
+   UINT encoding, resolution, width;
+   DBL min_v, max_v, clk_freq;
+   DBL *volts;
+
    /* Set the clock and frequency for data acquisition*/
-   CHECKERROR(olDaSetClockFrequency(*hDA_p, freq));
-   CHECKERROR(olDaSetDmaUsage(*hDA_p, dma));
-   CHECKERROR(olDaSetWrapMode(*hDA_p, OL_WRP_SINGLE));
+   CHECKERROR(daq->SetClockFrequency(*hDA_p, freq));
+   CHECKERROR(daq->SetDmaUsage(*hDA_p, dma));
+   CHECKERROR(daq->SetWrapMode(*hDA_p, ctx->output->streaming ? OL_WRP_NONE : OL_WRP_SINGLE));
+
+   /* the buffer length depends on the clock the board actually accepted */
+   CHECKERROR(daq->Config(*hDA_p));
+   CHECKERROR(daq->GetClockFrequency(*hDA_p, &clk_freq));
 
    /* get sub system information for code/volts conversion */
-   CHECKERROR(olDaGetRange(*hDA_p, &max_v, &min_v));
-   CHECKERROR(olDaGetEncoding(*hDA_p, &encoding));
-   CHECKERROR(olDaGetResolution(*hDA_p, &resolution));
-
-   /* convert max full scale to DAC units */
-   volts = amplitude;
-   olDaVoltsToCode(min_v, max_v, 1 /*gain*/, resolution, encoding, volts, &maxvalue);
-
-   /* convert min full scale to DAC units */
-   volts = -(amplitude);
-   olDaVoltsToCode(min_v, max_v, 1 /*gain*/, resolution, encoding, volts, &minvalue);
-
-   /* 100 hz square wave or the best the board can do */
-   wavefreq = wave_freq; // 10Hz - 400Hz
-   size = MAX_BUFFER_SIZE;
-   peak = (size * AVERAGING_CONSTANT) / wavefreq;
-
-   /* allocate the output buffer */
-   CHECKERROR(olDmCallocBuffer(GMEM_FIXED, 0, (ULNG)size, 2, &hBuf));
-   CHECKERROR(olDmGetBufferPtr(hBuf, (LPVOID *)&lpbuf));
-   
-   /* fill the output buffer with a simple square wave */
-   for (int i = 0, j = 0; i < size; i += peak)
-   {
-      while (j < i + (peak / 2))
-         lpbuf[j++] = (UINT)minvalue;
-      while (j < i + peak)
-         lpbuf[j++] = (UINT)maxvalue;
-   }
-
-   /* Test Sin Wave Implementation (DOESNT WORK)*/
-   // double angle = 0;
-   // for (i=0,j=0;i<size;i+=peak)
-   // {
-   //    angle = 2.0 * 3.14159265 * i / size;
-   //    volts = (amplitude * sin(angle));
-   //    olDaVoltsToCode(min,max, 1 /*gain*/, resolution, encoding, volts, &minvalue);
-   //    LOG_PRINT("val:%f %d\n",volts,minvalue);
-   //    lpbuf[i++] = (UINT)minvalue;
-   // }
+   CHECKERROR(daq->GetRange(*hDA_p, &max_v, &min_v));
+   CHECKERROR(daq->GetEncoding(*hDA_p, &encoding));
+   CHECKERROR(daq->GetResolution(*hDA_p, &resolution));
+   width = (resolution > 16) ? 4 : 2;
+
+   sync_release_stimulus();
+   if (ctx->output->streaming)
+      return output_stream_begin(*hDA_p, clk_freq, amplitude, wave_freq, min_v, max_v, resolution, encoding);
+
+   volts = wave_synthesize(ctx->wave, clk_freq, amplitude, wave_freq, ctx->wave_info);
+   if (volts == NULL)
+      return CFG_FAILURE;
+   LOG_PRINT("Waveform: %u samples, %u periods, %f Hz\n", ctx->wave_info->samples, ctx->wave_info->periods, ctx->wave_info->frequency);
+
+   /* allocate the output buffer and fill it with codes */
+   if (OLSUCCESS != daq->DmCallocBuffer(GMEM_FIXED, 0, (ULNG)ctx->wave_info->samples, width, &ctx->hBuf) ||
+       OLSUCCESS != daq->DmGetBufferPtr(ctx->hBuf, &ctx->lpbuf))
+   {
+      free(volts);
+      return CFG_FAILURE;
+   }
+   wave_to_codes(volts, ctx->wave_info->samples, min_v, max_v, resolution, encoding, ctx->lpbuf, width);
+   sync_keep_stimulus(volts, ctx->wave_info->samples, clk_freq, ctx->wave_info->frequency);
 
    /* for DAC's must set the number of valid samples in buffer */
-   CHECKERROR(olDmSetValidSamples(hBuf, size));
+   CHECKERROR(daq->DmSetValidSamples(ctx->hBuf, ctx->wave_info->samples));
 
    /* Put the buffer to the DAC */
-   CHECKERROR(olDaPutBuffer(*hDA_p, hBuf));
+   CHECKERROR(daq->PutBuffer(*hDA_p, ctx->hBuf));
 
    return CFG_SUCCESS;
 }
 
-int config_data_input(HDASS *hAD_p, int clk_freq, HBUF hBufs_p[])
+int config_clock_input(HDASS *hAD_p, int clk_freq)
 {
    /* Set the clock and frequency for data acquisition*/
-   CHECKERROR(olDaSetTrigger(*hAD_p, OL_TRG_SOFT));
-   CHECKERROR(olDaSetClockSource(*hAD_p, OL_CLK_INTERNAL));
-   CHECKERROR(olDaSetClockFrequency(*hAD_p, clk_freq));
-   CHECKERROR(olDaSetWrapMode(*hAD_p, OL_WRP_NONE));
+   CHECKERROR(daq->SetTrigger(*hAD_p, OL_TRG_SOFT));
+   CHECKERROR(daq->SetClockSource(*hAD_p, OL_CLK_INTERNAL));
+   CHECKERROR(daq->SetClockFrequency(*hAD_p, clk_freq));
+   CHECKERROR(daq->SetWrapMode(*hAD_p, OL_WRP_NONE));
+
+   return CFG_SUCCESS;
+}
+
+/* Plans the buffer pool for the clock the board accepted and queues new buffers */
+int config_buffers_input(HDASS *hAD_p, HBUF hBufs_p[])
+{
+   UINT resolution, listsize;
+   DBL freq;
+
+   CHECKERROR(daq->GetResolution(*hAD_p, &resolution));
+   CHECKERROR(daq->GetChannelListSize(*hAD_p, &listsize));
+   CHECKERROR(daq->GetClockFrequency(*hAD_p, &freq));
 
    /* Allocating memory for data buffers*/
-   for (int i = 0; i < NUM_OL_BUFFERS; i++)
+   pool_plan(freq, listsize);
+   LOG_PRINT("Buffer pool: %u x %lu samples (%f s)\n", ctx->pool->buffers, ctx->pool->buffer_samples, ctx->pool->buffer_seconds);
+   for (int i = 0; i < (int)ctx->pool->buffers; i++)
    {
-      if (OLSUCCESS != olDmCallocBuffer(GHND, 0, (int)clk_freq, 2, &hBufs_p[i]))
+      if (OLSUCCESS != daq->DmCallocBuffer(GHND, 0, ctx->pool->buffer_samples, (resolution > 16) ? 4 : 2, &hBufs_p[i]))
       {
          for (i--; i >= 0; i--)
          {
-            olDmFreeBuffer(hBufs_p[i]);
+            daq->DmFreeBuffer(hBufs_p[i]);
          }
          return CFG_FAILURE;
       }
-      olDaPutBuffer(*hAD_p, hBufs_p[i]);
+      daq->PutBuffer(*hAD_p, hBufs_p[i]);
    }
 
    return CFG_SUCCESS;
 }
+
+int config_data_input(HDASS *hAD_p, int clk_freq, HBUF hBufs_p[])
+{
+   if (config_clock_input(hAD_p, clk_freq) == CFG_FAILURE)
+      return CFG_FAILURE;
+   return config_buffers_input(hAD_p, hBufs_p);
+}
 int output_start(HDASS *hAD_p)
 {
    /* Start acquisition*/
-   if (OLSUCCESS != (olDaStart(hDA)))
+   if (OLSUCCESS != (daq->Start(ctx->hDA)))
    {
       LOG_PRINT("D/A Operation Start Failed...\n");
       return CFG_FAILURE;
@@ -581,17 +5942,85 @@ int output_start(HDASS *hAD_p)
    return CFG_SUCCESS;
 }
 
+static THREAD_LOCAL HWND notify_wnd[MAX_DEVICES]; // targets created by the calling thread, per device
+
+/* Points the device at a notification target of the calling thread, creating it
+   on first use. Open Layers delivers the messages of a window to the thread that
+   created it, so the target must belong to the thread that runs notify_loop(). */
+static int notify_attach()
+{
+   if (notify_wnd[ctx->index] == NULL && daq->InitNotify(&notify_wnd[ctx->index]) == CFG_FAILURE)
+      return CFG_FAILURE;
+   ctx->hWnd = notify_wnd[ctx->index];
+   return CFG_SUCCESS;
+}
+
+/* Dispatches backend notifications until the run is stopped, the deadline (0-none)
+   passes or, when untimed, a key is pressed */
+void notify_loop(HWND *hWnd_p, bool timer_en, DBL deadline)
+{
+   UINT wait_ms = KEY_POLL_MS;
+
+   // Acquire and dispatch notifications until the frame limit, deadline or a key...since
+   // we are a console app we are using a mix of backend notifications for data acquistion
+   // and console approaches for keyboard input.
+   //
+   while (daq->Pump(*hWnd_p, wait_ms))
+   {
+      if (deadline > 0)
+      {
+         DBL remaining = deadline - monotonic_seconds();
+
+         if (remaining <= 0)
+         {
+            schedule_stop(STOP_REASON_TIMER);
+         }
+         wait_ms = (UINT)MAX(0.0, MIN(remaining * 1000, (DBL)KEY_POLL_MS));
+      }
+      if (atomic_load(&ctx->schedule->stop_requested))
+      {
+         schedule_stop(STOP_REASON_USER);
+      }
+      if(!timer_en && !ctx->schedule->background)
+      {
+         if (key_pressed())
+         {
+            schedule_stop(STOP_REASON_KEY);
+         }
+      }
+      instr_dump_tick();
+   }
+   ctx->schedule->stop_time = monotonic_seconds();
+}
+
 int measurement_start(HWND *hWnd_p, HDASS *hAD_p, bool timer_en, int timer_duration)
 {
-   /* Start acquisition*/
-   if (OLSUCCESS != (olDaStart(*hAD_p)))
+   ECODE status;
+
+   schedule_begin();
+   instr_begin();
+
+   /* Start acquisition, together with a D/A left by generate() in sync mode */
+   if (ctx->sync_start->pending_da != NULL)
+   {
+      HDASS list[2] = {ctx->sync_start->pending_da, *hAD_p};
+      status = daq->StartTogether(list, 2);
+      ctx->sync_start->pending_da = NULL;
+      ctx->sync_start->synchronized = (status == OLSUCCESS);
+   }
+   else
+   {
+      status = daq->Start(*hAD_p);
+      ctx->sync_start->synchronized = FALSE;
+   }
+   if (OLSUCCESS != status)
    {
       LOG_PRINT("A/D Operation Start Failed...\n");
       return CFG_FAILURE;
    }
    else
    {
-      LOG_PRINT("A/D Operation Started...\n");
+      LOG_PRINT(ctx->sync_start->synchronized ? "A/D and D/A Operations Started Together...\n" : "A/D Operation Started...\n");
    }
 
    if(timer_en)
@@ -600,98 +6029,300 @@ int measurement_start(HWND *hWnd_p, HDASS *hAD_p, bool timer_en, int timer_durat
    }
    else
    {
-      LOG_PRINT("Timer Disabled. Hit any key to temrinate...\n\n", timer_duration);
+      LOG_PRINT("Timer Disabled. Hit any key to terminate...\n\n");
    }
 
-   MSG msg;
-   time_t start = time(0);
-   double seconds_since_start = 0;
-   SetMessageQueue(50); // Increase the our message queue size so
-                        // we don't lose any data acq messages
+   notify_loop(hWnd_p, timer_en,
+               (ctx->schedule->run_seconds > 0) ? ctx->schedule->start_time + ctx->schedule->run_seconds + STOP_GRACE_SECONDS : 0);
 
-   // Acquire and dispatch messages until a key is hit...since we are a console app
-   // we are using a mix of Windows messages for data acquistion and console approaches
-   // for keyboard input.
-   //
-   while (GetMessage(&msg, // message structure
-                     *hWnd_p, // handle of window receiving the message
-                     0,    // lowest message to examine
-                     0))   // highest message to examine
-   {
-      TranslateMessage(&msg); // Translates virtual key codes
-      DispatchMessage(&msg);  // Dispatches message to window
-      if(timer_en)
-      {
-         seconds_since_start = difftime(time(0), start);
+   return CFG_SUCCESS;
+}
 
-         if (seconds_since_start > timer_duration)
-         {
-            PostQuitMessage(0);
-         }
-      }
-      else
-      {
-         if (_kbhit())
-         {
-            _getch();
-            PostQuitMessage(0);
-         }
-      }
-   }
+/* Pumps the notifications of a streamed output when no input is read */
+int output_run(HWND *hWnd_p, bool timer_en, int timer_duration)
+{
+   schedule_plan(timer_en, timer_duration, ctx->output->clk_freq, TRUE);
+   schedule_begin();
+   notify_loop(hWnd_p, timer_en,
+               (ctx->schedule->run_seconds > 0) ? ctx->schedule->start_time + ctx->schedule->run_seconds + STOP_GRACE_SECONDS : 0);
 
-   return CFG_SUCCESS;
+   return (ctx->schedule->stop_reason == STOP_REASON_UNDERRUN) ? CFG_FAILURE : CFG_SUCCESS;
 }
 
 int deinitialize_output(HDASS *hDA_p, HBUF *hBuf_p)
 {
    // abort D/A operation
-   olDaAbort(*hDA_p);
+   daq->Abort(*hDA_p);
    LOG_PRINT("D/A Operation Terminated \n");
+   sync_release_stimulus();
 
    /*
-      get the output buffer from the DAC subsystem and
-      free the output buffer
+      get the output buffer(s) from the DAC subsystem and
+      free them
    */
-   CHECKERROR(olDaGetBuffer(*hDA_p, hBuf_p));
-   CHECKERROR(olDmFreeBuffer(*hBuf_p));
+   if (ctx->output->active)
+   {
+      output_stream_release();
+   }
+   else
+   {
+      CHECKERROR(daq->GetBuffer(*hDA_p, hBuf_p));
+      CHECKERROR(daq->DmFreeBuffer(*hBuf_p));
+   }
 
    /* release the subsystem*/
-   CHECKERROR(olDaReleaseDASS(*hDA_p));
+   CHECKERROR(daq->ReleaseDASS(*hDA_p));
    return CFG_SUCCESS;
 }
 
 int deinitialize_inputs(HDASS *hAD_p, HBUF hBufs_p[])
 {
    // abort A/D operation
-   olDaAbort(*hAD_p);
+   daq->Abort(*hAD_p);
    LOG_PRINT("A/D Operation Terminated \n");
 
-   for (int i = 0; i < NUM_OL_BUFFERS; i++)
+   for (int i = 0; i < (int)ctx->pool->buffers; i++)
    {
-      olDmFreeBuffer(hBufs_p[i]);
+      daq->DmFreeBuffer(hBufs_p[i]);
    }
    /* release the subsystem*/
-   CHECKERROR(olDaReleaseDASS(*hAD_p));
+   CHECKERROR(daq->ReleaseDASS(*hAD_p));
    return CFG_SUCCESS;
 }
 
 int deinit_board()
 {
    /* release the board */
-   CHECKERROR(olDaTerminate(hDev));
+   CHECKERROR(daq->Terminate(ctx->hDev));
+   ctx->hDev = NULL;
    return CFG_SUCCESS;
 }
 
 ChannelData get_channel_data()
 {
-   return measure_channels;
+   return *ctx->measure_channels;
+}
+
+/* Runs one capture on the configured A/D: storage, analysis, the conversion worker
+   and the notification loop. Every stage is ended on the way out whether or not
+   it was begun; a capture that fails before the A/D starts leaves no storage
+   attached. */
+int acquire(bool timer_en, int timer_duration, float clk_freq)
+{
+   BOOL started = FALSE;
+   int rc = CFG_FAILURE;
+
+   schedule_plan(timer_en, timer_duration, ctx->conv_table->freq, ctx->capture->streaming);
+   if(allocate_data_memory((ChannelData *)ctx->measure_channels, timer_duration, clk_freq) == CFG_FAILURE)
+      return ERR_MEASUREMENT;
+   if(capture_begin() == CFG_FAILURE || record_begin(ctx->conv_table) == CFG_FAILURE)
+      goto cleanup;
+
+   stats_begin();
+   if(psd_begin() == CFG_FAILURE || trig_begin() == CFG_FAILURE || decim_begin() == CFG_FAILURE || sub_begin(conv_frame_count(ctx->pool->buffer_samples, ctx->conv_table->listsize)) == CFG_FAILURE)
+      goto cleanup;
+#if EN_CONVERSION_WORKER
+   if(conv_worker_start(ctx->raw_ring, ctx->pool->buffers, ctx->pool->buffer_samples) == CFG_FAILURE)
+      goto cleanup;
+#endif
+   started = TRUE;
+   rc = measurement_start(&ctx->hWnd, &ctx->hAD, timer_en, timer_duration);
+
+cleanup:
+#if EN_CONVERSION_WORKER
+   conv_worker_stop(ctx->raw_ring);
+#endif
+   instr_end();
+   sub_end();
+   decim_end((ChannelData *)ctx->measure_channels);
+   trig_end();
+   capture_end((ChannelData *)ctx->measure_channels);
+   record_end();
+   if(!started)
+   {
+      psd_release();
+      cleanup_data();
+   }
+   if(rc == CFG_FAILURE) 
+      return ERR_MEASUREMENT;
+
+   return CFG_SUCCESS;
+}
+
+/* Acquisition sessions
+   Without a session every measure() gets the A/D subsystem, writes the channel
+   list, gains and clock, allocates the driver buffers and releases all of it
+   again at the end. Between session_open() and session_close(), measure() and
+   measure_async() run on one configured subsystem instead: the channel list and
+   clock are only written when they differ from the previous capture, the driver
+   buffers are taken back after the abort and queued again (new ones only when
+   the pool plan no longer fits them), and the capture storage is reused while it
+   is large enough.
+*/
+typedef struct {
+   BOOL open;
+   ULNG captures;
+   ULNG reconfigures;  // captures that had to write the channel list or clock
+   ULNG reallocations; // captures that had to allocate driver buffers
+} SessionInfo;
+
+typedef struct Session {
+   SessionInfo info;
+   BOOL configured; // the settings below are applied to hAD
+   int num_channels, all_channel_gain, gain[NUM_CHANNELS];
+   ChannelMap map;
+   float clk_freq;
+   UINT buffers; // driver buffers allocated in hBufs
+   ULNG buffer_samples;
+   UINT width;
+} Session;
+
+static void session_free_buffers()
+{
+   for (UINT i = 0; i < ctx->session->buffers; i++)
+      daq->DmFreeBuffer(ctx->hBufs[i]);
+   ctx->session->buffers = 0;
+}
+
+/* Stops the A/D and takes every buffer back from the done queue */
+static void session_finish()
+{
+   HBUF hBuf_v;
+
+   daq->Abort(ctx->hAD);
+   do
+   {
+      hBuf_v = NULL;
+      daq->GetBuffer(ctx->hAD, &hBuf_v);
+   } while (hBuf_v != NULL);
+}
+
+/* Plans the pool and queues the session's buffers, allocating only when they no longer fit */
+static int session_buffers()
+{
+   Session *ses = ctx->session;
+   UINT resolution, listsize;
+   DBL freq;
+
+   CHECKERROR(daq->GetResolution(ctx->hAD, &resolution));
+   CHECKERROR(daq->GetChannelListSize(ctx->hAD, &listsize));
+   CHECKERROR(daq->GetClockFrequency(ctx->hAD, &freq));
+   UINT width = (resolution > 16) ? 4 : 2;
+
+   pool_plan(freq, listsize);
+   if (ses->buffers > 0 && (ses->buffer_samples != ctx->pool->buffer_samples || ses->width != width ||
+                            ses->buffers < ctx->pool->buffers))
+      session_free_buffers();
+
+   if (ses->buffers == 0)
+   {
+      if (config_buffers_input(&ctx->hAD, ctx->hBufs) == CFG_FAILURE)
+         return CFG_FAILURE;
+      ses->buffers = ctx->pool->buffers;
+      ses->buffer_samples = ctx->pool->buffer_samples;
+      ses->width = width;
+      ses->info.reallocations++;
+      return CFG_SUCCESS;
+   }
+
+   // at least as many buffers of the planned size are allocated: queue them all
+   ctx->pool->buffers = ses->buffers;
+   ctx->pool->queue_seconds = ses->buffers * ctx->pool->buffer_seconds;
+   ctx->pool->min_headroom = ctx->pool->queue_seconds;
+   for (UINT i = 0; i < ses->buffers; i++)
+   {
+      CHECKERROR(daq->PutBuffer(ctx->hAD, ctx->hBufs[i]));
+   }
+   return CFG_SUCCESS;
+}
+
+/* Applies the settings that changed since the last capture and queues the buffers */
+static int session_configure(int num_channels, float clk_freq, int all_channel_gain, const int gain[NUM_CHANNELS])
+{
+   Session *ses = ctx->session;
+   BOOL channels_changed = !ses->configured || num_channels != ses->num_channels ||
+                           all_channel_gain != ses->all_channel_gain ||
+                           memcmp(gain, ses->gain, sizeof(ses->gain)) != 0 ||
+                           memcmp(ctx->channel_map, &ses->map, sizeof(ChannelMap)) != 0;
+   BOOL clock_changed = !ses->configured || clk_freq != ses->clk_freq;
+
+   // measure_async() runs on its own notification target
+   CHECKERROR(daq->SetWndHandle(ctx->hAD, ctx->hWnd, 0));
+   if (channels_changed || clock_changed)
+   {
+      ses->configured = FALSE;
+      if (channels_changed && config_channels_input(&ctx->hAD, num_channels, all_channel_gain, gain[0], gain[1],
+                                                    gain[2], gain[3]) == CFG_FAILURE)
+         return ERR_CHANNEL_CONFIG;
+      if (clock_changed && config_clock_input(&ctx->hAD, clk_freq) == CFG_FAILURE)
+         return ERR_DATA_CONFIG;
+      CHECKERROR(daq->Config(ctx->hAD));
+      if (conv_table_init(ctx->conv_table, ctx->hAD) == CFG_FAILURE)
+         return ERR_DATA_CONFIG;
+      ses->num_channels = num_channels;
+      ses->all_channel_gain = all_channel_gain;
+      memcpy(ses->gain, gain, sizeof(ses->gain));
+      ses->map = *ctx->channel_map;
+      ses->clk_freq = clk_freq;
+      ses->configured = TRUE;
+      ses->info.reconfigures++;
+   }
+   if (session_buffers() == CFG_FAILURE)
+      return ERR_DATA_CONFIG;
+   return CFG_SUCCESS;
+}
+
+/* Gets the A/D subsystem for the following captures */
+int session_open()
+{
+   if (ctx->session->info.open)
+      return CFG_SUCCESS;
+   if (notify_attach() == CFG_FAILURE)
+      return ERR_INIT_CONFIG;
+   if (config_board_input(&ctx->hWnd, &ctx->hDev, &ctx->hAD) == CFG_FAILURE)
+      return ERR_BOARD_CONFIG;
+   memset(ctx->session, 0, sizeof(Session));
+   ctx->session->info.open = TRUE;
+   return CFG_SUCCESS;
+}
+
+/* Frees the driver buffers and releases the subsystem; the captured data stays until cleanup_data() */
+int session_close()
+{
+   if (!ctx->session->info.open)
+      return CFG_SUCCESS;
+   session_finish();
+   session_free_buffers();
+   ctx->session->info.open = FALSE;
+   ctx->session->configured = FALSE;
+   if (daq->ReleaseDASS(ctx->hAD) != OLNOERROR)
+      return ERR_DEINIT_CONFIG;
+   return CFG_SUCCESS;
+}
+
+SessionInfo get_session_info()
+{
+   return ctx->session->info;
+}
+
+/* One measure() on the open session */
+static int session_measure(int num_channels, float clk_freq, int all_channel_gain, const int gain[NUM_CHANNELS],
+                           bool timer_en, int timer_duration)
+{
+   int rc = session_configure(num_channels, clk_freq, all_channel_gain, gain);
+
+   if (rc == CFG_SUCCESS && acquire(timer_en, timer_duration, clk_freq) != CFG_SUCCESS)
+      rc = ERR_MEASUREMENT;
+   session_finish();
+   ctx->session->info.captures++;
+   return rc;
 }
 
 int measure(bool use_default_values, int num_channels, float clk_freq, int all_channel_gain, int channel_0_gain, int channel_1_gain, int channel_2_gain, int channel_3_gain, bool timer_en, int timer_duration)
 {
    if (use_default_values)
    {
-      num_channels = NUM_CHANNELS;
+      num_channels = (int)ctx->channel_map->count;
       all_channel_gain = ALL_CHANNEL_GAIN;
       channel_0_gain = CHANNEL_GAIN_0;
       channel_1_gain = CHANNEL_GAIN_1;
@@ -702,30 +6333,36 @@ int measure(bool use_default_values, int num_channels, float clk_freq, int all_c
 
    if(!timer_en)
    {
-      // Limit to 15 mins
-      timer_duration = 900;
+      // Limit retained captures to 15 mins, streaming captures run until keypress
+      timer_duration = MAX_RETAINED_DURATION;
    }
 
-   int i = 0;
+   if (notify_attach() == CFG_FAILURE)
+      return ERR_INIT_CONFIG;
+   if (ctx->session->info.open)
+   {
+      int gain[NUM_CHANNELS] = {channel_0_gain, channel_1_gain, channel_2_gain, channel_3_gain};
+      return session_measure(num_channels, clk_freq, all_channel_gain, gain, timer_en, timer_duration);
+   }
 
-   if(config_board_input(&hWnd, &hDev, &hAD) == CFG_FAILURE) 
+   if(config_board_input(&ctx->hWnd, &ctx->hDev, &ctx->hAD) == CFG_FAILURE) 
       return ERR_BOARD_CONFIG;
-   if(config_channels_input(&hAD,num_channels,all_channel_gain,channel_0_gain,channel_1_gain,channel_2_gain,channel_3_gain) == CFG_FAILURE) 
+   if(config_channels_input(&ctx->hAD,num_channels,all_channel_gain,channel_0_gain,channel_1_gain,channel_2_gain,channel_3_gain) == CFG_FAILURE) 
       return ERR_CHANNEL_CONFIG;
-   if(config_data_input(&hAD, clk_freq,hBufs) == CFG_FAILURE) 
+   if(config_data_input(&ctx->hAD, clk_freq,ctx->hBufs) == CFG_FAILURE) 
       return ERR_DATA_CONFIG;
 
    /* Store the config*/
-   CHECKERROR(olDaConfig(hAD));
-
-   allocate_data_memory(&measure_channels, timer_duration);
+   CHECKERROR(daq->Config(ctx->hAD));
+   if(conv_table_init(ctx->conv_table, ctx->hAD) == CFG_FAILURE)
+      return ERR_DATA_CONFIG;
 
-   if(measurement_start(&hWnd, &hAD, timer_en, timer_duration) == CFG_FAILURE) 
-      return ERR_MEASUREMENT;
-   if(deinitialize_inputs(&hAD,hBufs) == CFG_FAILURE) 
+   // the subsystem is released whether or not the capture succeeded
+   int rc = (acquire(timer_en, timer_duration, clk_freq) == CFG_SUCCESS) ? CFG_SUCCESS : ERR_MEASUREMENT;
+   if(deinitialize_inputs(&ctx->hAD,ctx->hBufs) == CFG_FAILURE && rc == CFG_SUCCESS) 
       return ERR_DEINIT_CONFIG;
 
-   return CFG_SUCCESS;
+   return rc;
 }
 
 /* This function generates a simple squarewave at the specified amplitude, frequency and duration (in s) */
@@ -740,58 +6377,244 @@ int generate(bool use_default_values, bool read_input, float clk_freq, int all_c
    }
    if(!timer_en)
    {
-      // Limit to 15 mins
-      timer_duration = 900;
+      // Limit retained captures to 15 mins, streaming captures run until keypress
+      timer_duration = MAX_RETAINED_DURATION;
    }
 
    DBL freq;
    UINT dma;
 
-   if(config_board_output(&hWnd, &hDev, &hDA, &dma, &freq, clk_freq) == CFG_FAILURE) 
+   // an open session holds the A/D subsystem
+   if (read_input && ctx->session->info.open)
+      return ERR_BOARD_CONFIG;
+   if (notify_attach() == CFG_FAILURE)
+      return ERR_INIT_CONFIG;
+   if(config_board_output(&ctx->hWnd, &ctx->hDev, &ctx->hDA, &dma, &freq, clk_freq) == CFG_FAILURE) 
       return ERR_BOARD_CONFIG;
-   if(config_channels_output(&hDA,all_channel_gain) == CFG_FAILURE) 
+   if(config_channels_output(&ctx->hDA,all_channel_gain) == CFG_FAILURE) 
       return ERR_CHANNEL_CONFIG;
-   if(config_data_output(&hDA, dma, freq, wave_freq, amplitude) == CFG_FAILURE) 
+   // with input the A/D frame limit ends timed runs and the D/A is aborted after it
+   ctx->output->limit_seconds = (timer_en && !read_input) ? MAX(timer_duration, 1) : 0;
+   if(config_data_output(&ctx->hDA, dma, freq, wave_freq, amplitude) == CFG_FAILURE) 
       return ERR_DATA_CONFIG;
 
    /* Store the config*/
-   CHECKERROR(olDaConfig(hDA));
+   CHECKERROR(daq->Config(ctx->hDA));
 
    if (read_input)
    {
-      if(config_board_input(&hWnd, &hDev, &hAD) == CFG_FAILURE) 
+      if(config_board_input(&ctx->hWnd, &ctx->hDev, &ctx->hAD) == CFG_FAILURE) 
          return ERR_BOARD_CONFIG;
-      if(config_channels_input(&hAD,NUM_CHANNELS,all_channel_gain,all_channel_gain,all_channel_gain,all_channel_gain,all_channel_gain) == CFG_FAILURE) 
+      if(config_channels_input(&ctx->hAD,NUM_CHANNELS,all_channel_gain,all_channel_gain,all_channel_gain,all_channel_gain,all_channel_gain) == CFG_FAILURE) 
          return ERR_CHANNEL_CONFIG;
-      if(config_data_input(&hAD, clk_freq,hBufs) == CFG_FAILURE) 
+      if(config_data_input(&ctx->hAD, clk_freq,ctx->hBufs) == CFG_FAILURE) 
          return ERR_DATA_CONFIG;
 
       /* Store the config*/
-      CHECKERROR(olDaConfig(hAD));
+      CHECKERROR(daq->Config(ctx->hAD));
+      if(conv_table_init(ctx->conv_table, ctx->hAD) == CFG_FAILURE)
+         return ERR_DATA_CONFIG;
    }
 
-   if(output_start(&hAD) == CFG_FAILURE) 
+   ctx->sync_start->synchronized = FALSE;
+   ctx->sync_start->pending_da = NULL;
+   if (read_input && ctx->sync_start->enabled)
+   {
+      ctx->sync_start->pending_da = ctx->hDA; // started with the A/D by measurement_start()
+   }
+   else if(output_start(&ctx->hAD) == CFG_FAILURE) 
+   {
       return ERR_OUTPUT;
+   }
 
    if (read_input)
    {
-      allocate_data_memory(&measure_channels, timer_duration);
-      if(measurement_start(&hWnd, &hAD, timer_en, timer_duration) == CFG_FAILURE) 
+      int rc = acquire(timer_en, timer_duration, clk_freq);
+      ctx->sync_start->pending_da = NULL; // never left for a later measure()
+      if(rc != CFG_SUCCESS)
+      {
+         deinitialize_output(&ctx->hDA,&ctx->hBuf);
+         deinitialize_inputs(&ctx->hAD,ctx->hBufs);
          return ERR_MEASUREMENT;
+      }
+   }
+   else if (ctx->output->streaming)
+   {
+      if(output_run(&ctx->hWnd, timer_en, timer_duration) == CFG_FAILURE)
+      {
+         deinitialize_output(&ctx->hDA,&ctx->hBuf);
+         return ERR_OUTPUT;
+      }
    }
    else
    {
       LOG_PRINT("Sending output for %d seconds \n", timer_duration);
-      Sleep(timer_duration * 1000);
+      sleep_ms(timer_duration * 1000);
    }
 
-   if(deinitialize_output(&hDA,hBuf) == CFG_FAILURE) 
+   if(deinitialize_output(&ctx->hDA,&ctx->hBuf) == CFG_FAILURE) 
       return ERR_DEINIT_CONFIG;
    if (read_input)
    {
-      if(deinitialize_inputs(&hAD,hBufs) == CFG_FAILURE) 
+      if(deinitialize_inputs(&ctx->hAD,ctx->hBufs) == CFG_FAILURE) 
          return ERR_DEINIT_CONFIG;
    }
 
    return CFG_SUCCESS;
-}
\ No newline at end of file
+}
+
+/* Asynchronous measurement
+   measure_async() runs measure() on an acquisition thread and returns at once;
+   measure_stop() ends the run from any thread and measure_wait() collects the
+   result. measure() attaches the acquisition thread to its own notification
+   target (see notify_attach()).
+*/
+typedef struct MeasureArgs {
+   int num_channels, all_channel_gain, gain[4], timer_duration;
+   float clk_freq;
+   bool use_default_values, timer_en;
+} MeasureArgs;
+
+ThreadResult THREAD_CALL acq_worker(LPVOID lpParam)
+{
+   ctx_selected = (DeviceContext *)lpParam; // the device that started the run
+   MeasureArgs *a = ctx->acq_args;
+
+   ctx->schedule->background = TRUE;
+   ctx->acq_result = measure(a->use_default_values, a->num_channels, a->clk_freq, a->all_channel_gain, a->gain[0],
+                             a->gain[1], a->gain[2], a->gain[3], a->timer_en, a->timer_duration);
+   ctx->schedule->background = FALSE;
+   atomic_store(&ctx->acq_finished, TRUE);
+   event_set(ctx->acq_done);
+   return 0;
+}
+
+/* Same arguments as measure(); returns once the acquisition thread is running */
+int measure_async(bool use_default_values, int num_channels, float clk_freq, int all_channel_gain, int channel_0_gain, int channel_1_gain, int channel_2_gain, int channel_3_gain, bool timer_en, int timer_duration)
+{
+   if (ctx->acq_started)
+      return ERR_PENDING;
+   if (ctx->acq_done == NULL && (ctx->acq_done = event_create()) == NULL)
+      return ERR_MEASUREMENT;
+
+   MeasureArgs a = {num_channels, all_channel_gain, {channel_0_gain, channel_1_gain, channel_2_gain, channel_3_gain},
+                    timer_duration, clk_freq, use_default_values, timer_en};
+   *ctx->acq_args = a;
+   atomic_store(&ctx->acq_finished, FALSE);
+   atomic_store(&ctx->schedule->stop_requested, FALSE);
+   if (!thread_create(&ctx->acq_thread, acq_worker, ctx))
+      return ERR_MEASUREMENT;
+   ctx->acq_started = TRUE;
+   return CFG_SUCCESS;
+}
+
+/* Ends the running measurement at the next notification loop pass */
+int measure_stop()
+{
+   atomic_store(&ctx->schedule->stop_requested, TRUE);
+   return CFG_SUCCESS;
+}
+
+/* Waits up to timeout_ms (0xFFFFFFFF-forever) for measure_async() and returns the
+   result of measure(), or ERR_PENDING if it is still running */
+int measure_wait(UINT timeout_ms)
+{
+   if (!ctx->acq_started)
+      return CFG_FAILURE;
+   if (!atomic_load(&ctx->acq_finished))
+      event_wait(ctx->acq_done, timeout_ms);
+   if (!atomic_load(&ctx->acq_finished))
+      return ERR_PENDING;
+   thread_join(ctx->acq_thread);
+   ctx->acq_started = FALSE;
+   return ctx->acq_result;
+}
+
+/* Device contexts
+   device_open() allocates the context of a device together with the state of
+   every module in one block and gives the modules their defaults; everything
+   not set here starts zeroed (TRIG_OFF, WAVE_SQUARE, no session). The block is
+   kept for the life of the process, the buffers a run allocates hang off the
+   module states and are reused by the next run.
+*/
+typedef struct {
+   DeviceContext context;
+   SimConfig sim_config;
+   SimSinkStats sim_sink;
+   SimSubsystem sim_ad;
+   SimSubsystem sim_da;
+   ChannelData measure_channels;
+   ChannelMap channel_map;
+   ChannelMap active_map;
+   Decimator decim;
+   Trigger trig;
+   TimeBase time_base;
+   AcqSchedule schedule;
+   CaptureStream capture;
+   CaptureArena arena;
+   ChannelStatsState stats;
+   SyncStart sync_start;
+   PsdState psd;
+   ConvTable conv_table;
+   RecordFile record;
+   Subscription sub;
+   PoolLimits pool_limits;
+   BufferPool pool;
+   Instrumentation instr;
+   RawRing raw_ring;
+   WaveSpec wave;
+   WaveInfo wave_info;
+   OutputStream output;
+   HBUF hBufs[POOL_MAX_BUFFERS];
+   Session session;
+   MeasureArgs acq_args;
+} DeviceBlock;
+
+static DeviceContext *device_open(UINT index)
+{
+   DeviceBlock *b = calloc(1, sizeof(DeviceBlock));
+   DeviceContext *c;
+
+   if (b == NULL)
+      return NULL;
+   c = &b->context;
+   c->index = index;
+   c->sim_config = &b->sim_config;
+   c->sim_sink = &b->sim_sink;
+   c->sim_ad = &b->sim_ad;
+   c->sim_da = &b->sim_da;
+   c->measure_channels = &b->measure_channels;
+   c->channel_map = &b->channel_map;
+   c->active_map = &b->active_map;
+   c->decim = &b->decim;
+   c->trig = &b->trig;
+   c->time_base = &b->time_base;
+   c->schedule = &b->schedule;
+   c->capture = &b->capture;
+   c->arena = &b->arena;
+   c->stats = &b->stats;
+   c->sync_start = &b->sync_start;
+   c->psd = &b->psd;
+   c->conv_table = &b->conv_table;
+   c->record = &b->record;
+   c->sub = &b->sub;
+   c->pool_limits = &b->pool_limits;
+   c->pool = &b->pool;
+   c->instr = &b->instr;
+   c->raw_ring = &b->raw_ring;
+   c->wave = &b->wave;
+   c->wave_info = &b->wave_info;
+   c->output = &b->output;
+   c->hBufs = b->hBufs;
+   c->session = &b->session;
+   c->acq_args = &b->acq_args;
+
+   b->sim_config = sim_config_default;
+   b->sim_ad.type = OLSS_AD;
+   b->sim_da.type = OLSS_DA;
+   c->sim_rng = 1;
+   b->channel_map = channel_map_default;
+   b->decim = decim_default;
+   b->pool_limits = pool_limits_default;
+   return c;
+}
@@ -1,5 +1,14 @@
 # This program imports and runs the compiled data acuqisition C library for DT9837
+import json
+import os
+import sys
+import time
+import weakref
 from ctypes import *
+try:
+    import numpy as np
+except ImportError:
+    np = None
 # Config Params
 NUM_CHANNELS = 4  # Max 4 channels for DT9837
 ALL_CHANNEL_GAIN = 1  # 1 or 10
@@ -14,6 +23,17 @@ WAVEFORM_AMPLITUDE = 3  # in volts (V) [0V-10V]
 WAVEFORM_FREQUENCY = 10  # in hertz (Hz) [10Hz-400Hz]
 WAVEFORM_DURATION = 10  # in seconds (s)
 
+# Waveforms
+WAVE_SQUARE = 0
+WAVE_SINE = 1
+WAVE_TRIANGLE = 2
+WAVE_CHIRP = 3
+WAVE_ARBITRARY = 4
+
+# Backends
+BACKEND_OPENLAYERS = 0
+BACKEND_SIMULATOR = 1
+
 # Error Codes
 ERR_CFG_FAILURE = -1
 ERR_CFG_SUCCESS = 0
@@ -24,43 +44,534 @@ ERR_DATA_CONFIG = 4
 ERR_MEASUREMENT = 5
 ERR_OUTPUT = 6
 ERR_DEINIT_CONFIG = 7
+ERR_PENDING = 8
+
+# Stop Reasons
+STOP_REASON_NONE = 0
+STOP_REASON_TIMER = 1
+STOP_REASON_KEY = 2
+STOP_REASON_SAMPLE_COUNT = 3
+STOP_REASON_QUEUE_DONE = 4
+STOP_REASON_OVERRUN = 5
+STOP_REASON_TRIGGER_ERROR = 6
+STOP_REASON_ERROR = 7
+STOP_REASON_UNDERRUN = 8
+STOP_REASON_OUTPUT_DONE = 9
+STOP_REASON_USER = 10
+
+# Trigger modes
+TRIG_OFF = 0
+TRIG_RISING = 1
+TRIG_FALLING = 2
+TRIG_ABOVE = 3
+
+# Latency histograms
+HIST_HANDLER = 0  # buffer done notification until the buffer is back with the driver
+HIST_CONVERT = 1  # conversion and storage of one buffer
+HIST_BUCKETS = 40  # bucket b counts [2^b, 2^(b+1)) ns
+
+# Benchmarks
+BENCH_RATES = (1000.0, 10000.0, 25000.0, 52700.0)
 
 
 class ChannelData(Structure):
     _fields_ = [
         ("channel", (POINTER(c_double)) * NUM_CHANNELS),
-        ("time_ms", POINTER(c_double)),
         ("num_readings", c_int),
-        ("max_readings", c_int)
+        ("max_readings", c_int),
+        ("num_channels", c_uint)
+    ]
+
+
+class ChannelMap(Structure):
+    _fields_ = [
+        ("count", c_uint),
+        ("physical", c_uint * NUM_CHANNELS),
+        ("sensitivity", c_double * NUM_CHANNELS)
+    ]
+
+
+class ChannelView(Structure):
+    _fields_ = [
+        ("data", POINTER(c_double)),
+        ("stride", c_long),
+        ("count", c_uint),
+        ("dtype", c_char * 4)
+    ]
+
+
+NUM_VIEWS = NUM_CHANNELS
+
+
+class WaveInfo(Structure):
+    _fields_ = [
+        ("samples", c_uint),
+        ("periods", c_uint),
+        ("frequency", c_double)
+    ]
+
+
+class OutputCounters(Structure):
+    _fields_ = [
+        ("buffers_played", c_ulong),
+        ("samples_played", c_ulong),
+        ("samples_queued", c_ulong),
+        ("underruns", c_ulong),
+        ("min_queued", c_uint)
+    ]
+
+
+# Fills volts[0..count-1] from first_sample on, returns the samples written
+OUTPUT_PRODUCER = CFUNCTYPE(c_uint, POINTER(c_double), c_uint, c_ulong, c_void_p)
+
+
+class BufferPool(Structure):
+    _fields_ = [
+        ("buffers", c_uint),
+        ("buffer_samples", c_ulong),
+        ("buffer_seconds", c_double),
+        ("queue_seconds", c_double),
+        ("process_mean", c_double),
+        ("process_max", c_double),
+        ("max_lag", c_double),
+        ("min_headroom", c_double)
+    ]
+
+
+class DecimationInfo(Structure):
+    _fields_ = [
+        ("factor", c_uint),
+        ("taps", c_uint),
+        ("cutoff", c_double)
+    ]
+
+
+class ChannelStats(Structure):
+    _fields_ = [
+        ("count", c_ulong),
+        ("mean", c_double),
+        ("rms", c_double),
+        ("std", c_double),
+        ("min", c_double),
+        ("max", c_double),
+        ("peak", c_double),
+        ("crest", c_double)
+    ]
+
+
+class PsdInfo(Structure):
+    _fields_ = [
+        ("segment_frames", c_uint),
+        ("bins", c_uint),
+        ("segments", c_ulong),
+        ("bin_hz", c_double),
+        ("overlap", c_double)
+    ]
+
+
+class SyncInfo(Structure):
+    _fields_ = [
+        ("synchronized", c_int),
+        ("offset_seconds", c_double),
+        ("offset_frames", c_double),
+        ("stimulus_hz", c_double),
+        ("coherence", c_double),
+        ("segments", c_ulong)
+    ]
+
+
+class TriggerEvent(Structure):
+    _fields_ = [
+        ("trigger_frame", c_ulong),
+        ("first_frame", c_ulong),
+        ("offset", c_ulong),
+        ("frames", c_uint)
+    ]
+
+
+class TriggerCounters(Structure):
+    _fields_ = [
+        ("events", c_ulong),
+        ("missed", c_ulong)
+    ]
+
+
+class BlockHeader(Structure):
+    _fields_ = [
+        ("sequence", c_ulong),
+        ("first_frame", c_ulong),
+        ("frames", c_uint),
+        ("channels", c_uint)
+    ]
+
+
+class SubscriptionCounters(Structure):
+    _fields_ = [
+        ("published", c_ulong),
+        ("dropped", c_ulong),
+        ("read", c_ulong)
+    ]
+
+
+class LatencyHistogram(Structure):
+    _fields_ = [
+        ("count", c_ulong),
+        ("mean", c_double),
+        ("max", c_double),
+        ("bucket", c_ulong * HIST_BUCKETS)
+    ]
+
+
+class PipelineCounters(Structure):
+    _fields_ = [
+        ("buffers", c_ulong),
+        ("frames", c_ulong),
+        ("frames_dropped", c_ulong),
+        ("buffers_dropped", c_ulong),
+        ("queue_depth", c_uint),
+        ("queue_depth_max", c_uint)
+    ]
+
+
+class SessionInfo(Structure):
+    _fields_ = [
+        ("open", c_int),
+        ("captures", c_ulong),
+        ("reconfigures", c_ulong),
+        ("reallocations", c_ulong)
+    ]
+
+
+class SimConfig(Structure):
+    _fields_ = [
+        ("speed", c_double),
+        ("amplitude", c_double * NUM_CHANNELS),
+        ("frequency", c_double * NUM_CHANNELS),
+        ("noise", c_double),
+        ("seed", c_ulong),
+        ("overrun_after", c_ulong),
+        ("queue_done_after", c_ulong),
+        ("dac_loopback", c_int),
+        ("da_lead", c_double),
+        ("loopback_delay", c_double),
+        ("wait_for_worker", c_int)
+    ]
+
+
+class ArenaInfo(Structure):
+    _fields_ = [
+        ("reserved_bytes", c_size_t),
+        ("committed_bytes", c_size_t),
+        ("region_bytes", c_size_t),
+        ("resets", c_ulong),
+        ("reservations", c_ulong),
+        ("commits", c_ulong),
+        ("huge_pages", c_int),
+        ("generation", c_ulong),
+        ("pins", c_uint)
+    ]
+
+
+class RecordInfo(Structure):
+    _fields_ = [
+        ("block_frames", c_uint),
+        ("blocks", c_ulong),
+        ("raw_bytes", c_ulong),
+        ("file_bytes", c_ulong),
+        ("pack_seconds", c_double)
     ]
 
 
+# Called on the conversion thread with (channel, frames, first_frame, sequence, user)
+BLOCK_CALLBACK = CFUNCTYPE(None, POINTER(POINTER(c_double)), c_uint, c_ulong, c_ulong, c_void_p)
+
+
+class TimeBase(Structure):
+    _fields_ = [
+        ("rate", c_double),
+        ("start_seconds", c_double),
+        ("anchors", c_ulong),
+        ("decimation", c_uint)
+    ]
+
+
+class _DeviceFunction():
+    """Library function that selects the owner's device before every call"""
+
+    def __init__(self, lib, function, device):
+        self.__dict__.update(_lib=lib, _function=function, _device=device)
+
+    def __call__(self, *args):
+        self._lib.select_device(self._device)
+        return self._function(*args)
+
+    def __getattr__(self, name):
+        return getattr(self._function, name)
+
+    def __setattr__(self, name, value):
+        setattr(self._function, name, value)
+
+
+class _DeviceLib():
+    """The library as seen by one device: every call runs on that device
+
+    The library keeps the selected device per thread, so objects for
+    different devices can be used from different threads at the same time.
+    """
+
+    def __init__(self, lib, device):
+        self._lib = lib
+        self._device = device
+        self._functions = {}
+
+    def __getattr__(self, name):
+        function = self._functions.get(name)
+        if function is None:
+            function = _DeviceFunction(
+                self._lib, getattr(self._lib, name), self._device)
+            self._functions[name] = function
+        return function
+
+
+class _ArenaPin():
+    """Keeps a device's capture arena mapped while arrays from _channel_views(copy=False) use it
+
+    The arrays of one call share a pin through the ctypes arrays they wrap, so
+    the arena is unpinned once the last of them is collected.
+    """
+
+    def __init__(self, device):
+        device.dt_lib.pin_capture_arena(True)
+        weakref.finalize(self, device._unpin_arena)
+
+
+class CaptureReader():
+    """A recording made with set_record_file(), read back one frame window at a time
+
+    The file is mapped, not loaded: read() converts only the frames asked for,
+    decoding just the packed blocks they fall in. Open it with
+    DT9837.open_recording() and close() it (or use it in a with block) when done.
+    """
+
+    def __init__(self, lib, handle):
+        self._lib = lib
+        self._handle = handle
+        physical = (c_uint * NUM_CHANNELS)()
+        self.frames = lib.capture_file_frames(handle)
+        self.frequency = lib.capture_file_frequency(handle)
+        self.channels = lib.capture_file_channels(handle, physical)
+        self.physical = list(physical[:self.channels])
+
+    def read(self, first=0, count=None):
+        """Returns frames [first, first + count) as (times, channel arrays), like measure_acceleration()
+
+        The window is clipped to the end of the recording. Returns NumPy arrays
+        when NumPy is available, memoryviews otherwise; either way they are the
+        caller's to keep. Times are seconds since the first frame of the recording.
+
+        :param first: index of the first frame, defaults to 0
+        :type first: int, optional
+        :param count: number of frames, defaults to the rest of the recording
+        :type count: int, optional
+        """
+        if self._handle is None:
+            return ERR_CFG_FAILURE, ERR_CFG_FAILURE
+        count = max(min(self.frames - first if count is None else count, self.frames - first), 0)
+        blocks = [(c_double * count)() for _ in range(self.channels)]
+        out = (POINTER(c_double) * NUM_CHANNELS)(*(cast(block, POINTER(c_double)) for block in blocks))
+        count = self._lib.capture_file_read(self._handle, first, count, out) if count > 0 else 0
+        arrays = []
+        for block in blocks:
+            if np is not None:
+                arrays.append(np.ctypeslib.as_array(block)[:count])
+            else:
+                arrays.append(memoryview(block).cast("B").cast("d")[:count])
+        if np is not None:
+            times = (first + np.arange(count, dtype=np.float64)) / self.frequency
+        else:
+            times = memoryview((c_double * count)(*((first + i) / self.frequency for i in range(count))))
+            times = times.cast("B").cast("d")
+        return times, arrays
+
+    def close(self):
+        """Unmaps the recording"""
+        if self._handle is not None:
+            self._lib.capture_file_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+
 class DT9837():
-    def __init__(self):
+    def __init__(self, lib_path=None, simulated=False, device=0):
         """Equipment class for DT9837 signal analyzer
+
+        :param lib_path: path of the compiled library, defaults to the install location
+        :type lib_path: str, optional
+        :param simulated: use the built-in DT9837 simulator instead of a board, defaults to False
+        :type simulated: bool, optional
+        :param device: index of the board to use (see boards()), defaults to 0
+        :type device: int, optional
         """
-        self.dt_lib = CDLL(
-            "C:\_Automation\Win32\SDK\Examples\DtConsole\dt_lib.so")
+        if lib_path is None:
+            if os.name == "nt":
+                lib_path = "C:\_Automation\Win32\SDK\Examples\DtConsole\dt_lib.so"
+            else:
+                lib_path = os.path.join(os.path.dirname(
+                    os.path.abspath(__file__)), "dt_lib.so")
+        self.device = device
+        self.dt_lib = _DeviceLib(CDLL(lib_path), device)
+        self.simulated = simulated
+        self.dt_lib.get_board_name.argtypes = [c_uint, c_char_p, c_uint]
+        self.dt_lib.set_sim_boards.argtypes = [c_uint]
+        self.dt_lib.set_sim_timing.argtypes = [c_double, c_double]
+        self.dt_lib.configure_simulator.argtypes = [
+            c_double, c_double, c_ulong, c_ulong, c_ulong, c_bool]
+        self.dt_lib.get_simulator_config.restype = SimConfig
+        self.dt_lib.set_sim_flow_control.argtypes = [c_bool]
+        self.dt_lib.set_sim_signal.argtypes = [c_int, c_double, c_double]
+        self.dt_lib.get_channel_views.argtypes = [POINTER(ChannelView)]
+        self.dt_lib.get_channel_views.restype = c_int
+        self.dt_lib.get_channel_data.restype = ChannelData
+        self.dt_lib.set_channel_map.argtypes = [c_uint, POINTER(c_uint), POINTER(c_double)]
+        self.dt_lib.get_channel_map.restype = ChannelMap
+        self.dt_lib.set_waveform.argtypes = [c_int, c_double, c_double]
+        self.dt_lib.set_arbitrary_waveform.argtypes = [
+            POINTER(c_double), c_uint]
+        self.dt_lib.get_waveform_info.restype = WaveInfo
+        self.dt_lib.set_output_stream.argtypes = [
+            c_bool, OUTPUT_PRODUCER, c_void_p, c_char_p]
+        self.dt_lib.get_output_counters.restype = OutputCounters
+        self._producer = OUTPUT_PRODUCER()
+        self.dt_lib.set_buffer_pool.argtypes = [
+            c_double, c_double, c_uint, c_uint]
+        self.dt_lib.get_buffer_pool.restype = BufferPool
+        self.dt_lib.set_decimation.argtypes = [c_uint, c_uint]
+        self.dt_lib.get_decimation.restype = DecimationInfo
+        self.dt_lib.get_decimation_taps.argtypes = [POINTER(c_double), c_uint]
+        self.dt_lib.get_decimation_taps.restype = c_uint
+        self.dt_lib.set_stats_window.argtypes = [c_double]
+        self.dt_lib.get_channel_stats.argtypes = [POINTER(ChannelStats)]
+        self.dt_lib.get_window_stats.argtypes = [POINTER(ChannelStats)]
+        self.dt_lib.set_capture_stream.argtypes = [
+            c_bool, c_void_p, c_void_p, c_char_p]
+        self.dt_lib.set_psd.argtypes = [c_uint, c_double]
+        self.dt_lib.get_psd_info.restype = PsdInfo
+        self.dt_lib.get_psd.argtypes = [c_uint, POINTER(c_double), c_uint]
+        self.dt_lib.get_psd.restype = c_uint
+        self.dt_lib.set_capture_arena.argtypes = [c_bool]
+        self.dt_lib.pin_capture_arena.argtypes = [c_bool]
+        self.dt_lib.get_capture_arena.restype = ArenaInfo
+        self.dt_lib.set_record_file.argtypes = [c_char_p]
+        self.dt_lib.set_record_compression.argtypes = [c_bool]
+        self.dt_lib.get_record_info.restype = RecordInfo
+        self.dt_lib.capture_file_open.argtypes = [c_char_p]
+        self.dt_lib.capture_file_open.restype = c_void_p
+        self.dt_lib.capture_file_close.argtypes = [c_void_p]
+        self.dt_lib.capture_file_frames.argtypes = [c_void_p]
+        self.dt_lib.capture_file_frames.restype = c_ulong
+        self.dt_lib.capture_file_frequency.argtypes = [c_void_p]
+        self.dt_lib.capture_file_frequency.restype = c_double
+        self.dt_lib.capture_file_channels.argtypes = [c_void_p, POINTER(c_uint)]
+        self.dt_lib.capture_file_channels.restype = c_uint
+        self.dt_lib.capture_file_read.argtypes = [
+            c_void_p, c_ulong, c_ulong, POINTER(POINTER(c_double))]
+        self.dt_lib.capture_file_read.restype = c_ulong
+        self.dt_lib.set_frf.argtypes = [c_bool]
+        self.dt_lib.get_frf.argtypes = [c_uint, POINTER(c_double), POINTER(c_double),
+                                        POINTER(c_double), c_uint]
+        self.dt_lib.get_frf.restype = c_uint
+        self.dt_lib.set_sync_start.argtypes = [c_bool]
+        self.dt_lib.get_sync_info.restype = SyncInfo
+        self.dt_lib.set_trigger.argtypes = [
+            c_int, c_uint, c_double, c_double, c_uint, c_uint, c_uint]
+        self.dt_lib.get_trigger_events.argtypes = [POINTER(TriggerEvent), c_uint]
+        self.dt_lib.get_trigger_events.restype = c_uint
+        self.dt_lib.get_trigger_counters.restype = TriggerCounters
+        self.dt_lib.set_subscription.argtypes = [BLOCK_CALLBACK, c_void_p, c_bool]
+        self.dt_lib.read_block.argtypes = [
+            POINTER(BlockHeader), POINTER(POINTER(c_double)), c_uint, c_uint]
+        self.dt_lib.read_block.restype = c_uint
+        self.dt_lib.get_block_frames.restype = c_uint
+        self.dt_lib.get_subscription_counters.restype = SubscriptionCounters
+        self.dt_lib.measure_async.argtypes = [c_bool, c_int, c_float,
+                                              c_int, c_int, c_int, c_int, c_int, c_bool, c_int]
+        self.dt_lib.measure_wait.argtypes = [c_uint]
+        self._block_callback = BLOCK_CALLBACK()
+        self._block_arrays = None
+        self.dt_lib.get_latency_histogram.argtypes = [
+            c_int, POINTER(LatencyHistogram)]
+        self.dt_lib.latency_percentile.argtypes = [
+            POINTER(LatencyHistogram), c_double]
+        self.dt_lib.latency_percentile.restype = c_double
+        self.dt_lib.get_pipeline_counters.restype = PipelineCounters
+        self.dt_lib.set_instrumentation_dump.argtypes = [c_double, c_char_p]
+        self.dt_lib.set_instrumentation.argtypes = [c_bool]
+        self.dt_lib.get_session_info.restype = SessionInfo
+        self.dt_lib.get_time_base.restype = TimeBase
+        self.dt_lib.get_frame_times.argtypes = [
+            c_ulong, c_uint, POINTER(c_double)]
+        self.dt_lib.frame_host_time.argtypes = [c_ulong]
+        self.dt_lib.frame_host_time.restype = c_double
+        self.dt_lib.set_capture_frames.argtypes = [c_ulong]
+        self.dt_lib.get_stop_reason.restype = c_int
+        self.dt_lib.get_run_seconds.restype = c_double
+        self._data_held = False
+        self._arena_release_pending = False
 
     def connect(self):
         """Connect to the device."""
         err_str = ""
+        self._arena_release_pending = False
+        if self.simulated:
+            self.dt_lib.select_backend(BACKEND_SIMULATOR)
         self.init = self.dt_lib.initialize_board
         err_code = self.init()
         if err_code != 0:
             err_str = "ERROR_INIT_CONFIG_FAILURE"
             print(f"Error Occured: {err_code}_{err_str}")
 
+    def boards(self):
+        """Names of the boards with an A/D subsystem; device i opens board i"""
+        if self.simulated:
+            self.dt_lib.select_backend(BACKEND_SIMULATOR)
+        name = create_string_buffer(64)
+        names = []
+        for index in range(self.dt_lib.get_board_count()):
+            self.dt_lib.get_board_name(index, name, len(name))
+            names.append(name.value.decode())
+        return names
+
+    def set_sim_boards(self, count):
+        """Number of boards the simulator enumerates (1-8); set before connecting any of them"""
+        return self.dt_lib.set_sim_boards(count)
+
+    def set_sim_timing(self, da_lead, loopback_delay=0.0):
+        """Simulated loopback timing: seconds a separately started output runs ahead of
+        the input, and the delay from the output to the DAC input channel"""
+        return self.dt_lib.set_sim_timing(da_lead, loopback_delay)
+
     def disconnect(self):
         """Disconnect the device"""
         err_str = ""
+        self.session_close()
+        self.release_data()
+        # storage still under views from copy=False is released once they are gone
+        self._arena_release_pending = self.dt_lib.release_capture_arena() != ERR_CFG_SUCCESS
         self.deinit = self.dt_lib.deinit_board
         err_code = self.deinit()
         if err_code != 0:
             err_str = "ERROR_DEINIT_CONFIG_FAILURE"
             print(f"Error Occured: {err_code}_{err_str}")
 
-    def measure_acceleration(self, duration, timer_enabled=True, use_default_vals=True, save_csv=False):
+    def measure_acceleration(self, duration, timer_enabled=True, use_default_vals=True, save_csv=False, copy=True):
         """This function measures the acceleration reading
 
         A 3 axis accelerometer must be connected to the equipment.
@@ -74,6 +585,9 @@ class DT9837():
         :type use_default_vals: bool, optional
         :param save_csv: save the output to a csv file, defaults to False
         :type use_default_vals: bool, optional
+        :param copy: return copies of the data; False returns views into the capture storage
+            (see _channel_views()), defaults to True
+        :type copy: bool, optional
         """
         # C Functions assignment
         self.measure = self.dt_lib.measure
@@ -86,6 +600,7 @@ class DT9837():
         self.measure.restype = c_int
         self.get_data.restype = ChannelData
         # Measurement Excecution
+        self._prepare_capture()
         print(f"[Signal Analyzer]: Measurement Started for {duration} seconds")
         err_code = self.measure(use_default_vals, NUM_CHANNELS,
                                 CLOCK_FREQUENCY, ALL_CHANNEL_GAIN, CHANNEL_GAIN_0, CHANNEL_GAIN_1, CHANNEL_GAIN_2, CHANNEL_GAIN_3, timer_enabled, duration)
@@ -93,18 +608,9 @@ class DT9837():
         if err_code != ERR_CFG_SUCCESS:
             return ERR_MEASUREMENT, ERR_MEASUREMENT
         # Acquiring the stored data
-        data_struct = self.get_data()
-        channels = [[round(data_struct.channel[i][j], 3)
-                     for j in range(data_struct.num_readings)] for i in range(4)]
-        time_ms = [round(data_struct.time_ms[i], 3)
-                   for i in range(data_struct.num_readings)]
-
-        # Free the memory allocated
-        self.cleanup_data()
-
-        return time_ms, channels
+        return self._channel_views(copy)
 
-    def generate_squarewave(self, duration, timer_enabled=True, use_default_vals=True, read_input=True):
+    def generate_squarewave(self, duration, timer_enabled=True, use_default_vals=True, read_input=True, copy=True):
         """This function generates a simple squarewave
 
         Generates a wave at the specified amplitude (V), frequency (Hz) and duration (in s).
@@ -118,6 +624,9 @@ class DT9837():
         :type use_default_vals: bool, optional
         :param read_input: record the input into a csv, defaults to True
         :type read_input: bool, optional
+        :param copy: return copies of the data; False returns views into the capture storage
+            (see _channel_views()), defaults to True
+        :type copy: bool, optional
         """
         # C Functions assignment
         self.generate = self.dt_lib.generate
@@ -130,6 +639,7 @@ class DT9837():
         self.generate.restype = c_int
         self.get_data.restype = ChannelData
         # Measurement Excecution
+        self.release_data()
         if timer_enabled:
             print(
                 f"[Signal Analyzer]: Squarewave Output for {duration} seconds. Read_Input {read_input}")
@@ -143,18 +653,590 @@ class DT9837():
             return ERR_MEASUREMENT, ERR_MEASUREMENT
         if read_input:
             # Acquiring the stored data
-            data_struct = self.get_data()
-            channels = [[round(data_struct.channel[i][j], 3)
-                        for j in range(data_struct.num_readings)] for i in range(4)]
-            time_ms = [round(data_struct.time_ms[i], 3)
-                       for i in range(data_struct.num_readings)]
+            return self._channel_views(copy)
+        else:
+            return ERR_CFG_SUCCESS, ERR_CFG_SUCCESS
+
+    def set_waveform(self, shape, chirp_end=0.0, chirp_seconds=0.0):
+        """Selects the waveform used by generate_squarewave()
+
+        :param shape: WAVE_SQUARE, WAVE_SINE, WAVE_TRIANGLE or WAVE_CHIRP
+        :type shape: int
+        :param chirp_end: end frequency in hertz (Hz) of a chirp, which starts at WAVEFORM_FREQUENCY
+        :type chirp_end: float, optional
+        :param chirp_seconds: length in seconds(s) of one sweep
+        :type chirp_seconds: float, optional
+        """
+        return self.dt_lib.set_waveform(shape, chirp_end, chirp_seconds)
+
+    def set_arbitrary_waveform(self, volts):
+        """Outputs one period of user samples (in volts) repeated at the output clock
+
+        :param volts: samples of one period
+        :type volts: sequence of float
+        """
+        samples = (c_double * len(volts))(*volts)
+        return self.dt_lib.set_arbitrary_waveform(samples, len(volts))
 
-            # Free the memory allocated
-            self.cleanup_data()
+    def waveform_info(self):
+        """Returns the buffer length, period count and actual frequency of the last output"""
+        info = self.dt_lib.get_waveform_info()
+        return info.samples, info.periods, info.frequency
 
-            return time_ms, channels
+    def set_output_stream(self, enable, producer=None, path=None):
+        """Streams the output through rotating buffers instead of looping one table
+
+        Without a producer or path the waveform from set_waveform() is streamed.
+
+        :param enable: enable streaming output
+        :type enable: bool
+        :param producer: callable(volts, count, first_sample) that fills volts and returns the samples written
+        :type producer: callable, optional
+        :param path: file of little-endian float64 volts to play back
+        :type path: str, optional
+        """
+        if producer is not None:
+            self._producer = OUTPUT_PRODUCER(
+                lambda volts, count, first, user: producer(volts, count, first))
         else:
-            return ERR_CFG_SUCCESS, ERR_CFG_SUCCESS
+            self._producer = OUTPUT_PRODUCER()
+        return self.dt_lib.set_output_stream(enable, self._producer, None,
+                                             path.encode() if path else None)
+
+    def output_counters(self):
+        """Returns the counters of the last streamed output"""
+        return self.dt_lib.get_output_counters()
+
+    def set_buffer_pool(self, target_latency=0.1, queue_seconds=1.0, min_buffers=4, max_buffers=64):
+        """Sets the bounds used to size the driver buffers of the next measurements
+
+        :param target_latency: seconds of data per buffer
+        :type target_latency: float, optional
+        :param queue_seconds: seconds of data queued in the driver
+        :type queue_seconds: float, optional
+        :param min_buffers: fewest buffers (at least 2)
+        :type min_buffers: int, optional
+        :param max_buffers: most buffers (at most 64)
+        :type max_buffers: int, optional
+        """
+        return self.dt_lib.set_buffer_pool(target_latency, queue_seconds, min_buffers, max_buffers)
+
+    def buffer_pool(self):
+        """Returns the buffer configuration chosen for the last measurement and the headroom observed"""
+        return self.dt_lib.get_buffer_pool()
+
+    def set_decimation(self, factor, taps_per_phase=0):
+        """Stores every factor-th frame of the next measurements, low-pass filtered first
+
+        The returned arrays and frame_times() are at CLOCK_FREQUENCY / factor.
+        Blocks from subscribe() and read_block() stay at the full rate.
+
+        :param factor: input frames per stored frame, 1 to store every frame
+        :type factor: int
+        :param taps_per_phase: even filter length per output phase, 0 for the default
+        :type taps_per_phase: int, optional
+        """
+        return self.dt_lib.set_decimation(factor, taps_per_phase)
+
+    def decimation(self):
+        """Returns the decimation factor, filter length and cutoff (fraction of the clock)"""
+        return self.dt_lib.get_decimation()
+
+    def decimation_taps(self):
+        """Returns the coefficients of the decimation filter"""
+        taps = (c_double * self.dt_lib.get_decimation_taps(None, 0))()
+        self.dt_lib.get_decimation_taps(taps, len(taps))
+        return list(taps)
+
+    def retain_data(self, retain):
+        """Keeps (default) or discards the converted frames of the next measurements
+
+        Without retention memory stays at one chunk however long the run is and
+        the measurement returns no data; use channel_stats() for the results.
+        """
+        return self.dt_lib.set_capture_stream(not retain, None, None, None)
+
+    def set_stats_window(self, seconds):
+        """Length of the sliding window used by window_stats(), 0 to turn it off"""
+        return self.dt_lib.set_stats_window(seconds)
+
+    def channel_stats(self):
+        """Mean, RMS, std, min/max, peak and crest factor per channel over the whole run
+
+        Can be called while measure_async() is running.
+        """
+        stats = (ChannelStats * NUM_CHANNELS)()
+        self.dt_lib.get_channel_stats(stats)
+        return list(stats)
+
+    def window_stats(self):
+        """Like channel_stats() over the newest sliding window"""
+        stats = (ChannelStats * NUM_CHANNELS)()
+        self.dt_lib.get_window_stats(stats)
+        return list(stats)
+
+    def set_psd(self, segment_frames, overlap=0.5):
+        """Averages a Welch PSD of every channel during the next measurements
+
+        :param segment_frames: FFT length, a power of two from 64 to 65536, 0 to turn it off
+        :type segment_frames: int
+        :param overlap: fraction of each segment shared with the next, defaults to 0.5
+        :type overlap: float, optional
+        """
+        return self.dt_lib.set_psd(segment_frames, overlap)
+
+    def psd_info(self):
+        """Returns the segment length, bin count, segments averaged and bin width"""
+        return self.dt_lib.get_psd_info()
+
+    def psd(self, channel):
+        """Returns (frequencies, density) of channel, in g^2/Hz (V^2/Hz for the DAC)
+
+        Can be called mid-run for the average so far.
+        """
+        info = self.dt_lib.get_psd_info()
+        values = (c_double * max(info.bins, 1))()
+        bins = self.dt_lib.get_psd(channel, values, info.bins)
+        if np is not None:
+            return np.arange(bins) * info.bin_hz, np.array(values[:bins])
+        return [k * info.bin_hz for k in range(bins)], values[:bins]
+
+    def set_channel_map(self, physical, sensitivity=None):
+        """Captures the physical inputs in the given order from the next measurement on
+
+        Output channel k is input physical[k] (0-Z, 1-Y, 2-X, 3-DAC loop); one to
+        four inputs, each at most once. Measurements then return that many
+        channels. The default is [2, 1, 0, 3] (X, Y, Z, DAC).
+
+        :param physical: inputs in output order
+        :type physical: list
+        :param sensitivity: mV per g of each output channel, defaults to the calibrated values
+        :type sensitivity: list, optional
+        """
+        count = len(physical)
+        inputs = (c_uint * NUM_CHANNELS)(*physical)
+        scale = (c_double * NUM_CHANNELS)(*sensitivity) if sensitivity is not None else None
+        return self.dt_lib.set_channel_map(count, inputs, scale)
+
+    def channel_map(self):
+        """Returns (physical inputs, sensitivities) of the output channels"""
+        m = self.dt_lib.get_channel_map()
+        return list(m.physical[:m.count]), list(m.sensitivity[:m.count])
+
+    def set_capture_arena(self, huge_pages):
+        """Backs the capture storage with transparent huge pages (Linux) from the next run on"""
+        return self.dt_lib.set_capture_arena(huge_pages)
+
+    def capture_arena(self):
+        """Returns the reserved and committed bytes of the capture storage and its reuse counters"""
+        return self.dt_lib.get_capture_arena()
+
+    def release_capture_arena(self):
+        """Returns the capture storage to the system; release_data() only resets it for reuse
+
+        Fails (ERR_CFG_FAILURE) while the arena is pinned under views.
+        """
+        self.release_data()
+        return self.dt_lib.release_capture_arena()
+
+    def set_record_file(self, path, compressed=False):
+        """Records the raw A/D codes of the next measurements to a capture file
+
+        :param path: file to write, None to stop recording
+        :type path: str
+        :param compressed: pack the codes losslessly (delta + bit-packing), defaults to False
+        :type compressed: bool, optional
+        """
+        self.dt_lib.set_record_compression(compressed)
+        return self.dt_lib.set_record_file(path.encode() if path is not None else None)
+
+    def record_info(self):
+        """Returns the blocks, raw and file bytes and packing time of the last recording"""
+        return self.dt_lib.get_record_info()
+
+    def open_recording(self, path):
+        """Opens a capture file written by set_record_file() for reading
+
+        :param path: the recording, raw or packed
+        :type path: str
+        :return: a CaptureReader, or None if the file is not a readable recording
+        """
+        handle = self.dt_lib.capture_file_open(path.encode())
+        if not handle:
+            return None
+        return CaptureReader(self.dt_lib, handle)
+
+    def set_frf(self, enable=True):
+        """Sums cross spectra against the DAC channel in the next measurements with a PSD
+
+        The response is read with frf(); set_psd() chooses the segments.
+        """
+        return self.dt_lib.set_frf(enable)
+
+    def frf(self, channel):
+        """Returns (frequencies, magnitude, phase, coherence) of channel relative to the DAC
+
+        The magnitude is in g per volt and the phase in radians (H1 estimate).
+        Can be called mid-run for the average so far.
+        """
+        info = self.dt_lib.get_psd_info()
+        size = max(info.bins, 1)
+        magnitude, phase, coherence = (c_double * size)(), (c_double * size)(), (c_double * size)()
+        bins = self.dt_lib.get_frf(channel, magnitude, phase, coherence, info.bins)
+        freqs = [k * info.bin_hz for k in range(bins)]
+        if np is not None:
+            return (np.array(freqs), np.array(magnitude[:bins]), np.array(phase[:bins]),
+                    np.array(coherence[:bins]))
+        return freqs, magnitude[:bins], phase[:bins], coherence[:bins]
+
+    def set_sync_start(self, enable=True):
+        """Starts the output and the input together in generate_squarewave() with read_input
+
+        With a PSD set, sync_info() then reports the offset between the stimulus
+        played and the DAC input channel.
+        """
+        return self.dt_lib.set_sync_start(enable)
+
+    def sync_info(self):
+        """Returns whether the last output started with the input and the measured offset
+
+        The offset is known within half a period of the stimulus frequency.
+        """
+        return self.dt_lib.get_sync_info()
+
+    def set_trigger(self, mode, channel=0, level=0.0, hysteresis=0.0, pre_frames=0, post_frames=1000, max_events=100):
+        """Keeps only windows around trigger events in the next measurements
+
+        The returned arrays hold the windows back to back; split them with
+        event_windows().
+
+        :param mode: TRIG_RISING, TRIG_FALLING, TRIG_ABOVE (|value| >= level) or TRIG_OFF
+        :type mode: int
+        :param channel: trigger channel, 0-X 1-Y 2-Z 3-DAC
+        :type channel: int, optional
+        :param level: trigger level in g (V for the DAC channel)
+        :type level: float, optional
+        :param hysteresis: distance back past the level that re-arms the trigger
+        :type hysteresis: float, optional
+        :param pre_frames: frames kept before the trigger frame
+        :type pre_frames: int, optional
+        :param post_frames: frames kept from the trigger frame on
+        :type post_frames: int, optional
+        :param max_events: windows stored per run, later events are counted as missed
+        :type max_events: int, optional
+        """
+        return self.dt_lib.set_trigger(mode, channel, level, hysteresis, pre_frames, post_frames, max_events)
+
+    def trigger_events(self):
+        """Returns the TriggerEvent records of the last measurement and the counters"""
+        counters = self.dt_lib.get_trigger_counters()
+        events = (TriggerEvent * max(counters.events, 1))()
+        count = self.dt_lib.get_trigger_events(events, counters.events)
+        return list(events[:count]), counters
+
+    def event_windows(self, sensor_vals):
+        """Splits the arrays returned by a triggered measurement into (times, channels) per event"""
+        windows = []
+        for event in self.trigger_events()[0]:
+            end = event.offset + event.frames
+            windows.append((self.frame_times(event.first_frame, event.frames),
+                            [values[event.offset:end] for values in sensor_vals]))
+        return windows
+
+    def subscribe(self, callback=None, poll=True):
+        """Receives each converted block while a measurement runs
+
+        The callback runs on the library's conversion thread and is given
+        (channels, frames, first_frame, sequence); the channel arrays are only
+        valid during the call. With poll, blocks are also kept for read_block().
+
+        :param callback: callable receiving each block, defaults to None
+        :type callback: callable, optional
+        :param poll: keep blocks for read_block(), defaults to True
+        :type poll: bool, optional
+        """
+        if callback is not None:
+            def forward(channel, frames, first_frame, sequence, user):
+                callback([channel[c][:frames] for c in range(NUM_CHANNELS) if channel[c]],
+                         frames, first_frame, sequence)
+            self._block_callback = BLOCK_CALLBACK(forward)
+        else:
+            self._block_callback = BLOCK_CALLBACK()
+        return self.dt_lib.set_subscription(self._block_callback, None, poll)
+
+    def read_block(self, timeout_ms=100):
+        """Takes the oldest converted block, waiting up to timeout_ms for one
+
+        The GIL is released while waiting. When blocks are not read in time
+        the oldest ones are dropped to make room for new ones; a gap in the
+        sequence numbers shows where.
+
+        :return: (sequence, first_frame, channels) or None if no block arrived
+        """
+        block_frames = self.dt_lib.get_block_frames()
+        if block_frames == 0:
+            return None
+        if self._block_arrays is None or len(self._block_arrays[0]) != block_frames:
+            self._block_arrays = [(c_double * block_frames)()
+                                  for _ in range(NUM_CHANNELS)]
+        out = (POINTER(c_double) * NUM_CHANNELS)(
+            *[cast(a, POINTER(c_double)) for a in self._block_arrays])
+        header = BlockHeader()
+        frames = self.dt_lib.read_block(byref(header), out, block_frames, timeout_ms)
+        if frames == 0:
+            return None
+        arrays = self._block_arrays[:header.channels]
+        if np is not None:
+            channels = [np.array(a[:frames]) for a in arrays]
+        else:
+            channels = [a[:frames] for a in arrays]
+        return header.sequence, header.first_frame, channels
+
+    def subscription_counters(self):
+        """Returns the blocks published, dropped and read in the current run"""
+        return self.dt_lib.get_subscription_counters()
+
+    def measure_async(self, duration, timer_enabled=True, use_default_vals=True):
+        """Starts measure_acceleration() on the library's acquisition thread and returns at once
+
+        Use read_block() or subscribe() for data while it runs, stop() to end
+        it early and wait() for the result.
+        """
+        self._prepare_capture()
+        err_code = self.dt_lib.measure_async(use_default_vals, NUM_CHANNELS, CLOCK_FREQUENCY, ALL_CHANNEL_GAIN,
+                                             CHANNEL_GAIN_0, CHANNEL_GAIN_1, CHANNEL_GAIN_2, CHANNEL_GAIN_3, timer_enabled, duration)
+        self._error_check(err_code)
+        return err_code
+
+    def stop(self):
+        """Ends the running measurement"""
+        return self.dt_lib.measure_stop()
+
+    def wait(self, timeout_ms=0xFFFFFFFF, copy=True):
+        """Waits for measure_async() to finish and returns its data like measure_acceleration()
+
+        :param copy: return copies of the data; False returns views into the capture storage
+            (see _channel_views()), defaults to True
+        :type copy: bool, optional
+        :return: ERR_PENDING if still running after timeout_ms
+        """
+        err_code = self.dt_lib.measure_wait(timeout_ms)
+        if err_code == ERR_PENDING:
+            return ERR_PENDING
+        self._error_check(err_code)
+        if err_code != ERR_CFG_SUCCESS:
+            return ERR_MEASUREMENT, ERR_MEASUREMENT
+        return self._channel_views(copy)
+
+    def latency_histogram(self, which=HIST_HANDLER):
+        """Histogram of the per-buffer handler (HIST_HANDLER) or conversion (HIST_CONVERT) times of the current or last run"""
+        hist = LatencyHistogram()
+        self.dt_lib.get_latency_histogram(which, byref(hist))
+        return hist
+
+    def latency_percentile(self, hist, p):
+        """Upper bound in seconds of fraction p (0-1) of the times in a latency_histogram()"""
+        return self.dt_lib.latency_percentile(byref(hist), p)
+
+    def pipeline_counters(self):
+        """Buffers, frames, drops and conversion queue depth of the current or last run"""
+        return self.dt_lib.get_pipeline_counters()
+
+    def set_instrumentation_dump(self, period, path=None):
+        """Writes a CSV summary line every period seconds of the next runs
+
+        :param period: seconds between lines, 0 to turn the dump off
+        :type period: float
+        :param path: file the lines are appended to, defaults to stdout
+        :type path: str, optional
+        """
+        return self.dt_lib.set_instrumentation_dump(period, path.encode() if path else None)
+
+    def set_instrumentation(self, enabled):
+        """Turns the latency histograms of the next runs on or off; the pipeline counters always run"""
+        return self.dt_lib.set_instrumentation(enabled)
+
+    def benchmark(self, rates=BENCH_RATES, channels=(1, 2, 3, 4), seconds=1.0):
+        """Times getting simulated captures into Python
+
+        The extraction of the data into Python is timed on captures from the
+        simulator, so nothing is run unless simulated and connected. Rates are
+        in frames per second; ns_per_frame and realtime (times faster than the
+        board delivers) show how much headroom each path has. The library's
+        own paths (conversion, storage, square wave, packing, captures with
+        and without a session) are timed by make bench in tests/, which writes
+        the same JSON lines.
+
+        :return: one dict per path, rate and channel count (kind, rate, channels,
+            frames, seconds, frames_per_second, ns_per_frame, realtime)
+        """
+        results = []
+        for rate in rates:
+            if self.simulated:
+                for count in channels:
+                    results.extend(self._extraction_benchmark(rate, seconds, count))
+        return results
+
+    def _extraction_benchmark(self, rate, seconds, channels):
+        """Times getting a simulated capture of seconds of data into Python
+
+        Three ways are timed on the same capture: Python lists built one
+        element at a time through ctypes (extract_list, how the data used to be
+        returned), _channel_views() copies (extract_copy, the default) and
+        _channel_views(copy=False) views (extract_view). The capture uses the
+        first channels entries of the channel map.
+        """
+        frames = int(rate * seconds)
+        self.dt_lib.measure.argtypes = [c_bool, c_int, c_float,
+                                        c_int, c_int, c_int, c_int, c_int, c_bool, c_int]
+        config = self.dt_lib.get_simulator_config()
+        self.dt_lib.configure_simulator(0.0, 0.001, 1, 0, 0, True)
+        self.dt_lib.set_sim_flow_control(True)
+        try:
+            self.release_data()
+            self.set_capture_frames(frames)
+            err_code = self.dt_lib.measure(False, channels, rate, ALL_CHANNEL_GAIN, CHANNEL_GAIN_0,
+                                           CHANNEL_GAIN_1, CHANNEL_GAIN_2, CHANNEL_GAIN_3, True, int(seconds) + 1)
+        finally:
+            self.set_capture_frames(0)
+            self._restore_simulator(config)
+        self._error_check(err_code)
+        views = (ChannelView * NUM_VIEWS)()
+        self.dt_lib.get_channel_views(views)
+
+        def as_lists():
+            return [[view.data[i] for i in range(view.count)] for view in views[:channels]]
+
+        results = []
+        for kind, extract in (("extract_list", as_lists), ("extract_copy", self._channel_views),
+                              ("extract_view", lambda: self._channel_views(copy=False))):
+            passes = 0
+            start = time.perf_counter()
+            elapsed = 0.0
+            while err_code == ERR_CFG_SUCCESS and elapsed < 0.2:
+                extract()
+                passes += 1
+                elapsed = time.perf_counter() - start
+            processed = passes * frames
+            results.append({"kind": kind, "rate": rate, "channels": channels, "frames": processed,
+                            "seconds": elapsed, "frames_per_second": processed / elapsed if elapsed else 0.0,
+                            "ns_per_frame": elapsed * 1e9 / processed if processed else 0.0,
+                            "realtime": processed / elapsed / rate if elapsed else 0.0})
+        self.release_data()
+        return results
+
+    def _restore_simulator(self, config):
+        """Puts back the simulator settings saved by get_simulator_config()"""
+        self.dt_lib.configure_simulator(config.speed, config.noise, config.seed, config.overrun_after,
+                                        config.queue_done_after, bool(config.dac_loopback))
+        self.dt_lib.set_sim_flow_control(bool(config.wait_for_worker))
+
+    def session_open(self):
+        """Keeps the A/D configured across the following measurements
+
+        Until session_close() every measure_acceleration() and measure_async()
+        reuses the subsystem, driver buffers and capture storage, and only
+        writes the channel list or clock when they changed. Arrays returned by
+        a measurement are overwritten by the next one.
+        """
+        err_code = self.dt_lib.session_open()
+        self._error_check(err_code)
+        return err_code
+
+    def session_close(self):
+        """Releases the subsystem held by session_open(); the last data stays until release_data()"""
+        return self.dt_lib.session_close()
+
+    def session_info(self):
+        """Whether a session is open and its captures, reconfigurations and buffer allocations"""
+        return self.dt_lib.get_session_info()
+
+    def _prepare_capture(self):
+        """Frees the previous capture's storage unless a session reuses it"""
+        if not self.session_info().open:
+            self.release_data()
+
+    def set_capture_frames(self, frames):
+        """Stops the next measurements after an exact number of frames
+
+        :param frames: frames to capture, 0 to go back to the timer
+        :type frames: int
+        """
+        self.dt_lib.set_capture_frames(frames)
+
+    def stop_reason(self):
+        """Returns why the last measurement stopped (STOP_REASON_*) and how long it ran in seconds"""
+        return self.dt_lib.get_stop_reason(), self.dt_lib.get_run_seconds()
+
+    def frame_times(self, first_frame, count):
+        """Timestamps in seconds since the first frame, computed from the frame index
+
+        :param first_frame: index of the first frame
+        :type first_frame: int
+        :param count: number of timestamps
+        :type count: int
+        """
+        rate = self.dt_lib.get_time_base().rate
+        if np is not None:
+            return (first_frame + np.arange(count, dtype=np.float64)) / rate
+        times = (c_double * count)()
+        self.dt_lib.get_frame_times(first_frame, count, times)
+        return memoryview(times).cast("B").cast("d")
+
+    def frame_host_time(self, frame):
+        """Host monotonic time in seconds at which frame was sampled"""
+        return self.dt_lib.frame_host_time(frame)
+
+    def release_data(self):
+        """Hand the capture storage back to the library for the next run
+
+        Views returned with copy=False point into this storage and must not be
+        used after it is released: the next run overwrites it. Copies (the
+        default) are not affected.
+        """
+        if self._data_held:
+            self.dt_lib.cleanup_data()
+            self._data_held = False
+
+    def _channel_views(self, copy=True):
+        """Returns the captured data as (times, channel arrays)
+
+        Returns NumPy arrays when NumPy is available, memoryviews otherwise.
+        Time is generated from the sample rate since the library does not store it.
+        By default each channel is copied out of the capture storage, so the
+        arrays are the caller's to keep. With copy=False they are views into the
+        storage instead, with no copy: they hold a pin that keeps the storage
+        mapped (release_capture_arena() and disconnect() leave it until the last
+        view is gone), but release_data() hands it to the next measurement, which
+        overwrites it in place. Use views only for data that is read before then.
+        """
+        views = (ChannelView * NUM_VIEWS)()
+        if self.dt_lib.get_channel_views(views) != ERR_CFG_SUCCESS:
+            return ERR_MEASUREMENT, ERR_MEASUREMENT
+        self._data_held = True
+        pin = None if copy else _ArenaPin(self)
+        arrays = []
+        for view in views[:self.dt_lib.get_channel_data().num_channels]:
+            if view.count == 0:
+                arrays.append(np.empty(0) if np else memoryview(b"").cast("d"))
+                continue
+            block = (c_double * view.count).from_address(addressof(view.data.contents))
+            if copy:
+                block = (c_double * view.count).from_buffer_copy(block)
+            else:
+                block._pin = pin  # lives as long as any array built on the block
+            if np is not None:
+                arrays.append(np.ctypeslib.as_array(block))
+            else:
+                arrays.append(memoryview(block).cast("B").cast("d"))
+        return self.frame_times(0, views[0].count), arrays
+
+    def _unpin_arena(self):
+        """Drops the pin of one _channel_views(copy=False) call, releasing the
+        storage disconnect() had to leave"""
+        self.dt_lib.pin_capture_arena(False)
+        if self._arena_release_pending and self.dt_lib.release_capture_arena() == ERR_CFG_SUCCESS:
+            self._arena_release_pending = False
 
     def _error_check(self, err_code):
         """Represents the different error codes that occur from the shared .so library
@@ -182,10 +1264,50 @@ class DT9837():
                 err_str = "ERROR_OUTPUT_FAILURE"
             if err_code == ERR_DEINIT_CONFIG:
                 err_str = "ERROR_DEINIT_CONFIG_FAILURE"
+            if err_code == ERR_PENDING:
+                err_str = "ERROR_MEASUREMENT_PENDING"
             print(f"Error Occured: {err_code}_{err_str}")
 
 
+def align_by_time(devices, results):
+    """Trims simultaneous measurements of several devices to a common start
+
+    Each device counts frames from its own start, so the host time of every
+    device's first frame is used to drop the frames sampled before the last
+    device started. The results are also cut to the shortest run.
+
+    :param devices: DT9837 objects that took the measurements
+    :type devices: list
+    :param results: (time_vals, sensor_vals) returned by each device
+    :type results: list
+    :return: (time_vals, sensor_vals) per device, all starting at the same host time
+    """
+    starts = [device.frame_host_time(0) for device in devices]
+    common = max(starts)
+    skips = []
+    for device, start in zip(devices, starts):
+        rate = device.dt_lib.get_time_base().rate
+        skips.append(int(round((common - start) * rate)))
+    frames = min(len(result[0]) - skip for result, skip in zip(results, skips))
+    frames = max(frames, 0)
+    aligned = []
+    for device, (time_vals, sensor_vals), skip in zip(devices, results, skips):
+        channels = [vals[skip:skip + frames] for vals in sensor_vals]
+        aligned.append((device.frame_times(0, frames), channels))
+    return aligned
+
+
 if __name__ == "__main__":
+    if len(sys.argv) > 1 and sys.argv[1] == "--benchmark":
+        # python run.py --benchmark [results.jsonl]: one JSON object per line
+        signalanalyzer = DT9837(simulated=True)
+        signalanalyzer.connect()
+        out = open(sys.argv[2], "w") if len(sys.argv) > 2 else sys.stdout
+        for result in signalanalyzer.benchmark():
+            out.write(json.dumps(result) + "\n")
+        signalanalyzer.disconnect()
+        sys.exit(0)
+
     signalanalyzer = DT9837()
 
     signalanalyzer.connect()
@@ -195,15 +1317,10 @@ if __name__ == "__main__":
     #     0, timer_enabled=False, use_default_vals=False)
 
     # Print the data (DEBUGGING)
-    print("Time(ms),accel_x(g),accel_y(g),accel_z(g)\n")
-    print(
-        f"{time_vals[0]},{sensor_vals[0][0]},{sensor_vals[1][0]},{sensor_vals[2][0]},{sensor_vals[3][0]}")
-    print(
-        f"{time_vals[1]},{sensor_vals[0][1]},{sensor_vals[1][1]},{sensor_vals[2][1]},{sensor_vals[3][1]}")
-    print(
-        f"{time_vals[-1]},{sensor_vals[0][-1]},{sensor_vals[1][-1]},{sensor_vals[2][-1]},{sensor_vals[3][-1]}")
-    print(
-        f"{time_vals[-2]},{sensor_vals[0][-2]},{sensor_vals[1][-2]},{sensor_vals[2][-2]},{sensor_vals[3][-2]}")
+    print("Time(s),accel_x(g),accel_y(g),accel_z(g)\n")
+    for k in (0, 1, -1, -2):
+        print(
+            f"{time_vals[k]:.3f},{sensor_vals[0][k]:.3f},{sensor_vals[1][k]:.3f},{sensor_vals[2][k]:.3f},{sensor_vals[3][k]:.3f}")
 
     time_vals, sensor_vals = signalanalyzer.generate_squarewave(
         WAVEFORM_DURATION, use_default_vals=False, read_input=False)
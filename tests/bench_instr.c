@@ -0,0 +1,73 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Cost of the run instrumentation. For each A/D clock, runs of
+    BENCH_SECONDS of four channels go through the whole pipeline on the
+    simulator at full speed, alternately with set_instrumentation(TRUE)
+    and FALSE, BENCH_REPEATS times each; the fastest run of each kind is
+    kept. One JSON line per clock and kind (instrumented, uninstrumented)
+    and an instrumentation_overhead line with the difference per buffer go
+    to the file named on the command line, or to stdout; a difference
+    smaller than the spread between runs can come out negative. Not part
+    of make test: it only reports.
+
+****************************************************************************/
+
+#include <float.h>
+#include "test.h"
+
+#define BENCH_SECONDS 30.0
+#define BENCH_REPEATS 9
+
+/* Seconds one run of frames frames takes */
+static DBL timed_run(DBL rate, ULNG frames, bool enabled, ULNG *buffers)
+{
+   set_instrumentation(enabled);
+   set_capture_frames(frames);
+   DBL t0 = monotonic_seconds();
+   int rc = measure(FALSE, NUM_CHANNELS, (float)rate, 1, 1, 1, 1, 1, TRUE, (int)BENCH_SECONDS + 1);
+   DBL elapsed = monotonic_seconds() - t0;
+   CHECK(rc == CFG_SUCCESS, "%.0f Hz: measure returned %d", rate, rc);
+   *buffers = get_pipeline_counters().buffers;
+   cleanup_data();
+   return elapsed;
+}
+
+static void bench(FILE *out, DBL rate)
+{
+   const ULNG frames = (ULNG)(rate * BENCH_SECONDS);
+   DBL best[2] = {DBL_MAX, DBL_MAX}; // off, on
+   ULNG buffers = 0;
+
+   for (UINT i = 0; i < BENCH_REPEATS; i++)
+   {
+      for (int on = 0; on <= 1; on++)
+         best[on] = MIN(best[on], timed_run(rate, frames, on, &buffers));
+   }
+   test_bench_line(out, "uninstrumented", rate, NUM_CHANNELS, frames, best[0], 0, 0);
+   test_bench_line(out, "instrumented", rate, NUM_CHANNELS, frames, best[1], 0, 0);
+   fprintf(out, "{\"kind\": \"instrumentation_overhead\", \"rate\": %.1f, \"channels\": %u, \"buffers\": %lu, "
+                "\"seconds_per_buffer\": %.9f, \"fraction\": %.4f}\n",
+           rate, NUM_CHANNELS, buffers, (buffers > 0) ? (best[1] - best[0]) / buffers : 0.0,
+           (best[1] - best[0]) / best[0]);
+   fflush(out);
+}
+
+int main(int argc, char **argv)
+{
+   static const DBL rates[] = {1000.0, 10000.0, 25000.0, 52700.0};
+   FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+
+   CHECK(out != NULL, "open %s", argv[1]);
+   if (out == NULL)
+      return test_done("bench_instr");
+   test_open_sim(0, 0.0, 0.001);
+   for (UINT r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+      bench(out, rates[r]);
+   set_instrumentation(TRUE);
+   set_capture_frames(0);
+   deinit_board();
+   if (out != stdout)
+      fclose(out);
+   return test_done("bench_instr");
+}
@@ -0,0 +1,108 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Speed and ratio of the packed recording format. For each sample rate
+    and channel count, blocks of an accelerometer-like 24-bit signal
+    (three tones per channel at up to a third of full scale plus a few
+    LSB of noise) are packed with pack_block() and decoded with
+    unpack_block() for at least BENCH_MIN_SECONDS each, and one JSON line
+    per path reports megabytes of raw codes per second and raw bytes per
+    packed byte. The lines go to the file named on the command line, or
+    to stdout. Not part of make test: it only reports.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define BENCH_MIN_SECONDS 0.2
+#define BENCH_BLOCKS 16      // distinct blocks of signal cycled through
+#define BENCH_NOISE 4.0      // LSB rms
+
+/* Sign extended 24-bit codes: three tones per channel plus BENCH_NOISE LSB of noise */
+static void vibration_codes(DWORD *raw, ULNG frames, UINT channels, DBL rate)
+{
+   static const DBL tone_hz[3] = {80.0, 160.0, 1250.0};
+   static const DBL tone_fs[3] = {0.2, 0.1, 0.02};
+   uint64_t x = 88172645463325252ULL;
+
+   for (ULNG f = 0; f < frames; f++)
+   {
+      for (UINT c = 0; c < channels; c++)
+      {
+         DBL v = 0, noise = 0;
+         for (int k = 0; k < 3; k++)
+            v += tone_fs[k] * (1 << 23) * sin(2 * M_PI * tone_hz[k] * (1 + 0.1 * c) * f / rate);
+         for (int k = 0; k < 4; k++) // sum of uniforms, close enough to gaussian
+         {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            noise += (DBL)(x >> 11) / (1ULL << 53) - 0.5;
+         }
+         raw[f * channels + c] = (DWORD)(int32_t)floor(v + noise * BENCH_NOISE * sqrt(3.0) + 0.5);
+      }
+   }
+}
+
+static void bench(FILE *out, DBL rate, UINT channels)
+{
+   const UINT block_samples = PACK_BLOCK_FRAMES * channels;
+   DWORD *raw = malloc((size_t)BENCH_BLOCKS * block_samples * sizeof(DWORD));
+   DWORD *codes = malloc((size_t)block_samples * sizeof(DWORD));
+   unsigned char *packed = malloc(BENCH_BLOCKS * PACK_BOUND(block_samples, channels, sizeof(DWORD)));
+   size_t offset[BENCH_BLOCKS + 1] = {0};
+
+   CHECK(raw != NULL && codes != NULL && packed != NULL, "buffers");
+   if (raw == NULL || codes == NULL || packed == NULL)
+      goto done;
+   vibration_codes(raw, (ULNG)BENCH_BLOCKS * PACK_BLOCK_FRAMES, channels, rate);
+   for (UINT k = 0; k < BENCH_BLOCKS; k++)
+      offset[k + 1] = offset[k] + pack_block(raw + (size_t)k * block_samples, 4, block_samples, channels,
+                                             packed + offset[k]);
+   const DBL ratio = (DBL)BENCH_BLOCKS * block_samples * sizeof(DWORD) / offset[BENCH_BLOCKS];
+
+   for (int unpack = 0; unpack <= 1; unpack++)
+   {
+      ULNG frames = 0;
+      DBL t0 = monotonic_seconds(), elapsed = 0;
+      for (UINT b = 0; elapsed < BENCH_MIN_SECONDS; b++)
+      {
+         UINT k = b % BENCH_BLOCKS;
+         if (!unpack)
+            pack_block(raw + (size_t)k * block_samples, 4, block_samples, channels, packed + offset[k]);
+         else if (!unpack_block(packed + offset[k], offset[k + 1] - offset[k], 4, block_samples, channels, codes) ||
+                  memcmp(codes, raw + (size_t)k * block_samples, block_samples * sizeof(DWORD)) != 0)
+         {
+            CHECK(FALSE, "%.0f Hz x %u: block %u does not round-trip", rate, channels, k);
+            break;
+         }
+         frames += PACK_BLOCK_FRAMES;
+         elapsed = monotonic_seconds() - t0;
+      }
+      test_bench_line(out, unpack ? "unpack" : "pack", rate, channels, frames, elapsed,
+                      frames / MAX(elapsed, 1e-9) * channels * sizeof(DWORD) / 1e6, ratio);
+   }
+
+done:
+   free(raw);
+   free(codes);
+   free(packed);
+}
+
+int main(int argc, char **argv)
+{
+   static const DBL rates[] = {1000.0, 10000.0, 25000.0, 52700.0};
+   FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+
+   CHECK(out != NULL, "open %s", argv[1]);
+   if (out == NULL)
+      return test_done("bench_pack");
+   for (UINT r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+   {
+      for (UINT channels = 1; channels <= NUM_CHANNELS; channels++)
+         bench(out, rates[r], channels);
+   }
+   if (out != stdout)
+      fclose(out);
+   return test_done("bench_pack");
+}
@@ -0,0 +1,164 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Speed of the hot paths of a run, on synthetic data and without a
+    board, for each A/D clock and channel count. Buffers are sized by the
+    same plan as a run (pool_plan()) and passes over one second of data are
+    repeated for at least BENCH_MIN_SECONDS:
+       convert16/32  folded code-to-g kernel on 16-bit or 32-bit (24-bit) codes
+       store         frame by frame storage through add_reading()
+       square_wave   square wave table of config_data_output() at a D/A clock of rate Hz
+    One JSON line per path goes to the file named on the command line, or
+    to stdout (bench_pack covers the packed recording format). Not part of
+    make test: it only reports.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define BENCH_MIN_SECONDS 0.2
+#define BENCH_WAVE_FREQUENCY 10.0 // Hz, the run.py default
+
+enum { BENCH_CONVERT16, BENCH_CONVERT32, BENCH_STORE, BENCH_SQUARE_WAVE, BENCH_KINDS };
+static const char *const bench_name[] = {"convert16", "convert32", "store", "square_wave"};
+
+/* Codes of the given width spread over the whole resolution */
+static void bench_codes(void *raw, ULNG samples, UINT width)
+{
+   uint64_t x = 88172645463325252ULL;
+
+   for (ULNG i = 0; i < samples; i++)
+   {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      if (width > 2)
+         ((DWORD *)raw)[i] = (DWORD)(x & 0xFFFFFF);
+      else
+         ((WORD *)raw)[i] = (WORD)x;
+   }
+}
+
+/* One pass over frames frames of the chosen path; returns the frames processed */
+static ULNG bench_pass(int kind, const ConvTable *ct, const void *raw, ULNG buffer_frames, UINT stride, ULNG frames,
+                       DBL *out[NUM_CHANNELS], ChannelData *store, DBL rate)
+{
+   ULNG done = 0;
+
+   if (kind == BENCH_SQUARE_WAVE)
+   {
+      WaveSpec square = {WAVE_SQUARE, 0, 0, NULL, 0};
+      WaveInfo info;
+      DBL *volts = wave_synthesize(&square, rate, DEFAULT_WAV_AMPLITUDE, BENCH_WAVE_FREQUENCY, &info);
+      if (volts == NULL)
+         return 0;
+      wave_to_codes(volts, info.samples, -10.0, 10.0, 16, OL_ENC_2SCOMP, out[0], 2);
+      free(volts);
+      return info.samples;
+   }
+
+   store->num_readings = 0;
+   while (done < frames)
+   {
+      ULNG n = MIN(buffer_frames, frames - done);
+      if (kind == BENCH_STORE)
+      {
+         for (ULNG f = 0; f < n; f++)
+            add_reading(store, out[0][f], out[1][f], out[2][f], out[3][f]);
+      }
+      else
+         conv_frames(ct, raw, (kind == BENCH_CONVERT32) ? 4 : 2, n, stride, out, done);
+      done += n;
+   }
+   return done;
+}
+
+static void bench(FILE *out, int kind, DBL rate, UINT channels)
+{
+   ConvTable ct = {0};
+   ChannelData store = {0};
+   DBL *data[NUM_CHANNELS] = {NULL};
+
+   /* buffer size of a real run */
+   pool_plan(rate, channels);
+   const ULNG buffer_samples = ctx->pool->buffer_samples;
+   const ULNG frames = (ULNG)ceil(rate);
+   const ULNG buffer_frames = conv_frame_count(buffer_samples, channels);
+   const UINT width = (kind == BENCH_CONVERT32) ? 4 : 2;
+
+   ct.min = -10.0;
+   ct.max = 10.0;
+   ct.resolution = (width > 2) ? 24 : 16;
+   ct.encoding = OL_ENC_2SCOMP;
+   ct.listsize = channels;
+   for (UINT c = 0; c < channels; c++)
+   {
+      ct.gainlist[c] = 1.0;
+      ct.sensitivity[c] = input_sensitivity[c];
+   }
+
+   void *raw = malloc(buffer_samples * width);
+   /* add_reading() takes all four values, the storage holds the channels in use */
+   const ULNG out_frames = MAX(frames, (ULNG)WAVE_MAX_SAMPLES);
+   for (int c = 0; c < NUM_CHANNELS; c++)
+   {
+      data[c] = aligned_malloc(out_frames * sizeof(DBL), DATA_ALIGNMENT);
+      if (data[c] != NULL)
+         memset(data[c], 0, out_frames * sizeof(DBL));
+   }
+   store.max_readings = (UINT)frames + 1; // never fills, so streaming mode never flushes
+   store.num_channels = channels;
+   for (UINT c = 0; c < channels; c++)
+      store.channel[c] = aligned_malloc(store.max_readings * sizeof(DBL), DATA_ALIGNMENT);
+   BOOL ok = raw != NULL && conv_table_build(&ct) == CFG_SUCCESS;
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+      ok = ok && data[c] != NULL && (c >= channels || store.channel[c] != NULL);
+   CHECK(ok, "%s at %.0f Hz x %u: setup", bench_name[kind], rate, channels);
+
+   if (ok)
+   {
+      bench_codes(raw, buffer_samples, width);
+      conv_frames(&ct, raw, width, MIN(buffer_frames, frames), channels, data, 0); // BENCH_STORE input
+
+      ULNG processed = 0;
+      DBL t0 = monotonic_seconds(), elapsed = 0;
+      do
+      {
+         ULNG n = bench_pass(kind, &ct, raw, buffer_frames, channels, frames, data, &store, rate);
+         if (n == 0)
+            break;
+         processed += n;
+         elapsed = monotonic_seconds() - t0;
+      } while (elapsed < BENCH_MIN_SECONDS);
+      test_bench_line(out, bench_name[kind], rate, (kind == BENCH_SQUARE_WAVE) ? 1 : channels, processed, elapsed, 0,
+                      0);
+   }
+
+   free(raw);
+   for (int c = 0; c < NUM_CHANNELS; c++)
+   {
+      aligned_free(data[c]);
+      aligned_free(store.channel[c]);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   static const DBL rates[] = {1000.0, 10000.0, 25000.0, 52700.0};
+   FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+
+   CHECK(out != NULL, "open %s", argv[1]);
+   if (out == NULL)
+      return test_done("bench_paths");
+   for (UINT r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+   {
+      for (int kind = 0; kind < BENCH_KINDS; kind++)
+      {
+         for (UINT channels = 1; channels <= ((kind == BENCH_SQUARE_WAVE) ? 1 : NUM_CHANNELS); channels++)
+            bench(out, kind, rates[r], channels);
+      }
+   }
+   if (out != stdout)
+      fclose(out);
+   return test_done("bench_paths");
+}
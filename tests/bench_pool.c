@@ -0,0 +1,54 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Latency/overrun trade-off of the A/D buffer pool on the real-time
+    simulator. For each sample rate from 1 kHz to 52.7 kHz, target latency
+    and extra processing time per buffer (a subscriber that sleeps, as a
+    stand-in for a slow consumer), runs one second of 4 channels and prints
+    the plan the pool chose next to what the run observed. Not part of
+    make test: it takes about half a minute and only reports.
+
+****************************************************************************/
+
+#include "test.h"
+
+static UINT stall_ms;
+
+static void stall(DBL *const channel[NUM_CHANNELS], UINT frames, ULNG first_frame, ULNG sequence, void *user)
+{
+   (void)channel, (void)frames, (void)first_frame, (void)sequence, (void)user;
+   sleep_ms(stall_ms);
+}
+
+int main(void)
+{
+   static const float rates[] = {1000.0f, 10000.0f, 25000.0f, 52734.0f};
+   static const DBL latencies[] = {0.002, 0.01, 0.1};
+   static const UINT stalls[] = {0, 5};
+
+   test_open_sim(0, 1.0, 0.001);
+   printf("   rate latency stall  bufs samples buffer(s) queue(s) proc_mean(us) proc_max(us) max_lag(ms) "
+          "headroom(ms) stop drops\n");
+   for (UINT r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+   {
+      for (UINT l = 0; l < sizeof(latencies) / sizeof(latencies[0]); l++)
+      {
+         for (UINT s = 0; s < sizeof(stalls) / sizeof(stalls[0]); s++)
+         {
+            stall_ms = stalls[s];
+            set_subscription(stall_ms ? stall : NULL, NULL, FALSE);
+            set_buffer_pool(latencies[l], 1.0, 2, POOL_MAX_BUFFERS);
+            int rc = measure(FALSE, 4, rates[r], 1, 1, 1, 1, 1, TRUE, 1);
+            BufferPool p = get_buffer_pool();
+            printf("%7.0f %7.3f %5u %5u %7lu %9.4f %8.2f %13.1f %12.1f %11.2f %12.1f %4d %5lu%s\n", rates[r],
+                   latencies[l], stall_ms, p.buffers, p.buffer_samples, p.buffer_seconds, p.queue_seconds,
+                   p.process_mean * 1e6, p.process_max * 1e6, p.max_lag * 1e3, p.min_headroom * 1e3,
+                   get_stop_reason(), get_dropped_buffers(), (rc == CFG_SUCCESS) ? "" : " (failed)");
+            cleanup_data();
+         }
+      }
+   }
+   set_subscription(NULL, NULL, FALSE);
+   deinit_board();
+   return test_done("bench_pool");
+}
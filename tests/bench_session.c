@@ -0,0 +1,70 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Cost of a capture with and without a session. For each A/D clock,
+    BENCH_CAPTURES captures of one second of four channels are run back
+    to back on the simulator at full speed, once as one-shot measure()
+    calls that free their storage in between (capture) and once inside
+    session_open()/session_close() (session_capture). One JSON line per
+    clock and kind adds seconds_per_capture to the usual fields. The lines
+    go to the file named on the command line, or to stdout. Not part of
+    make test: it only reports.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define BENCH_CAPTURES 10
+
+static void bench(FILE *out, DBL rate, bool session)
+{
+   const ULNG frames = (ULNG)rate;
+   UINT done = 0;
+
+   set_capture_frames(frames);
+   if (session)
+      CHECK(session_open() == CFG_SUCCESS, "%.0f Hz: session_open", rate);
+   DBL t0 = monotonic_seconds();
+   for (UINT i = 0; i < BENCH_CAPTURES; i++)
+   {
+      if (!session)
+         cleanup_data();
+      if (measure(FALSE, NUM_CHANNELS, (float)rate, 1, 1, 1, 1, 1, TRUE, 2) == CFG_SUCCESS)
+         done++;
+   }
+   DBL elapsed = monotonic_seconds() - t0;
+   if (session)
+      session_close();
+   cleanup_data();
+   CHECK(done == BENCH_CAPTURES, "%.0f Hz: %u of %u captures", rate, done, BENCH_CAPTURES);
+
+   const ULNG processed = done * frames;
+   const DBL fps = processed / MAX(elapsed, 1e-9);
+   fprintf(out,
+           "{\"kind\": \"%s\", \"rate\": %.1f, \"channels\": %u, \"frames\": %lu, \"seconds\": %.6f, "
+           "\"frames_per_second\": %.1f, \"ns_per_frame\": %.3f, \"realtime\": %.2f, \"seconds_per_capture\": %.6f}\n",
+           session ? "session_capture" : "capture", rate, NUM_CHANNELS, processed, elapsed, fps,
+           (processed > 0) ? 1e9 / fps : 0.0, fps / rate, (done > 0) ? elapsed / done : 0.0);
+   fflush(out);
+}
+
+int main(int argc, char **argv)
+{
+   static const DBL rates[] = {1000.0, 10000.0, 25000.0, 52700.0};
+   FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+
+   CHECK(out != NULL, "open %s", argv[1]);
+   if (out == NULL)
+      return test_done("bench_session");
+   test_open_sim(0, 0.0, 0.001);
+   for (UINT r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+   {
+      bench(out, rates[r], FALSE);
+      bench(out, rates[r], TRUE);
+   }
+   set_capture_frames(0);
+   deinit_board();
+   if (out != stdout)
+      fclose(out);
+   return test_done("bench_session");
+}
@@ -0,0 +1,73 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Shared scaffolding of the tests. Every test is one program built from
+    the whole library (so the static helpers and module state are in
+    reach) and runs the simulator backend, which needs no board.
+
+****************************************************************************/
+
+#include "../dt_automation.c"
+
+static _Atomic int test_failures = 0; // CHECK may run on several threads
+
+#define CHECK(cond, ...)                                           \
+   do                                                              \
+   {                                                               \
+      if (!(cond))                                                 \
+      {                                                            \
+         test_failures++;                                          \
+         printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond);    \
+         printf(__VA_ARGS__);                                      \
+         printf("\n");                                             \
+      }                                                            \
+   } while (0)
+
+/* Prints the verdict and returns the exit status of the test */
+static inline int test_done(const char *name)
+{
+   printf("%s: %s\n", name, (test_failures == 0) ? "ok" : "FAILED");
+   return (test_failures == 0) ? 0 : 1;
+}
+
+/* Selects device index on the simulator and opens its board; speed 0 runs flat out,
+   with the simulated A/D waiting for the conversion worker instead of overrunning */
+static inline void test_open_sim(UINT index, DBL speed, DBL noise)
+{
+   CHECK(select_backend(DAQ_BACKEND_SIMULATOR) == CFG_SUCCESS, "simulator backend");
+   CHECK(set_sim_boards(MAX_DEVICES) == CFG_SUCCESS, "simulated boards");
+   CHECK(select_device(index) == CFG_SUCCESS, "device %u", index);
+   CHECK(configure_simulator(speed, noise, index + 1, 0, 0, TRUE) == CFG_SUCCESS, "simulator config");
+   set_sim_flow_control(speed <= 0);
+   CHECK(initialize_board() == CFG_SUCCESS, "board %u", index);
+}
+
+/* The value the simulator's tone on input physical converts to at frame f, with
+   the input quantized like the simulated A/D and converted by the reference
+   formula (the D/A loop and noise must be off) */
+static inline DBL test_sim_expected(const ConvTable *ct, UINT physical, DBL gain, DBL sensitivity, ULNG f)
+{
+   DBL t = f / ctx->sim_ad->freq;
+   DBL volts = ctx->sim_config->amplitude[physical] * sin(2 * M_PI * ctx->sim_config->frequency[physical] * t);
+   ULNG code;
+
+   sim_volts_to_code(ct->min, ct->max, gain, ct->resolution, ct->encoding, volts, &code);
+   return code_to_volts_ref(ct->min, ct->max, gain, ct->resolution, ct->encoding, code) / (sensitivity / 1000);
+}
+
+/* One benchmark result as a JSON line, the format of python run.py --benchmark:
+   frames processed in seconds at an A/D clock of rate Hz, mb_per_second and
+   ratio only for the paths that report them (0 otherwise) */
+static inline void test_bench_line(FILE *out, const char *kind, DBL rate, UINT channels, ULNG frames, DBL seconds,
+                                   DBL mb_per_second, DBL ratio)
+{
+   DBL fps = frames / MAX(seconds, 1e-9);
+
+   fprintf(out,
+           "{\"kind\": \"%s\", \"rate\": %.1f, \"channels\": %u, \"frames\": %lu, \"seconds\": %.6f, "
+           "\"frames_per_second\": %.1f, \"ns_per_frame\": %.3f, \"realtime\": %.2f, \"mb_per_second\": %.2f, "
+           "\"ratio\": %.4f}\n",
+           kind, rate, channels, frames, seconds, fps, (frames > 0) ? 1e9 / fps : 0.0, fps / rate, mb_per_second,
+           ratio);
+   fflush(out);
+}
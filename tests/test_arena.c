@@ -0,0 +1,98 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Capture arena on the simulator. The resident set stays flat over many
+    captures of the same size, with and without releasing the arena in
+    between. A pinned arena is neither released nor moved, so views taken
+    before stay readable, and every run and release starts a new
+    generation.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define ARENA_FREQ 50000.0f
+#define ARENA_FRAMES 250000UL // 5 s of 4 channels, 8 MB of storage
+#define ARENA_RUNS 40
+#define RSS_SLACK (2UL << 20) // bytes the resident set may grow by after the first runs
+
+static ULNG rss_bytes(void)
+{
+   FILE *f = fopen("/proc/self/statm", "r");
+   ULNG size = 0, resident = 0;
+
+   if (f == NULL)
+      return 0;
+   if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+      resident = 0;
+   fclose(f);
+   return resident * (ULNG)sysconf(_SC_PAGESIZE);
+}
+
+static int capture(UINT seconds)
+{
+   int rc = measure(FALSE, 4, ARENA_FREQ, 1, 1, 1, 1, 1, TRUE, (int)seconds);
+   cleanup_data();
+   return rc;
+}
+
+static void constant_rss(BOOL release)
+{
+   ULNG base = 0, worst = 0;
+
+   for (int i = 0; i < ARENA_RUNS; i++)
+   {
+      CHECK(capture(5) == CFG_SUCCESS, "run %d", i);
+      if (release)
+         CHECK(release_capture_arena() == CFG_SUCCESS, "release after run %d", i);
+      if (i == 1)
+         base = rss_bytes();
+      else if (i > 1)
+         worst = MAX(worst, rss_bytes());
+   }
+   CHECK(worst <= base + RSS_SLACK, "resident set grew from %lu to %lu bytes", base, worst);
+   printf("%d runs%s: resident set %.1f MB after two, at most %.1f MB after\n", ARENA_RUNS,
+          release ? " releasing the arena" : "", base / 1048576.0, worst / 1048576.0);
+}
+
+static void pinned(void)
+{
+   ChannelView views[NUM_VIEWS];
+
+   CHECK(measure(FALSE, 4, ARENA_FREQ, 1, 1, 1, 1, 1, TRUE, 5) == CFG_SUCCESS, "capture");
+   CHECK(get_channel_views(views) == CFG_SUCCESS, "views");
+   ULNG generation = get_capture_arena().generation;
+   DBL first = views[0].data[0], last = views[0].data[views[0].count - 1];
+
+   CHECK(pin_capture_arena(TRUE) == CFG_SUCCESS, "pin");
+   CHECK(release_capture_arena() == CFG_FAILURE, "released while pinned");
+   CHECK(views[0].data[0] == first && views[0].data[views[0].count - 1] == last, "views changed");
+   CHECK(get_capture_arena().generation == generation, "generation moved without a run");
+
+   /* a larger run would move the storage, one that fits reuses it as a new generation */
+   set_capture_frames(4 * ARENA_FRAMES);
+   CHECK(measure(FALSE, 4, ARENA_FREQ, 1, 1, 1, 1, 1, TRUE, 20) == ERR_MEASUREMENT, "larger run while pinned");
+   set_capture_frames(ARENA_FRAMES);
+   CHECK(views[0].data[views[0].count - 1] == last, "views changed by a failed run");
+   CHECK(capture(5) == CFG_SUCCESS, "run that fits while pinned");
+   CHECK(get_capture_arena().generation > generation, "no new generation");
+
+   CHECK(pin_capture_arena(FALSE) == CFG_SUCCESS, "unpin");
+   CHECK(pin_capture_arena(FALSE) == CFG_FAILURE, "unpinned twice");
+   generation = get_capture_arena().generation;
+   CHECK(release_capture_arena() == CFG_SUCCESS, "release");
+   CHECK(get_capture_arena().generation == generation + 1, "release left the generation");
+   CHECK(get_capture_arena().reserved_bytes == 0, "still reserved");
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.001);
+   set_capture_frames(ARENA_FRAMES);
+   constant_rss(FALSE);
+   constant_rss(TRUE);
+   pinned();
+   set_capture_frames(0);
+   deinit_board();
+   return test_done("test_arena");
+}
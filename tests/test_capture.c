@@ -0,0 +1,92 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Streaming capture on the simulator: the chunk callback and the csv
+    file see every frame once and in order, and the counters agree. A
+    capture that fails after the csv file is opened (here the record file
+    cannot be created) closes it, leaves no storage attached and does not
+    stop the next capture from running.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define CAPTURE_FREQ 10000.0f
+#define CAPTURE_FRAMES 100000UL
+#define CSV_PATH "test_capture.csv"
+
+static ULNG chunk_frames, chunk_next, chunk_calls;
+static BOOL chunk_in_order = TRUE;
+
+static void on_chunk(DBL *const channel[NUM_CHANNELS], UINT frames, ULNG first_frame, void *user)
+{
+   (void)channel, (void)user;
+   if (first_frame != chunk_next)
+      chunk_in_order = FALSE;
+   chunk_next = first_frame + frames;
+   chunk_frames += frames;
+   chunk_calls++;
+}
+
+static ULNG count_lines(const char *path)
+{
+   FILE *f = fopen(path, "r");
+   ULNG lines = 0;
+   int ch;
+
+   if (f == NULL)
+      return 0;
+   while ((ch = fgetc(f)) != EOF)
+      lines += (ch == '\n');
+   fclose(f);
+   return lines;
+}
+
+static void streaming(void)
+{
+   CHECK(set_capture_stream(TRUE, on_chunk, NULL, CSV_PATH) == CFG_SUCCESS, "streaming");
+   set_capture_frames(CAPTURE_FRAMES);
+   int rc = measure(FALSE, 4, CAPTURE_FREQ, 1, 1, 1, 1, 1, TRUE, 10);
+   CHECK(rc == CFG_SUCCESS, "measure returned %d", rc);
+
+   CaptureCounters c = ctx->capture->counters;
+   ULNG chunks = (CAPTURE_FRAMES + STREAM_CHUNK_FRAMES - 1) / STREAM_CHUNK_FRAMES;
+   CHECK(c.frames_stored == CAPTURE_FRAMES, "%lu frames stored", c.frames_stored);
+   CHECK(c.frames_dropped == 0, "%lu frames dropped", c.frames_dropped);
+   CHECK(c.chunks_flushed == chunks, "%lu chunks flushed", c.chunks_flushed);
+   CHECK(chunk_calls == chunks && chunk_frames == CAPTURE_FRAMES && chunk_in_order,
+         "callback saw %lu frames in %lu calls", chunk_frames, chunk_calls);
+   CHECK(count_lines(CSV_PATH) == CAPTURE_FRAMES + 1, "%lu csv lines", count_lines(CSV_PATH));
+   cleanup_data();
+}
+
+static void failed_start(void)
+{
+   ChannelView views[NUM_VIEWS];
+
+   set_record_file("no-such-directory/capture.dtc");
+   int rc = measure(FALSE, 4, CAPTURE_FREQ, 1, 1, 1, 1, 1, TRUE, 10);
+   set_record_file(NULL);
+   CHECK(rc == ERR_MEASUREMENT, "measure returned %d", rc);
+   CHECK(ctx->capture->stream == NULL, "csv file left open");
+   CHECK(count_lines(CSV_PATH) == 1, "csv holds %lu lines", count_lines(CSV_PATH));
+   CHECK(get_channel_views(views) == CFG_FAILURE, "storage left attached");
+
+   chunk_frames = chunk_next = chunk_calls = 0;
+   rc = measure(FALSE, 4, CAPTURE_FREQ, 1, 1, 1, 1, 1, TRUE, 10);
+   CHECK(rc == CFG_SUCCESS, "measure after a failed one returned %d", rc);
+   CHECK(chunk_frames == CAPTURE_FRAMES, "callback saw %lu frames", chunk_frames);
+   cleanup_data();
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.001);
+   streaming();
+   failed_start();
+   set_capture_stream(FALSE, NULL, NULL, NULL);
+   set_capture_frames(0);
+   remove(CSV_PATH);
+   deinit_board();
+   return test_done("test_capture");
+}
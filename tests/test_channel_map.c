@@ -0,0 +1,125 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Channel maps on the simulator. For every ordered choice of one to four
+    physical inputs the A/D channel list holds the inputs in ascending
+    order, output channel k carries input physical[k] (each input plays its
+    own tone) within the conversion tolerance of code_to_volts_ref(), and a
+    recording of the run reads back with the same channels and values.
+
+****************************************************************************/
+
+#include <float.h>
+#include "test.h"
+
+#define MAP_FREQ 10000.0f
+#define MAP_FRAMES 2000UL
+#define MAP_RECORD "test_channel_map.dtc"
+
+static UINT maps_tried;
+
+static void check_map(UINT count, const UINT *physical)
+{
+   ChannelView views[NUM_VIEWS];
+   const ChannelMap *map = ctx->active_map;
+   const ConvTable *ct = ctx->conv_table;
+   char name[32];
+
+   int len = snprintf(name, sizeof(name), "map");
+   for (UINT k = 0; k < count; k++)
+      len += snprintf(name + len, sizeof(name) - len, "%c%u", (k == 0) ? ' ' : ',', physical[k]);
+   maps_tried++;
+
+   CHECK(set_channel_map(count, physical, NULL) == CFG_SUCCESS, "%s: set_channel_map", name);
+   set_capture_frames(MAP_FRAMES);
+   set_record_file(MAP_RECORD);
+   int rc = measure(FALSE, NUM_CHANNELS, MAP_FREQ, 1, 1, 1, 1, 1, TRUE, 1);
+   set_record_file(NULL);
+   CHECK(rc == CFG_SUCCESS, "%s: measure returned %d", name, rc);
+   if (rc != CFG_SUCCESS)
+      return;
+   CHECK(get_channel_views(views) == CFG_SUCCESS && capture_channels() == count, "%s: %u channels", name,
+         capture_channels());
+
+   /* the board scans the mapped inputs in ascending order */
+   CHECK(ctx->sim_ad->listsize == count, "%s: channel list of %u", name, ctx->sim_ad->listsize);
+   for (UINT i = 1; i < ctx->sim_ad->listsize; i++)
+      CHECK(ctx->sim_ad->chanlist[i - 1] < ctx->sim_ad->chanlist[i], "%s: channel list entry %u is %u after %u", name,
+            i, ctx->sim_ad->chanlist[i], ctx->sim_ad->chanlist[i - 1]);
+
+   /* output channel k is input physical[k] */
+   for (UINT k = 0; k < count; k++)
+   {
+      DBL full = (ct->max - ct->min) / (map->sensitivity[k] / 1000);
+      DBL worst = 0;
+      CHECK(views[k].count == MAP_FRAMES, "%s: channel %u holds %u frames", name, k, views[k].count);
+      for (UINT f = 0; f < views[k].count; f++)
+      {
+         DBL want = test_sim_expected(ct, physical[k], 1, map->sensitivity[k], f);
+         worst = MAX(worst, fabs(views[k].data[f] - want));
+      }
+      CHECK(worst <= CONV_TOLERANCE * DBL_EPSILON * full, "%s: channel %u off by %.3g", name, k, worst);
+   }
+   for (UINT k = count; k < NUM_CHANNELS; k++)
+      CHECK(views[k].data == NULL, "%s: channel %u is not empty", name, k);
+
+   /* the recording reads back as the same output channels */
+   CaptureFile *cf = capture_file_open(MAP_RECORD);
+   CHECK(cf != NULL, "%s: open the recording", name);
+   if (cf != NULL)
+   {
+      UINT file_physical[NUM_CHANNELS];
+      DBL *out[NUM_CHANNELS] = {NULL};
+      CHECK(capture_file_channels(cf, file_physical) == count, "%s: recording channels", name);
+      for (UINT k = 0; k < count; k++)
+      {
+         CHECK(file_physical[k] == physical[k], "%s: recorded channel %u is input %u", name, k, file_physical[k]);
+         out[k] = malloc(MAP_FRAMES * sizeof(DBL));
+      }
+      CHECK(capture_file_read(cf, 0, MAP_FRAMES, out) == MAP_FRAMES, "%s: read the recording", name);
+      for (UINT k = 0; k < count; k++)
+      {
+         CHECK(memcmp(out[k], views[k].data, MAP_FRAMES * sizeof(DBL)) == 0, "%s: recorded channel %u differs", name,
+               k);
+         free(out[k]);
+      }
+      capture_file_close(cf);
+   }
+   cleanup_data();
+}
+
+/* Every ordered choice of count inputs, built up in physical[0..depth) */
+static void all_maps(UINT count, UINT depth, UINT used, UINT *physical)
+{
+   if (depth == count)
+   {
+      check_map(count, physical);
+      return;
+   }
+   for (UINT p = 0; p < NUM_CHANNELS; p++)
+   {
+      if (used & (1u << p))
+         continue;
+      physical[depth] = p;
+      all_maps(count, depth + 1, used | (1u << p), physical);
+   }
+}
+
+int main(void)
+{
+   UINT physical[NUM_CHANNELS];
+
+   test_open_sim(0, 0.0, 0.0);
+   CHECK(configure_simulator(0.0, 0.0, 1, 0, 0, FALSE) == CFG_SUCCESS, "simulator without the D/A loop");
+   for (UINT p = 0; p < NUM_CHANNELS; p++)
+      CHECK(set_sim_signal(p, 0.5 + 1.5 * p, 17.0 * (p + 1)) == CFG_SUCCESS, "input %u tone", p);
+
+   for (UINT count = 1; count <= NUM_CHANNELS; count++)
+      all_maps(count, 0, 0, physical);
+   printf("%u channel maps checked\n", maps_tried);
+   CHECK(maps_tried == 4 + 12 + 24 + 24, "%u maps", maps_tried);
+
+   set_channel_map(channel_map_default.count, channel_map_default.physical, NULL);
+   remove(MAP_RECORD);
+   return test_done("test_channel_map");
+}
@@ -0,0 +1,127 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Folded conversion kernels against the reference formula: every code of
+    the 16-bit range and of the 24-bit range (sign extended as the board
+    delivers them), both encodings, channel lists of 1 to 4 entries and
+    every gain and sensitivity combination below. Each result must be
+    within CONV_TOLERANCE * DBL_EPSILON of the channel's full scale of
+    conv_block_ref().
+
+****************************************************************************/
+
+#include <float.h>
+#include "test.h"
+
+#define CHUNK_FRAMES 65536
+
+static const DBL gains[] = {1.0, 2.0, 10.0, 100.0};
+static const DBL sensitivities[][NUM_CHANNELS] = {
+   {SENSITIVITY_VAL_X, SENSITIVITY_VAL_Y, SENSITIVITY_VAL_Z, 1000.0},
+   {10.0, 500.0, 1.0, 9.81},
+};
+
+/* Code of the given resolution and encoding the way the board delivers it */
+static DWORD board_code(ULNG v, UINT resolution, UINT encoding)
+{
+   if (encoding != OL_ENC_BINARY && resolution < 32 && (v >> (resolution - 1)) & 1)
+      v |= ~((1UL << resolution) - 1); // sign extended
+   return (DWORD)v;
+}
+
+/* Converts codes [0, count) in steps of step, rotated through the channel list
+   positions, with the kernel and the reference; returns the worst error in units
+   of DBL_EPSILON of the full scale */
+static DBL compare(ConvTable *ct, UINT width, ULNG count, ULNG step)
+{
+   const UINT n = ct->listsize;
+   void *raw = malloc((size_t)CHUNK_FRAMES * n * width);
+   DBL *fast[NUM_CHANNELS], *ref[NUM_CHANNELS], worst = 0;
+   DBL full[NUM_CHANNELS];
+
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      fast[c] = malloc(CHUNK_FRAMES * sizeof(DBL));
+      ref[c] = malloc(CHUNK_FRAMES * sizeof(DBL));
+   }
+   for (UINT c = 0; c < n; c++)
+      full[c] = MAX(fabs(ct->min), fabs(ct->max)) / ct->gainlist[c] * 1000.0 / ct->sensitivity[c];
+
+   for (ULNG first = 0; first * step < count; first += CHUNK_FRAMES)
+   {
+      ULNG frames = MIN((ULNG)CHUNK_FRAMES, (count - first * step + step - 1) / step);
+      for (ULNG f = 0; f < frames; f++)
+      {
+         for (UINT c = 0; c < n; c++)
+         {
+            ULNG v = ((first + f) * step + c * 7919UL) % count; // each position sees the whole range
+            DWORD code = board_code(v, ct->resolution, ct->encoding);
+            if (width > 2)
+               ((DWORD *)raw)[f * n + c] = code;
+            else
+               ((WORD *)raw)[f * n + c] = (WORD)code;
+         }
+      }
+      conv_frames(ct, raw, width, frames, n, fast, 0);
+      conv_block_ref(ct, raw, width, frames, n, ref, 0);
+      for (UINT c = 0; c < n; c++)
+      {
+         for (ULNG f = 0; f < frames; f++)
+            worst = MAX(worst, fabs(fast[c][f] - ref[c][f]) / (full[c] * DBL_EPSILON));
+      }
+   }
+
+   free(raw);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      free(fast[c]);
+      free(ref[c]);
+   }
+   return worst;
+}
+
+int main(void)
+{
+   static const UINT encodings[] = {OL_ENC_2SCOMP, OL_ENC_BINARY};
+   DBL worst = 0;
+
+   for (UINT e = 0; e < 2; e++)
+   {
+      for (UINT res = 16; res <= 24; res += 8)
+      {
+         const UINT width = (res > 16) ? 4 : 2;
+         const ULNG count = 1UL << res;
+
+         for (UINT n = 1; n <= NUM_CHANNELS; n++)
+         {
+            for (UINT g = 0; g < sizeof(gains) / sizeof(gains[0]); g++)
+            {
+               for (UINT s = 0; s < sizeof(sensitivities) / sizeof(sensitivities[0]); s++)
+               {
+                  ConvTable ct = {0};
+                  ct.min = -10.0;
+                  ct.max = 10.0;
+                  ct.resolution = res;
+                  ct.encoding = encodings[e];
+                  ct.listsize = n;
+                  for (UINT c = 0; c < n; c++)
+                  {
+                     ct.gainlist[c] = gains[(g + c) % 4]; // mixed gains along the list
+                     ct.sensitivity[c] = sensitivities[s][c];
+                  }
+                  CHECK(conv_table_build(&ct) == CFG_SUCCESS, "table");
+
+                  /* the 24-bit range in full for the list of 4, sampled for the shorter lists */
+                  ULNG step = (res > 16 && n < NUM_CHANNELS) ? 257 : 1;
+                  DBL err = compare(&ct, width, count, step);
+                  CHECK(err <= CONV_TOLERANCE, "res %u enc %u list %u gain %g sens set %u: %.2f eps", res,
+                        encodings[e], n, gains[g], s, err);
+                  worst = MAX(worst, err);
+               }
+            }
+         }
+      }
+   }
+   printf("worst folded error %.2f eps of full scale (tolerance %.0f)\n", worst, CONV_TOLERANCE);
+   return test_done("test_conversion");
+}
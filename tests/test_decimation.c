@@ -0,0 +1,206 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Decimation. The taps match an independent Blackman windowed-sinc
+    design and have the intended response: flat pass band, -6 dB at the
+    cutoff, and every frequency that would alias into the pass band at
+    least 75 dB down. On the simulator the stored frames of a decimated
+    run equal decimate_ref() applied to the same run at the full rate, a
+    pass band tone keeps its amplitude and tones above the output Nyquist
+    frequency do not alias into the capture.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define DEC_FREQ 10000.0f
+#define DEC_FRAMES 20000UL
+#define DEC_FACTOR 8
+
+/* Direct evaluation of the windowed-sinc design of the Decimation banner */
+static void design_ref(UINT factor, UINT taps_per_phase, DBL *h)
+{
+   const UINT taps = factor * taps_per_phase + 1;
+   const DBL fc = 0.8 * 0.5 / factor;
+   DBL sum = 0;
+
+   for (UINT t = 0; t < taps; t++)
+   {
+      DBL x = t - (taps - 1) / 2.0;
+      DBL n = (DBL)t / (taps - 1);
+      h[t] = ((x == 0) ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x)) *
+             (0.42 - 0.5 * cos(2 * M_PI * n) + 0.08 * cos(4 * M_PI * n));
+      sum += h[t];
+   }
+   for (UINT t = 0; t < taps; t++)
+      h[t] /= sum;
+}
+
+/* Magnitude response in dB at f cycles per input frame */
+static DBL response_db(const DBL *h, UINT taps, DBL f)
+{
+   DBL re = 0, im = 0;
+   for (UINT t = 0; t < taps; t++)
+   {
+      re += h[t] * cos(2 * M_PI * f * t);
+      im -= h[t] * sin(2 * M_PI * f * t);
+   }
+   return 10 * log10(re * re + im * im);
+}
+
+static void taps(void)
+{
+   static DBL h[DECIM_MAX_TAPS], want[DECIM_MAX_TAPS];
+   static const UINT factors[] = {2, 3, 4, 8, 64};
+   static const UINT phases[] = {2, 16, 32};
+
+   for (UINT i = 0; i < sizeof(factors) / sizeof(factors[0]); i++)
+   {
+      for (UINT j = 0; j < sizeof(phases) / sizeof(phases[0]); j++)
+      {
+         CHECK(set_decimation(factors[i], phases[j]) == CFG_SUCCESS, "factor %u", factors[i]);
+         DecimationInfo info = get_decimation();
+         UINT n = get_decimation_taps(h, DECIM_MAX_TAPS);
+         DBL worst = 0, sum = 0;
+
+         CHECK(n == factors[i] * phases[j] + 1 && info.taps == n && info.factor == factors[i],
+               "factor %u: %u taps", factors[i], n);
+         CHECK(fabs(info.cutoff - 0.4 / factors[i]) < 1e-15, "factor %u: cutoff %g", factors[i], info.cutoff);
+         design_ref(factors[i], phases[j], want);
+         for (UINT t = 0; t < n; t++)
+         {
+            worst = MAX(worst, fabs(h[t] - want[t]));
+            worst = MAX(worst, fabs(h[t] - h[n - 1 - t])); // linear phase
+            sum += h[t];
+         }
+         CHECK(worst < 1e-15 && fabs(sum - 1) < 1e-12, "factor %u x %u: taps off by %g, sum %.15f", factors[i],
+               phases[j], worst, sum);
+      }
+   }
+   CHECK(set_decimation(4, 3) == CFG_FAILURE && set_decimation(DECIM_MAX_FACTOR + 1, 0) == CFG_FAILURE,
+         "odd taps per phase or too large a factor");
+
+   /* response of the default design */
+   for (UINT i = 0; i < sizeof(factors) / sizeof(factors[0]); i++)
+   {
+      const UINT factor = factors[i];
+      const DBL nyquist = 0.5 / factor; // output Nyquist frequency in cycles per input frame
+      set_decimation(factor, 0);
+      UINT n = get_decimation_taps(h, DECIM_MAX_TAPS);
+      DBL pass = 0, stop = -400;
+
+      for (DBL f = 0; f <= 0.5 * nyquist; f += nyquist / 200)
+         pass = MAX(pass, fabs(response_db(h, n, f)));
+      for (DBL f = 1.4 * nyquist; f <= 0.5; f += nyquist / 50)
+         stop = MAX(stop, response_db(h, n, f));
+      DBL edge = response_db(h, n, 0.8 * nyquist);
+      CHECK(pass < 0.02, "factor %u: pass band ripple %.4f dB", factor, pass);
+      CHECK(fabs(edge + 6.02) < 0.05, "factor %u: %.3f dB at the cutoff", factor, edge);
+      CHECK(stop < -75, "factor %u: aliasing frequencies only %.1f dB down", factor, stop);
+   }
+   set_decimation(1, 0);
+}
+
+static int capture(UINT factor, DBL *copy[NUM_CHANNELS])
+{
+   ChannelView views[NUM_VIEWS];
+
+   set_decimation(factor, 0);
+   set_capture_frames(DEC_FRAMES);
+   int rc = measure(FALSE, NUM_CHANNELS, DEC_FREQ, 1, 1, 1, 1, 1, TRUE, 5);
+   CHECK(rc == CFG_SUCCESS, "factor %u: measure returned %d", factor, rc);
+   get_channel_views(views);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      copy[c] = malloc((views[c].count + 1) * sizeof(DBL));
+      if (views[c].count > 0)
+         memcpy(copy[c], views[c].data, views[c].count * sizeof(DBL));
+   }
+   int count = (int)views[0].count;
+   cleanup_data();
+   set_decimation(1, 0);
+   return count;
+}
+
+/* Amplitude of the f cycles per frame component of x[margin, margin + n), n whole periods */
+static DBL amplitude(const DBL *x, int margin, int n, DBL f)
+{
+   DBL re = 0, im = 0;
+   for (int i = margin; i < margin + n; i++)
+   {
+      re += x[i] * cos(2 * M_PI * f * i);
+      im += x[i] * sin(2 * M_PI * f * i);
+   }
+   return 2 * sqrt(re * re + im * im) / n;
+}
+
+/* Largest magnitude away from the first and last margin frames */
+static DBL peak(const DBL *x, int count, int margin)
+{
+   DBL p = 0;
+   for (int i = margin; i < count - margin; i++)
+      p = MAX(p, fabs(x[i]));
+   return p;
+}
+
+static void decimated_run(void)
+{
+   DBL *full[NUM_CHANNELS], *dec[NUM_CHANNELS];
+   DBL *ref = malloc(DEC_FRAMES * sizeof(DBL));
+   /* output Nyquist 625 Hz: X in the pass band, Y and Z alias to 150 Hz and 100 Hz */
+   static const DBL tone[NUM_CHANNELS] = {2400.0, 1100.0, 100.0, 0.0}; // per physical input
+   ULNG n_ref = 0;
+
+   for (UINT p = 0; p < NUM_CHANNELS; p++)
+      set_sim_signal(p, (tone[p] > 0) ? 1.0 : 0.0, tone[p]);
+
+   int n_full = capture(1, full);
+   int n_dec = capture(DEC_FACTOR, dec);
+   CHECK(n_full == (int)DEC_FRAMES && n_dec == (int)(DEC_FRAMES / DEC_FACTOR), "stored %d and %d frames", n_full,
+         n_dec);
+
+   set_decimation(DEC_FACTOR, 0);
+   for (UINT c = 0; c < NUM_CHANNELS - 1 && n_dec > 0; c++)
+   {
+      DBL worst = 0, scale = peak(full[c], n_full, 0);
+      n_ref = decimate_ref(full[c], (ULNG)n_full, ref);
+      CHECK(n_ref == (ULNG)n_dec, "channel %u: reference gives %lu frames", c, n_ref);
+      for (int i = 0; i < n_dec; i++)
+         worst = MAX(worst, fabs(dec[c][i] - ref[i]));
+      CHECK(worst <= 1e-12 * scale, "channel %u: decimated frames off the reference by %g", c, worst);
+   }
+   set_decimation(1, 0);
+
+   /* tones: default map, output 0-X (input 2), 1-Y (input 1), 2-Z (input 0) */
+   if (n_dec > 0)
+   {
+      int margin = DECIM_DEFAULT_TAPS; // the filter spans this many output frames, skip the edges
+      int periods = (n_dec - 2 * margin) / 25 * 25; // 100 Hz repeats every 25 stored frames
+      DBL x = amplitude(dec[0], margin, periods, 100.0 * DEC_FACTOR / DEC_FREQ) /
+              amplitude(full[0], 0, n_full, 100.0 / DEC_FREQ);
+      DBL y = peak(dec[1], n_dec, margin) / peak(full[1], n_full, 0);
+      DBL z = peak(dec[2], n_dec, margin) / peak(full[2], n_full, 0);
+      printf("100 Hz kept at %.4f dB, 1100 Hz at %.1f dB, 2400 Hz at %.1f dB\n", 20 * log10(x), 20 * log10(y),
+             20 * log10(z));
+      CHECK(fabs(20 * log10(x)) < 0.02, "pass band tone at %.4f dB", 20 * log10(x));
+      CHECK(20 * log10(y) < -75 && 20 * log10(z) < -75, "aliases at %.1f and %.1f dB", 20 * log10(y),
+            20 * log10(z));
+   }
+
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      free(full[c]);
+      free(dec[c]);
+   }
+   free(ref);
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.0);
+   CHECK(configure_simulator(0.0, 0.0, 1, 0, 0, FALSE) == CFG_SUCCESS, "simulator without the D/A loop");
+
+   taps();
+   decimated_run();
+   return test_done("test_decimation");
+}
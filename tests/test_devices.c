@@ -0,0 +1,151 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Several devices in one process. Two simulated boards, each with its
+    own clock, channel map, tone, simulator settings and frame count, run
+    at the same time from two threads on the real time simulator: each
+    stores exactly its own frames, on its own tone, and keeps its own stop
+    reason, drop count and configuration. A thread that never selects a
+    device works on device 0, and threads selecting the same new device at
+    once all get the one context.
+
+****************************************************************************/
+
+#include <float.h>
+#include "test.h"
+
+typedef struct {
+   UINT index;
+   float freq;
+   ULNG frames;
+   UINT physical[NUM_CHANNELS]; // channel map, first count entries
+   UINT count;
+   UINT input;                  // the input playing the tone
+   DBL volts, hz;
+   ULNG seed;
+   DBL start, end;              // monotonic seconds of the run
+   int rc;
+} DeviceRun;
+
+static DeviceRun runs[2] = {
+   {1, 10000.0f, 15000, {2, 1, 0, 3}, 4, 2, 1.0, 50.0, 11},
+   {2, 20000.0f, 24000, {0, 3}, 2, 0, 0.5, 120.0, 22},
+};
+
+static void configure(DeviceRun *r)
+{
+   test_open_sim(r->index, 1.0, 0.0);
+   CHECK(configure_simulator(1.0, 0.0, r->seed, 0, 0, FALSE) == CFG_SUCCESS, "device %u: simulator", r->index);
+   for (UINT p = 0; p < NUM_CHANNELS; p++)
+      set_sim_signal(p, 0, 0);
+   set_sim_signal(r->input, r->volts, r->hz);
+   CHECK(set_channel_map(r->count, r->physical, NULL) == CFG_SUCCESS, "device %u: channel map", r->index);
+   set_capture_frames(r->frames);
+}
+
+static ThreadResult THREAD_CALL run_device(LPVOID arg)
+{
+   DeviceRun *r = arg;
+
+   CHECK(select_device(r->index) == CFG_SUCCESS && get_device() == r->index, "select device %u", r->index);
+   r->start = monotonic_seconds();
+   r->rc = measure(FALSE, NUM_CHANNELS, r->freq, 1, 1, 1, 1, 1, TRUE, 10);
+   r->end = monotonic_seconds();
+   return 0;
+}
+
+/* The run of device r as seen from the calling thread, which selects it */
+static void check_run(const DeviceRun *r)
+{
+   ChannelView views[NUM_VIEWS];
+
+   CHECK(select_device(r->index) == CFG_SUCCESS, "select device %u", r->index);
+   CHECK(r->rc == CFG_SUCCESS, "device %u: measure returned %d", r->index, r->rc);
+   CHECK(get_stop_reason() == STOP_REASON_SAMPLE_COUNT && get_dropped_buffers() == 0,
+         "device %u: stop reason %d, %lu buffers dropped", r->index, get_stop_reason(), get_dropped_buffers());
+   CHECK(ctx->sim_ad->freq == r->freq && ctx->sim_ad->listsize == r->count, "device %u: A/D at %g Hz with %u inputs",
+         r->index, ctx->sim_ad->freq, ctx->sim_ad->listsize);
+   SimConfig config = get_simulator_config();
+   CHECK(config.seed == r->seed && config.amplitude[r->input] == r->volts && config.frequency[r->input] == r->hz,
+         "device %u: simulator settings of another device", r->index);
+   CHECK(get_channel_views(views) == CFG_SUCCESS, "device %u: views", r->index);
+
+   const ConvTable *ct = ctx->conv_table;
+   const ChannelMap *map = ctx->active_map;
+   for (UINT k = 0; k < r->count; k++)
+   {
+      const UINT physical = r->physical[k];
+      DBL full = (ct->max - ct->min) / (map->sensitivity[k] / 1000), worst = 0;
+      for (ULNG f = 0; f < views[k].count; f++)
+         worst = MAX(worst, fabs(views[k].data[f] - test_sim_expected(ct, physical, 1, map->sensitivity[k], f)));
+      CHECK(views[k].count == r->frames, "device %u: channel %u holds %u frames, want %lu", r->index, k,
+            views[k].count, r->frames);
+      CHECK(worst <= CONV_TOLERANCE * DBL_EPSILON * full, "device %u: channel %u (input %u) off its tone by %.3g",
+            r->index, k, physical, worst);
+   }
+   for (UINT k = r->count; k < NUM_CHANNELS; k++)
+      CHECK(views[k].data == NULL, "device %u: channel %u is not empty", r->index, k);
+   cleanup_data();
+}
+
+static DeviceContext *selected[4];
+
+static ThreadResult THREAD_CALL select_new(LPVOID arg)
+{
+   UINT slot = (UINT)(uintptr_t)arg;
+
+   select_device(MAX_DEVICES - 1);
+   selected[slot] = ctx;
+   return 0;
+}
+
+static ThreadResult THREAD_CALL unselected(LPVOID arg)
+{
+   *(UINT *)arg = get_device();
+   set_capture_frames(777); // lands on device 0
+   return 0;
+}
+
+int main(void)
+{
+   Thread threads[4];
+
+   for (UINT i = 0; i < 2; i++)
+      configure(&runs[i]);
+   for (UINT i = 0; i < 2; i++)
+      CHECK(thread_create(&threads[i], run_device, &runs[i]), "thread %u", i);
+   for (UINT i = 0; i < 2; i++)
+      thread_join(threads[i]);
+   printf("device %u ran %.2f s, device %u %.2f s, %.2f s of it together\n", runs[0].index,
+          runs[0].end - runs[0].start, runs[1].index, runs[1].end - runs[1].start,
+          MIN(runs[0].end, runs[1].end) - MAX(runs[0].start, runs[1].start));
+   CHECK(runs[0].start < runs[1].end && runs[1].start < runs[0].end, "the two runs did not overlap");
+   for (UINT i = 0; i < 2; i++)
+      check_run(&runs[i]);
+
+   /* threads that select the same new device at once share its context */
+   for (UINT i = 0; i < 4; i++)
+      CHECK(thread_create(&threads[i], select_new, (LPVOID)(uintptr_t)i), "thread %u", i);
+   for (UINT i = 0; i < 4; i++)
+      thread_join(threads[i]);
+   for (UINT i = 1; i < 4; i++)
+      CHECK(selected[i] != NULL && selected[i] == selected[0], "thread %u got context %p, thread 0 %p", i,
+            (void *)selected[i], (void *)selected[0]);
+
+   /* a thread that never selects a device works on device 0 */
+   UINT device = MAX_DEVICES;
+   CHECK(thread_create(&threads[0], unselected, &device), "unselected thread");
+   thread_join(threads[0]);
+   CHECK(device == 0, "a thread without a device is on %u", device);
+   select_device(0);
+   CHECK(ctx->schedule->requested_frames == 777, "device 0 did not take the setting");
+   set_capture_frames(0);
+
+   for (UINT i = 0; i < 2; i++)
+   {
+      select_device(runs[i].index);
+      set_capture_frames(0);
+      deinit_board();
+   }
+   return test_done("test_devices");
+}
@@ -0,0 +1,113 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Mixed gains on the simulator. Every combination of gains 1 and 10 over
+    the four inputs is run through several channel maps: the gain list
+    entry of each channel list position is the gain of its input, every
+    output channel matches the reference formula at its own gain within
+    the conversion tolerance, and a recording reads back identical.
+
+****************************************************************************/
+
+#include <float.h>
+#include "test.h"
+
+#define GAIN_FREQ 10000.0f
+#define GAIN_FRAMES 2000UL
+#define GAIN_RECORD "test_gain.dtc"
+
+static const struct {
+   UINT count;
+   UINT physical[NUM_CHANNELS];
+} maps[] = {
+   {4, {2, 1, 0, 3}},
+   {4, {0, 1, 2, 3}},
+   {4, {3, 2, 1, 0}},
+   {4, {1, 3, 0, 2}},
+   {3, {3, 0, 2}},
+   {2, {1, 3}},
+};
+
+static void check_gains(UINT m, const int gain[NUM_CHANNELS])
+{
+   ChannelView views[NUM_VIEWS];
+   const ChannelMap *map = ctx->active_map;
+   const ConvTable *ct = ctx->conv_table;
+   const UINT count = maps[m].count;
+
+   CHECK(set_channel_map(count, maps[m].physical, NULL) == CFG_SUCCESS, "map %u", m);
+   set_capture_frames(GAIN_FRAMES);
+   set_record_file(GAIN_RECORD);
+   int rc = measure(FALSE, NUM_CHANNELS, GAIN_FREQ, 1, gain[0], gain[1], gain[2], gain[3], TRUE, 1);
+   set_record_file(NULL);
+   CHECK(rc == CFG_SUCCESS, "map %u gains %d%d%d%d: measure returned %d", m, gain[0], gain[1], gain[2], gain[3], rc);
+   if (rc != CFG_SUCCESS)
+      return;
+   CHECK(get_channel_views(views) == CFG_SUCCESS, "views");
+
+   /* each channel list position carries the gain of the input it scans */
+   for (UINT i = 0; i < ctx->sim_ad->listsize; i++)
+      CHECK(ctx->sim_ad->gainlist[i] == gain[ctx->sim_ad->chanlist[i]] && ct->gainlist[i] == ctx->sim_ad->gainlist[i],
+            "map %u: list entry %u (input %u) at gain %g, conversion %g", m, i, ctx->sim_ad->chanlist[i],
+            ctx->sim_ad->gainlist[i], ct->gainlist[i]);
+
+   for (UINT k = 0; k < count; k++)
+   {
+      UINT physical = maps[m].physical[k];
+      DBL full = (ct->max - ct->min) / gain[physical] / (map->sensitivity[k] / 1000);
+      DBL worst = 0;
+      for (UINT f = 0; f < views[k].count; f++)
+      {
+         DBL want = test_sim_expected(ct, physical, gain[physical], map->sensitivity[k], f);
+         worst = MAX(worst, fabs(views[k].data[f] - want));
+      }
+      CHECK(views[k].count == GAIN_FRAMES && worst <= CONV_TOLERANCE * DBL_EPSILON * full,
+            "map %u gains %d%d%d%d: channel %u (input %u) off by %.3g", m, gain[0], gain[1], gain[2], gain[3], k,
+            physical, worst);
+   }
+
+   CaptureFile *cf = capture_file_open(GAIN_RECORD);
+   CHECK(cf != NULL, "open the recording");
+   if (cf != NULL)
+   {
+      DBL *out[NUM_CHANNELS] = {NULL};
+      for (UINT k = 0; k < count; k++)
+         out[k] = malloc(GAIN_FRAMES * sizeof(DBL));
+      CHECK(capture_file_read(cf, 0, GAIN_FRAMES, out) == GAIN_FRAMES, "read the recording");
+      for (UINT k = 0; k < count; k++)
+      {
+         CHECK(memcmp(out[k], views[k].data, GAIN_FRAMES * sizeof(DBL)) == 0,
+               "map %u gains %d%d%d%d: recorded channel %u differs", m, gain[0], gain[1], gain[2], gain[3], k);
+         free(out[k]);
+      }
+      capture_file_close(cf);
+   }
+   cleanup_data();
+}
+
+int main(void)
+{
+   UINT runs = 0;
+
+   test_open_sim(0, 0.0, 0.0);
+   CHECK(configure_simulator(0.0, 0.0, 1, 0, 0, FALSE) == CFG_SUCCESS, "simulator without the D/A loop");
+   for (UINT p = 0; p < NUM_CHANNELS; p++)
+      CHECK(set_sim_signal(p, 0.2 + 0.2 * p, 23.0 * (p + 1)) == CFG_SUCCESS, "input %u tone", p); // inside +-1 V at gain 10
+
+   for (UINT m = 0; m < sizeof(maps) / sizeof(maps[0]); m++)
+   {
+      for (UINT bits = 0; bits < (1u << NUM_CHANNELS); bits++)
+      {
+         int gain[NUM_CHANNELS];
+         for (UINT p = 0; p < NUM_CHANNELS; p++)
+            gain[p] = (bits & (1u << p)) ? 10 : 1;
+         check_gains(m, gain);
+         runs++;
+      }
+   }
+   printf("%u gain combinations checked\n", runs);
+
+   set_channel_map(channel_map_default.count, channel_map_default.physical, NULL);
+   remove(GAIN_RECORD);
+   return test_done("test_gain");
+}
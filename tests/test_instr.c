@@ -0,0 +1,133 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Run instrumentation. instr_note_queue() keeps the last and deepest
+    conversion queue and counts drops. latency_percentile() returns the
+    upper edge of the bucket holding the fraction asked for, capped at the
+    maximum. After a run, the handler and conversion histograms hold one
+    entry per delivered and converted buffer, their buckets sum to the
+    count, the maximum lies in the last bucket in use, and the percentiles
+    rise with p and each falls in the bucket that holds it. With
+    set_instrumentation(FALSE) the histograms stay empty and the counters
+    still run.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define INSTR_FREQ 20000.0f
+#define INSTR_FRAMES 123457UL
+
+static void queue(void)
+{
+   atomic_store(&ctx->instr->queue_depth, 0);
+   atomic_store(&ctx->instr->queue_depth_max, 0);
+   atomic_store(&ctx->instr->buffers_dropped, 0);
+   instr_note_queue(3, FALSE);
+   instr_note_queue(7, FALSE);
+   instr_note_queue(2, TRUE);
+   PipelineCounters c = get_pipeline_counters();
+   CHECK(c.queue_depth == 2 && c.queue_depth_max == 7 && c.buffers_dropped == 1,
+         "queue depth %u, deepest %u, %lu dropped", c.queue_depth, c.queue_depth_max, c.buffers_dropped);
+}
+
+/* Buckets 10, 12 and 20 ([1024, 2048), [4096, 8192) and [2^20, 2^21) ns) */
+static void percentiles(void)
+{
+   LatencyHistogram h = {0};
+
+   CHECK(latency_percentile(&h, 0.5) == 0, "empty histogram");
+   h.bucket[10] = 50;
+   h.bucket[12] = 30;
+   h.bucket[20] = 20;
+   h.count = 100;
+   h.max = 1.5e-3;
+   CHECK(latency_percentile(&h, 0.5) == 2048e-9, "p50 %.9g", latency_percentile(&h, 0.5));
+   CHECK(latency_percentile(&h, 0.51) == 8192e-9, "p51 %.9g", latency_percentile(&h, 0.51));
+   CHECK(latency_percentile(&h, 0.8) == 8192e-9, "p80 %.9g", latency_percentile(&h, 0.8));
+   CHECK(latency_percentile(&h, 0.81) == 1.5e-3, "p81 %.9g, want the maximum", latency_percentile(&h, 0.81));
+   CHECK(latency_percentile(&h, 1.0) == 1.5e-3, "p100 %.9g", latency_percentile(&h, 1.0));
+   CHECK(hist_bucket(0) == 0 && hist_bucket(1023) == 9 && hist_bucket(1024) == 10 &&
+            hist_bucket(UINT64_MAX) == HIST_BUCKETS - 1,
+         "bucket edges");
+}
+
+/* Checks one histogram of a run holding count buffers */
+static void check_histogram(int which, const char *name, ULNG count)
+{
+   static const DBL p[] = {0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 1.0};
+   LatencyHistogram h;
+   ULNG total = 0;
+   int last = -1;
+
+   CHECK(get_latency_histogram(which, &h) == CFG_SUCCESS, "%s histogram", name);
+   for (int b = 0; b < HIST_BUCKETS; b++)
+   {
+      total += h.bucket[b];
+      if (h.bucket[b] > 0)
+         last = b;
+   }
+   CHECK(h.count == count && total == count, "%s: %lu entries, buckets sum to %lu, want %lu", name, h.count, total,
+         count);
+   CHECK(last >= 0 && hist_bucket((uint64_t)(h.max * 1e9)) == (UINT)last && h.mean > 0 && h.mean <= h.max,
+         "%s: mean %.3g s, max %.3g s in bucket %d", name, h.mean, h.max, last);
+
+   DBL previous = 0;
+   for (UINT i = 0; i < sizeof(p) / sizeof(p[0]); i++)
+   {
+      DBL v = latency_percentile(&h, p[i]);
+      ULNG below = 0;
+      int b = 0;
+      while (below + h.bucket[b] < p[i] * total)
+         below += h.bucket[b++];
+      CHECK(v >= previous, "%s: p%g %.3g s below the previous percentile", name, p[i] * 100, v);
+      CHECK(v >= ldexp(1e-9, b) && v <= ldexp(1e-9, b + 1) && v <= h.max, "%s: p%g %.3g s outside bucket %d", name,
+            p[i] * 100, v, b);
+      previous = v;
+   }
+   CHECK(latency_percentile(&h, 1.0) == h.max, "%s: p100 is not the maximum", name);
+   printf("%s: %lu buffers, p50 %.1f us, p99 %.1f us, max %.1f us\n", name, h.count, latency_percentile(&h, 0.5) * 1e6,
+          latency_percentile(&h, 0.99) * 1e6, h.max * 1e6);
+}
+
+static void run(bool enabled)
+{
+   set_instrumentation(enabled);
+   set_capture_frames(INSTR_FRAMES);
+   CHECK(measure(FALSE, NUM_CHANNELS, INSTR_FREQ, 1, 1, 1, 1, 1, TRUE, 10) == CFG_SUCCESS, "measure");
+
+   PipelineCounters c = get_pipeline_counters();
+   const ULNG buffer_frames = ctx->pool->buffer_samples / NUM_CHANNELS;
+   const ULNG converted = (INSTR_FRAMES + buffer_frames - 1) / buffer_frames;
+   CHECK(c.buffers >= converted && c.frames >= INSTR_FRAMES && c.buffers_dropped == 0,
+         "%lu buffers of %lu frames, %lu frames, %lu dropped", c.buffers, buffer_frames, c.frames, c.buffers_dropped);
+   CHECK(c.queue_depth_max >= 1 && c.queue_depth_max <= ctx->raw_ring->slots, "deepest queue %u of %u",
+         c.queue_depth_max, ctx->raw_ring->slots);
+   if (enabled)
+   {
+      check_histogram(HIST_HANDLER, "handler", c.buffers);
+      check_histogram(HIST_CONVERT, "convert", converted);
+   }
+   else
+   {
+      LatencyHistogram h[2];
+      get_latency_histogram(HIST_HANDLER, &h[0]);
+      get_latency_histogram(HIST_CONVERT, &h[1]);
+      CHECK(h[0].count == 0 && h[1].count == 0 && h[0].max == 0 && h[1].max == 0,
+            "instrumentation off: %lu handler and %lu convert entries", h[0].count, h[1].count);
+   }
+   cleanup_data();
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.001);
+   queue();
+   percentiles();
+   run(TRUE);
+   run(FALSE);
+   run(TRUE);
+   set_capture_frames(0);
+   deinit_board();
+   return test_done("test_instr");
+}
@@ -0,0 +1,127 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Streamed D/A output on the simulator. With a callback, the selected
+    waveform and a file as producers, the simulated D/A plays exactly the
+    samples the producer gave, in order, as the codes olDaVoltsToCode
+    would write for them (checked sample by sample in the sink history),
+    with no underrun and no discontinuity at the buffer boundaries, and
+    the output counters agree with the sink.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define OUT_FREQ 10000.0f
+#define OUT_FILE "test_output.f64"
+#define OUT_FILE_SAMPLES 5000
+
+/* Two tones: smooth across buffer boundaries, and no buffer repeats another */
+static DBL ramp_volts(ULNG k)
+{
+   return 4.0 * sin(2 * M_PI * 3.0 * k / OUT_FREQ) + 0.5 * sin(2 * M_PI * 41.3 * k / OUT_FREQ);
+}
+
+static ULNG producer_calls, producer_next;
+static BOOL producer_in_order = TRUE;
+
+static UINT ramp_producer(DBL *volts, UINT count, ULNG first_sample, void *user)
+{
+   (void)user;
+   if (first_sample != producer_next)
+      producer_in_order = FALSE;
+   for (UINT i = 0; i < count; i++)
+      volts[i] = ramp_volts(first_sample + i);
+   producer_next = first_sample + count;
+   producer_calls++;
+   return count;
+}
+
+/* The sink holds every played sample as the D/A code of want(k) */
+static void check_played(const char *name, ULNG samples, DBL (*want)(ULNG k))
+{
+   SimSinkStats sink = get_sim_sink_stats();
+   OutputCounters out = get_output_counters();
+   const SimSubsystem *da = ctx->sim_da;
+   ULNG wrong = 0, first_wrong = 0;
+
+   CHECK(sink.samples == samples, "%s: %lu samples played, want %lu", name, sink.samples, samples);
+   CHECK(sink.underruns == 0 && sink.discontinuities == 0, "%s: %lu underruns, %lu discontinuities", name,
+         sink.underruns, sink.discontinuities);
+   CHECK(out.samples_queued == samples && out.samples_played == samples && out.underruns == 0,
+         "%s: counters queued %lu, played %lu, %lu underruns", name, out.samples_queued, out.samples_played,
+         out.underruns);
+   CHECK(sink.samples <= SIM_SINK_HISTORY, "%s: the run must fit in the sink history", name);
+   for (ULNG k = 0; k < MIN(sink.samples, (ULNG)SIM_SINK_HISTORY); k++)
+   {
+      ULNG code;
+      sim_volts_to_code(da->min, da->max, 1, da->resolution, da->encoding, want(k), &code);
+      DBL v = code_to_volts_ref(da->min, da->max, 1, da->resolution, da->encoding, code);
+      if (ctx->sim_sink_history[k] != v && wrong++ == 0)
+         first_wrong = k;
+   }
+   CHECK(wrong == 0, "%s: %lu played samples differ, first at %lu (%g V, want %g V)", name, wrong, first_wrong,
+         ctx->sim_sink_history[first_wrong], want(first_wrong));
+}
+
+static void callback(void)
+{
+   set_output_stream(TRUE, ramp_producer, NULL, NULL);
+   int rc = generate(FALSE, FALSE, OUT_FREQ, 1, 0, 0, TRUE, 2);
+   CHECK(rc == CFG_SUCCESS, "callback: generate returned %d", rc);
+   CHECK(producer_in_order && producer_calls > 2, "callback: %lu producer calls, in order %d", producer_calls,
+         producer_in_order);
+   check_played("callback", 2 * (ULNG)OUT_FREQ, ramp_volts);
+}
+
+static DBL sine_volts(ULNG k)
+{
+   return 3.0 * sin(2 * M_PI * fmod(k * 37.0 / OUT_FREQ, 1.0));
+}
+
+static void waveform(void)
+{
+   set_waveform(WAVE_SINE, 0, 0);
+   set_output_stream(TRUE, NULL, NULL, NULL);
+   int rc = generate(FALSE, FALSE, OUT_FREQ, 1, 3, 37, TRUE, 1);
+   CHECK(rc == CFG_SUCCESS, "waveform: generate returned %d", rc);
+   check_played("waveform", (ULNG)OUT_FREQ, sine_volts);
+   set_waveform(WAVE_SQUARE, 0, 0);
+}
+
+static DBL file_volts(ULNG k)
+{
+   return -2.5 + 5.0 * k / OUT_FILE_SAMPLES;
+}
+
+static void file(void)
+{
+   FILE *f = fopen(OUT_FILE, "wb");
+   CHECK(f != NULL, "create %s", OUT_FILE);
+   if (f == NULL)
+      return;
+   for (ULNG k = 0; k < OUT_FILE_SAMPLES; k++)
+   {
+      DBL v = file_volts(k);
+      fwrite(&v, sizeof(v), 1, f);
+   }
+   fclose(f);
+
+   /* the file ends the stream before the 1 s limit */
+   set_output_stream(TRUE, NULL, NULL, OUT_FILE);
+   int rc = generate(FALSE, FALSE, OUT_FREQ, 1, 0, 0, TRUE, 1);
+   CHECK(rc == CFG_SUCCESS, "file: generate returned %d", rc);
+   check_played("file", OUT_FILE_SAMPLES, file_volts);
+   remove(OUT_FILE);
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.0);
+
+   callback();
+   waveform();
+   file();
+   set_output_stream(FALSE, NULL, NULL, NULL);
+   return test_done("test_output");
+}
@@ -0,0 +1,240 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Packed recordings. pack_block() and unpack_block() round-trip random
+    codes, constant codes and full-scale swings exactly for 16- and 32-bit
+    codes, 1 to 4 codes per frame, whole and partial blocks, within
+    PACK_BOUND(), and a block cut short is refused. A run recorded packed
+    reads back through capture_file_read() as the same volts as the same
+    run recorded raw and as the live views, and a packed file torn in the
+    middle of a block reads back its whole blocks.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define PACK_FREQ 10000.0f
+#define PACK_RUN (5UL * PACK_BLOCK_FRAMES + 1234) // ends in a partial block
+#define RAW_RECORD "test_pack_raw.dtc"
+#define PACKED_RECORD "test_pack_packed.dtc"
+#define TORN_RECORD "test_pack_torn.dtc"
+
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void)
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 17;
+   rng ^= rng << 5;
+   return rng;
+}
+
+enum { PATTERN_RANDOM, PATTERN_CONSTANT, PATTERN_SWING, PATTERN_SMOOTH, PATTERNS };
+static const char *const pattern_name[] = {"random", "constant", "full-scale swing", "smooth"};
+
+static uint32_t pattern_code(int pattern, UINT width, ULNG i, UINT frame_size)
+{
+   const uint32_t top = (width > 2) ? 0xFFFFFFFFU : 0xFFFFU;
+   const UINT c = (UINT)(i % frame_size);
+
+   switch (pattern)
+   {
+   case PATTERN_RANDOM:
+      return next_random() & top;
+   case PATTERN_CONSTANT:
+      return (0x5A5A5A5AU + c) & top;
+   case PATTERN_SWING:
+      return ((i / frame_size + c) & 1) ? top : 0;
+   default:
+      return (uint32_t)(int32_t)floor((top / 3.0) * sin(2 * M_PI * (i / frame_size) / 500.0 + c)) & top;
+   }
+}
+
+static void round_trip(int pattern, UINT width, UINT frame_size, ULNG samples)
+{
+   const size_t bound = PACK_BOUND(samples, frame_size, width);
+   void *codes = malloc((size_t)samples * width), *back = malloc((size_t)samples * width);
+   unsigned char *packed = malloc(bound);
+
+   for (ULNG i = 0; i < samples; i++)
+   {
+      if (width > 2)
+         ((DWORD *)codes)[i] = pattern_code(pattern, width, i, frame_size);
+      else
+         ((WORD *)codes)[i] = (WORD)pattern_code(pattern, width, i, frame_size);
+   }
+   size_t bytes = pack_block(codes, width, samples, frame_size, packed);
+   CHECK(bytes > 0 && bytes <= bound, "%s, %u bytes x %u, %lu samples: %zu bytes packed, bound %zu",
+         pattern_name[pattern], width, frame_size, samples, bytes, bound);
+   memset(back, 0xA5, (size_t)samples * width);
+   CHECK(unpack_block(packed, bytes, width, samples, frame_size, back), "%s, %u bytes x %u, %lu samples: unpack",
+         pattern_name[pattern], width, frame_size, samples);
+   CHECK(memcmp(codes, back, (size_t)samples * width) == 0, "%s, %u bytes x %u, %lu samples: codes differ",
+         pattern_name[pattern], width, frame_size, samples);
+   CHECK(!unpack_block(packed, bytes - 1, width, samples, frame_size, back),
+         "%s, %u bytes x %u, %lu samples: a block one byte short unpacks", pattern_name[pattern], width, frame_size,
+         samples);
+   if (pattern == PATTERN_CONSTANT && samples == (ULNG)PACK_BLOCK_FRAMES * frame_size)
+      CHECK(bytes * 50 < (size_t)samples * width, "constant, %u bytes x %u: packed to %zu of %zu bytes", width,
+            frame_size, bytes, (size_t)samples * width);
+   free(codes);
+   free(back);
+   free(packed);
+}
+
+static void blocks(void)
+{
+   static const UINT widths[] = {2, 4};
+   UINT tried = 0;
+
+   for (int pattern = 0; pattern < PATTERNS; pattern++)
+   {
+      for (UINT w = 0; w < 2; w++)
+      {
+         for (UINT fs = 1; fs <= NUM_CHANNELS; fs++)
+         {
+            const ULNG lengths[] = {(ULNG)PACK_BLOCK_FRAMES * fs, 1234UL * fs, 1000UL * fs + fs - 1, fs, 1, 2, 3};
+            for (UINT l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++, tried++)
+               round_trip(pattern, widths[w], fs, lengths[l]);
+         }
+      }
+   }
+   printf("%u blocks round-tripped\n", tried);
+
+   /* more codes than a block holds are refused */
+   unsigned char out[64] = {0};
+   CHECK(pack_block(out, 2, PACK_BLOCK_FRAMES + 1, 1, out) == 0, "an oversized block packed");
+}
+
+/* Records the run to path, raw or packed, and keeps the live views in live */
+static void record(const char *path, bool packed, DBL *live[NUM_CHANNELS])
+{
+   ChannelView views[NUM_VIEWS];
+
+   set_record_file(path);
+   set_record_compression(packed);
+   set_capture_frames(PACK_RUN);
+   int rc = measure(FALSE, NUM_CHANNELS, PACK_FREQ, 1, 1, 1, 1, 1, TRUE, 10);
+   set_record_file(NULL);
+   set_record_compression(FALSE);
+   CHECK(rc == CFG_SUCCESS, "%s: measure returned %d", path, rc);
+
+   RecordInfo info = get_record_info();
+   CHECK(info.raw_bytes == PACK_RUN * NUM_CHANNELS * 4, "%s: %lu raw bytes", path, info.raw_bytes);
+   if (packed)
+   {
+      CHECK(info.block_frames == PACK_BLOCK_FRAMES && info.blocks == PACK_RUN / PACK_BLOCK_FRAMES + 1,
+            "%s: %lu blocks of %u frames", path, info.blocks, info.block_frames);
+      CHECK(info.file_bytes < info.raw_bytes, "%s: %lu bytes packed from %lu", path, info.file_bytes, info.raw_bytes);
+      printf("packed recording: %lu raw bytes in %lu (ratio %.2f)\n", info.raw_bytes, info.file_bytes,
+             (DBL)info.raw_bytes / info.file_bytes);
+   }
+   get_channel_views(views);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+      memcpy(live[c], views[c].data, MIN((ULNG)views[c].count, PACK_RUN) * sizeof(DBL));
+   cleanup_data();
+}
+
+/* Reads frames [0, frames) of a recording */
+static ULNG read_all(const char *path, ULNG frames, DBL *out[NUM_CHANNELS])
+{
+   CaptureFile *cf = capture_file_open(path);
+   CHECK(cf != NULL, "%s: open", path);
+   if (cf == NULL)
+      return 0;
+   ULNG got = capture_file_read(cf, 0, frames, out);
+   capture_file_close(cf);
+   return got;
+}
+
+/* Copies the first bytes of src to dst */
+static void copy_prefix(const char *src, const char *dst, size_t bytes)
+{
+   FILE *in = fopen(src, "rb"), *out = fopen(dst, "wb");
+   char *data = malloc(bytes);
+
+   CHECK(in != NULL && out != NULL && data != NULL && fread(data, 1, bytes, in) == bytes &&
+            fwrite(data, 1, bytes, out) == bytes,
+         "copy %zu bytes of %s", bytes, src);
+   free(data);
+   if (in)
+      fclose(in);
+   if (out)
+      fclose(out);
+}
+
+static void recordings(void)
+{
+   DBL *raw_live[NUM_CHANNELS], *packed_live[NUM_CHANNELS], *raw[NUM_CHANNELS], *packed[NUM_CHANNELS];
+
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      raw_live[c] = calloc(PACK_RUN, sizeof(DBL));
+      packed_live[c] = calloc(PACK_RUN, sizeof(DBL));
+      raw[c] = calloc(PACK_RUN, sizeof(DBL));
+      packed[c] = calloc(PACK_RUN, sizeof(DBL));
+   }
+
+   /* the simulator restarts its noise from the seed, so both runs are the same */
+   record(RAW_RECORD, FALSE, raw_live);
+   record(PACKED_RECORD, TRUE, packed_live);
+   CHECK(read_all(RAW_RECORD, PACK_RUN, raw) == PACK_RUN, "raw recording frames");
+   CHECK(read_all(PACKED_RECORD, PACK_RUN + 1, packed) == PACK_RUN, "packed recording frames");
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      CHECK(memcmp(raw_live[c], packed_live[c], PACK_RUN * sizeof(DBL)) == 0, "channel %u: the two runs differ", c);
+      CHECK(memcmp(raw[c], raw_live[c], PACK_RUN * sizeof(DBL)) == 0, "channel %u: raw recording differs", c);
+      CHECK(memcmp(packed[c], raw[c], PACK_RUN * sizeof(DBL)) == 0, "channel %u: packed and raw recordings differ", c);
+   }
+
+   /* a window across a block boundary */
+   CaptureFile *cf = capture_file_open(PACKED_RECORD);
+   CHECK(cf != NULL, "open the packed recording");
+   if (cf != NULL)
+   {
+      const ULNG first = 2 * PACK_BLOCK_FRAMES - 100;
+      CHECK(capture_file_read(cf, first, 300, packed) == 300, "window across a block boundary");
+      for (UINT c = 0; c < NUM_CHANNELS; c++)
+         CHECK(memcmp(packed[c], raw[c] + first, 300 * sizeof(DBL)) == 0, "channel %u: window differs", c);
+
+      /* torn in the middle of block 3: blocks 0-2 remain */
+      PackedBlockHeader blk;
+      memcpy(&blk, cf->codes + cf->block_offset[3], sizeof(blk));
+      size_t torn = cf->header.header_bytes + cf->block_offset[3] + sizeof(blk) + blk.bytes / 2;
+      capture_file_close(cf);
+      copy_prefix(PACKED_RECORD, TORN_RECORD, torn);
+      ULNG got = read_all(TORN_RECORD, PACK_RUN, packed);
+      CHECK(got == 3 * PACK_BLOCK_FRAMES, "torn packed recording: %lu frames", got);
+      for (UINT c = 0; c < NUM_CHANNELS; c++)
+         CHECK(memcmp(packed[c], raw[c], MIN(got, PACK_RUN) * sizeof(DBL)) == 0, "channel %u: torn recording differs",
+               c);
+
+      /* a raw recording torn mid-frame keeps its whole frames */
+      copy_prefix(RAW_RECORD, TORN_RECORD, sizeof(CaptureFileHeader) + 1000 * NUM_CHANNELS * 4 + 6);
+      got = read_all(TORN_RECORD, PACK_RUN, raw_live);
+      CHECK(got == 1000, "torn raw recording: %lu frames", got);
+      for (UINT c = 0; c < NUM_CHANNELS; c++)
+         CHECK(memcmp(raw_live[c], raw[c], 1000 * sizeof(DBL)) == 0, "channel %u: torn raw recording differs", c);
+   }
+
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      free(raw_live[c]);
+      free(packed_live[c]);
+      free(raw[c]);
+      free(packed[c]);
+   }
+   remove(RAW_RECORD);
+   remove(PACKED_RECORD);
+   remove(TORN_RECORD);
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.001);
+   blocks();
+   recordings();
+   set_capture_frames(0);
+   deinit_board();
+   return test_done("test_pack");
+}
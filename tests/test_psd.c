@@ -0,0 +1,164 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Welch PSD on the simulator. A tone centred on a bin and a tone between
+    bins peak in the right bin and integrate to their power (A^2 / 2)
+    within 1%, bins more than ten away stay 70 dB down, white noise of
+    known variance gives the expected one-sided density, and the averaged
+    spectrum equals a Welch estimate computed here with a direct DFT over
+    the stored frames.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define PSD_FREQ 10000.0f
+#define PSD_RUN 20000UL
+#define PSD_SEGMENT 512
+#define PSD_OVERLAP 0.5
+
+static DBL psd[NUM_CHANNELS][PSD_SEGMENT / 2 + 1];
+static DBL stored[NUM_CHANNELS][PSD_RUN];
+
+/* Captures one run with the PSD on and keeps the stored frames and spectra */
+static PsdInfo capture(void)
+{
+   ChannelView views[NUM_VIEWS];
+
+   set_psd(PSD_SEGMENT, PSD_OVERLAP);
+   set_capture_frames(PSD_RUN);
+   int rc = measure(FALSE, NUM_CHANNELS, PSD_FREQ, 1, 1, 1, 1, 1, TRUE, 5);
+   CHECK(rc == CFG_SUCCESS, "measure returned %d", rc);
+   get_channel_views(views);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      CHECK(views[c].count == PSD_RUN, "channel %u: %u frames", c, views[c].count);
+      memcpy(stored[c], views[c].data, MIN(views[c].count, PSD_RUN) * sizeof(DBL));
+      CHECK(get_psd(c, psd[c], PSD_SEGMENT / 2 + 1) == PSD_SEGMENT / 2 + 1, "channel %u: bins", c);
+   }
+   PsdInfo info = get_psd_info();
+   cleanup_data();
+   set_psd(0, 0);
+   return info;
+}
+
+/* Welch estimate of x with a direct DFT: periodic Hann, one-sided density */
+static void welch_ref(const DBL *x, ULNG frames, DBL *out)
+{
+   const UINT n = PSD_SEGMENT, hop = (UINT)(n * (1 - PSD_OVERLAP));
+   DBL window[PSD_SEGMENT], wsum = 0;
+   ULNG segments = 0;
+
+   for (UINT i = 0; i < n; i++)
+   {
+      window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+      wsum += window[i] * window[i];
+   }
+   memset(out, 0, (n / 2 + 1) * sizeof(DBL));
+   for (ULNG start = 0; start + n <= frames; start += hop, segments++)
+   {
+      for (UINT k = 0; k <= n / 2; k++)
+      {
+         DBL re = 0, im = 0;
+         for (UINT i = 0; i < n; i++)
+         {
+            re += x[start + i] * window[i] * cos(2 * M_PI * k * i / n);
+            im -= x[start + i] * window[i] * sin(2 * M_PI * k * i / n);
+         }
+         out[k] += (re * re + im * im) * ((k == 0 || k == n / 2) ? 1 : 2) / (PSD_FREQ * wsum);
+      }
+   }
+   for (UINT k = 0; k <= n / 2; k++)
+      out[k] /= segments;
+}
+
+static UINT peak_bin(const DBL *p)
+{
+   UINT best = 0;
+   for (UINT k = 1; k <= PSD_SEGMENT / 2; k++)
+      best = (p[k] > p[best]) ? k : best;
+   return best;
+}
+
+/* Power in bins [k - 5, k + 5] */
+static DBL tone_power(const DBL *p, UINT k, DBL bin_hz)
+{
+   DBL sum = 0;
+   for (UINT i = k - 5; i <= k + 5; i++)
+      sum += p[i] * bin_hz;
+   return sum;
+}
+
+static void tones(void)
+{
+   static DBL ref[PSD_SEGMENT / 2 + 1];
+   const ChannelMap *map = ctx->active_map;
+   const DBL bin_hz = PSD_FREQ / PSD_SEGMENT;
+   /* default map: output 0-X (input 2) on bin 20, output 1-Y (input 1) between bins 63 and 64 */
+   const DBL hz[2] = {20 * bin_hz, 1234.5}, volts[2] = {1.0, 0.5};
+
+   set_sim_signal(2, volts[0], hz[0]);
+   set_sim_signal(1, volts[1], hz[1]);
+   PsdInfo info = capture();
+   CHECK(info.bins == PSD_SEGMENT / 2 + 1 && info.bin_hz == bin_hz, "%u bins of %g Hz", info.bins, info.bin_hz);
+   CHECK(info.segments == (PSD_RUN - PSD_SEGMENT) / (PSD_SEGMENT / 2) + 1, "%lu segments", info.segments);
+
+   for (UINT c = 0; c < 2; c++)
+   {
+      DBL amplitude = volts[c] / (map->sensitivity[c] / 1000); // g
+      UINT k = peak_bin(psd[c]);
+      UINT want = (UINT)floor(hz[c] / bin_hz + 0.5);
+      DBL power = tone_power(psd[c], k, bin_hz), far = 0;
+      for (UINT i = 0; i <= PSD_SEGMENT / 2; i++)
+      {
+         if (i + 10 < k || i > k + 10)
+            far = MAX(far, psd[c][i]);
+      }
+      printf("%.1f Hz: peak in bin %u, power %.6g of %.6g g^2, far bins %.1f dB down\n", hz[c], k, power,
+             amplitude * amplitude / 2, 10 * log10(far / psd[c][k]));
+      CHECK(k == want, "%.1f Hz: peak in bin %u, not %u", hz[c], k, want);
+      CHECK(fabs(power / (amplitude * amplitude / 2) - 1) < 0.01, "%.1f Hz: power %g, want %g", hz[c], power,
+            amplitude * amplitude / 2);
+      CHECK(far < 1e-7 * psd[c][k], "%.1f Hz: far bins only %.1f dB down", hz[c], 10 * log10(far / psd[c][k]));
+
+      DBL worst = 0;
+      welch_ref(stored[c], PSD_RUN, ref);
+      for (UINT i = 0; i <= PSD_SEGMENT / 2; i++)
+         worst = MAX(worst, fabs(psd[c][i] - ref[i]));
+      CHECK(worst < 1e-9 * psd[c][k], "%.1f Hz: off the direct Welch estimate by %g", hz[c], worst);
+   }
+   set_sim_signal(2, 0, 0);
+   set_sim_signal(1, 0, 0);
+}
+
+static void noise_floor(void)
+{
+   const ChannelMap *map = ctx->active_map;
+   const DBL sigma = 0.01; // volts, the simulator noise has unit variance times this
+
+   CHECK(configure_simulator(0.0, sigma, 7, 0, 0, FALSE) == CFG_SUCCESS, "noisy simulator");
+   capture();
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      DBL g = sigma / (map->sensitivity[c] / 1000);
+      DBL want = g * g / (PSD_FREQ / 2), mean = 0;
+      for (UINT k = 1; k < PSD_SEGMENT / 2; k++)
+         mean += psd[c][k];
+      mean /= PSD_SEGMENT / 2 - 1;
+      CHECK(fabs(mean / want - 1) < 0.05, "channel %u: noise density %g, want %g", c, mean, want);
+   }
+   configure_simulator(0.0, 0.0, 1, 0, 0, FALSE);
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.0);
+   CHECK(configure_simulator(0.0, 0.0, 1, 0, 0, FALSE) == CFG_SUCCESS, "simulator without the D/A loop");
+   for (UINT p = 0; p < NUM_CHANNELS; p++)
+      set_sim_signal(p, 0, 0);
+
+   CHECK(set_psd(100, 0.5) == CFG_FAILURE && set_psd(PSD_SEGMENT, 0.95) == CFG_FAILURE, "bad segment or overlap");
+   tones();
+   noise_floor();
+   return test_done("test_psd");
+}
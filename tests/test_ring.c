@@ -0,0 +1,125 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Conversion worker hand-off. A 50 kHz x 4 channel capture on the real
+    time simulator, which hands over buffers on its clock whether or not
+    the worker has caught up, must keep every buffer for several seconds,
+    and a buffer that finds the ring full must stop the run with
+    STOP_REASON_OVERRUN. The ring is sized per run to the driver queue. A
+    run that overruns must keep only the frames ahead of the first lost
+    buffer, so the stored samples stay on the simulator's sine at their
+    frame index.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define STRESS_FREQ 50000.0f
+#define STRESS_FRAMES 400000UL // 8 s of data
+
+static void stress(void)
+{
+   ChannelView views[NUM_VIEWS];
+
+   /* real time and no flow control: the A/D never waits for the worker */
+   CHECK(configure_simulator(1.0, 0.001, 1, 0, 0, TRUE) == CFG_SUCCESS, "real time simulator");
+   set_sim_flow_control(FALSE);
+   CHECK(set_capture_frames(STRESS_FRAMES) == CFG_SUCCESS, "frame count");
+   DBL t0 = monotonic_seconds();
+   int rc = measure(FALSE, 4, STRESS_FREQ, 1, 1, 1, 1, 1, TRUE, 10);
+   DBL seconds = monotonic_seconds() - t0;
+   CHECK(rc == CFG_SUCCESS, "measure returned %d", rc);
+   CHECK(seconds > 0.9 * STRESS_FRAMES / STRESS_FREQ, "ran in %.2f s, not in real time", seconds);
+   CHECK(get_stop_reason() == STOP_REASON_SAMPLE_COUNT, "stop reason %d", get_stop_reason());
+   CHECK(get_dropped_buffers() == 0, "%lu buffers dropped", get_dropped_buffers());
+   CHECK(get_channel_views(views) == CFG_SUCCESS, "views");
+   for (int i = 0; i < NUM_CHANNELS; i++)
+      CHECK(views[i].count == STRESS_FRAMES, "channel %d holds %lu frames", i, (ULNG)views[i].count);
+   /* the ring covers the whole driver queue */
+   UINT slots = ctx->raw_ring->slots;
+   CHECK(slots >= get_buffer_pool().buffers && slots / 2 < get_buffer_pool().buffers && (slots & (slots - 1)) == 0,
+         "%u ring slots for %u driver buffers", slots, get_buffer_pool().buffers);
+   printf("%lu frames x 4 channels at %.0f Hz in %.2f s, %lu buffers dropped\n", STRESS_FRAMES,
+          STRESS_FREQ, seconds, get_dropped_buffers());
+   set_capture_frames(0);
+   cleanup_data();
+}
+
+static void full_ring(void)
+{
+   RawRing ring = {0};
+
+   schedule_begin();
+   ring.slots = 8;
+   atomic_store(&ring.head, 8);
+   atomic_store(&ring.tail, 0);
+   CHECK(!ring_push(&ring, NULL, 0), "push into a full ring");
+   CHECK(ring.dropped_buffers == 1, "%lu dropped", ring.dropped_buffers);
+   CHECK(get_stop_reason() == STOP_REASON_OVERRUN, "stop reason %d", get_stop_reason());
+   CHECK(atomic_load(&ring.head) == 8, "head moved");
+}
+
+#define TONE_HZ 37.0
+
+static void slow_consumer(DBL *const channel[NUM_CHANNELS], UINT frames, ULNG first_frame, ULNG sequence, void *user)
+{
+   (void)channel, (void)frames, (void)first_frame, (void)sequence, (void)user;
+   sleep_ms(200); // far slower than the buffers arrive
+}
+
+/* Worst deviation of a channel from the least-squares fit of the tone at its frame
+   index, relative to the fitted amplitude */
+static DBL tone_residual(const DBL *x, ULNG n, DBL rate)
+{
+   DBL xs = 0, ss = 0, worst = 0;
+
+   for (ULNG i = 0; i < n; i++)
+   {
+      DBL s = sin(2 * M_PI * TONE_HZ * i / rate);
+      xs += x[i] * s;
+      ss += s * s;
+   }
+   DBL a = xs / ss;
+   for (ULNG i = 0; i < n; i++)
+      worst = MAX(worst, fabs(x[i] - a * sin(2 * M_PI * TONE_HZ * i / rate)));
+   return worst / fabs(a);
+}
+
+static void overrun_gap(void)
+{
+   const DBL rate = 20000.0;
+   ChannelView views[NUM_VIEWS];
+
+   CHECK(configure_simulator(1.0, 0.0, 1, 0, 0, FALSE) == CFG_SUCCESS, "real time simulator");
+   for (int ch = 0; ch < 3; ch++)
+      set_sim_signal(ch, 1.0, TONE_HZ);
+   set_subscription(slow_consumer, NULL, FALSE);
+   set_capture_frames((ULNG)(5 * rate));
+   int rc = measure(FALSE, 4, (float)rate, 1, 1, 1, 1, 1, TRUE, 5);
+   set_subscription(NULL, NULL, FALSE);
+   set_capture_frames(0);
+
+   CHECK(rc == CFG_SUCCESS, "measure returned %d", rc);
+   CHECK(get_stop_reason() == STOP_REASON_OVERRUN, "stop reason %d", get_stop_reason());
+   CHECK(get_dropped_buffers() > 0, "nothing dropped");
+   CHECK(get_channel_views(views) == CFG_SUCCESS, "views");
+   ULNG n = views[0].count;
+   CHECK(n > 0 && n < (ULNG)(5 * rate), "%lu frames kept", n);
+   for (int c = 0; c < 3; c++)
+   {
+      DBL r = tone_residual(views[c].data, n, rate);
+      CHECK(r < 1e-3, "channel %d leaves the tone by %.3g of its amplitude", c, r);
+   }
+   printf("overrun after %lu frames, %lu buffers dropped\n", n, get_dropped_buffers());
+   cleanup_data();
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.001);
+   stress();
+   full_ring();
+   overrun_gap();
+   deinit_board();
+   return test_done("test_ring");
+}
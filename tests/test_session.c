@@ -0,0 +1,175 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Acquisition sessions on the simulator, with the backend wrapped to
+    count the calls that configure the A/D. Repeated captures in a session
+    write the channel list and clock only for the first capture and when
+    the clock or a gain changes (and then only the part that changed),
+    allocate driver buffers only when the pool plan no longer fits them,
+    keep the same capture storage, and store the same frames as a one-shot
+    measure() with the same settings.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define SESSION_FRAMES 12000UL
+
+typedef struct {
+   ULNG channel_lists, clocks, configs, allocs, frees, subsystems;
+} BackendCalls;
+
+static DaqBackend counting;
+static BackendCalls calls;
+
+static ECODE count_channel_list_size(HDASS hDass_v, UINT size)
+{
+   calls.channel_lists++;
+   return sim_backend.SetChannelListSize(hDass_v, size);
+}
+
+static ECODE count_clock(HDASS hDass_v, DBL freq)
+{
+   calls.clocks++;
+   return sim_backend.SetClockFrequency(hDass_v, freq);
+}
+
+static ECODE count_config(HDASS hDass_v)
+{
+   calls.configs++;
+   return sim_backend.Config(hDass_v);
+}
+
+static ECODE count_alloc(UINT flags, UINT ex_flags, ULNG samples, UINT sample_size, HBUF *hBuf_p)
+{
+   calls.allocs++;
+   return sim_backend.DmCallocBuffer(flags, ex_flags, samples, sample_size, hBuf_p);
+}
+
+static ECODE count_free(HBUF hBuf_v)
+{
+   calls.frees++;
+   return sim_backend.DmFreeBuffer(hBuf_v);
+}
+
+static ECODE count_subsystem(HDEV hDev_v, UINT type, UINT element, HDASS *hDass_p)
+{
+   calls.subsystems++;
+   return sim_backend.GetDASS(hDev_v, type, element, hDass_p);
+}
+
+typedef struct {
+   const char *name;
+   float freq;
+   int gain[NUM_CHANNELS];
+} Settings;
+
+static const Settings settings[] = {
+   {"10 kHz", 10000.0f, {1, 1, 1, 1}},
+   {"20 kHz", 20000.0f, {1, 1, 1, 1}},
+   {"20 kHz, input 2 at gain 10", 20000.0f, {1, 1, 10, 1}},
+};
+#define SETTINGS (sizeof(settings) / sizeof(settings[0]))
+
+static DBL *reference[SETTINGS][NUM_CHANNELS];
+
+static int capture(const Settings *s)
+{
+   set_capture_frames(SESSION_FRAMES);
+   return measure(FALSE, NUM_CHANNELS, s->freq, 1, s->gain[0], s->gain[1], s->gain[2], s->gain[3], TRUE, 5);
+}
+
+/* One-shot captures of each setting, kept as the reference */
+static void one_shot(void)
+{
+   ChannelView views[NUM_VIEWS];
+
+   for (UINT i = 0; i < SETTINGS; i++)
+   {
+      CHECK(capture(&settings[i]) == CFG_SUCCESS, "%s: one-shot measure", settings[i].name);
+      get_channel_views(views);
+      for (UINT c = 0; c < NUM_CHANNELS; c++)
+      {
+         reference[i][c] = calloc(SESSION_FRAMES, sizeof(DBL));
+         CHECK(views[c].count == SESSION_FRAMES, "%s: channel %u holds %u frames", settings[i].name, c, views[c].count);
+         memcpy(reference[i][c], views[c].data, MIN((ULNG)views[c].count, SESSION_FRAMES) * sizeof(DBL));
+      }
+      cleanup_data();
+   }
+}
+
+/* A capture in the session: the calls it made and the data it stored */
+static void session_capture(UINT s, const BackendCalls *want, const char *what)
+{
+   ChannelView views[NUM_VIEWS];
+   static DBL *storage[NUM_CHANNELS];
+
+   memset(&calls, 0, sizeof(calls));
+   ArenaInfo before = get_capture_arena();
+   CHECK(capture(&settings[s]) == CFG_SUCCESS, "%s (%s): measure", settings[s].name, what);
+   ArenaInfo after = get_capture_arena();
+   printf("%s (%s): %lu channel lists, %lu clocks, %lu configs, %lu buffers allocated\n", settings[s].name, what,
+          calls.channel_lists, calls.clocks, calls.configs, calls.allocs);
+   CHECK(calls.channel_lists == want->channel_lists && calls.clocks == want->clocks && calls.configs == want->configs,
+         "%s (%s): wrote %lu channel lists, %lu clocks, %lu configs, want %lu, %lu, %lu", settings[s].name, what,
+         calls.channel_lists, calls.clocks, calls.configs, want->channel_lists, want->clocks, want->configs);
+   CHECK(calls.subsystems == 0, "%s (%s): took the subsystem %lu times", settings[s].name, what, calls.subsystems);
+   if (want->allocs == 0)
+      CHECK(calls.allocs == 0 && calls.frees == 0, "%s (%s): %lu driver buffers allocated, %lu freed",
+            settings[s].name, what, calls.allocs, calls.frees);
+
+   /* the storage is reused, not reserved or committed again */
+   get_channel_views(views);
+   CHECK(after.reservations == before.reservations, "%s (%s): storage reserved again", settings[s].name, what);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      if (storage[c] != NULL && want->allocs == 0)
+         CHECK(views[c].data == storage[c], "%s (%s): channel %u moved", settings[s].name, what, c);
+      storage[c] = views[c].data;
+      CHECK(views[c].count == SESSION_FRAMES &&
+               memcmp(views[c].data, reference[s][c], SESSION_FRAMES * sizeof(DBL)) == 0,
+            "%s (%s): channel %u differs from the one-shot capture", settings[s].name, what, c);
+   }
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.001);
+   counting = sim_backend;
+   counting.SetChannelListSize = count_channel_list_size;
+   counting.SetClockFrequency = count_clock;
+   counting.Config = count_config;
+   counting.DmCallocBuffer = count_alloc;
+   counting.DmFreeBuffer = count_free;
+   counting.GetDASS = count_subsystem;
+   daq = &counting;
+
+   one_shot();
+
+   const BackendCalls first = {1, 1, 1, 1}, same = {0}, clock = {0, 1, 1, 1}, gain = {1, 0, 1, 0};
+   CHECK(session_open() == CFG_SUCCESS, "session_open");
+   session_capture(0, &first, "first");
+   for (UINT i = 0; i < 3; i++)
+      session_capture(0, &same, "again");
+   session_capture(1, &clock, "clock changed");
+   session_capture(1, &same, "again");
+   session_capture(2, &gain, "gain changed");
+   session_capture(2, &same, "again");
+
+   SessionInfo info = get_session_info();
+   CHECK(info.open && info.captures == 8 && info.reconfigures == 3, "%lu captures, %lu reconfigures", info.captures,
+         info.reconfigures);
+   CHECK(info.reallocations >= 1 && info.reallocations <= 2, "%lu reallocations", info.reallocations);
+   memset(&calls, 0, sizeof(calls));
+   CHECK(session_close() == CFG_SUCCESS, "session_close");
+   CHECK(calls.frees > 0, "session_close freed no driver buffers");
+   cleanup_data();
+
+   daq = &sim_backend;
+   for (UINT i = 0; i < SETTINGS; i++)
+      for (UINT c = 0; c < NUM_CHANNELS; c++)
+         free(reference[i][c]);
+   set_capture_frames(0);
+   deinit_board();
+   return test_done("test_session");
+}
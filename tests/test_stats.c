@@ -0,0 +1,163 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Channel statistics. After a run, get_channel_stats() matches the
+    statistics computed directly from the stored views and
+    get_window_stats() those of the last window_seconds of frames (of the
+    newest whole segments when the run ends inside one). During a long run
+    at full speed, snapshots taken from the main thread while the
+    conversion thread updates the statistics are each consistent: every
+    channel has the same count and the run and window summaries match the
+    frames stored up to that count.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define STATS_FREQ 10000.0f
+#define STATS_WINDOW 0.16         // seconds: segments of 100 frames at STATS_FREQ
+#define STATS_LIVE_FRAMES 400000UL
+#define STATS_SNAPSHOTS 2000
+
+/* Statistics of frames [first, last) computed directly */
+static void direct(const DBL *x, ULNG first, ULNG last, ChannelStats *out)
+{
+   StatsAccum a = {last - first, 0, 0, x[first], x[first]};
+
+   for (ULNG i = first; i < last; i++)
+   {
+      a.mean += x[i];
+      a.min = MIN(a.min, x[i]);
+      a.max = MAX(a.max, x[i]);
+   }
+   a.mean /= a.count;
+   for (ULNG i = first; i < last; i++)
+      a.m2 += (x[i] - a.mean) * (x[i] - a.mean);
+   stats_report(&a, out);
+}
+
+static bool same_stats(const ChannelStats *got, const ChannelStats *want)
+{
+   const DBL tol = 1e-9 * MAX(want->peak, 1e-3);
+
+   return got->count == want->count && got->min == want->min && got->max == want->max && got->peak == want->peak &&
+          fabs(got->mean - want->mean) <= tol && fabs(got->std - want->std) <= tol &&
+          fabs(got->rms - want->rms) <= tol && fabs(got->crest - want->crest) <= 1e-9 * want->crest;
+}
+
+static void signals(void)
+{
+   set_sim_signal(0, 1.0, 50.0);
+   set_sim_signal(1, 0.25, 333.0);
+   set_sim_signal(2, 2.0, 7.0);
+   set_sim_signal(3, 0, 0);
+}
+
+/* Run and window statistics of a finished run of frames frames */
+static void after_run(ULNG frames)
+{
+   ChannelView views[NUM_VIEWS];
+   ChannelStats run[NUM_CHANNELS], window[NUM_CHANNELS], want;
+
+   set_capture_frames(frames);
+   CHECK(measure(FALSE, NUM_CHANNELS, STATS_FREQ, 1, 1, 1, 1, 1, TRUE, 10) == CFG_SUCCESS, "%lu frames: measure",
+         frames);
+   get_channel_views(views);
+   CHECK(get_channel_stats(run) == CFG_SUCCESS, "%lu frames: get_channel_stats", frames);
+   CHECK(get_window_stats(window) == CFG_SUCCESS, "%lu frames: get_window_stats", frames);
+
+   const ULNG segment = (ULNG)(STATS_WINDOW * STATS_FREQ / STATS_SEGMENTS + 0.5);
+   const ULNG end = frames - frames % segment;
+   const ULNG start = end - MIN(end, STATS_SEGMENTS * segment);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      CHECK(views[c].count == frames, "%lu frames: channel %u holds %u", frames, c, views[c].count);
+      direct(views[c].data, 0, frames, &want);
+      CHECK(same_stats(&run[c], &want), "%lu frames: channel %u run mean %.15g std %.15g count %lu, want %.15g %.15g %lu",
+            frames, c, run[c].mean, run[c].std, run[c].count, want.mean, want.std, want.count);
+      direct(views[c].data, start, end, &want);
+      CHECK(same_stats(&window[c], &want),
+            "%lu frames: channel %u window [%lu, %lu) mean %.15g std %.15g count %lu, want %.15g %.15g %lu", frames, c,
+            start, end, window[c].mean, window[c].std, window[c].count, want.mean, want.std, want.count);
+   }
+   printf("%lu frames: window of frames [%lu, %lu), channel 0 rms %.6f crest %.4f\n", frames, start, end, run[0].rms,
+          run[0].crest);
+   cleanup_data();
+}
+
+static ChannelStatsState snaps[STATS_SNAPSHOTS];
+
+/* Snapshots taken while a run goes, checked against the stored frames once it ends */
+static void during_run(void)
+{
+   ChannelView views[NUM_VIEWS];
+   UINT taken = 0, torn = 0, wrong = 0;
+   ULNG last = 0;
+
+   set_capture_frames(STATS_LIVE_FRAMES);
+   CHECK(measure_async(FALSE, NUM_CHANNELS, STATS_FREQ, 1, 1, 1, 1, 1, TRUE, 60) == CFG_SUCCESS, "measure_async");
+   while (measure_wait(0) == ERR_PENDING)
+   {
+      if (taken == STATS_SNAPSHOTS)
+         continue;
+      stats_snapshot(&snaps[taken]);
+      if (snaps[taken].run[0].count != last && snaps[taken].run[0].count > 0)
+         last = snaps[taken++].run[0].count;
+   }
+   get_channel_views(views);
+   CHECK(views[0].count == STATS_LIVE_FRAMES, "live run: %u frames", views[0].count);
+
+   for (UINT s = 0; s < taken; s++)
+   {
+      const ChannelStatsState *snap = &snaps[s];
+      const ULNG count = snap->run[0].count;
+      BOOL consistent = count <= views[0].count &&
+                        count == snap->segments * snap->segment_frames + snap->current[0].count;
+      for (UINT c = 1; c < NUM_CHANNELS; c++)
+         consistent = consistent && snap->run[c].count == count && snap->current[c].count == snap->current[0].count;
+      if (!consistent)
+      {
+         torn++;
+         continue;
+      }
+
+      const ULNG end = snap->segments * snap->segment_frames;
+      const ULNG first = (snap->segments > STATS_SEGMENTS) ? snap->segments - STATS_SEGMENTS : 0;
+      for (UINT c = 0; c < NUM_CHANNELS; c++)
+      {
+         ChannelStats got, want;
+         StatsAccum window = {0};
+         stats_report(&snap->run[c], &got);
+         direct(views[c].data, 0, count, &want);
+         BOOL ok = same_stats(&got, &want);
+         for (ULNG k = first; k < snap->segments; k++)
+            stats_merge(&window, &snap->segment[k % STATS_SEGMENTS][c]);
+         if (end > 0)
+         {
+            stats_report(&window, &got);
+            direct(views[c].data, first * snap->segment_frames, end, &want);
+            ok = ok && same_stats(&got, &want);
+         }
+         wrong += !ok;
+      }
+   }
+   printf("live run: %u snapshots up to frame %lu, %u torn, %u channel summaries wrong\n", taken, last, torn, wrong);
+   CHECK(taken >= 10, "only %u snapshots during the run", taken);
+   CHECK(torn == 0 && wrong == 0, "%u torn snapshots, %u wrong channel summaries", torn, wrong);
+   cleanup_data();
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.01);
+   signals();
+   CHECK(set_stats_window(STATS_WINDOW) == CFG_SUCCESS, "set_stats_window");
+   after_run(12000);  // ends on a segment boundary: the last window_seconds
+   after_run(12345);  // ends inside a segment
+   after_run(1050);   // the first window has not filled
+   during_run();
+   set_stats_window(0);
+   set_capture_frames(0);
+   deinit_board();
+   return test_done("test_stats");
+}
@@ -0,0 +1,241 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    How runs stop. A set_capture_frames() count and a timer each store
+    exactly the frames asked for, whether or not the count falls on a
+    buffer boundary, and report STOP_REASON_SAMPLE_COUNT or
+    STOP_REASON_TIMER. Every other way out of a run reports its own
+    reason: a key on the console (KEY), measure_stop() (USER, with NONE
+    while the run is going), the driver's queue running out (QUEUE_DONE),
+    an input overrun (OVERRUN) and a trigger error (TRIGGER_ERROR), each
+    keeping the whole buffers delivered before it. A streamed output ends
+    on its timer (TIMER), when its producer runs out (OUTPUT_DONE) or when
+    the D/A runs dry (UNDERRUN). No path reports STOP_REASON_ERROR.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define STOP_FREQ 10000.0f
+#define STOP_AFTER 4 // buffers before the simulated error
+
+static ULNG buffer_frames(DBL freq)
+{
+   pool_plan(freq, NUM_CHANNELS);
+   return ctx->pool->buffer_samples / NUM_CHANNELS;
+}
+
+/* Frames stored by the last run, the same on every channel */
+static ULNG stored(void)
+{
+   ChannelView views[NUM_VIEWS];
+
+   get_channel_views(views);
+   for (UINT c = 1; c < NUM_CHANNELS; c++)
+      CHECK(views[c].count == views[0].count, "channel %u holds %u frames, channel 0 %u", c, views[c].count,
+            views[0].count);
+   return views[0].count;
+}
+
+static void check_run(const char *what, int rc, int reason, ULNG frames)
+{
+   ULNG got = stored();
+
+   CHECK(rc == CFG_SUCCESS, "%s: measure returned %d", what, rc);
+   CHECK(get_stop_reason() == reason, "%s: stop reason %d, want %d", what, get_stop_reason(), reason);
+   CHECK(got == frames, "%s: %lu frames stored, want %lu", what, got, frames);
+   /* the buffer holding the last frame is trimmed, not stored until the storage is full */
+   CHECK(get_pipeline_counters().frames_dropped == 0, "%s: %lu frames dropped", what,
+         get_pipeline_counters().frames_dropped);
+   cleanup_data();
+}
+
+static void frame_count(void)
+{
+   const ULNG bf = buffer_frames(STOP_FREQ);
+   const ULNG counts[] = {bf, 7 * bf, 7 * bf + 1, 7 * bf - 1, bf / 2, 12345};
+   char what[64];
+
+   for (UINT i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+   {
+      snprintf(what, sizeof(what), "%lu frames (%s)", counts[i], (counts[i] % bf == 0) ? "aligned" : "not aligned");
+      set_capture_frames(counts[i]);
+      check_run(what, measure(FALSE, NUM_CHANNELS, STOP_FREQ, 1, 1, 1, 1, 1, TRUE, 10), STOP_REASON_SAMPLE_COUNT,
+                counts[i]);
+   }
+   set_capture_frames(0);
+}
+
+static void timer(void)
+{
+   /* one second at these clocks ends on and off a buffer boundary */
+   static const float freqs[] = {10000.0f, 10007.0f};
+   char what[64];
+
+   for (UINT i = 0; i < 2; i++)
+   {
+      const ULNG bf = buffer_frames(freqs[i]), frames = (ULNG)freqs[i];
+      CHECK((frames % bf == 0) == (i == 0), "%g Hz: %lu frames in buffers of %lu", freqs[i], frames, bf);
+      snprintf(what, sizeof(what), "timer at %g Hz", freqs[i]);
+      check_run(what, measure(FALSE, NUM_CHANNELS, freqs[i], 1, 1, 1, 1, 1, TRUE, 1), STOP_REASON_TIMER, frames);
+   }
+}
+
+/* The simulator's overrun and queue done errors after STOP_AFTER buffers */
+static void driver_errors(void)
+{
+   const ULNG bf = buffer_frames(STOP_FREQ);
+
+   set_capture_frames(100 * bf);
+   configure_simulator(0.0, 0.001, 1, STOP_AFTER, 0, TRUE);
+   check_run("overrun", measure(FALSE, NUM_CHANNELS, STOP_FREQ, 1, 1, 1, 1, 1, TRUE, 200), STOP_REASON_OVERRUN,
+             (STOP_AFTER - 1) * bf);
+   configure_simulator(0.0, 0.001, 1, 0, STOP_AFTER, TRUE);
+   check_run("queue done", measure(FALSE, NUM_CHANNELS, STOP_FREQ, 1, 1, 1, 1, 1, TRUE, 200), STOP_REASON_QUEUE_DONE,
+             (STOP_AFTER - 1) * bf);
+   configure_simulator(0.0, 0.001, 1, 0, 0, TRUE);
+   set_capture_frames(0);
+}
+
+/* The simulator has no trigger hardware: the error is posted from a pump */
+static DaqBackend trigger_error_backend;
+static UINT pumps;
+
+static BOOL pump_then_trigger_error(HWND hWnd_v, UINT timeout_ms)
+{
+   BOOL running = sim_backend.Pump(hWnd_v, timeout_ms);
+   if (running && ++pumps == STOP_AFTER)
+      daq_event(ctx->hAD, OLDA_WM_TRIGGER_ERROR);
+   return running;
+}
+
+static void trigger_error(void)
+{
+   const ULNG bf = buffer_frames(STOP_FREQ);
+
+   trigger_error_backend = sim_backend;
+   trigger_error_backend.Pump = pump_then_trigger_error;
+   daq = &trigger_error_backend;
+   configure_simulator(1.0, 0.001, 1, 0, 0, TRUE);
+   set_sim_flow_control(FALSE);
+   set_capture_frames(100 * bf);
+   int rc = measure(FALSE, NUM_CHANNELS, STOP_FREQ, 1, 1, 1, 1, 1, TRUE, 20);
+   ULNG got = stored();
+   CHECK(rc == CFG_SUCCESS && get_stop_reason() == STOP_REASON_TRIGGER_ERROR, "trigger error: rc %d, stop reason %d",
+         rc, get_stop_reason());
+   CHECK(got < 100 * bf && got % bf == 0, "trigger error: %lu frames stored in buffers of %lu", got, bf);
+   cleanup_data();
+   daq = &sim_backend;
+   set_capture_frames(0);
+}
+
+/* A key on the console stops an untimed run */
+static void key(void)
+{
+   int master = posix_openpt(O_RDWR | O_NOCTTY);
+   int saved = dup(STDIN_FILENO);
+   int slave = -1;
+
+   if (master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0)
+      slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+   CHECK(slave >= 0 && saved >= 0, "pseudo terminal");
+   if (slave < 0 || saved < 0)
+      return;
+   dup2(slave, STDIN_FILENO);
+   CHECK(write(master, "\n", 1) == 1, "key press");
+
+   configure_simulator(1.0, 0.001, 1, 0, 0, TRUE);
+   set_sim_flow_control(FALSE);
+   int rc = measure(FALSE, NUM_CHANNELS, STOP_FREQ, 1, 1, 1, 1, 1, FALSE, 0);
+   CHECK(rc == CFG_SUCCESS && get_stop_reason() == STOP_REASON_KEY, "key: rc %d, stop reason %d", rc,
+         get_stop_reason());
+   CHECK(get_run_seconds() < 1.0, "key: ran %.2f s", get_run_seconds());
+   stored();
+   cleanup_data();
+
+   dup2(saved, STDIN_FILENO);
+   close(saved);
+   close(slave);
+   close(master);
+}
+
+/* measure_stop() from another thread; NONE while the run goes */
+static void user(void)
+{
+   configure_simulator(1.0, 0.001, 1, 0, 0, TRUE);
+   set_sim_flow_control(FALSE);
+   CHECK(measure_async(FALSE, NUM_CHANNELS, STOP_FREQ, 1, 1, 1, 1, 1, TRUE, 10) == CFG_SUCCESS, "measure_async");
+   sleep_ms(300);
+   CHECK(measure_wait(0) == ERR_PENDING && get_stop_reason() == STOP_REASON_NONE, "running: stop reason %d",
+         get_stop_reason());
+   measure_stop();
+   int rc = measure_wait(5000);
+   CHECK(rc == CFG_SUCCESS && get_stop_reason() == STOP_REASON_USER, "user: rc %d, stop reason %d", rc,
+         get_stop_reason());
+   CHECK(get_run_seconds() < 2.0, "user: ran %.2f s", get_run_seconds());
+   stored();
+   cleanup_data();
+}
+
+static ULNG produced_limit;
+static UINT produced_calls, slow_call;
+
+static UINT producer(DBL *volts, UINT count, ULNG first_sample, void *user)
+{
+   (void)user;
+   if (++produced_calls == slow_call)
+      sleep_ms(500);
+   if (produced_limit > 0)
+      count = (UINT)MIN((ULNG)count, produced_limit - MIN(first_sample, produced_limit));
+   for (UINT i = 0; i < count; i++)
+      volts[i] = sin(2 * M_PI * 50.0 * (first_sample + i) / STOP_FREQ);
+   return count;
+}
+
+static void output(void)
+{
+   set_output_stream(TRUE, producer, NULL, NULL);
+
+   configure_simulator(0.0, 0.0, 1, 0, 0, TRUE);
+   int rc = generate(FALSE, FALSE, STOP_FREQ, 1, 0, 0, TRUE, 1);
+   CHECK(rc == CFG_SUCCESS && get_stop_reason() == STOP_REASON_TIMER, "output timer: rc %d, stop reason %d", rc,
+         get_stop_reason());
+   CHECK(get_output_counters().samples_played == (ULNG)STOP_FREQ, "output timer: %lu samples played",
+         get_output_counters().samples_played);
+
+   produced_limit = 5000;
+   rc = generate(FALSE, FALSE, STOP_FREQ, 1, 0, 0, TRUE, 2);
+   CHECK(rc == CFG_SUCCESS && get_stop_reason() == STOP_REASON_OUTPUT_DONE, "output done: rc %d, stop reason %d", rc,
+         get_stop_reason());
+   CHECK(get_output_counters().samples_played == produced_limit, "output done: %lu samples played",
+         get_output_counters().samples_played);
+   produced_limit = 0;
+
+   /* at real time a producer that stalls lets the D/A run dry */
+   configure_simulator(1.0, 0.0, 1, 0, 0, TRUE);
+   produced_calls = 0;
+   slow_call = OUT_NUM_BUFFERS + 2; // a refill once the D/A is playing
+   rc = generate(FALSE, FALSE, STOP_FREQ, 1, 0, 0, TRUE, 2);
+   CHECK(rc != CFG_SUCCESS && get_stop_reason() == STOP_REASON_UNDERRUN, "underrun: rc %d, stop reason %d", rc,
+         get_stop_reason());
+   slow_call = 0;
+
+   set_output_stream(FALSE, NULL, NULL, NULL);
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.001);
+   CHECK(get_stop_reason() == STOP_REASON_NONE, "stop reason %d before any run", get_stop_reason());
+   frame_count();
+   timer();
+   driver_errors();
+   trigger_error();
+   key();
+   user();
+   output();
+   configure_simulator(0.0, 0.001, 1, 0, 0, TRUE);
+   set_sim_flow_control(TRUE);
+   deinit_board();
+   return test_done("test_stop");
+}
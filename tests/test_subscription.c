@@ -0,0 +1,130 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Live block subscription on the simulator. The callback sees every
+    frame of a run once, in order and identical to the stored capture. A
+    reader that cannot keep up loses the oldest blocks, never the newest:
+    everything it reads matches the stored capture at the block's first
+    frame, sequence numbers only increase, the last blocks of the run are
+    all there, and published = read + dropped.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define SUB_FREQ 20000.0f
+#define SUB_FRAMES 400000UL
+
+static ULNG cb_frames, cb_next, cb_blocks;
+static BOOL cb_in_order = TRUE;
+static DBL cb_sum[NUM_CHANNELS];
+
+static void on_block(DBL *const channel[NUM_CHANNELS], UINT frames, ULNG first_frame, ULNG sequence, void *user)
+{
+   (void)user;
+   if (first_frame != cb_next || sequence != cb_blocks)
+      cb_in_order = FALSE;
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      for (UINT i = 0; i < frames; i++)
+         cb_sum[c] += channel[c][i];
+   }
+   cb_next = first_frame + frames;
+   cb_frames += frames;
+   cb_blocks++;
+}
+
+static void callback(void)
+{
+   ChannelView views[NUM_VIEWS];
+
+   set_subscription(on_block, NULL, FALSE);
+   int rc = measure(FALSE, 4, SUB_FREQ, 1, 1, 1, 1, 1, TRUE, 20);
+   CHECK(rc == CFG_SUCCESS, "measure returned %d", rc);
+   CHECK(get_channel_views(views) == CFG_SUCCESS, "views");
+   CHECK(cb_in_order, "blocks out of order");
+   CHECK(cb_frames == SUB_FRAMES && views[0].count == SUB_FRAMES, "callback saw %lu of %u frames", cb_frames,
+         views[0].count);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      DBL sum = 0;
+      for (UINT i = 0; i < views[c].count; i++)
+         sum += views[c].data[i];
+      CHECK(sum == cb_sum[c], "channel %u: blocks sum to %.17g, storage to %.17g", c, cb_sum[c], sum);
+   }
+   cleanup_data();
+}
+
+static void slow_reader(void)
+{
+   ChannelView views[NUM_VIEWS];
+   DBL *out[NUM_CHANNELS];
+   BlockHeader h;
+   ULNG reads = 0, last_seq = 0, bad = 0, last_end = 0;
+   UINT frames;
+
+   UINT block = get_block_frames(); // same plan as the callback run
+   set_subscription(NULL, NULL, TRUE);
+   CHECK(measure_async(FALSE, 4, SUB_FREQ, 1, 1, 1, 1, 1, TRUE, 20) == CFG_SUCCESS, "measure_async");
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+      out[c] = malloc(block * sizeof(DBL));
+   struct { ULNG first; UINT frames; DBL v[NUM_CHANNELS][64]; } *seen = calloc(SUB_FRAMES, sizeof(*seen));
+
+   for (;;)
+   {
+      BOOL running = measure_wait(0) == ERR_PENDING;
+      while ((frames = read_block(&h, out, block, 10)) > 0)
+      {
+         if (reads > 0 && h.sequence <= last_seq)
+            bad++;
+         last_seq = h.sequence;
+         last_end = h.first_frame + frames;
+         seen[reads].first = h.first_frame;
+         seen[reads].frames = frames;
+         for (UINT c = 0; c < NUM_CHANNELS; c++)
+            memcpy(seen[reads].v[c], out[c], MIN(frames, 64U) * sizeof(DBL));
+         reads++;
+         sleep_ms(1); // far slower than the blocks arrive
+      }
+      if (!running)
+         break;
+   }
+
+   SubscriptionCounters sc = get_subscription_counters();
+   CHECK(get_channel_views(views) == CFG_SUCCESS, "views");
+   CHECK(bad == 0, "%lu blocks out of sequence", bad);
+   CHECK(sc.read == reads && sc.published == sc.read + sc.dropped, "published %lu, read %lu, dropped %lu",
+         sc.published, sc.read, sc.dropped);
+   CHECK(sc.dropped > 0, "the reader kept up, nothing to check");
+   CHECK(last_end == SUB_FRAMES, "the last block read ends at frame %lu", last_end);
+   for (ULNG r = 0; r < reads; r++)
+   {
+      for (UINT c = 0; c < NUM_CHANNELS; c++)
+      {
+         for (UINT i = 0; i < MIN(seen[r].frames, 64U); i++)
+         {
+            if (seen[r].v[c][i] != views[c].data[seen[r].first + i])
+               bad++;
+         }
+      }
+   }
+   CHECK(bad == 0, "%lu samples read differ from the storage", bad);
+   printf("slow reader: %lu blocks published, %lu read, %lu dropped\n", sc.published, sc.read, sc.dropped);
+
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+      free(out[c]);
+   free(seen);
+   cleanup_data();
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.01);
+   set_capture_frames(SUB_FRAMES);
+   callback();
+   slow_reader();
+   set_subscription(NULL, NULL, FALSE);
+   set_capture_frames(0);
+   deinit_board();
+   return test_done("test_subscription");
+}
@@ -0,0 +1,103 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Stimulus/response on the simulator, with the D/A looped back into the
+    DAC input. With a synchronized start the offset get_sync_info() reports
+    is the loopback delay set in the simulator, to a small fraction of a
+    frame, and with a D/A started ahead of the A/D it is the delay less the
+    lead. The loopback FRF is unity with zero phase on the DAC channel, and
+    an accelerometer input playing a tone locked to the stimulus shows the
+    magnitude (g per volt) and the phase lead of the delay at that bin.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define SYNC_FREQ 10240.0f
+#define SYNC_RUN 40960UL
+#define SYNC_SEGMENT 1024 // 10 Hz bins
+#define SYNC_WAVE 160     // Hz, bin 16 and 64 samples per period
+#define SYNC_VOLTS 2
+
+/* One generate() reading input with the PSD and FRF on; the DAC input is output 3 */
+static SyncInfo run(bool synchronized, DBL lead_frames, DBL delay_frames)
+{
+   CHECK(set_sim_timing(lead_frames / SYNC_FREQ, delay_frames / SYNC_FREQ) == CFG_SUCCESS, "simulator timing");
+   set_sync_start(synchronized);
+   set_psd(SYNC_SEGMENT, 0.5);
+   set_frf(TRUE);
+   set_capture_frames(SYNC_RUN);
+   int rc = generate(FALSE, TRUE, SYNC_FREQ, 1, SYNC_VOLTS, SYNC_WAVE, TRUE, 5);
+   CHECK(rc == CFG_SUCCESS, "generate returned %d", rc);
+   return get_sync_info();
+}
+
+static void offsets(void)
+{
+   static const DBL delays[] = {0, 1, 7, 23};
+
+   for (UINT i = 0; i < sizeof(delays) / sizeof(delays[0]); i++)
+   {
+      SyncInfo info = run(TRUE, 0, delays[i]);
+      printf("synchronized, %g frame delay: offset %.4f frames, coherence %.6f, %lu segments\n", delays[i],
+             info.offset_frames, info.coherence, info.segments);
+      CHECK(info.synchronized && info.stimulus_hz == SYNC_WAVE && info.segments > 0, "run not synchronized");
+      CHECK(fabs(info.offset_frames - delays[i]) < 0.01, "%g frame delay: offset %.4f frames", delays[i],
+            info.offset_frames);
+      CHECK(fabs(info.offset_seconds * SYNC_FREQ - info.offset_frames) < 1e-9, "offset in seconds and frames differ");
+      CHECK(info.coherence > 0.999, "%g frame delay: coherence %.6f", delays[i], info.coherence);
+      cleanup_data();
+   }
+
+   /* started separately the D/A runs ahead and the lead shows up in the offset */
+   SyncInfo info = run(FALSE, 5, 12);
+   printf("started separately, 5 frame lead, 12 frame delay: offset %.4f frames\n", info.offset_frames);
+   CHECK(!info.synchronized, "separate start reported as synchronized");
+   CHECK(fabs(info.offset_frames - 7) < 0.01, "offset %.4f frames, want 7", info.offset_frames);
+   cleanup_data();
+}
+
+static void loopback_frf(void)
+{
+   static DBL magnitude[SYNC_SEGMENT / 2 + 1], phase[SYNC_SEGMENT / 2 + 1], coherence[SYNC_SEGMENT / 2 + 1];
+   const UINT bin = SYNC_WAVE * SYNC_SEGMENT / (UINT)SYNC_FREQ;
+   const DBL delay = 9, tone = 0.5; // frames; volts on X, locked to the stimulus
+
+   set_sim_signal(2, tone, SYNC_WAVE); // X, output 0
+   run(TRUE, 0, delay);
+   const ChannelMap *map = ctx->active_map;
+
+   /* the DAC channel against itself */
+   CHECK(get_frf(3, magnitude, phase, coherence, SYNC_SEGMENT / 2 + 1) == SYNC_SEGMENT / 2 + 1, "DAC channel FRF");
+   CHECK(fabs(magnitude[bin] - 1) < 1e-12 && fabs(phase[bin]) < 1e-12 && fabs(coherence[bin] - 1) < 1e-12,
+         "DAC channel: %g at %g rad, coherence %g", magnitude[bin], phase[bin], coherence[bin]);
+
+   /* X plays sin(w t), the loopback sin(w (t - delay)): X leads by w * delay */
+   CHECK(get_frf(0, magnitude, phase, coherence, SYNC_SEGMENT / 2 + 1) == SYNC_SEGMENT / 2 + 1, "X channel FRF");
+   DBL want = tone / (map->sensitivity[0] / 1000) / SYNC_VOLTS, lead = 2 * M_PI * SYNC_WAVE * delay / SYNC_FREQ;
+   printf("X at %u Hz: %.6f g/V at %.5f rad (want %.6f at %.5f), coherence %.6f\n", SYNC_WAVE, magnitude[bin],
+          phase[bin], want, lead, coherence[bin]);
+   CHECK(fabs(magnitude[bin] / want - 1) < 1e-3, "X: %g g/V, want %g", magnitude[bin], want);
+   CHECK(fabs(phase[bin] - lead) < 1e-3, "X: %g rad, want %g", phase[bin], lead);
+   CHECK(coherence[bin] > 0.999, "X: coherence %g", coherence[bin]);
+   cleanup_data();
+   set_sim_signal(2, 0, 0);
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.0);
+   for (UINT p = 0; p < NUM_CHANNELS; p++)
+      set_sim_signal(p, 0, 0);
+   set_waveform(WAVE_SINE, 0, 0);
+
+   offsets();
+   loopback_frf();
+
+   set_waveform(WAVE_SQUARE, 0, 0);
+   set_frf(FALSE);
+   set_psd(0, 0);
+   set_sync_start(FALSE);
+   set_sim_timing(0, 0);
+   return test_done("test_sync");
+}
@@ -0,0 +1,101 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Time base on the real time simulator, at the full rate and decimated.
+    frame_time(n) and get_frame_times() are exactly n / stored rate (the
+    clock over the decimation factor), for small and very large n. Every
+    delivered buffer leaves one anchor: their frame counts step by whole
+    buffers up to the frames delivered and their host times rise, at the
+    board's pace, from the start of the run. frame_host_time() places each
+    frame on its buffer's anchor, one board period per frame before the
+    buffer's last, and frames past the last anchor on the last one.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define TB_FREQ 20000.0f
+#define TB_FRAMES 20000UL // one second at real time
+
+static void run(UINT decimation)
+{
+   ChannelView views[NUM_VIEWS];
+   static DBL times[1000];
+
+   CHECK(set_decimation(decimation, 0) == CFG_SUCCESS, "set_decimation(%u)", decimation);
+   set_capture_frames(TB_FRAMES);
+   DBL before = monotonic_seconds();
+   CHECK(measure(FALSE, NUM_CHANNELS, TB_FREQ, 1, 1, 1, 1, 1, TRUE, 10) == CFG_SUCCESS, "x%u: measure", decimation);
+   DBL after = monotonic_seconds();
+   get_channel_views(views);
+
+   /* stored frame n is n / stored rate seconds after the first */
+   const TimeBase tb = get_time_base();
+   const DBL rate = TB_FREQ / decimation;
+   const ULNG stored = views[0].count;
+   CHECK(tb.rate == rate && tb.decimation == decimation, "x%u: time base at %g Hz, decimation %u", decimation,
+         tb.rate, tb.decimation);
+   static const ULNG frames[] = {0, 1, 2, 3, 999, 4096, TB_FRAMES - 1, 123456789UL, 4000000000UL};
+   for (UINT i = 0; i < sizeof(frames) / sizeof(frames[0]); i++)
+      CHECK(frame_time(frames[i]) == (DBL)frames[i] / rate, "x%u: frame_time(%lu) = %.17g", decimation, frames[i],
+            frame_time(frames[i]));
+   CHECK(get_frame_times(stored - 1000, 1000, times) == CFG_SUCCESS, "x%u: get_frame_times", decimation);
+   for (UINT i = 0; i < 1000; i++)
+      CHECK(times[i] == (DBL)(stored - 1000 + i) / rate, "x%u: time of frame %lu", decimation, stored - 1000 + i);
+
+   /* one anchor per delivered buffer, rising at the board's pace */
+   const ULNG n = tb.anchors;
+   const DBL board_rate = TB_FREQ;
+   const ULNG delivered = ctx->schedule->frames_delivered;
+   BOOL rising = n > 1 && ctx->time_anchor[0].end_frame > 0 && ctx->time_anchor[0].host_seconds >= tb.start_seconds &&
+                 tb.start_seconds >= before && ctx->time_anchor[n - 1].host_seconds <= after;
+   for (ULNG a = 1; a < n; a++)
+   {
+      const TimeAnchor *p = &ctx->time_anchor[a - 1], *q = &ctx->time_anchor[a];
+      rising = rising && q->end_frame > p->end_frame && q->host_seconds > p->host_seconds;
+   }
+   CHECK(rising, "x%u: %lu anchors do not rise from the start of the run", decimation, n);
+   CHECK(n > 1 && ctx->time_anchor[n - 1].end_frame == delivered && delivered >= stored * decimation,
+         "x%u: last anchor at frame %lu, %lu delivered, %lu stored", decimation,
+         (n > 0) ? ctx->time_anchor[n - 1].end_frame : 0, delivered, stored);
+   if (n > 1)
+   {
+      const TimeAnchor *first = &ctx->time_anchor[0], *last = &ctx->time_anchor[n - 1];
+      DBL pace = (last->host_seconds - first->host_seconds) / (last->end_frame - first->end_frame) * board_rate;
+      printf("x%u: %lu stored frames, %lu anchors, host clock runs %.3f board periods per frame\n", decimation, stored,
+             n, pace);
+      CHECK(pace > 0.9 && pace < 1.1, "x%u: anchors advance %.3f board periods per frame", decimation, pace);
+   }
+
+   /* every frame is placed on the anchor of the buffer that delivered it */
+   ULNG wrong = 0, a = 0;
+   for (ULNG f = 0; f < stored + 100; f++)
+   {
+      const ULNG board = f * decimation;
+      while (a + 1 < n && ctx->time_anchor[a].end_frame <= board)
+         a++;
+      const TimeAnchor *anchor = &ctx->time_anchor[a];
+      DBL want = anchor->host_seconds - ((DBL)anchor->end_frame - 1 - (DBL)board) / board_rate;
+      if (frame_host_time(f) != want)
+      {
+         if (wrong++ == 0)
+            printf("x%u: frame %lu at %.9f, want %.9f (anchor %lu)\n", decimation, f, frame_host_time(f), want, a);
+      }
+   }
+   CHECK(wrong == 0, "x%u: %lu frames placed off their buffer's anchor", decimation, wrong);
+   for (ULNG k = 0; k < n; k++)
+      CHECK(frame_host_time((ctx->time_anchor[k].end_frame - 1) / decimation) <= ctx->time_anchor[k].host_seconds,
+            "x%u: a frame of buffer %lu placed after the buffer arrived", decimation, k);
+   cleanup_data();
+}
+
+int main(void)
+{
+   test_open_sim(0, 1.0, 0.001);
+   run(1);
+   run(4);
+   set_decimation(1, 0);
+   set_capture_frames(0);
+   deinit_board();
+   return test_done("test_timebase");
+}
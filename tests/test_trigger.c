@@ -0,0 +1,152 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    Event capture on the simulator. A run with a trigger is compared with
+    the same run stored in full: every window starts exactly pre_frames
+    before the frame that fired (fewer only at the start of the run), the
+    first post-trigger frame is the first one past the level, the window
+    holds the frames of the full run from there on, and events, misses
+    and storage offsets follow the hysteresis and max_events rules. The
+    rules are checked rising, falling, without history and after
+    decimation.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define TRIG_FREQ 10000.0f
+#define TRIG_RUN 20000UL
+
+typedef struct {
+   const char *name;
+   int mode;
+   UINT channel;
+   DBL level;      // fraction of the channel's peak
+   DBL hysteresis; // fraction of the channel's peak
+   UINT pre, post, max_events, factor;
+} TriggerCase;
+
+static const TriggerCase cases[] = {
+   {"rising", TRIG_RISING, 0, 0.5, 0.1, 64, 100, 40, 1},
+   {"falling, no history", TRIG_FALLING, 1, -0.3, 0.05, 0, 50, 1000, 1},
+   {"above, decimated by 4", TRIG_ABOVE, 0, 0.9, 0.2, 10, 30, 1000, 4},
+};
+
+/* Stores a run and returns its frames of every channel */
+static ULNG capture(UINT factor, DBL *copy[NUM_CHANNELS], ULNG max)
+{
+   ChannelView views[NUM_VIEWS];
+
+   set_decimation(factor, 0);
+   set_capture_frames(TRIG_RUN);
+   int rc = measure(FALSE, NUM_CHANNELS, TRIG_FREQ, 1, 1, 1, 1, 1, TRUE, 5);
+   CHECK(rc == CFG_SUCCESS, "measure returned %d", rc);
+   get_channel_views(views);
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+      memcpy(copy[c], views[c].data, MIN(views[c].count, max) * sizeof(DBL));
+   ULNG count = views[0].count;
+   cleanup_data();
+   set_decimation(1, 0);
+   return count;
+}
+
+static void check_case(const TriggerCase *tc)
+{
+   DBL *full[NUM_CHANNELS], *trig[NUM_CHANNELS];
+   TriggerEvent *events = calloc(tc->max_events, sizeof(TriggerEvent));
+
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      full[c] = malloc(TRIG_RUN * sizeof(DBL));
+      trig[c] = malloc(TRIG_RUN * sizeof(DBL));
+   }
+
+   set_trigger(TRIG_OFF, 0, 0, 0, 0, 0, 0);
+   ULNG n = capture(tc->factor, full, TRIG_RUN);
+   const DBL *x = full[tc->channel];
+   DBL peak = 0;
+   for (ULNG i = 0; i < n; i++)
+      peak = MAX(peak, fabs(x[i]));
+   const DBL level = tc->level * peak, hysteresis = tc->hysteresis * peak;
+
+   CHECK(set_trigger(tc->mode, tc->channel, level, hysteresis, tc->pre, tc->post, tc->max_events) == CFG_SUCCESS,
+         "%s: set_trigger", tc->name);
+   ULNG stored = capture(tc->factor, trig, TRIG_RUN);
+   UINT got = get_trigger_events(events, tc->max_events);
+   TriggerCounters counters = get_trigger_counters();
+   set_trigger(TRIG_OFF, 0, 0, 0, 0, 0, 0);
+
+   /* the windows expected from the full run */
+   BOOL armed = FALSE;
+   ULNG window_end = 0, offset = 0, missed = 0;
+   UINT k = 0;
+   for (ULNG i = 0; i < n; i++)
+   {
+      DBL v = (tc->mode == TRIG_ABOVE) ? fabs(x[i]) : x[i];
+      BOOL fire = (tc->mode == TRIG_FALLING) ? v <= level : v >= level;
+      BOOL rearm = (tc->mode == TRIG_FALLING) ? v > level + hysteresis : v < level - hysteresis;
+      if (!armed)
+      {
+         armed = rearm;
+         continue;
+      }
+      if (!fire)
+         continue;
+      armed = FALSE;
+      if (i < window_end || k >= tc->max_events)
+      {
+         missed++;
+         continue;
+      }
+
+      ULNG pre = MIN((ULNG)tc->pre, i), frames = MIN(pre + tc->post, n - (i - pre));
+      if (k < got)
+      {
+         const TriggerEvent *e = &events[k];
+         CHECK(e->trigger_frame == i, "%s: event %u fired at %lu, want %lu", tc->name, k, e->trigger_frame, i);
+         CHECK(e->trigger_frame - e->first_frame == pre, "%s: event %u keeps %lu pre-trigger frames, want %lu",
+               tc->name, k, e->trigger_frame - e->first_frame, pre);
+         CHECK(e->offset == offset && e->frames == frames, "%s: event %u at %lu with %u frames, want %lu with %lu",
+               tc->name, k, e->offset, e->frames, offset, frames);
+         if (e->trigger_frame == i && e->offset + frames <= stored)
+         {
+            /* the first post-trigger frame is the one past the level, the one before is not */
+            DBL first = trig[tc->channel][offset + pre];
+            CHECK(first == x[i], "%s: event %u: first post-trigger frame %g, want %g", tc->name, k, first, x[i]);
+            for (UINT c = 0; c < NUM_CHANNELS; c++)
+               CHECK(memcmp(trig[c] + offset, full[c] + (i - pre), frames * sizeof(DBL)) == 0,
+                     "%s: event %u: channel %u window differs from the full run", tc->name, k, c);
+         }
+      }
+      offset += frames;
+      window_end = i + tc->post;
+      k++;
+   }
+   printf("%s: %u events, %lu missed, %lu frames stored of %lu\n", tc->name, got, counters.missed, stored, n);
+   CHECK(got == k && counters.events == k && counters.missed == missed, "%s: %u events and %lu missed, want %u and %lu",
+         tc->name, got, counters.missed, k, missed);
+   CHECK(stored == offset, "%s: %lu frames stored, want %lu", tc->name, stored, offset);
+   CHECK(k > 3 && (tc->pre == 0 || events[0].trigger_frame > 0), "%s: too few events to check", tc->name);
+
+   for (UINT c = 0; c < NUM_CHANNELS; c++)
+   {
+      free(full[c]);
+      free(trig[c]);
+   }
+   free(events);
+}
+
+int main(void)
+{
+   test_open_sim(0, 0.0, 0.0);
+   CHECK(configure_simulator(0.0, 0.0, 1, 0, 0, FALSE) == CFG_SUCCESS, "simulator without the D/A loop");
+   set_sim_signal(2, 1.0, 50.0); // X, output 0
+   set_sim_signal(1, 0.8, 37.0); // Y, output 1
+
+   CHECK(set_trigger(TRIG_RISING, NUM_CHANNELS, 0, 0, 10, 10, 1) == CFG_FAILURE &&
+            set_trigger(TRIG_RISING, 0, 0, 0, 10, 0, 1) == CFG_FAILURE,
+         "bad channel or no post-trigger frames");
+   for (UINT i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+      check_case(&cases[i]);
+   return test_done("test_trigger");
+}
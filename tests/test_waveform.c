@@ -0,0 +1,157 @@
+/*-----------------------------------------------------------------------
+
+PURPOSE:
+    D/A waveform tables. For square, sine and triangle waves over several
+    clocks and frequencies the table holds a whole number of periods, the
+    frequency produced is within WAVE_FREQ_TOLERANCE of the one asked for,
+    every sample matches the waveform at its phase, and the codes written
+    for the D/A decode to within half a code of the volts with the rounding
+    and clamping of olDaVoltsToCode (the simulator's). A chirp table holds
+    whole cycles so its phase is continuous across the wrap.
+
+****************************************************************************/
+
+#include "test.h"
+
+#define WAVE_AMPLITUDE 3.0
+
+static const DBL clocks[] = {46875.0, 48000.0, 10000.0};
+static const DBL frequencies[] = {10.0, 100.0, 1000.0 / 3, 997.0, 1234.567};
+static const char *const shape_name[] = {"square", "sine", "triangle"};
+
+/* The waveform at phase t (in periods) */
+static DBL wave_ref(int shape, DBL t)
+{
+   switch (shape)
+   {
+   case WAVE_SINE:
+      return WAVE_AMPLITUDE * sin(2 * M_PI * t);
+   case WAVE_TRIANGLE:
+      return WAVE_AMPLITUDE * (1 - 4 * fabs(t - 0.5));
+   default:
+      return (t < 0.5) ? -WAVE_AMPLITUDE : WAVE_AMPLITUDE;
+   }
+}
+
+/* Codes for a +-10 V D/A of the given resolution and encoding decode back to the volts */
+static void check_codes(const char *name, const DBL *volts, UINT n, UINT resolution, UINT encoding)
+{
+   const UINT width = (resolution > 16) ? 4 : 2;
+   const DBL lsb = 20.0 / ldexp(1.0, resolution);
+   void *codes = malloc((size_t)n * width);
+   DBL worst = 0, top = -HUGE_VAL, bottom = HUGE_VAL;
+   UINT mismatched = 0;
+
+   wave_to_codes(volts, n, -10.0, 10.0, resolution, encoding, codes, width);
+   for (UINT i = 0; i < n; i++)
+   {
+      ULNG code = (width > 2) ? ((DWORD *)codes)[i] : ((WORD *)codes)[i], want;
+      DBL v = code_to_volts_ref(-10.0, 10.0, 1, resolution, encoding, code);
+      sim_volts_to_code(-10.0, 10.0, 1, resolution, encoding, volts[i], &want);
+      mismatched += (code != want);
+      worst = MAX(worst, fabs(v - volts[i]));
+      top = MAX(top, v);
+      bottom = MIN(bottom, v);
+   }
+   CHECK(mismatched == 0, "%s, %u bits: %u codes differ from olDaVoltsToCode", name, resolution, mismatched);
+   CHECK(worst <= lsb / 2 * (1 + 1e-9), "%s, %u bits: codes %.3g V off (half a code is %.3g V)", name, resolution,
+         worst, lsb / 2);
+   CHECK(top <= WAVE_AMPLITUDE + lsb && bottom >= -WAVE_AMPLITUDE - lsb, "%s, %u bits: codes span %g to %g V", name,
+         resolution, bottom, top);
+   free(codes);
+}
+
+static void tables(void)
+{
+   WaveSpec spec = {0};
+   WaveInfo info;
+   char name[64];
+   UINT tables = 0;
+
+   for (UINT c = 0; c < sizeof(clocks) / sizeof(clocks[0]); c++)
+   {
+      for (UINT f = 0; f < sizeof(frequencies) / sizeof(frequencies[0]); f++)
+      {
+         for (int shape = WAVE_SQUARE; shape <= WAVE_TRIANGLE; shape++)
+         {
+            const DBL clk = clocks[c], want = frequencies[f];
+            snprintf(name, sizeof(name), "%s %.3f Hz at %.0f Hz", shape_name[shape], want, clk);
+            spec.shape = shape;
+            DBL *volts = wave_synthesize(&spec, clk, WAVE_AMPLITUDE, want, &info);
+            CHECK(volts != NULL, "%s: no table", name);
+            if (volts == NULL)
+               continue;
+            tables++;
+
+            /* period: a whole number of periods at the frequency asked for */
+            DBL cycles = info.samples * info.frequency / clk;
+            CHECK(fabs(cycles - info.periods) < 1e-9 * info.periods, "%s: %.12g periods in the table, not %u", name,
+                  cycles, info.periods);
+            CHECK(fabs(info.frequency - want) < WAVE_FREQ_TOLERANCE * want, "%s: %.9g Hz produced", name,
+                  info.frequency);
+            CHECK(info.samples >= 2 && info.samples <= MAX(WAVE_MAX_SAMPLES, MAX_BUFFER_SIZE), "%s: %u samples", name,
+                  info.samples);
+
+            /* amplitude and shape: each sample is the waveform at its phase */
+            DBL worst = 0, top = 0;
+            for (UINT i = 0; i < info.samples; i++)
+            {
+               DBL t = fmod(i * info.frequency / clk, 1.0);
+               top = MAX(top, fabs(volts[i]));
+               if (shape == WAVE_SQUARE && (fabs(t - 0.5) < 1e-6 || t < 1e-6 || t > 1 - 1e-6))
+                  continue; // at an edge either level is right
+               worst = MAX(worst, fabs(volts[i] - wave_ref(shape, t)));
+            }
+            CHECK(worst < 1e-6 * WAVE_AMPLITUDE, "%s: samples up to %.3g V off the waveform", name, worst);
+            CHECK(top <= WAVE_AMPLITUDE * (1 + 1e-12) &&
+                     top >= WAVE_AMPLITUDE * ((shape == WAVE_SQUARE) ? 1 : cos(2 * M_PI * info.frequency / clk)),
+                  "%s: peak %.9g V", name, top);
+
+            check_codes(name, volts, info.samples, 16, OL_ENC_2SCOMP);
+            check_codes(name, volts, info.samples, 24, OL_ENC_BINARY);
+            free(volts);
+         }
+      }
+   }
+   printf("%u waveform tables checked\n", tables);
+}
+
+static void chirp(void)
+{
+   WaveSpec spec = {WAVE_CHIRP, 500.0, 0.5, NULL, 0};
+   WaveInfo info;
+   const DBL clk = 46875.0;
+
+   DBL *volts = wave_synthesize(&spec, clk, WAVE_AMPLITUDE, 50.0, &info);
+   CHECK(volts != NULL, "chirp table");
+   if (volts == NULL)
+      return;
+   DBL cycles = info.frequency * info.samples / clk; // mean frequency times the sweep
+   CHECK(fabs(cycles - floor(cycles + 0.5)) < 1e-9, "chirp holds %.12g cycles", cycles);
+   CHECK(fabs(info.frequency - 275.0) < 275.0 * 0.01, "chirp mean %.6g Hz", info.frequency);
+   CHECK(volts[0] == 0, "chirp starts at %g V", volts[0]);
+   for (UINT i = 0; i < info.samples; i++)
+      CHECK(fabs(volts[i]) <= WAVE_AMPLITUDE, "chirp sample %u is %g V", i, volts[i]);
+   check_codes("chirp", volts, info.samples, 16, OL_ENC_2SCOMP);
+   free(volts);
+}
+
+static void clamping(void)
+{
+   const DBL volts[4] = {-25.0, -10.0, 9.99999, 25.0};
+   WORD codes[4];
+
+   wave_to_codes(volts, 4, -10.0, 10.0, 16, OL_ENC_BINARY, codes, 2);
+   CHECK(codes[0] == 0 && codes[1] == 0 && codes[2] == 0xFFFF && codes[3] == 0xFFFF,
+         "out of range volts give %04x %04x %04x %04x", codes[0], codes[1], codes[2], codes[3]);
+   wave_to_codes(volts, 4, -10.0, 10.0, 16, OL_ENC_2SCOMP, codes, 2);
+   CHECK(codes[0] == 0x8000 && codes[3] == 0x7FFF, "2's complement limits %04x %04x", codes[0], codes[3]);
+}
+
+int main(void)
+{
+   tables();
+   chirp();
+   clamping();
+   return test_done("test_waveform");
+}